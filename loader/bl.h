@@ -130,7 +130,7 @@ typedef unsigned    u32;
 
 /**********************************************************************/
 
-// misc/crc.c
+// crc.c
 
 typedef struct
 {
@@ -157,6 +157,9 @@ typedef struct
     u32         version;            //  Software update version
     unsigned    start;              //  Software update start address
     unsigned    end;                //  Software update end address (+1)
+    unsigned    delta;              //  Delta stream length (0 if full image)
+    u32         base;               //  Version the delta applies to
+    u32         crc;                //  CRC of the new image (delta only)
 }
     SuInfo_t;
 
@@ -166,6 +169,7 @@ typedef struct
     unsigned    sequence;           //  Sequence ID this record was stored with
     unsigned    address;
     u8          data[64];
+    unsigned    offset;             //  Word offset of the record in storage
 }
     SuData_t;
 
@@ -178,15 +182,57 @@ typedef struct
     SuExec_t;
 
 
+typedef struct
+{
+    u32         read;               //  Cycles reading the storage area
+    u32         check;              //  Cycles comparing (or delta dry run)
+    u32         erase;              //  Cycles in FlashErase()
+    u32         program;            //  Cycles in FlashProgram()
+    u32         total;              //  Cycles for the whole update
+    unsigned    erases;             //  Pages erased
+    unsigned    writes;             //  Words written
+}
+    LoaderStats_t;
+
+/*
+ *  The statistics are only kept in a test build (the host build sets
+ *  OQ_LOADER_STATS);  the loader has little room to spare.
+ */
+#if defined(OQ_LOADER_STATS)
+extern LoaderStats_t LoaderStats;
+#  define STAT(x)       do { x; } while (0)
+#else
+#  define STAT(x)       do { } while (0)
+#endif // defined(OQ_LOADER_STATS)
+
+
 extern void     StoreCallbackSoftwareUpdateInfo(SuInfo_t * info);
 extern void     StoreCallbackSoftwareUpdateChunk(SuData_t * data);
 extern void     StoreCallbackSoftwareUpdateExecute(SuExec_t * info);
 
 extern void     StoreRead(void);
+extern bool     StoreReadChunk(unsigned offset, SuData_t * data);
+
+/********************/
+
+// main.c
+
+extern void     FlashErase(u32 * addr);
+extern bool     FlashNeedsErase(u32 * dst, u32 * src, unsigned bytes);
+extern void     FlashProgram(u32 * dst, u32 * src, unsigned bytes);
+extern bool     SuChunkGet(unsigned addr, SuData_t * data);
+
+// delta.c
+
+extern bool     DeltaApply(SuInfo_t * su, bool program);
+extern bool     DeltaIsApplied(SuInfo_t * su);
+extern bool     DeltaIsOld(SuInfo_t * su);
+extern bool     DeltaIsStarted(SuInfo_t * su);
 
 /********************/
 
 extern void     GoSoftDevice(void);
+extern void     Halt(void);
 
 extern void *   memset(void * dest, int c, size_t sz);
 extern int      memcmp(const void * l, const void * r, size_t cnt);
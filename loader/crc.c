@@ -0,0 +1,38 @@
+/*
+ *  CRC-32C, the same as misc/crc.c in the main image, but with a table of
+ *  16 entries (a nibble at a time) rather than 256, to save flash.
+ */
+
+#include "bl.h"
+
+
+static const u32 table[16] =
+{
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1,
+    0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9,
+    0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75,
+};
+
+
+void
+CRCInit(CRC_t * crc)
+{
+    crc->crc = 0;
+}
+
+
+void
+CRC(CRC_t * crc, u8 * data, unsigned len)
+{
+    u32 c = ~crc->crc;
+
+    while (len-- > 0)
+    {
+        c ^= *data++;
+        c = (c >> 4) ^ table[c & 0xf];
+        c = (c >> 4) ^ table[c & 0xf];
+    }
+
+    crc->crc = ~c;
+}
@@ -0,0 +1,469 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Software update delta images.
+ *
+ *  A delta update carries a stream of operations that build the new image
+ *  from the one already in flash, rather than the new image itself.  The
+ *  stream is stored as ordinary software update chunks, addressed from 0
+ *  to the stream length.  It is made by tools/sudelta.
+ *
+ *  The stream starts with a flags byte and the end of the old image, then
+ *  for each page of the new image in turn:  the CRCs of the page in the old
+ *  image (as much of it as is below the old image's end) and in the new,
+ *  then the operations that build it.  Words are four bytes, low first.
+ *  Each operation starts with a tag byte, whose top two bits are the
+ *  operation and low six bits the length (less 1).  A length of 63 or more
+ *  is followed by the rest of it as a number.  Numbers are 7 bits per byte,
+ *  low bits first, the MSB set if more bytes follow.
+ *
+ *      DL_LITERAL      The bytes follow in the stream.
+ *      DL_COPY         Copy from the old image.  A number follows, the
+ *                      change (zig-zag coded) in the distance from the
+ *                      output address to the source.  The distance is
+ *                      kept from one copy to the next, so the common case
+ *                      of code that has moved a little costs one byte.
+ *      DL_MATCH        Copy from earlier in the same page of output.  A
+ *                      number follows, the distance back (less 1).
+ *
+ *  No operation crosses a page.  The pages are written in place, so a page
+ *  may only copy from the parts of the old image not yet written over:
+ *  with DF_DOWN clear the pages are written from the lowest up, and may
+ *  copy only from at or above the page start;  with DF_DOWN set from the
+ *  highest down, copying only from below the page end.  The generator picks
+ *  the order that suits the image (DF_DOWN when code has moved up).
+ *
+ *  The whole stream is run once without writing anything, to check that it
+ *  builds an image with the right CRC, before any page is erased.  The CRC
+ *  is taken page by page, in the order that the pages are written.
+ *
+ *  An apply cut short by a reset or a loss of power is taken up again on
+ *  the next boot.  The pages that already have their new CRC are passed
+ *  over, and the rest built as before.  A page that copies from itself
+ *  can't be built again once it has been erased, so before it's written
+ *  its old contents are kept in the scratch page (the last page before the
+ *  store), and a page without its old CRC is built from there.  Neither
+ *  image may reach the scratch page.
+ */
+
+/**********************************************************************/
+
+#include "bl.h"
+
+
+enum
+{
+    DL_LITERAL = 0,         //  Literal bytes
+    DL_COPY = 1,            //  Copy from the old image
+    DL_MATCH = 2,           //  Copy from the output page
+
+    DF_DOWN = 0x01,         //  Write the pages from the highest down
+};
+
+/*
+ *  The page being built, and where its old contents are to be copied from
+ *  (the page itself, the scratch page, or nowhere if they're lost).
+ */
+static u32      page[OQ_FLASH_PAGE / 4];
+static u8 *     pageOld;
+static bool     pageSelf;           //  It copied from its old contents
+
+/*
+ *  The stream reader.
+ */
+static SuData_t chunk;              //  The chunk being read
+static unsigned inPos;              //  Offset in the stream
+static unsigned inEnd;              //  Length of the stream
+static bool     inError;            //  Ran off the end, or a chunk is missing
+static unsigned oldEnd;             //  End of the old image
+
+/**********************************************************************/
+
+static unsigned
+get(void)
+{
+    if (inError || inPos >= inEnd ||
+        ((inPos & (OQ_SU_CHUNK - 1)) == 0 && !SuChunkGet(inPos, &chunk)))
+    {
+        inError = true;
+        return 0;
+    }
+
+    return chunk.data[inPos++ & (OQ_SU_CHUNK - 1)];
+}
+
+
+static u32
+get32(void)
+{
+    u32 w = get();
+    w |= get() << 8;
+    w |= get() << 16;
+    return w | get() << 24;
+}
+
+
+static unsigned
+getNumber(void)
+{
+    unsigned n = 0;
+    unsigned s = 0;
+    unsigned b;
+
+    do
+    {
+        b = get();
+        n |= (b & 0x7f) << s;
+        s += 7;
+    }
+    while ((b & 0x80) && s < 32);
+
+    return n;
+}
+
+/*
+ *  Start reading the stream from the beginning.  Returns the flags byte.
+ */
+static unsigned
+begin(SuInfo_t * su)
+{
+    inPos = 0;
+    inEnd = su->delta;
+    inError = false;
+
+    unsigned flags = get();
+    oldEnd = get32();
+    return flags;
+}
+
+/**********************************************************************/
+
+static u32 *
+scratch(void)
+{
+    return (u32 *)(StoreStart - OQ_FLASH_PAGE);
+}
+
+
+static u32
+crcOf(void * p, unsigned len)
+{
+    CRC_t crc;
+
+    CRCInit(&crc);
+    CRC(&crc, (u8 *)p, len);
+    return crc.crc;
+}
+
+
+/*
+ *  Return the address of the `n'th page to be written, its length, and
+ *  the length of it in the old image.
+ */
+static unsigned
+pageAt(SuInfo_t * su, unsigned flags, unsigned n, unsigned * len,
+       unsigned * old)
+{
+    unsigned last = (su->end - 1) & ~(OQ_FLASH_PAGE - 1);
+    unsigned pg = (flags & DF_DOWN) ? last - n * OQ_FLASH_PAGE
+                                    : su->start + n * OQ_FLASH_PAGE;
+
+    *len = (pg == last) ? su->end - pg : OQ_FLASH_PAGE;
+    *old = (oldEnd <= pg) ? 0 : (oldEnd - pg < *len) ? oldEnd - pg : *len;
+    return pg;
+}
+
+
+/*
+ *  Build the page at `pg' from the stream.  Returns false if the stream is
+ *  bad, or the page copies from its old contents and they're lost.
+ */
+static bool
+build(unsigned pg, unsigned len, unsigned flags, int * diff)
+{
+    u8 * out = (u8 *)&page[0];
+    unsigned o = 0;
+
+    pageSelf = false;
+
+    while (o < len)
+    {
+        unsigned tag = get();
+        unsigned n = tag & 0x3f;
+        if (n == 0x3f)
+            n += getNumber();
+        n += 1;
+
+        if (inError || n > len - o)
+            return false;
+
+        switch (tag >> 6)
+        {
+        case DL_LITERAL:
+            while (n-- > 0)
+                out[o++] = get();
+            break;
+
+        case DL_COPY:
+            {
+                unsigned z = getNumber();
+                *diff += (z & 1) ? ~(z >> 1) : (z >> 1);
+
+                unsigned src = pg + o + *diff;
+                if ((flags & DF_DOWN) ? src + n > pg + OQ_FLASH_PAGE
+                                      : src < pg)
+                    return false;
+                if (src + n > oldEnd || src + n < src)
+                    return false;
+
+                for (; n > 0; n--, src++)
+                {
+                    if (src - pg >= OQ_FLASH_PAGE)
+                        out[o++] = *(u8 *)src;
+                    else if (pageOld)
+                    {
+                        out[o++] = pageOld[src - pg];
+                        pageSelf = true;
+                    }
+                    else
+                        return false;
+                }
+            }
+            break;
+
+        case DL_MATCH:
+            {
+                unsigned d = getNumber() + 1;
+                if (d > o)
+                    return false;
+
+                while (n-- > 0)
+                {
+                    out[o] = out[o - d];
+                    o++;
+                }
+            }
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    return !inError;
+}
+
+
+/*
+ *  Run the delta stream.  If `program' is clear, nothing is written, and
+ *  the CRC of the image built is checked.  Otherwise each page not yet
+ *  written is programmed, after an erase if it needs one, and if it copies
+ *  from itself, after its old contents are kept in the scratch page.
+ *  Returns false if the stream is bad, or doesn't fit the flash.
+ */
+bool
+DeltaApply(SuInfo_t * su, bool program)
+{
+    CRC_t crc;
+    CRCInit(&crc);
+
+    unsigned flags = begin(su);
+    unsigned pages = (su->end - su->start + OQ_FLASH_PAGE - 1) / OQ_FLASH_PAGE;
+    int diff = 0;
+
+    if (su->end > (unsigned)scratch() || oldEnd > (unsigned)scratch())
+        return false;
+
+    for (unsigned n = 0; n < pages; n++)
+    {
+        unsigned len, old;
+        unsigned pg = pageAt(su, flags, n, &len, &old);
+        u32 oldCRC = get32();
+        u32 newCRC = get32();
+
+        /*
+         *  A page already written is passed over, though its operations
+         *  still have to be read.
+         */
+        bool done = crcOf((u8 *)pg, len) == newCRC;
+        if (done || crcOf((u8 *)pg, old) == oldCRC)
+            pageOld = (u8 *)pg;
+        else if (crcOf(scratch(), old) == oldCRC)
+            pageOld = (u8 *)scratch();
+        else
+            pageOld = 0;
+
+        if (!build(pg, len, flags, &diff))
+            return false;
+        if (done)
+        {
+            if (!program)
+                CRC(&crc, (u8 *)pg, len);
+            continue;
+        }
+        if (crcOf(&page[0], len) != newCRC)
+            return false;
+
+        if (!program)
+            CRC(&crc, (u8 *)&page[0], len);
+        else
+        {
+            if (pageSelf && pageOld == (u8 *)pg)
+            {
+                if (FlashNeedsErase(scratch(), (u32 *)pg, OQ_FLASH_PAGE))
+                    FlashErase(scratch());
+                FlashProgram(scratch(), (u32 *)pg, OQ_FLASH_PAGE);
+            }
+            if (FlashNeedsErase((u32 *)pg, &page[0], len))
+                FlashErase((u32 *)pg);
+            FlashProgram((u32 *)pg, &page[0], len);
+        }
+    }
+
+    return program || crc.crc == su->crc;
+}
+
+
+/*
+ *  Returns true if the flash already holds the image the delta builds.
+ */
+bool
+DeltaIsApplied(SuInfo_t * su)
+{
+    CRC_t crc;
+    CRCInit(&crc);
+
+    unsigned flags = begin(su);
+    unsigned pages = (su->end - su->start + OQ_FLASH_PAGE - 1) / OQ_FLASH_PAGE;
+
+    for (unsigned n = 0; n < pages; n++)
+    {
+        unsigned len, old;
+        unsigned pg = pageAt(su, flags, n, &len, &old);
+        CRC(&crc, (u8 *)pg, len);
+    }
+
+    return !inError && crc.crc == su->crc;
+}
+
+
+/*
+ *  Returns true if every page the delta writes still has its old contents
+ *  (checked against the old CRCs in the stream):  the app the delta was
+ *  made for is whole.
+ */
+bool
+DeltaIsOld(SuInfo_t * su)
+{
+    unsigned flags = begin(su);
+    unsigned pages = (su->end - su->start + OQ_FLASH_PAGE - 1) / OQ_FLASH_PAGE;
+    int diff = 0;
+
+    for (unsigned n = 0; n < pages; n++)
+    {
+        unsigned len, old;
+        unsigned pg = pageAt(su, flags, n, &len, &old);
+        u32 oldCRC = get32();
+        get32();
+
+        pageOld = (u8 *)pg;
+        if (!build(pg, len, flags, &diff) ||
+            crcOf((u8 *)pg, old) != oldCRC)
+                return false;
+    }
+
+    return true;
+}
+
+
+/*
+ *  Returns true if the flash holds an apply of the delta that was cut
+ *  short:  in the order the pages are written, some with their new
+ *  contents, then one with its old contents or neither, then the rest
+ *  with their old contents (passing over those the same in both).  Or
+ *  none with their new contents, but the first with its old contents
+ *  kept in the scratch page.  An app the delta wasn't made for differs
+ *  in other ways.
+ */
+bool
+DeltaIsStarted(SuInfo_t * su)
+{
+    unsigned flags = begin(su);
+    unsigned pages = (su->end - su->start + OQ_FLASH_PAGE - 1) / OQ_FLASH_PAGE;
+    int diff = 0;
+    bool started = false;
+    bool cut = false;
+
+    for (unsigned n = 0; n < pages; n++)
+    {
+        unsigned len, old;
+        unsigned pg = pageAt(su, flags, n, &len, &old);
+        u32 oldCRC = get32();
+        u32 newCRC = get32();
+
+        pageOld = (u8 *)pg;
+        if (!build(pg, len, flags, &diff))
+            return false;
+
+        bool isNew = crcOf((u8 *)pg, len) == newCRC;
+        bool isOld = crcOf((u8 *)pg, old) == oldCRC;
+        if (isNew && isOld)
+            continue;
+
+        if (!cut && isNew)
+            started = true;
+        else if (!cut)
+        {
+            cut = true;
+            if (!isOld && crcOf(scratch(), old) == oldCRC)
+                started = true;
+        }
+        else if (!isOld)
+            return false;
+    }
+
+    return started;
+}
+
+/**********************************************************************/
@@ -0,0 +1,1208 @@
+/*
+ *  Run the boot loader (main.c, store.c, delta.c) on a model of the flash,
+ *  checking and timing the software updates it applies.
+ *
+ *      loadertest [-n rounds] [-s seed]
+ *      loadertest [-o out] flash.img
+ *
+ *  The flash is memory at the chip's addresses, from 0x10000 up (the MBR
+ *  and the soft device below that are left out, as not every host will map
+ *  page 0).  The store is where the UICR says, 0x40000 to 0x7d000.  Each
+ *  boot zeroes the loader's globals, as low.S does, and runs Main(), which
+ *  comes back here in place of starting the soft device, or of staying in
+ *  the loader (Halt()).  The flash is written through a model of the NVMC,
+ *  which checks each write and erase, and counts them (see `flashWrite()'),
+ *  and can cut the power part way through one.
+ *
+ *  Each of -n rounds (default 10) writes the store records for an update
+ *  of each kind below, in a random order, from a random page of the store,
+ *  among records of other kinds, over an app of random bytes.  After the
+ *  boot, the flash must hold the new image, or still the old one, and
+ *  nothing else may have changed.  A boot after one that applied an update
+ *  must write nothing.  A full update over a partly programmed app must
+ *  erase only the pages that can't just be programmed.
+ *
+ *      -   a full update, and one with earlier wrong copies of chunks
+ *      -   a full update over an app that is partly programmed with it
+ *      -   a full update superseded by a newer one
+ *      -   a delta update, one against the wrong app, and one that
+ *          doesn't build the image it should (the app is left, and run)
+ *      -   a delta update cut short by up to three resets, each part way
+ *          through a write or an erase, which must be taken up again
+ *      -   a delta update cut short, with its copy of the page it was
+ *          writing lost (the loader must stay in the loader)
+ *      -   an update with a chunk missing, cut short, or not executed,
+ *          or superseded by one that isn't complete (none are applied)
+ *
+ *  Then 64 KB full and delta updates are timed, with the model off.
+ *
+ *  With a file, the loader is run on the image in it (512 KB, the whole
+ *  flash), once timed and once through the model, and what it did is
+ *  printed;  -o writes the flash after.
+ */
+
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "bl.h"
+#include "cpu/nrf.h"
+
+#define FLASH_LOW       0x10000         //  The lowest address mapped
+#define STORE_START     0x40000
+#define STORE_END       0x7d000
+#define CONFIG_START    0x7d000
+#define SCRATCH         (STORE_START - OQ_FLASH_PAGE)
+
+#define NVMC_PAGE       ((void *)((unsigned long)NRF_NVMC & ~0xfffUL))
+
+/*
+ *  The flash, as the test writes it (see `flashModel()').
+ */
+#define FLASH(a)        (flashAlias + (a) - FLASH_LOW)
+
+/*
+ *  Store record types (as store.c has them).
+ */
+enum
+{
+    RT_ZERO = 0x00,
+    RT_SLOG = 0x08,
+    RT_SU_HDR = 0x0c,
+    RT_SU_DATA = 0x0d,
+    RT_SU_EXEC = 0x0e,
+    RT_SU_DELTA = 0x0f,
+    RT_SEQUENCE = 0x1f,
+    RT_SHIFT = 26,
+};
+
+/*
+ *  Delta stream operations (as delta.c has them).
+ */
+enum
+{
+    DL_LITERAL = 0,
+    DL_COPY = 1,
+};
+
+enum
+{
+    FULL,
+    FULL_DUPLICATES,
+    FULL_PARTLY_DONE,
+    FULL_SUPERSEDED,
+    DELTA,
+    DELTA_CUT,
+    DELTA_WRONG_APP,
+    DELTA_BAD_CRC,
+    DELTA_CUT_LOST,
+    NO_UPDATE,
+    CHUNK_MISSING,
+    CHUNK_CUT_SHORT,
+    NOT_EXECUTED,
+    WRONG_EXECUTE,
+    NEWER_INCOMPLETE,
+    CASES
+};
+
+static const char * caseName[CASES] =
+{
+    "full update",
+    "full update, with wrong copies of chunks",
+    "full update, partly done already",
+    "full update, superseded",
+    "delta update",
+    "delta update, cut short",
+    "delta update, against the wrong app",
+    "delta update, with the wrong CRC",
+    "delta update, cut short with its scratch page lost",
+    "no update",
+    "update with a chunk missing",
+    "update with a chunk cut short",
+    "update not executed",
+    "update executed for the wrong version",
+    "update superseded by an incomplete one",
+};
+
+extern void     Main(void);
+extern SuInfo_t SuInfo;
+extern SuExec_t SuExec;
+
+static u8       Want[0x80000];          //  The flash the boot should leave
+static u8       Image[0x80000];         //  The new app
+static u8       Stream[0x40000];        //  A delta stream
+static unsigned StreamLen;
+static jmp_buf  Booted;
+static int      Ended;                  //  How the boot ended (below)
+static unsigned Cuts;                   //  Boots cut short
+static int      Failed;
+
+enum
+{
+    BOOTED = 1,                         //  Started the soft device
+    HALTED,                             //  Stayed in the loader
+    CUT,                                //  Lost power
+};
+
+static u8 *     flashAlias;             //  The flash, writable
+static volatile u32 * nvmcAlias;        //  The NVMC's registers, likewise
+
+/**********************************************************************/
+/*
+ *  What the loader uses from low.S.
+ */
+
+void
+GoSoftDevice(void)
+{
+    Ended = BOOTED;
+    longjmp(Booted, 1);
+}
+
+
+void
+Halt(void)
+{
+    Ended = HALTED;
+    longjmp(Booted, 1);
+}
+
+/**********************************************************************/
+
+static unsigned
+rnd(unsigned n)
+{
+    return random() % n;
+}
+
+
+static void
+fail(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (Failed++ < 10)
+    {
+        vprintf(fmt, ap);
+        putchar('\n');
+    }
+    va_end(ap);
+}
+
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**********************************************************************/
+/*
+ *  The NVMC, and the flash under it.  Both are kept read-only, so that
+ *  each write the loader makes is caught (SIGSEGV), let through a single
+ *  instruction (SIGTRAP), and then acted on as the chip would.  A word of
+ *  flash can only be written with CONFIG set to WEN, and only have bits
+ *  cleared, at most twice between erases, and only in the app (below the
+ *  store).  ERASEPAGE needs CONFIG set to EEN, and erases an app page.
+ *  The test itself writes the flash through a second, writable, mapping.
+ *
+ *  With `CutAt' set, the power is cut during that write or erase of the
+ *  boot, leaving some of the bits written, or some of the words erased.
+ */
+
+static u8       writesTo[(STORE_START - FLASH_LOW) / 4];
+static unsigned Writes;                 //  Words written
+static unsigned Erases;                 //  Pages erased
+static bool     Modelled;               //  The model is on
+static unsigned Ops;                    //  Writes and erases made
+static unsigned CutAt;                  //  Cut the power at this one
+static bool     Cut;
+
+static unsigned long trapAddr;          //  Where the write was
+static u32      trapPage[OQ_FLASH_PAGE / 4];    //  The page before it
+
+
+static bool
+inApp(unsigned long a)
+{
+    return a >= FLASH_LOW && a < STORE_START;
+}
+
+
+static bool
+cutNow(void)
+{
+    if (CutAt != 0 && ++Ops == CutAt)
+        Cut = true;
+    return Cut;
+}
+
+
+/*
+ *  Count the words each app word has been written since its erase, taking
+ *  one write for any that isn't erased.
+ */
+static void
+flashCounts(void)
+{
+    u32 * f = (u32 *)FLASH(FLASH_LOW);
+
+    for (unsigned i = 0; i < ARRAY_SIZE(writesTo); i++)
+        writesTo[i] = f[i] != 0xffffffff;
+}
+
+
+/*
+ *  Turn the model on (read-only) or off (plain memory, with erases doing
+ *  nothing).
+ */
+static void
+flashModel(bool on)
+{
+    int prot = on ? PROT_READ : PROT_READ | PROT_WRITE;
+
+    Modelled = on;
+
+    if (mprotect((void *)FLASH_LOW, OQ_FLASH_SIZE - FLASH_LOW, prot) < 0 ||
+        mprotect(NVMC_PAGE, 0x1000, prot) < 0)
+            err(1, "can't protect the flash");
+}
+
+
+static void
+flashWrite(unsigned long pg)
+{
+    u32 * f = (u32 *)FLASH(pg);
+    u32 config = nvmcAlias[offsetof(NRF_NVMC_Type, CONFIG) / 4];
+
+    if (trapAddr & 3)
+        fail("flash written at %lx, not a word", trapAddr);
+
+    for (unsigned i = 0; i < OQ_FLASH_PAGE / 4; i++)
+    {
+        unsigned long a = pg + i * 4;
+        if (f[i] == trapPage[i] && a != (trapAddr & ~3UL))
+            continue;
+
+        Writes++;
+        if (config != NVMC_CONFIG_WEN_Wen)
+            fail("flash written at %lx, with CONFIG %u", a, config);
+        if (!inApp(a))
+        {
+            fail("flash written at %lx, outside the app", a);
+            continue;
+        }
+        if (f[i] & ~trapPage[i])
+            fail("flash at %lx written from %08x to %08x", a,
+                 trapPage[i], f[i]);
+        if (++writesTo[(a - FLASH_LOW) / 4] > 2)
+            fail("flash at %lx written %u times", a,
+                 writesTo[(a - FLASH_LOW) / 4]);
+        if (cutNow())
+            f[i] = trapPage[i] & (f[i] | random());
+        else
+            f[i] &= trapPage[i];
+    }
+}
+
+
+static void
+nvmcWrite(unsigned off, u32 v)
+{
+    u32 config = nvmcAlias[offsetof(NRF_NVMC_Type, CONFIG) / 4];
+
+    switch (off)
+    {
+    case offsetof(NRF_NVMC_Type, CONFIG):
+        if (v > NVMC_CONFIG_WEN_Een)
+            fail("NVMC CONFIG set to %x", v);
+        break;
+
+    case offsetof(NRF_NVMC_Type, ERASEPAGE):
+        if (config != NVMC_CONFIG_WEN_Een)
+            fail("flash erased at %x, with CONFIG %u", v, config);
+        else if ((v & (OQ_FLASH_PAGE - 1)) || !inApp(v))
+            fail("flash erased at %x, not an app page", v);
+        else
+        {
+            u32 * f = (u32 *)FLASH(v);
+            bool cut = cutNow();
+            for (unsigned i = 0; i < OQ_FLASH_PAGE / 4; i++)
+                if (!cut || rnd(2) == 0)
+                {
+                    f[i] = 0xffffffff;
+                    writesTo[(v - FLASH_LOW) / 4 + i] = 0;
+                }
+            Erases++;
+        }
+        break;
+
+    case offsetof(NRF_NVMC_Type, ICACHECNF):
+        break;
+
+    default:
+        fail("NVMC register %x written", off);
+        break;
+    }
+}
+
+
+static void
+segv(int sig, siginfo_t * si, void * ctx)
+{
+    unsigned long a = (unsigned long)si->si_addr;
+    void * page = (void *)(a & ~0xfffUL);
+
+    if (page == NVMC_PAGE)
+        memcpy(trapPage, (void *)nvmcAlias, sizeof trapPage);
+    else if (a >= FLASH_LOW && a < OQ_FLASH_SIZE)
+        memcpy(trapPage, FLASH(a & ~0xfffUL), sizeof trapPage);
+    else
+    {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    trapAddr = a;
+    mprotect(page, 0x1000, PROT_READ | PROT_WRITE);
+    ((ucontext_t *)ctx)->uc_mcontext.gregs[REG_EFL] |= 0x100;  //  Step
+}
+
+
+static void
+trap(int sig, siginfo_t * si, void * ctx)
+{
+    unsigned long pg = trapAddr & ~0xfffUL;
+
+    ((ucontext_t *)ctx)->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+
+    if ((void *)pg == NVMC_PAGE)
+        nvmcWrite(trapAddr & 0xfff, *(u32 *)(trapAddr & ~3UL));
+    else
+        flashWrite(pg);
+    mprotect((void *)pg, 0x1000, PROT_READ);
+
+    if (Cut)
+    {
+        Ended = CUT;
+        longjmp(Booted, 1);
+    }
+}
+
+/**********************************************************************/
+
+/*
+ *  Reset, and run the loader until it starts the soft device, stays in the
+ *  loader, or loses power (`Ended').  Returns how long it took.  With the
+ *  model on, what the NVMC saw must agree with the loader's counts, and
+ *  the flash be left read-only.
+ */
+static double
+boot(void)
+{
+    memset(&SuInfo, 0, sizeof SuInfo);
+    memset(&SuExec, 0, sizeof SuExec);
+    memset(&LoaderStats, 0, sizeof LoaderStats);
+    nvmcAlias[offsetof(NRF_NVMC_Type, CONFIG) / 4] = NVMC_CONFIG_WEN_Ren;
+    Writes = 0;
+    Erases = 0;
+    Ops = 0;
+    Cut = false;
+    Ended = 0;
+
+    double t = now();
+    if (setjmp(Booted) == 0)
+        Main();
+    t = now() - t;
+
+    if (!Modelled || Ended == CUT)
+        return t;
+    if (Writes != LoaderStats.writes || Erases != LoaderStats.erases)
+        fail("the NVMC saw %u writes and %u erases, the loader %u and %u",
+             Writes, Erases, LoaderStats.writes, LoaderStats.erases);
+    if (nvmcAlias[offsetof(NRF_NVMC_Type, CONFIG) / 4] !=
+        NVMC_CONFIG_WEN_Ren)
+            fail("the flash was left writable");
+    return t;
+}
+
+/**********************************************************************/
+/*
+ *  Writing the store, as the tracer does:  each page starts with its
+ *  sequence record, or has it just after a record that runs into it from
+ *  the page before.  Records don't run past the end of the store;  the
+ *  rest of the last page is padded instead.
+ */
+
+static u32      storeNext;              //  Where the next word goes
+static u32      storeFirst;             //  The oldest page
+static bool     storeWrapped;
+static unsigned storeSeq;               //  The last page's sequence number
+
+static u32      rec[40];                //  The record being built
+static unsigned recIdx;
+static unsigned recPtr;                 //  Bits left in rec[recIdx]
+
+
+static void
+storeReset(void)
+{
+    memset(FLASH(STORE_START), 0xff, STORE_END - STORE_START);
+    storeFirst = STORE_START +
+        rnd((STORE_END - STORE_START) / OQ_FLASH_PAGE) * OQ_FLASH_PAGE;
+    storeNext = storeFirst;
+    storeWrapped = false;
+    storeSeq = 1 + rnd(1000);
+}
+
+
+static void
+storeWord(u32 w)
+{
+    if (storeWrapped && storeNext == storeFirst)
+        errx(1, "the store is full");
+    *(u32 *)FLASH(storeNext) = w;
+    storeNext += 4;
+}
+
+
+static bool
+atPage(void)
+{
+    return (storeNext & (OQ_FLASH_PAGE - 1)) == 0;
+}
+
+
+static void
+recStart(unsigned type)
+{
+    memset(rec, 0, sizeof rec);
+    rec[0] = 0x80000000 | type << RT_SHIFT;
+    recIdx = 0;
+    recPtr = RT_SHIFT;
+}
+
+
+/*
+ *  The reverse of store.c's rd():  the low bits of a value go in the rest
+ *  of a word, and the high bits at the top of the next.
+ */
+static void
+wr(unsigned bits, u32 v)
+{
+    while (bits > recPtr)
+    {
+        if (recPtr > 0)
+        {
+            rec[recIdx] |= v & ((1u << recPtr) - 1);
+            v >>= recPtr;
+            bits -= recPtr;
+        }
+        recIdx++;
+        recPtr = 31;
+    }
+
+    recPtr -= bits;
+    rec[recIdx] |= (u32)(v & ((1ull << bits) - 1)) << recPtr;
+}
+
+
+/*
+ *  Put the first `words' of the record built into the store.
+ */
+static void
+recPut(unsigned words)
+{
+    if (storeNext + words * 4 > STORE_END)
+        while (storeNext < STORE_END)
+            storeWord(0x80000000 | RT_ZERO << RT_SHIFT);
+    if (storeNext == STORE_END)
+    {
+        storeNext = STORE_START;
+        storeWrapped = true;
+    }
+
+    bool into = false;
+    if (atPage())
+        storeWord(0x80000000 | RT_SEQUENCE << RT_SHIFT | ++storeSeq);
+    for (unsigned i = 0; i < words; i++)
+    {
+        if (i > 0 && atPage())
+            into = true;
+        storeWord(rec[i]);
+    }
+    if (into)
+        storeWord(0x80000000 | RT_SEQUENCE << RT_SHIFT | ++storeSeq);
+}
+
+
+static void
+recEnd(void)
+{
+    recPut(recIdx + 1);
+}
+
+/********************/
+
+static void
+putHeader(unsigned seq, u32 version, unsigned start, unsigned end,
+          unsigned delta, u32 crc)
+{
+    recStart(delta ? RT_SU_DELTA : RT_SU_HDR);
+    wr(20, seq);
+    wr(32, version);
+    wr(14, start >> OQ_SU_CHUNK_SHIFT);
+    wr(14, end >> OQ_SU_CHUNK_SHIFT);
+    if (delta)
+    {
+        wr(18, delta);
+        wr(32, version - 1);
+        wr(32, crc);
+    }
+    recEnd();
+}
+
+
+/*
+ *  A chunk record, cut short to `words' if that isn't 0.
+ */
+static void
+putChunk(unsigned seq, unsigned addr, const u8 * data, unsigned words)
+{
+    recStart(RT_SU_DATA);
+    wr(20, seq);
+    wr(13, addr >> OQ_SU_CHUNK_SHIFT);
+    for (int i = 0; i < OQ_SU_CHUNK; i++)
+        wr(8, data[i]);
+    recPut(words ? words : recIdx + 1);
+}
+
+
+static void
+putExecute(unsigned seq, u32 version)
+{
+    recStart(RT_SU_EXEC);
+    wr(20, seq);
+    wr(32, version);
+    recEnd();
+}
+
+
+/*
+ *  Now and then, a record of some other kind.
+ */
+static void
+putOther(void)
+{
+    if (rnd(8) != 0)
+        return;
+
+    recStart(RT_SLOG);
+    for (unsigned n = rnd(30); n > 0; n--)
+        wr(31, random());
+    recEnd();
+}
+
+/**********************************************************************/
+/*
+ *  Updates.
+ */
+
+static void
+randomBytes(u8 * p, unsigned len)
+{
+    while (len-- > 0)
+        *p++ = random();
+}
+
+
+/*
+ *  A chunk of the image, at random.
+ */
+static unsigned
+chunkAt(unsigned start, unsigned end)
+{
+    return start + rnd((end - start) / OQ_SU_CHUNK) * OQ_SU_CHUNK;
+}
+
+
+/*
+ *  Write the chunks of `data' (the image, or a delta stream from address
+ *  0) in a random order, leaving out the one at `skip'.
+ */
+static void
+putChunks(unsigned seq, unsigned start, unsigned end, const u8 * data,
+          unsigned skip)
+{
+    unsigned n = (end - start) / OQ_SU_CHUNK;
+    static unsigned order[0x40000 / OQ_SU_CHUNK];
+
+    for (unsigned i = 0; i < n; i++)
+        order[i] = i;
+    for (unsigned i = n - 1; i > 0; i--)
+    {
+        unsigned j = rnd(i + 1);
+        unsigned t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned a = start + order[i] * OQ_SU_CHUNK;
+        if (a != skip)
+            putChunk(seq, a, data + a - start, 0);
+        putOther();
+    }
+}
+
+
+static u32
+crcOf(const u8 * p, unsigned len)
+{
+    CRC_t crc;
+
+    CRCInit(&crc);
+    CRC(&crc, (u8 *)p, len);
+    return crc.crc;
+}
+
+
+static void
+streamWord(u32 w)
+{
+    for (int i = 0; i < 4; i++, w >>= 8)
+        Stream[StreamLen++] = w;
+}
+
+
+static void
+streamNumber(unsigned n)
+{
+    for (; n >= 0x80; n >>= 7)
+        Stream[StreamLen++] = (n & 0x7f) | 0x80;
+    Stream[StreamLen++] = n;
+}
+
+
+/*
+ *  A delta stream that builds Image[start, end) from the flash (the old
+ *  image ending at `end'), 32 bytes at a time:  copying where the two are
+ *  the same in place, or where the image is the old page after, and the
+ *  rest literal.
+ */
+static u32
+makeDelta(unsigned start, unsigned end)
+{
+    CRC_t crc;
+    int diff = 0;
+
+    CRCInit(&crc);
+    CRC(&crc, &Image[start], end - start);
+
+    StreamLen = 0;
+    Stream[StreamLen++] = 0;                    //  Up, from the lowest page
+    streamWord(end);
+    bool copied = false;
+    for (unsigned pg = start; pg < end; pg += OQ_FLASH_PAGE)
+    {
+        unsigned len = (end - pg < OQ_FLASH_PAGE) ? end - pg : OQ_FLASH_PAGE;
+        streamWord(crcOf(FLASH(pg), len));
+        streamWord(crcOf(&Image[pg], len));
+
+        for (unsigned a = pg; a < pg + len; a += 32)
+        {
+            int d = -1;
+            if (memcmp(&Image[a], FLASH(a), 32) == 0)
+                d = 0;
+            else if (a + OQ_FLASH_PAGE + 32 <= end &&
+                     memcmp(&Image[a], FLASH(a + OQ_FLASH_PAGE), 32) == 0)
+                d = OQ_FLASH_PAGE;
+
+            if (d >= 0)
+            {
+                Stream[StreamLen++] = DL_COPY << 6 | (32 - 1);
+                streamNumber(d >= diff ? (d - diff) << 1
+                                       : (diff - d - 1) << 1 | 1);
+                diff = d;
+                copied = true;
+            }
+            else
+            {
+                Stream[StreamLen++] = DL_LITERAL << 6 | (32 - 1);
+                memcpy(&Stream[StreamLen], &Image[a], 32);
+                StreamLen += 32;
+            }
+        }
+    }
+    if (!copied)
+        errx(1, "a delta that copies nothing");
+
+    memset(&Stream[StreamLen], 0xff, -StreamLen & (OQ_SU_CHUNK - 1));
+    return crc.crc;
+}
+
+
+/*
+ *  Set up the flash and the store for an update of kind `c', and say what
+ *  the flash should be after the boot.
+ */
+static void
+setUp(int c, unsigned start, unsigned end)
+{
+    unsigned seq = 1 + rnd(100000);
+    u32 version = 0x02000000 + rnd(0x10000);
+
+    /*
+     *  The old app, with erased flash after it to the end of its page,
+     *  and the new one, with some of its chunks the same.
+     */
+    randomBytes(FLASH(FLASH_LOW), STORE_START - FLASH_LOW);
+    memset(FLASH(end), 0xff, -end & (OQ_FLASH_PAGE - 1));
+    memcpy(&Image[FLASH_LOW], FLASH(FLASH_LOW), STORE_START - FLASH_LOW);
+    for (unsigned a = start; a < end; a += OQ_SU_CHUNK)
+        if (rnd(3) != 0)
+            randomBytes(&Image[a], OQ_SU_CHUNK);
+    memset(FLASH(CONFIG_START), 0xff, OQ_FLASH_PAGE);
+
+    /*
+     *  In a delta, some pages are the old page after (code moved down), so
+     *  they copy nothing from themselves.
+     */
+    if (c == DELTA || c == DELTA_CUT)
+        for (unsigned pg = start;
+             pg + 2 * OQ_FLASH_PAGE <= end;
+             pg += OQ_FLASH_PAGE)
+        {
+            if (rnd(4) == 0)
+                memcpy(&Image[pg], FLASH(pg + OQ_FLASH_PAGE), OQ_FLASH_PAGE);
+        }
+    storeReset();
+
+    /*
+     *  Partly programmed:  some pages done, some part way (the rest of the
+     *  page still erased, as after an erase and a cut in the power), and
+     *  some not started.
+     */
+    if (c == FULL_PARTLY_DONE)
+        for (unsigned pg = start; pg < end; pg += OQ_FLASH_PAGE)
+        {
+            unsigned len = end - pg < OQ_FLASH_PAGE ? end - pg
+                                                    : OQ_FLASH_PAGE;
+            unsigned part = rnd(len / 4) * 4;
+
+            switch (rnd(3))
+            {
+            case 0:
+                memcpy(FLASH(pg), &Image[pg], len);
+                break;
+            case 1:
+                memset(FLASH(pg), 0xff, OQ_FLASH_PAGE);
+                memcpy(FLASH(pg), &Image[pg], part);
+                break;
+            }
+        }
+
+    memcpy(&Want[FLASH_LOW], FLASH(FLASH_LOW), sizeof Want - FLASH_LOW);
+    flashCounts();
+
+    switch (c)
+    {
+    case FULL:
+    case FULL_PARTLY_DONE:
+        putHeader(seq, version, start, end, 0, 0);
+        putChunks(seq, start, end, &Image[start], 0);
+        putExecute(seq, version);
+        break;
+
+    case FULL_DUPLICATES:
+        putHeader(seq, version, start, end, 0, 0);
+        for (unsigned a = start; a < end; a += OQ_SU_CHUNK)
+            if (rnd(4) == 0)
+            {
+                u8 junk[OQ_SU_CHUNK];
+                randomBytes(junk, sizeof junk);
+                putChunk(seq, a, junk, 0);
+            }
+        putChunks(seq, start, end, &Image[start], 0);
+        putExecute(seq, version);
+        break;
+
+    case FULL_SUPERSEDED:
+    case NEWER_INCOMPLETE:
+        {
+            static u8 other[0x40000];
+            randomBytes(other, end - start);
+            putHeader(seq, version, start, end, 0, 0);
+            putChunks(seq, start, end, other, 0);
+            putExecute(seq, version);
+        }
+        putHeader(seq + 1, version + 1, start, end, 0, 0);
+        putChunks(seq + 1, start, end, &Image[start],
+                  c == NEWER_INCOMPLETE ? chunkAt(start, end) : 0);
+        putExecute(seq + 1, version + 1);
+        break;
+
+    case DELTA:
+    case DELTA_CUT:
+    case DELTA_WRONG_APP:
+    case DELTA_BAD_CRC:
+    case DELTA_CUT_LOST:
+        if (c == DELTA_CUT_LOST)
+            memcpy(&Image[start + OQ_FLASH_PAGE], FLASH(start + OQ_FLASH_PAGE),
+                   OQ_SU_CHUNK);
+        {
+            u32 crc = makeDelta(start, end);
+            unsigned len = (StreamLen + OQ_SU_CHUNK - 1) & ~(OQ_SU_CHUNK - 1);
+            putHeader(seq, version, start, end, StreamLen,
+                      crc ^ (c == DELTA_BAD_CRC));
+            putChunks(seq, 0, len, Stream, len);
+            putExecute(seq, version);
+        }
+        if (c == DELTA_WRONG_APP)
+        {
+            /*
+             *  Change a byte that the delta copies.
+             */
+            unsigned a;
+            do
+                a = start + rnd(end - start);
+            while (Image[a] != *FLASH(a));
+            *FLASH(a) ^= 0x10;
+            Want[a] ^= 0x10;
+        }
+        if (c == DELTA_CUT_LOST)
+        {
+            /*
+             *  The first page written, the second part way, and the copy
+             *  of the second (which it copies from itself) lost.
+             */
+            unsigned a = start + OQ_FLASH_PAGE;
+            memcpy(FLASH(start), &Image[start], OQ_FLASH_PAGE);
+            *FLASH(a) ^= 0x10;
+            memset(FLASH(SCRATCH), 0xff, OQ_FLASH_PAGE);
+            memcpy(&Want[start], FLASH(start), 2 * OQ_FLASH_PAGE);
+            flashCounts();
+        }
+        break;
+
+    case NO_UPDATE:
+        for (int n = 0; n < 1000; n++)
+            putOther();
+        break;
+
+    case CHUNK_MISSING:
+        putHeader(seq, version, start, end, 0, 0);
+        putChunks(seq, start, end, &Image[start], chunkAt(start, end));
+        putExecute(seq, version);
+        break;
+
+    case CHUNK_CUT_SHORT:
+        {
+            unsigned a = chunkAt(start, end);
+            putHeader(seq, version, start, end, 0, 0);
+            putChunks(seq, start, end, &Image[start], a);
+            putChunk(seq, a, &Image[a], 1 + rnd(17));
+            putExecute(seq, version);
+        }
+        break;
+
+    case NOT_EXECUTED:
+        putHeader(seq, version, start, end, 0, 0);
+        putChunks(seq, start, end, &Image[start], 0);
+        break;
+
+    case WRONG_EXECUTE:
+        putHeader(seq, version, start, end, 0, 0);
+        putChunks(seq, start, end, &Image[start], 0);
+        putExecute(seq, version + 1);
+        break;
+    }
+    putOther();
+
+    if (c <= DELTA_CUT)
+        memcpy(&Want[start], &Image[start], end - start);
+    memcpy(&Want[STORE_START], FLASH(STORE_START), STORE_END - STORE_START);
+}
+
+
+/*
+ *  The pages an update from Image[] must erase.
+ */
+static unsigned
+erasesNeeded(unsigned start, unsigned end)
+{
+    unsigned n = 0;
+
+    for (unsigned pg = start; pg < end; pg += OQ_FLASH_PAGE)
+    {
+        u32 * f = (u32 *)FLASH(pg);
+        u32 * w = (u32 *)&Image[pg];
+        for (unsigned i = 0; i < OQ_FLASH_PAGE / 4 && pg + i * 4 < end; i++)
+            if (f[i] != w[i] && f[i] != 0xffffffff)
+            {
+                n++;
+                break;
+            }
+    }
+
+    return n;
+}
+
+
+/*
+ *  Check the flash after a boot.  A delta may leave anything in the
+ *  scratch page.
+ */
+static void
+check(int c, const char * when)
+{
+    bool delta = c >= DELTA && c <= DELTA_CUT_LOST;
+
+    for (unsigned a = FLASH_LOW; a < sizeof Want; a++)
+        if (*FLASH(a) != Want[a] &&
+            !(delta && a >= SCRATCH && a < STORE_START))
+        {
+            fail("%s, %s:  %x is %02x, should be %02x", caseName[c], when,
+                 a, *FLASH(a), Want[a]);
+            break;
+        }
+}
+
+
+static void
+update(int c)
+{
+    unsigned pages = (STORE_START - FLASH_LOW) / OQ_FLASH_PAGE;
+    unsigned start = FLASH_LOW + rnd(pages / 2) * OQ_FLASH_PAGE;
+    unsigned end = start + OQ_FLASH_PAGE + rnd(16 * OQ_FLASH_PAGE);
+    end &= ~(OQ_SU_CHUNK - 1);
+    if (c == DELTA_CUT_LOST && end < start + 2 * OQ_FLASH_PAGE)
+        end = start + 2 * OQ_FLASH_PAGE;
+
+    setUp(c, start, end);
+    unsigned erases = erasesNeeded(start, end);
+
+    /*
+     *  Cut the power part way through, up to three times, before a boot
+     *  that's left to finish.
+     */
+    if (c == DELTA_CUT)
+        for (int n = 0; n < 3; n++)
+        {
+            CutAt = 1 + rnd((end - start) / 2);
+            boot();
+            CutAt = 0;
+            if (Ended != CUT)
+                break;
+            Cuts++;
+        }
+
+    boot();
+    check(c, "first boot");
+    if (Ended != (c == DELTA_CUT_LOST ? HALTED : BOOTED))
+        fail("%s:  %s", caseName[c], Ended == HALTED
+                                     ? "stayed in the loader"
+                                     : "started the soft device");
+    if (c > DELTA_CUT)
+    {
+        if (LoaderStats.writes != 0 || LoaderStats.erases != 0)
+            fail("%s:  %u writes, %u erases", caseName[c],
+                 LoaderStats.writes, LoaderStats.erases);
+        return;
+    }
+
+    if (c < DELTA && LoaderStats.erases != erases)
+        fail("%s:  %u erases, should be %u", caseName[c],
+             LoaderStats.erases, erases);
+
+    boot();
+    check(c, "second boot");
+    if (LoaderStats.writes != 0 || LoaderStats.erases != 0)
+        fail("%s, second boot:  %u writes, %u erases", caseName[c],
+             LoaderStats.writes, LoaderStats.erases);
+}
+
+
+/*
+ *  Time full and delta updates, and the boots after them, with the model
+ *  off (its traps would swamp the loader).
+ */
+static void
+speed(unsigned rounds)
+{
+    double apply = 0;
+    double after = 0;
+
+    flashModel(false);
+    for (unsigned r = 0; r < rounds; r++)
+        for (int c = FULL; c <= DELTA; c += DELTA - FULL)
+        {
+            setUp(c, FLASH_LOW, FLASH_LOW + 16 * OQ_FLASH_PAGE);
+            apply += boot();
+            after += boot();
+        }
+    flashModel(true);
+
+    printf("64 KB updates:  %.2f ms to apply one, %.2f ms to boot after\n",
+           apply * 1e3 / (2 * rounds), after * 1e3 / (2 * rounds));
+}
+
+/**********************************************************************/
+
+static void
+map(unsigned long addr, size_t size)
+{
+    if (mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+        err(1, "can't map %lx", addr);
+}
+
+
+/*
+ *  Map `size' bytes at `addr' read-only, and again writable elsewhere,
+ *  returning that.
+ */
+static void *
+alias(unsigned long addr, size_t size, const char * name)
+{
+    int fd = memfd_create(name, 0);
+    void * p;
+
+    if (fd < 0 || ftruncate(fd, size) < 0 ||
+        mmap((void *)addr, size, PROT_READ, MAP_FIXED | MAP_SHARED,
+             fd, 0) == MAP_FAILED ||
+        (p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0)) == MAP_FAILED)
+            err(1, "can't map the %s", name);
+    return p;
+}
+
+
+/*
+ *  Run the loader on the flash image in `in', writing the flash after to
+ *  `out' if that's set.
+ */
+static void
+runImage(const char * in, const char * out)
+{
+    FILE * f = fopen(in, "rb");
+    if (!f)
+        err(1, "%s", in);
+    memset(Image, 0xff, sizeof Image);
+    size_t n = fread(Image, 1, sizeof Image, f);
+    fclose(f);
+    if (n <= STORE_START)
+        errx(1, "%s:  too short for the store", in);
+
+    /*
+     *  Once for the time, and once through the model.
+     */
+    flashModel(false);
+    memcpy(FLASH(FLASH_LOW), &Image[FLASH_LOW], sizeof Image - FLASH_LOW);
+    double t = boot();
+    flashModel(true);
+    memcpy(FLASH(FLASH_LOW), &Image[FLASH_LOW], sizeof Image - FLASH_LOW);
+    flashCounts();
+    boot();
+    memcpy(&Image[FLASH_LOW], FLASH(FLASH_LOW), sizeof Image - FLASH_LOW);
+
+    if (SuInfo.sequence == 0)
+        printf("no update\n");
+    else
+        printf("update %u, version %08x, %05x to %05x%s%s\n",
+               SuInfo.sequence, SuInfo.version, SuInfo.start, SuInfo.end,
+               SuInfo.delta ? ", delta" : "",
+               SuExec.version == SuInfo.version ? ", executed" : "");
+    printf("%u pages erased, %u words written, in %.2f ms%s\n",
+           LoaderStats.erases, LoaderStats.writes, t * 1e3,
+           Failed ? ", FAILED" : "");
+
+    if (out)
+    {
+        f = fopen(out, "wb");
+        if (!f || fwrite(Image, 1, sizeof Image, f) != sizeof Image ||
+            fclose(f) != 0)
+                err(1, "%s", out);
+    }
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    extern int optind;
+    const char * out = 0;
+    unsigned rounds = 10;
+    int c;
+
+    srandom(31);
+    while ((c = getopt(argc, argv, "n:o:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            rounds = strtoul(optarg, 0, 0);
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: loadertest [-n rounds] [-s seed]\n"
+                  "       loadertest [-o out] flash.img\n", stderr);
+            exit(1);
+        }
+
+    /*
+     *  The flash and the NVMC (always ready), each with its writable
+     *  mapping, then the UICR, and DWT.
+     */
+    flashAlias = alias(FLASH_LOW, OQ_FLASH_SIZE - FLASH_LOW, "flash");
+    nvmcAlias = alias((unsigned long)NVMC_PAGE, 0x1000, "nvmc");
+    map((unsigned long)NRF_UICR & ~0xfffUL, 0x1000);
+    map(0xe0000000, 0x10000);
+    nvmcAlias[offsetof(NRF_NVMC_Type, READY) / 4] = NVMC_READY_READY_Ready;
+
+    struct sigaction sa = { .sa_flags = SA_SIGINFO | SA_NODEFER };
+    sa.sa_sigaction = segv;
+    sigaction(SIGSEGV, &sa, 0);
+    sa.sa_sigaction = trap;
+    sigaction(SIGTRAP, &sa, 0);
+    *(volatile u32 *)&NRF_UICR->CUSTOMER[0] = STORE_START;
+    *(volatile u32 *)&NRF_UICR->CUSTOMER[1] = STORE_END;
+    *(volatile u32 *)&NRF_UICR->CUSTOMER[2] = CONFIG_START;
+
+    if (optind < argc)
+    {
+        runImage(argv[optind], out);
+        return Failed != 0;
+    }
+
+    for (unsigned r = 0; r < rounds; r++)
+        for (c = 0; c < CASES; c++)
+            update(c);
+
+    printf("%u rounds of %d updates (%u boots cut short):  %s\n", rounds,
+           CASES, Cuts,
+           Failed ? "FAILED" : "all applied, or not, as they should be");
+
+    speed(100);
+    return Failed != 0;
+}
@@ -0,0 +1,372 @@
+/*
+ *  Check and time the chunk maps (map.c).
+ *
+ *      maptest [-n operations] [-s seed]
+ *
+ *  The maps are built as the tracer has them, with all of the functions
+ *  (the loader has a few of them).  Maps of a few shapes are checked
+ *  against a plain array of slots:  one word or many, a whole number of
+ *  words or not, one slot, and a map with no words.  -n operations
+ *  (default 1000000) are made at random on each, with addresses in, below
+ *  and past the map, and after each the queries must agree with the array.
+ *
+ *  Then the time each operation takes, on a map the size of the loader's
+ *  chunk map (4096 slots), with the slots set that a software update
+ *  leaves behind.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "map.h"
+
+#define SLOTS_MAX       4096
+
+MAP_DEFINE(chunks, 0, 0x40000, 64);             //  As the loader has them
+MAP_DEFINE(pages, 0, 0x40000, 4096);
+MAP_DEFINE(odd, 0x1000, 0x1000 + 77 * 64, 64);
+MAP_DEFINE(small, 0x100, 0x100 + 33 * 16, 16);
+MAP_DEFINE(one, 0x20, 0x40, 32);
+
+static Map_t    none = { .start = 0, .end = 0x1000, .shift = 6 };
+
+static bool     Slot[SLOTS_MAX];
+static int      Failed;
+
+/**********************************************************************/
+
+static unsigned
+rnd(unsigned n)
+{
+    return random() % n;
+}
+
+
+static void
+fail(Map_t * map, const char * what, unsigned arg, int got, int want)
+{
+    if (Failed++ < 10)
+        printf("%u slot map, %s(%x):  %d, should be %d\n",
+               map->count, what, arg, got, want);
+}
+
+
+/*
+ *  An address at random:  mostly in the map, now and then just outside
+ *  it, and not always at the start of a slot.
+ */
+static unsigned
+address(Map_t * map)
+{
+    unsigned cs = 1 << map->shift;
+
+    switch (rnd(20))
+    {
+    case 0:
+        return map->start ? map->start - 1 - rnd(map->start) : 0;
+    case 1:
+        return map->end + rnd(3 * cs);
+    case 2:
+        return map->end;
+    default:
+        return map->start + rnd(map->end - map->start) / cs * cs +
+               (rnd(4) == 0 ? rnd(cs) : 0);
+    }
+}
+
+
+static int
+slotAt(Map_t * map, unsigned a)
+{
+    if (a < map->start || a >= map->end)
+        return -1;
+    return (a - map->start) >> map->shift;
+}
+
+
+static int
+addressOf(Map_t * map, int slot)
+{
+    return map->start + (slot << map->shift);
+}
+
+/**********************************************************************/
+
+/*
+ *  Check the queries against Slot[].
+ */
+static void
+query(Map_t * map)
+{
+    int n = map->count;
+    int set = 0;
+
+    for (int i = 0; i < n; i++)
+        set += Slot[i];
+
+    if (MapIsClearAll(map) != (set == 0))
+        fail(map, "MapIsClearAll", 0, MapIsClearAll(map), set == 0);
+    if (MapIsSetAll(map) != (set == n))
+        fail(map, "MapIsSetAll", 0, MapIsSetAll(map), set == n);
+
+    unsigned a = address(map);
+    int s = slotAt(map, a);
+    bool in = s >= 0;
+    if (MapIsSet(map, a) != (in && Slot[s]))
+        fail(map, "MapIsSet", a, MapIsSet(map, a), in && Slot[s]);
+    if (MapIsClear(map, a) != (in && !Slot[s]))
+        fail(map, "MapIsClear", a, MapIsClear(map, a), in && !Slot[s]);
+
+    /*
+     *  The first set and clear slots from `a' on.
+     */
+    int from = a < map->start ? 0 : in ? s : n;
+    int fs = MAP_COMPLETE;
+    int fc = MAP_COMPLETE;
+    for (int i = from; i < n; i++)
+        if (Slot[i] && fs == MAP_COMPLETE)
+            fs = addressOf(map, i);
+        else if (!Slot[i] && fc == MAP_COMPLETE)
+            fc = addressOf(map, i);
+    if (MapFindSet(map, a) != fs)
+        fail(map, "MapFindSet", a, MapFindSet(map, a), fs);
+    if (MapFindClear(map, a) != fc)
+        fail(map, "MapFindClear", a, MapFindClear(map, a), fc);
+
+    if (a <= map->start)
+    {
+        if (MapFirstBitSet(map) != fs)
+            fail(map, "MapFirstBitSet", 0, MapFirstBitSet(map), fs);
+    }
+
+    /*
+     *  The N'th set slot, or the last if there are fewer.
+     */
+    unsigned nth = rnd(set + 2);
+    int want = MAP_COMPLETE;
+    for (int i = 0, c = 0; i < n; i++)
+        if (Slot[i])
+        {
+            want = addressOf(map, i);
+            if (c++ == nth)
+                break;
+        }
+    if (MapNBitSet(map, nth) != want)
+        fail(map, "MapNBitSet", nth, MapNBitSet(map, nth), want);
+}
+
+
+/*
+ *  Make `ops' changes to the map at random, checking it after each.
+ */
+static void
+check(Map_t * map, unsigned ops)
+{
+    int n = map->count;
+
+    MapClearAll(map);
+    memset(Slot, 0, sizeof Slot);
+
+    for (unsigned k = 0; k < ops; k++)
+    {
+        unsigned r = rnd(100);
+        unsigned a = address(map);
+        int s = slotAt(map, a);
+
+        if (r < 30)
+        {
+            MapSet(map, a);
+            if (s >= 0)
+                Slot[s] = true;
+        }
+        else if (r < 60)
+        {
+            MapClear(map, a);
+            if (s >= 0)
+                Slot[s] = false;
+        }
+        else if (r < 98)
+        {
+            /*
+             *  A range, only done if it's in the map and not empty.
+             */
+            unsigned e = rnd(4) == 0 ? address(map)
+                                     : a + rnd(3 << map->shift) + 1;
+            bool set = r < 79;
+
+            if (set)
+                MapSetRange(map, a, e);
+            else
+                MapClearRange(map, a, e);
+            if (a >= map->start && e <= map->end && a < e)
+            {
+                int es = (e - map->start + (1 << map->shift) - 1)
+                         >> map->shift;
+                for (int i = slotAt(map, a); i < es; i++)
+                    Slot[i] = set;
+            }
+        }
+        else if (r < 99)
+        {
+            MapClearAll(map);
+            memset(Slot, 0, n * sizeof Slot[0]);
+        }
+        else
+        {
+            MapSetAll(map);
+            memset(Slot, 1, n * sizeof Slot[0]);
+        }
+
+        query(map);
+    }
+}
+
+
+/*
+ *  A map with no words is no map:  nothing is in it, and nothing changes.
+ */
+static void
+checkNone(void)
+{
+    MapSet(&none, 0x40);
+    MapSetRange(&none, 0, 0x1000);
+    MapSetAll(&none);
+    MapClearAll(&none);
+
+    if (MapIsSet(&none, 0x40) || MapIsClear(&none, 0x40) ||
+        MapIsSetAll(&none) || MapIsClearAll(&none))
+            fail(&none, "a query", 0x40, 1, 0);
+    if (MapFindSet(&none, 0) != MAP_INVALID ||
+        MapFindClear(&none, 0) != MAP_INVALID ||
+        MapFirstBitSet(&none) != MAP_INVALID ||
+        MapNBitSet(&none, 0) != MAP_INVALID)
+            fail(&none, "a find", 0, MapFindSet(&none, 0), MAP_INVALID);
+}
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static volatile int Sink;
+
+
+/*
+ *  The chunk map after an update, with a few chunks still missing, and
+ *  the page map with a few pages to program.  The addresses are made
+ *  beforehand, so only the map is timed.
+ */
+static void
+speed(unsigned ops)
+{
+    static unsigned addr[1 << 16];
+    double t[9];
+    int sink = 0;
+
+    for (unsigned i = 0; i < ARRAY_SIZE(addr); i++)
+        addr[i] = rnd(0x40000);
+    MapClearAll(&chunks);
+    for (int i = 0; i < 8; i++)
+        MapSet(&chunks, rnd(0x40000));
+    MapClearAll(&pages);
+    for (int i = 0; i < 8; i++)
+        MapSet(&pages, rnd(0x40000));
+
+    unsigned m = ARRAY_SIZE(addr) - 1;
+    t[0] = now();
+    for (unsigned k = 0; k < ops; k++)
+        MapSet(&chunks, addr[k & m]);
+    t[1] = now();
+    for (unsigned k = 0; k < ops; k++)
+        MapClear(&chunks, addr[k & m]);
+    t[2] = now();
+    for (unsigned k = 0; k < ops; k++)
+        sink += MapIsSet(&chunks, addr[k & m]);
+    t[3] = now();
+    for (unsigned k = 0; k < ops; k++)
+        sink += MapIsClearAll(&chunks);
+    t[4] = now();
+    for (unsigned k = 0; k < ops; k++)
+        sink += MapFindSet(&chunks, addr[k & m]);
+    t[5] = now();
+    for (unsigned k = 0; k < ops; k++)
+    {
+        unsigned a = addr[k & m];
+        MapSetRange(&chunks, a & ~0xfff, (a & ~0xfff) + 0x1000);
+    }
+    t[6] = now();
+    for (unsigned k = 0; k < ops / 64; k++)
+    {
+        MapClearAll(&chunks);
+        MapSetRange(&chunks, 0x1000, 0x3f000);
+    }
+    t[7] = now();
+    for (unsigned k = 0; k < ops / 16; k++)
+        for (int pg = MapFindSet(&pages, 0);
+             pg >= 0;
+             pg = MapFindSet(&pages, pg + 4096))
+                sink++;
+    t[8] = now();
+    Sink = sink;
+
+    printf("%u slots:  MapSet %.1f ns, MapClear %.1f ns, "
+           "MapIsSet %.1f ns,\n", chunks.count,
+           (t[1] - t[0]) * 1e9 / ops, (t[2] - t[1]) * 1e9 / ops,
+           (t[3] - t[2]) * 1e9 / ops);
+    printf("    MapIsClearAll %.1f ns, MapFindSet %.1f ns, "
+           "MapSetRange (a page) %.1f ns,\n",
+           (t[4] - t[3]) * 1e9 / ops, (t[5] - t[4]) * 1e9 / ops,
+           (t[6] - t[5]) * 1e9 / ops);
+    printf("    clear and set the whole map %.1f ns, "
+           "find the pages to program %.1f ns\n",
+           (t[7] - t[6]) * 1e9 / (ops / 64),
+           (t[8] - t[7]) * 1e9 / (ops / 16));
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    unsigned ops = 1000000;
+    int c;
+
+    srandom(32);
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            ops = strtoul(optarg, 0, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: maptest [-n operations] [-s seed]\n", stderr);
+            exit(1);
+        }
+
+    check(&chunks, ops / 10);
+    check(&pages, ops);
+    check(&odd, ops);
+    check(&small, ops);
+    check(&one, ops / 10);
+    checkNone();
+    printf("%u operations on 5 maps:  %s\n", ops,
+           Failed ? "FAILED" : "all as they should be");
+
+    speed(ops * 10);
+    return Failed != 0;
+}
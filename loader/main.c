@@ -75,9 +75,13 @@
  *      -   Compare the software update version with the App version.
  *      -   If equal, run the App.
  *      -   Collect all SU chunks, and verify we have all of them
+ *          (noting where the newest copy of each is in storage).
  *      -   If not, run the App.
- *      -   Erase flash in the software update region
- *      -   Loop through all chunks and write them to flash.
+ *      -   Compare the chunks with the flash, noting which pages differ.
+ *      -   Erase those pages, and write their chunks to flash.
+ *          (A delta is applied in place instead, see delta.c.  If it
+ *          doesn't take and the App is no longer whole, stay in the
+ *          loader for a minute, then reset.)
  *      -   Run the App.
  *      -   (When we run the App, we set the protect bits on all of the code
  *           space for the App, SD, etc.  They can only be cleared with a
@@ -100,15 +104,19 @@
  *                          The total of all of the above should a little
  *                          less than 256 KB.
  *
- *      40000 - 7f000       Circular flash storage (configuration, sensor
- *                          samples, software updates, etc).
+ *      3f000 - 40000       Boot loader scratch page, for delta updates.
  *
- *      7f000 - 80000       Boot loader (for software update)
+ *      40000 - 7d000       Circular flash storage (sensor samples,
+ *                          software updates, etc).
+ *
+ *      7d000 - 7e000       Configuration page.
+ *
+ *      7e000 - 80000       Boot loader (for software update)
  *
  *  RAM memory:  (20000000 - 2000ffff)
  *      0000 - 0004         MBR storage (vector table address)
  *      0004 - 4000         (unused)
- *      4000 - 8000         boot loader memory
+ *      4000 - 8000         boot loader memory (2 KB of which is stack)
  *      8000 - ffff         (unused)
  */
 
@@ -152,17 +160,6 @@ trace(u32 v)
 
 /**********************************************************************/
 
-/*
- *  What we will do with the storage software update chunks.
- */
-enum
-{
-    OP_SEARCH,
-    OP_COMPARE,
-    OP_WRITE,
-}
-    Op;
-
 /*
  *  The most recent software update info we have found, and the most
  *  recent execute record.  They will be used to program the flash, and
@@ -172,11 +169,33 @@ SuInfo_t   SuInfo;
 SuExec_t   SuExec;
 
 /*
- *  Maps to track which chunks we have found in the storage, and which pages
- *  we must erase and program to do this update.
+ *  Maps to track which chunks we have found in the storage, which pages
+ *  we must program to do this update, and which of those must first be
+ *  erased.
  */
 MAP_DEFINE(chunks, 0, 0x40000, OQ_SU_CHUNK);
 MAP_DEFINE(pages, 0, 0x40000, OQ_FLASH_PAGE);
+MAP_DEFINE(erases, 0, 0x40000, OQ_FLASH_PAGE);
+
+/*
+ *  The location of the newest copy of each chunk in storage, as a word
+ *  offset from the start of the storage area (0xffff if not found yet).
+ *  The storage area is smaller than 256 KB, so an offset fits in 16 bits.
+ *  This lets the compare and program steps go straight to the records
+ *  they need, rather than reading the whole storage area again.
+ */
+#define CHUNK_NONE      0xffff
+
+static u16  chunkAt[0x40000 / OQ_SU_CHUNK];
+
+/*
+ *  How long each step of the update took, in CPU cycles, and how much
+ *  flash was touched.  Nothing reports these;  look at them with the
+ *  debugger.
+ */
+#if defined(OQ_LOADER_STATS)
+LoaderStats_t LoaderStats;
+#endif // defined(OQ_LOADER_STATS)
 
 /**********************************************************************/
 /*
@@ -197,6 +216,8 @@ FlashWait(void)
 void
 FlashErase(u32 * addr)
 {
+    STAT(LoaderStats.erase -= DWT->CYCCNT);
+
     /*
      *   Turn on the flash erase enable.
      */
@@ -214,18 +235,46 @@ FlashErase(u32 * addr)
      */
     NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
     FlashWait();
+
+    STAT(LoaderStats.erases++);
+    STAT(LoaderStats.erase += DWT->CYCCNT);
+}
+
+
+/*
+ *  Returns true if the block at `dst' must be erased before it can be
+ *  programmed with `src'.  Programming can only clear bits, and a word may
+ *  only be written a couple of times between erases (we can't know how
+ *  often it has been already), so a word that differs can be programmed
+ *  only if it's still erased.  That is enough for a page that an earlier
+ *  try got part way through:  its remaining words are just written.
+ */
+bool
+FlashNeedsErase(u32 * dst, u32 * src, unsigned bytes)
+{
+    u32 * end = src + (bytes+3)/4;
+
+    for (; src < end; src++, dst++)
+        if (*dst != *src && *dst != 0xffffffff)
+            return true;
+
+    return false;
 }
 
 
 /*
  *  Write a block of words to flash.  The start address must be word aligned,
- *  and the count an even multiple of words.
+ *  and the count an even multiple of words.  Only words that differ from
+ *  the flash are written;  the rest (including those already erased, if
+ *  the source word is all ones) are skipped.
  */
 void
 FlashProgram(u32 * dst, u32 * src, unsigned bytes)
 {
     u32 * end = src + (bytes+3)/4;
 
+    STAT(LoaderStats.program -= DWT->CYCCNT);
+
     /*
      *  Turn on the flash write enable.
      */
@@ -233,19 +282,26 @@ FlashProgram(u32 * dst, u32 * src, unsigned bytes)
     FlashWait();
 
     /*
-     *  Loop over the block, writing.
+     *  Loop over the block, writing.  We run from flash, so the CPU is
+     *  stalled on the next fetch until each write is done;  there is no
+     *  need to poll READY between words.
      */
-    while (src < end)
+    for (; src < end; src++, dst++)
     {
-        *dst++ = *src++;
-        FlashWait();
+        if (*dst == *src)
+            continue;
+        *dst = *src;
+        STAT(LoaderStats.writes++);
     }
 
     /*
      *  Turn off the flash write enable.
      */
+    FlashWait();
     NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
     FlashWait();
+
+    STAT(LoaderStats.program += DWT->CYCCNT);
 }
 
 
@@ -291,45 +347,49 @@ void
 StoreCallbackSoftwareUpdateInfo(SuInfo_t * info)
 {
     /*
-     *  Make sure this software update header is sane.
+     *  Make sure this software update header is sane.  (The chunk maps
+     *  cover only the bottom of flash.)  A delta is written a page at a
+     *  time, so it must start on a page.
      */
     if ((info->start < 0x1000 || info->start > 0x7f000) ||
-        (info->end < info->start + 0x1000 || info->end > 0x80000))
+        (info->end < info->start + 0x1000 || info->end > 0x80000) ||
+        info->end > ARRAY_SIZE(chunkAt) * OQ_SU_CHUNK)
+            return;
+    if (info->delta &&
+        ((info->start & (OQ_FLASH_PAGE - 1)) ||
+         info->delta > ARRAY_SIZE(chunkAt) * OQ_SU_CHUNK))
             return;
 
-    switch (Op)
-    {
-    case OP_SEARCH:
 trace(0x69626373);
 trace(info->sequence);
 trace(SuInfo.sequence);
+    /*
+     *  We found a new software update header.  If it's more recent
+     *  than the one we have (if we have one), over write it and start
+     *  collecting chunks again.
+     */
+    if (info->sequence > SuInfo.sequence)
+    {
+        SuInfo = *info;
+
         /*
-         *  We found a new software update header.  If it's more recent
-         *  than the one we have (if we have one), over write it and start
-         *  collecting chunks again.
+         *  The chunks of a delta hold the stream, rather than the image.
          */
-        if (info->sequence > SuInfo.sequence)
-        {
-            SuInfo = *info;
-
-            MapClearAll(&chunks);
+        MapClearAll(&chunks);
+        if (info->delta)
+            MapSetRange(&chunks, 0, info->delta);
+        else
             MapSetRange(&chunks, info->start, info->end);
+        memset(&chunkAt[0], 0xff, sizeof chunkAt);
 
-            SuExec.sequence = 0;
-        }
-        break;
-
-    case OP_COMPARE:
-        break;
-
-    case OP_WRITE:
-        break;
+        SuExec.sequence = 0;
     }
 }
 
 
 /*
- *  Called when storage found a software update data chunk.
+ *  Called when storage found a software update data chunk.  (The data
+ *  itself is not decoded;  `SuChunkGet()' fetches it when needed.)
  */
 void
 StoreCallbackSoftwareUpdateChunk(SuData_t * data)
@@ -337,39 +397,19 @@ StoreCallbackSoftwareUpdateChunk(SuData_t * data)
     /*
      *  Make sure the chunk is sane.
      */
+    unsigned s = SuInfo.delta ? 0 : SuInfo.start;
+    unsigned e = SuInfo.delta ? SuInfo.delta + OQ_SU_CHUNK - 1 : SuInfo.end;
     if (data->sequence != SuInfo.sequence ||
-        data->address < SuInfo.start ||
-        data->address + OQ_SU_CHUNK > SuInfo.end)
+        data->address < s ||
+        data->address + OQ_SU_CHUNK > e)
             return;
 
-    switch (Op)
-    {
-    case OP_SEARCH:
-        /*
-         *  Mark that we have this chunk.
-         */
-        MapClear(&chunks, data->address);
-        break;
-
-    case OP_COMPARE:
-        /*
-         *  Compare this chunk to existing flash, and set a bit for the pages
-         *  that don't match.
-         */
-        if (memcmp(&data->data[0], (u8 *)data->address, OQ_SU_CHUNK) != 0)
-            MapSet(&pages, data->address);
-        break;
-
-    case OP_WRITE:
-        /*
-         *  Write this chunk to flash.
-         */
-        if (memcmp(&data->data[0], (u8 *)data->address, OQ_SU_CHUNK) != 0)
-            FlashProgram((u32 *)data->address,
-                         (u32 *)&data->data[0],
-                         OQ_SU_CHUNK);
-        break;
-    }
+    /*
+     *  Mark that we have this chunk, and where.  Storage is read oldest
+     *  first, so the last copy we see is the one to use.
+     */
+    MapClear(&chunks, data->address);
+    chunkAt[data->address >> OQ_SU_CHUNK_SHIFT] = data->offset;
 }
 
 
@@ -379,24 +419,29 @@ StoreCallbackSoftwareUpdateChunk(SuData_t * data)
 void
 StoreCallbackSoftwareUpdateExecute(SuExec_t * exec)
 {
-    switch (Op)
-    {
-    case OP_SEARCH:
-        /*
-         *  We found a new software update header.  If it's more recent
-         *  than the one we have (if we have one), over write it and start
-         *  collecting chunks again.
-         */
-        if (exec->sequence == SuInfo.sequence)
-            SuExec = *exec;
-        break;
+    /*
+     *  We found a new software update header.  If it's more recent
+     *  than the one we have (if we have one), over write it and start
+     *  collecting chunks again.
+     */
+    if (exec->sequence == SuInfo.sequence)
+        SuExec = *exec;
+}
 
-    case OP_COMPARE:
-        break;
+/**********************************************************************/
 
-    case OP_WRITE:
-        break;
-    }
+/*
+ *  Fetch the newest copy of the chunk at `addr' from storage.  Returns
+ *  false if it can't be had.
+ */
+bool
+SuChunkGet(unsigned addr, SuData_t * sd)
+{
+    unsigned off = chunkAt[addr >> OQ_SU_CHUNK_SHIFT];
+    if (off == CHUNK_NONE || !StoreReadChunk(off, sd))
+        return false;
+
+    return sd->sequence == SuInfo.sequence && sd->address == addr;
 }
 
 /**********************************************************************/
@@ -416,6 +461,15 @@ trace(StoreStart);
 trace(StoreEnd);
 trace(ConfigStart);
 
+#if defined(OQ_LOADER_STATS)
+    /*
+     *  Start the cycle counter, for the update statistics.
+     */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif // defined(OQ_LOADER_STATS)
+
     if ((StoreStart < 0x1000 || StoreStart > 0x7f000) ||
         (StoreEnd < (StoreStart + 0x1000) || StoreEnd > 0x80000))
             goto out;
@@ -425,8 +479,8 @@ trace(ConfigStart);
      *  If there is no software update, or this is not a complete update
      *  image, bug out.
      */
-    Op = OP_SEARCH;
     StoreRead();
+    STAT(LoaderStats.read = DWT->CYCCNT);
 trace(SuInfo.sequence);
 trace(MapIsClearAll(&chunks));
 trace(SuInfo.version);
@@ -438,14 +492,56 @@ trace(SuExec.version);
         goto out;
     }
 
+    /*
+     *  A delta can only be run against the image it was made from, so
+     *  unless the flash already holds the result, check that it builds
+     *  the right image before anything is written.  An apply cut short is
+     *  taken up where it left off.
+     *
+     *  If the delta doesn't take, the app is run as long as it's whole:
+     *  the one the delta was made for, with every page still matching its
+     *  old CRC, or some other app the delta doesn't fit.  (The app cancels
+     *  the update, so it isn't tried at every reset.)  Only if the flash
+     *  holds part of the old image and part of the new is there nothing
+     *  to run:  stay in the loader, where the debug port can still be used
+     *  to put in a full image, and look again after a while.
+     */
+    if (SuInfo.delta)
+    {
+        bool applied = DeltaIsApplied(&SuInfo);
+        bool apply = !applied && DeltaApply(&SuInfo, false);
+        STAT(LoaderStats.check = DWT->CYCCNT - LoaderStats.read);
+        if (apply)
+        {
+            DeltaApply(&SuInfo, true);
+            applied = DeltaIsApplied(&SuInfo);
+        }
+        if (!applied && !DeltaIsOld(&SuInfo) && DeltaIsStarted(&SuInfo))
+            Halt();
+        goto out;
+    }
+
     /*
      *  We have a software update.  Now it might be possible that we have
-     *  already programmed some or all of this update.  Read the update
-     *  from storage again, comparing it to the existing flash,
+     *  already programmed some or all of this update.  Compare the newest
+     *  copy of each chunk to the existing flash.  A page only has to be
+     *  erased if some chunk in it can't just be programmed over what's
+     *  there.
      */
-    Op = OP_COMPARE;
+    SuData_t sd;
     MapClearAll(&pages);
-    StoreRead();
+    MapClearAll(&erases);
+    for (unsigned a = SuInfo.start; a < SuInfo.end; a += OQ_SU_CHUNK)
+    {
+        if (!SuChunkGet(a, &sd))
+            goto out;
+        if (memcmp(&sd.data[0], (u8 *)a, OQ_SU_CHUNK) == 0)
+            continue;
+        MapSet(&pages, a);
+        if (FlashNeedsErase((u32 *)a, (u32 *)&sd.data[0], OQ_SU_CHUNK))
+            MapSet(&erases, a);
+    }
+    STAT(LoaderStats.check = DWT->CYCCNT - LoaderStats.read);
 
 trace(0x12340005);
     /*
@@ -457,18 +553,37 @@ trace(0x12340005);
 trace(0x12340007);
 
     /*
-     *  Erase the pages that are to be programmed.
+     *  Erase the pages that need it.
      */
-    for (unsigned pg = 1*OQ_FLASH_PAGE; pg < StoreStart; pg += OQ_FLASH_PAGE)
-        if (MapIsSet(&pages, pg))
-            FlashErase((u32 *)pg);
+    int pg;
+    for (pg = MapFindSet(&erases, 1*OQ_FLASH_PAGE);
+         pg >= 0 && (unsigned)pg < StoreStart;
+         pg = MapFindSet(&erases, pg + OQ_FLASH_PAGE))
+    {
+        FlashErase((u32 *)pg);
+    }
 trace(0x12340009);
 
     /*
-     *  Program all chunks that are different than the existing flash.
+     *  Program the pages that differ.  Every chunk in the page is offered
+     *  (an erased page has lost the ones that were the same), but only
+     *  the words that differ get written.
      */
-    Op = OP_WRITE;
-    StoreRead();
+    for (pg = MapFindSet(&pages, SuInfo.start);
+         pg >= 0;
+         pg = MapFindSet(&pages, pg + OQ_FLASH_PAGE))
+    {
+        unsigned e = pg + OQ_FLASH_PAGE;
+        if (e > SuInfo.end)
+            e = SuInfo.end;
+        for (unsigned a = pg < SuInfo.start ? SuInfo.start : pg;
+             a < e;
+             a += OQ_SU_CHUNK)
+        {
+            if (SuChunkGet(a, &sd))
+                FlashProgram((u32 *)a, (u32 *)&sd.data[0], OQ_SU_CHUNK);
+        }
+    }
 
     /*
      *  Set the flash protect bits for the sections of flash that we use,
@@ -476,6 +591,7 @@ trace(0x12340009);
      *  does, spin forever.
      */
   out:
+    STAT(LoaderStats.total = DWT->CYCCNT);
 trace(0x12340000);
     Protect();
     FlushCache();
@@ -59,7 +59,115 @@
 #endif
 
 
-#if 1
+/*
+ *  Slots are kept 32 to a word, the lowest address in the LSB.  Functions
+ *  the boot loader has no use for are left out of it, to keep it small.
+ */
+
+/*
+ *  Return true if the map is usable.
+ */
+static inline bool
+mapValid(Map_t * map)
+{
+    return map && map->words != 0;
+}
+
+
+/*
+ *  Return the slot for `address', or -1 if it is not in the map.
+ */
+static inline int
+mapSlot(Map_t * map, unsigned address)
+{
+    if (address < map->start || address >= map->end)
+        return -1;
+    return (address - map->start) >> map->shift;
+}
+
+
+/*
+ *  Return a mask of the bits in the last word that are within the map.
+ */
+static inline u32
+mapLastMask(Map_t * map)
+{
+    unsigned n = map->count & 31;
+    return n ? (1u << n) - 1 : 0xffffffff;
+}
+
+
+/*
+ *  Set or clear the slots from `s' to `e' (exclusive).
+ */
+static void
+mapRange(Map_t * map, unsigned s, unsigned e, bool set)
+{
+    if (!mapValid(map))
+        return;
+
+    if (s < map->start || e > map->end || s >= e)
+        return;
+
+    unsigned ss = (s - map->start) >> map->shift;
+    unsigned es = (e - map->start + (1 << map->shift) - 1) >> map->shift;
+
+    unsigned sw = ss >> 5;
+    unsigned ew = es >> 5;
+    u32 sm = 0xffffffff << (ss & 31);       //  Bits from the start on
+    u32 em = (1u << (es & 31)) - 1;         //  Bits before the end
+
+    u32 * bp = &map->bits[0];
+    if (sw == ew)
+    {
+        u32 m = sm & em;
+        bp[sw] = set ? (bp[sw] | m) : (bp[sw] & ~m);
+        return;
+    }
+
+    bp[sw] = set ? (bp[sw] | sm) : (bp[sw] & ~sm);
+    for (unsigned w = sw + 1; w < ew; w++)
+        bp[w] = set ? 0xffffffff : 0;
+    if (em)
+        bp[ew] = set ? (bp[ew] | em) : (bp[ew] & ~em);
+}
+
+
+/*
+ *  Return the address of the first slot at or after `address' whose bit
+ *  is `set'.
+ */
+static int
+mapFind(Map_t * map, unsigned address, bool set)
+{
+    if (!mapValid(map))
+        return MAP_INVALID;
+
+    if (address < map->start)
+        address = map->start;
+    int slot = mapSlot(map, address);
+    if (slot < 0)
+        return MAP_COMPLETE;
+
+    u32 flip = set ? 0 : 0xffffffff;
+    unsigned w = slot >> 5;
+    u32 v = (map->bits[w] ^ flip) & (0xffffffff << (slot & 31));
+
+    for (;;)
+    {
+        if (w == map->words - 1)
+            v &= mapLastMask(map);
+        if (v)
+            return map->start +
+                   (((w << 5) + __builtin_ctz(v)) << map->shift);
+        if (++w >= map->words)
+            return MAP_COMPLETE;
+        v = map->bits[w] ^ flip;
+    }
+}
+
+/******************************/
+
 /*
  *  Clear the entire map's allocation and set it all to 0s.  This is expected
  *  to be called before we wish to track one or more segments within this map's
@@ -68,15 +176,14 @@
 void
 MapClearAll(Map_t * map)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return;
 
-    memset(map->bits, 0x00, map->entryCount);
+    memset(map->bits, 0x00, map->words * sizeof map->bits[0]);
 }
-#endif // 0
 
 
-#if 0
+#if !defined(LOADER)
 /*
  *  Set the entire map's allocation and set it all to 1s.  This is expected
  *  to be called before we wish to track one or more segments within this map's
@@ -85,16 +192,16 @@ MapClearAll(Map_t * map)
 void
 MapSetAll(Map_t * map)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return;
 
-    memset(map->bits, 0xff, map->entryCount);
+    memset(map->bits, 0xff, map->words * sizeof map->bits[0]);
+    map->bits[map->words - 1] &= mapLastMask(map);
 }
-#endif // 0
+#endif // !defined(LOADER)
 
 /***********/
 
-#if 1
 /*
  *  Clear the bit that corresponds to the slot in the map for the provided
  *  `address'.  All invalid maps will result in no modification to the map.
@@ -102,82 +209,29 @@ MapSetAll(Map_t * map)
 void
 MapClear(Map_t * map, unsigned address)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return;
 
-    if (address < map->start || address >= map->end)
+    int slot = mapSlot(map, address);
+    if (slot < 0)
         return;
 
-    unsigned offset = address - map->start;
-    unsigned slot = offset / map->chunkSize;
-    unsigned byteIdx = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
-
-    map->bits[byteIdx] &= ~(1 << bitOffset);
+    map->bits[slot >> 5] &= ~(1u << (slot & 31));
 }
-#endif // 0
 
 
-#if 0
+#if !defined(LOADER)
 /*
- *  Clear the bits that corresponds to the slots in the map for the provided
- *  `start' and `end' addresses.  If either address is invalid, this function
- *  will make no modifications to the map.
+ *  Clear the bits that corresponds to the slots in the map for the addresses
+ *  from `s' up to (but not including) `e'.
  */
 void
 MapClearRange(Map_t * map, unsigned s, unsigned e)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
-        return;
-
-    if (s < map->start || e >= map->end || s >= e)
-        return;
-
-    /*
-     *  Find the byte where the start address corresponds to and find the bit
-     *  which marks its start.  Do the same for the end address.
-     */
-    unsigned sOffset = s - map->start;
-    unsigned eOffset = e - map->start;
-
-    unsigned sSlot = sOffset / map->chunkSize;
-    unsigned sByte = sSlot / BITS_PER_BYTE;
-    unsigned sBit = sSlot % BITS_PER_BYTE;
-
-    unsigned eSlot = (eOffset + map->chunkSize - 1) / map->chunkSize;
-    unsigned eByte = eSlot / BITS_PER_BYTE;
-    unsigned eBit = eSlot % BITS_PER_BYTE;
-
-    /*
-     *  If both the start and end reside on the same byte we just clear
-     *  the bits needed in place.
-     */
-    if (sByte == eByte)
-    {
-        map->bits[sByte] &= ~(((1 << (eBit-sBit)) - 1) << sBit);
-    }
-    else
-    {
-        /*
-         *  Clear the bits in the first byte from sBit -> MSB.
-         */
-        map->bits[sByte++] &= ((1 << sBit) - 1);
-
-        /*
-         *  Clear the bytes from sByte + 1 -> eByte.
-         */
-        memset(&map->bits[sByte], 0x00, eByte-sByte);
-
-        /*
-         *  Clear the bits in the last byte up to eBit.
-         */
-        map->bits[eByte] &= ~((1 << eBit) - 1);
-    }
+    mapRange(map, s, e, false);
 }
-#endif // 0
 
 
-#if 0
 /*
  *  Return true if the slot at the corresponding address is clear, false for
  *  all other cases.
@@ -185,30 +239,22 @@ MapClearRange(Map_t * map, unsigned s, unsigned e)
 bool
 MapIsClear(Map_t * map, unsigned address)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return false;
 
-    if (address < map->start || address >= map->end)
-        return false;
-
-    /*
-     *  Figure out the slot for the chunk at this address.
-     */
-    unsigned offset = address - map->start;
-    unsigned slot = offset / map->chunkSize;
-    unsigned byteIdx = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
-
     /*
      *  We cannot just blindly return !MapIsSet(...) as invalid maps and
      *  addresses will return false.
      */
-    return !(map->bits[byteIdx] & (1 << bitOffset));
+    int slot = mapSlot(map, address);
+    if (slot < 0)
+        return false;
+
+    return !(map->bits[slot >> 5] & (1u << (slot & 31)));
 }
-#endif // 0
+#endif // !defined(LOADER)
 
 
-#if 1
 /*
  *  Return true if the entire map is clear, false otherwise.  All invalid map's
  *  will also return false.
@@ -216,33 +262,17 @@ MapIsClear(Map_t * map, unsigned address)
 bool
 MapIsClearAll(Map_t * map)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return false;
 
-    unsigned range = map->end - map->start;
-    unsigned slot = range / map->chunkSize;
-    unsigned byteOffset = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
-
-    u8 mask = 0xff;
-    unsigned i = 0;
-    for (i = 0; i < map->entryCount; i++)
-    {
-        if (i == byteOffset)
-        {
-            mask <<= (BITS_PER_BYTE - bitOffset);
-            mask >>= (BITS_PER_BYTE - bitOffset);
-        }
-        if ((map->bits[i] & mask) != 0)
-            return false;
-    }
-    return true;
+    u32 acc = map->bits[map->words - 1] & mapLastMask(map);
+    for (unsigned i = 0; i < map->words - 1; i++)
+        acc |= map->bits[i];
+    return acc == 0;
 }
-#endif // 0
 
 /***********/
 
-#if 1
 /*
  *  Set the bit that corresponds to the slot in the map for the provided
  *  `address'.  All invalid maps will result in no modification to the map.
@@ -250,82 +280,28 @@ MapIsClearAll(Map_t * map)
 void
 MapSet(Map_t * map, unsigned address)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return;
 
-    if (address < map->start || address >= map->end)
+    int slot = mapSlot(map, address);
+    if (slot < 0)
         return;
 
-    unsigned offset = address - map->start;
-    unsigned slot = offset / map->chunkSize;
-    unsigned byteIdx = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
-
-    map->bits[byteIdx] |= (1 << bitOffset);
+    map->bits[slot >> 5] |= 1u << (slot & 31);
 }
-#endif // 0
 
 
-#if 1
 /*
- *  Set the bits that corresponds to the slots in the map for the provided
- *  `start' and `end' addresses.  If either address is invalid, this function
- *  will make no modifications to the map.
+ *  Set the bits that corresponds to the slots in the map for the addresses
+ *  from `s' up to (but not including) `e'.
  */
 void
 MapSetRange(Map_t * map, unsigned s, unsigned e)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
-        return;
-
-    if (s < map->start || e >= map->end || s >= e)
-        return;
-
-    /*
-     *  Find the byte where the start address corresponds to and find the bit
-     *  which marks its start.  Do the same for the end address.
-     */
-    unsigned sOffset = s - map->start;
-    unsigned eOffset = e - map->start;
-
-    unsigned sSlot = sOffset / map->chunkSize;
-    unsigned sByte = sSlot / BITS_PER_BYTE;
-    unsigned sBit = sSlot % BITS_PER_BYTE;
-
-    unsigned eSlot = (eOffset + map->chunkSize - 1) / map->chunkSize;
-    unsigned eByte = eSlot / BITS_PER_BYTE;
-    unsigned eBit = eSlot % BITS_PER_BYTE;
-
-    /*
-     *  If both the start and end reside on the same byte we just set
-     *  the bits needed in place.
-     */
-    if (sByte == eByte)
-    {
-        map->bits[sByte] |= (((1 << (eBit-sBit)) - 1) << sBit);
-    }
-    else
-    {
-        /*
-         *  Set the bits in the first byte from sBit -> MSB. Should this be (sBit-1) ?
-         */
-        map->bits[sByte++] |= ~((1 << sBit) - 1);
-
-        /*
-         *  Set the bytes from sByte + 1 -> eByte.
-         */
-        memset(&map->bits[sByte], 0xff, eByte-sByte);
-
-        /*
-         *  Set the bits in the last byte up to eBit.
-         */
-        map->bits[eByte] |= ((1 << eBit) - 1);
-    }
+    mapRange(map, s, e, true);
 }
-#endif // 0
 
 
-#if 1
 /*
  *  Return true if the slot at the corresponding address is set, false for all
  *  other cases.
@@ -333,26 +309,18 @@ MapSetRange(Map_t * map, unsigned s, unsigned e)
 bool
 MapIsSet(Map_t * map, unsigned address)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return false;
 
-    if (address < map->start || address >= map->end)
+    int slot = mapSlot(map, address);
+    if (slot < 0)
         return false;
 
-    /*
-     *  Figure out the slot for the chunk at this address.
-     */
-    unsigned offset = address - map->start;
-    unsigned slot = offset / map->chunkSize;
-    unsigned byteIdx = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
-
-    return (map->bits[byteIdx] & (1 << bitOffset));
+    return (map->bits[slot >> 5] >> (slot & 31)) & 1;
 }
-#endif // 0
 
 
-#if 0
+#if !defined(LOADER)
 /*
  *  Return true if the entire map is set, false otherwise.  All invalid map's
  *  will also return false.
@@ -360,34 +328,40 @@ MapIsSet(Map_t * map, unsigned address)
 bool
 MapIsSetAll(Map_t * map)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return false;
 
-    unsigned range = map->end - map->start;
-    unsigned slot = range / map->chunkSize;
-    unsigned byteOffset = slot / BITS_PER_BYTE;
-    unsigned bitOffset = slot % BITS_PER_BYTE;
+    u32 m = mapLastMask(map);
+    u32 acc = ~map->bits[map->words - 1] & m;
+    for (unsigned i = 0; i < map->words - 1; i++)
+        acc |= ~map->bits[i];
+    return acc == 0;
+}
+#endif // !defined(LOADER)
 
-    u8 mask = 0xff;
-    unsigned i = 0;
-    for (i = 0; i < map->entryCount; i++)
-    {
-        if (i == byteOffset)
-        {
-            mask <<= bitOffset;
-            mask >>= bitOffset;
-        }
+/***********/
 
-        if ((map->bits[i] & mask) != mask)
-            return false;
-    }
-    return true;
+/*
+ *  Returns the address of the first set slot at or after `address'.
+ */
+int
+MapFindSet(Map_t * map, unsigned address)
+{
+    return mapFind(map, address, true);
+}
+
+
+#if !defined(LOADER)
+/*
+ *  Returns the address of the first clear slot at or after `address'.
+ */
+int
+MapFindClear(Map_t * map, unsigned address)
+{
+    return mapFind(map, address, false);
 }
-#endif // 0
 
-/***********/
 
-#if 0
 /*
  *  Returns the address of the `N'th set bit in the map.  However, if `N' bits
  *  are not set, it will return the address of the last bit that was set.
@@ -397,42 +371,40 @@ MapIsSetAll(Map_t * map)
 int
 MapNBitSet(Map_t * map, unsigned n)
 {
-    if (!map || map->chunkSize == 0 || map->entryCount == 0)
+    if (!mapValid(map))
         return MAP_INVALID;
 
-    for (unsigned i = 0; i < map->entryCount; i++)
+    int last = MAP_COMPLETE;
+    for (unsigned w = 0; w < map->words; w++)
     {
-        u8 c = map->bits[i];
-        unsigned count = 0;
+        u32 v = map->bits[w];
+        if (w == map->words - 1)
+            v &= mapLastMask(map);
 
-        while (c)
+        /*
+         *  Skip whole words that don't reach the N'th bit.
+         */
+        unsigned c = __builtin_popcount(v);
+        if (c <= n)
         {
-            /*
-             *  Find the next set bit in the byte.
-             */
-            while (!(c & 0x01))
-            {
-                c >>= 1;
-                count++;
-            }
-
-            if (n == 0)
-            {
-                unsigned chunkIdx = (i * BITS_PER_BYTE) + count;
-                return (map->start + (chunkIdx * map->chunkSize));
-            }
-
-            n--;
-            c >>= 1;
-            count++;
+            if (c)
+                last = (w << 5) + 31 - __builtin_clz(v);
+            n -= c;
+            continue;
         }
+
+        while (n--)
+            v &= v - 1;             //  Drop the lowest set bit
+        last = (w << 5) + __builtin_ctz(v);
+        return map->start + (last << map->shift);
     }
-    return MAP_COMPLETE;
+
+    if (last < 0)
+        return MAP_COMPLETE;
+    return map->start + (last << map->shift);
 }
-#endif // 0
 
 
-#if 0
 /*
  *  Returns the address of the first set bit in the map.  Returns
  *  MAP_COMPLETE (-1) if the map is clear
@@ -441,9 +413,9 @@ MapNBitSet(Map_t * map, unsigned n)
 int
 MapFirstBitSet(Map_t * map)
 {
-    return MapNBitSet(map, 0);
+    return mapFind(map, map->start, true);
 }
-#endif // 0
+#endif // !defined(LOADER)
 
 /***********/
 
@@ -454,16 +426,18 @@ MapFirstBitSet(Map_t * map)
 void
 MapDump(Map_t * map)
 {
-    if (!map || map->chunkSize == 0)
+    if (!mapValid(map))
         return;
 
-dprintf("\nmap with count: %d bytes starting at addr: %08x\n", map->entryCount, map->start);
+dprintf("\nmap with count: %d words starting at addr: %08x\n", map->words, map->start);
     unsigned i = 0;
-    for (i = 0; i < map->entryCount; i++)
+    for (i = 0; i < map->words; i++)
     {
-        dprintf("%02x", map->bits[i]);
-        if (i % 16 == 15)
+        dprintf("%08x", map->bits[i]);
+        if (i % 8 == 7)
             dprintf("\n");
+        else
+            dprintf(" ");
     }
     dprintf("\n");
 }
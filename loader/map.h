@@ -85,9 +85,10 @@ typedef struct
 {
     unsigned    start;              // start offset of the data being tracked
     unsigned    end;                // end address of the largest byte tracked
-    unsigned    chunkSize;          // size of each chunk
-    u8 *        bits;               // pointer to data
-    unsigned    entryCount;         // number of bytes pointed to by `bits'
+    unsigned    shift;              // log2 of the size of each chunk
+    unsigned    count;              // number of slots (bits) in the map
+    u32 *       bits;               // pointer to data
+    unsigned    words;              // number of words pointed to by `bits'
 }
     Map_t;
 
@@ -96,25 +97,28 @@ typedef struct
 /*
  *  Mask creation helper.
  *
- *  Allocate a byte array to associate with this mask.  The allocation has to
+ *  Allocate a word array to associate with this mask.  The allocation has to
  *  be able to account for the range of address from start to end where each
  *  chunk has a size as specified by `cs' below.  This allows for the caller
  *  to create various masks to track different allocations, pages et al.
- *  `s' and `e' must be aligned to a multiple of `cs'.
+ *  `s' and `e' must be aligned to a multiple of `cs', and `cs' must be a
+ *  power of two.
  */
+#define MAP_SLOTS(s, e, cs)     ((((e) - (s)) + (cs) - 1) / (cs))
+#define MAP_WORDS(s, e, cs)     ((MAP_SLOTS(s, e, cs) + 32 - 1) / 32)
+
 #define MAP_DEFINE(name, s, e, cs)                                    \
-u8 name ## _alloc[(((((e) - (s)) + (cs) - 1) / (cs)) + 8 - 1) / 8];   \
+u32 name ## _alloc[MAP_WORDS(s, e, cs)];                              \
 Map_t name =                                                          \
 {                                                                     \
     .start = (s),                                                     \
     .end = (e),                                                       \
-    .chunkSize = (cs),                                                \
+    .shift = __builtin_ctz(cs),                                       \
+    .count = MAP_SLOTS(s, e, cs),                                     \
     .bits = &name ## _alloc[0],                                       \
-    .entryCount = (((((e) - (s)) + (cs) - 1) / (cs)) + 8 - 1) / 8,    \
+    .words = MAP_WORDS(s, e, cs),                                     \
 }
 
-// TODO: Optimize cs -> shift so we can do away with idivs in the code.
-
 /**********************************************************************/
 
 /*
@@ -140,9 +144,9 @@ extern void         MapSetAll(Map_t * map);
 extern void         MapClear(Map_t * map, unsigned address);
 
 /*
- *  Clear the bits that corresponds to the slots in the map for the provided
- *  `start' and `end' addresses.  If either address is invalid, this function
- *  will make no modifications to the map.
+ *  Clear the bits that corresponds to the slots in the map for the addresses
+ *  from `start' up to (but not including) `end'.  If the range is not within
+ *  the map, this function will make no modifications to the map.
  */
 extern void         MapClearRange(Map_t * map, unsigned s, unsigned e);
 
@@ -166,9 +170,9 @@ extern bool         MapIsClearAll(Map_t * map);
 extern void         MapSet(Map_t * map, unsigned address);
 
 /*
- *  Set the bits that corresponds to the slots in the map for the provided
- *  `start' and `end' addresses.  If either address is invalid, this function
- *  will make no modifications to the map.
+ *  Set the bits that corresponds to the slots in the map for the addresses
+ *  from `start' up to (but not including) `end'.  If the range is not within
+ *  the map, this function will make no modifications to the map.
  */
 extern void         MapSetRange(Map_t * map, unsigned start, unsigned end);
 
@@ -185,6 +189,15 @@ extern bool         MapIsSetAll(Map_t * map);
 
 /***********/
 
+/*
+ *  Returns the address of the first set (or clear) slot at or after
+ *  `address'.  Returns
+ *  MAP_COMPLETE (-1) if there is no such slot
+ *  MAP_INVALID  (-2) if the map or parameters are invalid
+ */
+extern int          MapFindSet(Map_t * map, unsigned address);
+extern int          MapFindClear(Map_t * map, unsigned address);
+
 /*
  *  Returns the address of the first set bit in the map.  Returns
  *  MAP_COMPLETE (-1) if the map is clear
@@ -9,7 +9,7 @@ int
 memcmp(const void * l, const void * r, size_t len)
 {
     unsigned i = 0;
-    for (i = 0; i < len; l++, r++)
+    for (i = 0; i < len; i++, l++, r++)
     {
         if (*(char *)l < *(char *)r)
             return -1;
@@ -66,6 +66,7 @@ enum
     RT_SU_HDR = 0x0c,       //  Software update header
     RT_SU_DATA = 0x0d,      //  Software update chunk
     RT_SU_EXEC = 0x0e,      //  Software update execute
+    RT_SU_DELTA = 0x0f,     //  Software update header, delta image
     RT_SEQUENCE = 0x1f,     //  Storage manager sequence record
 
     RT_MASK = 0x1f,         //  Mask of the record type data
@@ -105,6 +106,7 @@ static u32      buffer[40];
 static unsigned bufferIndex = ARRAY_SIZE(buffer);
 static unsigned bufferLimit = 0;
 static unsigned bufferPointer;
+static u32 *    bufferAddress;      //  Flash address of the record start
 
 /**********************************************************************/
 
@@ -149,6 +151,69 @@ rd(unsigned bits)
 }
 
 
+/*
+ *  Read `cnt' bytes into `dst';  the same as `rd(8)' for each byte, but
+ *  with the current word kept in a register.  (A byte split over two words
+ *  has its low bits at the end of the first word.)
+ */
+static void
+rdBytes(u8 * dst, unsigned cnt)
+{
+    unsigned idx = bufferIndex;
+    unsigned ptr = bufferPointer;
+    unsigned lim = bufferLimit;
+    u32 w = buffer[idx];
+
+    while (cnt-- > 0)
+    {
+        if (ptr >= 8)
+        {
+            ptr -= 8;
+            *dst++ = w >> ptr;
+        }
+        else
+        {
+            u32 x = w & ((1 << ptr) - 1);
+            unsigned lo = ptr;
+
+            idx++;
+            if (idx >= lim)
+            {
+                idx = 0;
+                lim = 0;
+            }
+            w = buffer[idx];
+            ptr += 31 - 8;
+
+            *dst++ = x | (w >> ptr) << lo;
+        }
+    }
+
+    bufferIndex = idx;
+    bufferPointer = ptr;
+    bufferLimit = lim;
+}
+
+
+/*
+ *  Decode a software update chunk record.  The data bytes are only
+ *  decoded if `data' is set;  the record length is checked either way.
+ */
+#define CHUNK_WORDS     (1 + (20 + 13 + OQ_SU_CHUNK * 8 - RT_SHIFT + 30) / 31)
+
+static void
+decodeChunk(SuData_t * sd, bool data)
+{
+    sd->sequence = rd(20);     //  Sequence #
+    sd->address = rd(13) << OQ_SU_CHUNK_SHIFT;
+    if (data)
+        rdBytes(&sd->data[0], OQ_SU_CHUNK);
+    else if (bufferLimit < CHUNK_WORDS)
+        bufferLimit = 0;
+    sd->offset = bufferAddress - (u32 *)StoreStart;
+}
+
+
 static void
 importRecord(unsigned ops)
 {
@@ -180,19 +245,22 @@ importRecord(unsigned ops)
         break;
 
     case RT_SU_HDR:            //  Software update header
+    case RT_SU_DELTA:          //  Software update header, delta image
         sui.sequence = rd(20);                         //  Sequence #
         sui.version = rd(32);                          //  Version
         sui.start = rd(14) << OQ_SU_CHUNK_SHIFT;      //  Start address
         sui.end = rd(14) << OQ_SU_CHUNK_SHIFT;        //  End address
+        sui.delta = 0;
+        if (ty == RT_SU_DELTA)
+        {
+            sui.delta = rd(18);                        //  Stream length
+            sui.base = rd(32);                         //  Base version
+            sui.crc = rd(32);                          //  New image CRC
+        }
         break;
 
     case RT_SU_DATA:           //  Software update chunk
-        {
-            sud.sequence = rd(20);     //  Sequence #
-            sud.address = rd(13) << OQ_SU_CHUNK_SHIFT;
-            for (int i = 0; i < OQ_SU_CHUNK; i++)
-                sud.data[i] = rd(8);
-        }
+        decodeChunk(&sud, false);       //  (Fetched later if needed)
         break;
 
     case RT_SU_EXEC:           //  Software update execute
@@ -220,6 +288,7 @@ importRecord(unsigned ops)
         break;
 
     case RT_SU_HDR:            //  Software update header
+    case RT_SU_DELTA:          //  Software update header, delta image
         if (ops & OF_SW_UPDATE)
             StoreCallbackSoftwareUpdateInfo(&sui);
         break;
@@ -238,7 +307,7 @@ importRecord(unsigned ops)
 
 
 static void
-importWord(unsigned ops, u32 record)
+importWord(unsigned ops, u32 record, u32 * address)
 {
     if (record & 0x80000000)
     {
@@ -265,6 +334,7 @@ importWord(unsigned ops, u32 record)
          */
         buffer[0] = record;
         bufferIndex = 0;
+        bufferAddress = address;
         return;
     }
 
@@ -373,7 +443,7 @@ readFlash(unsigned ops)
             while (rp < erp)
             {
                 u32 rec = *rp++;
-                importWord(ops, rec);   //  Add to accumulated data
+                importWord(ops, rec, rp - 1);   //  Add to accumulated data
 
                 if (rec == 0xffffffff)
                     break;              //  End of records in page
@@ -386,7 +456,7 @@ readFlash(unsigned ops)
              */
             if (page == newp)
             {
-                importWord(ops, 0xffffffff);
+                importWord(ops, 0xffffffff, 0);
                 break;
             }
 
@@ -423,4 +493,42 @@ StoreRead(void)
     readFlash(OF_SW_UPDATE | OF_SW_CHUNK | OF_SW_EXEC);
 }
 
+
+/*
+ *  Read the software update chunk record at word `offset' in the storage
+ *  area (as found in `SuData_t.offset' by an earlier `StoreRead()').
+ *  Returns false if there is no intact chunk record there.
+ */
+bool
+StoreReadChunk(unsigned offset, SuData_t * sd)
+{
+    u32 * rp = (u32 *)StoreStart + offset;
+    u32 * ep = (u32 *)StoreEnd;
+    if (rp >= ep)
+        return false;
+
+    u32 rec = *rp;
+    if (rec == 0xffffffff ||
+        !(rec & 0x80000000) ||
+        ((rec >> RT_SHIFT) & RT_MASK) != RT_SU_DATA)
+            return false;
+
+    /*
+     *  Collect the record, and decode it.
+     */
+    unsigned n = 0;
+    buffer[0] = *rp++;
+    while (n < ARRAY_SIZE(buffer) - 1 && rp < ep && !(*rp & 0x80000000))
+        buffer[++n] = *rp++;
+
+    bufferAddress = (u32 *)StoreStart + offset;
+    bufferLimit = n + 1;
+    bufferIndex = 0;
+    bufferPointer = RT_SHIFT;
+
+    decodeChunk(sd, true);
+
+    return bufferLimit != 0;
+}
+
 /**********************************************************************/
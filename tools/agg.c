@@ -0,0 +1,1116 @@
+/*
+ *  Merge the packet logs of several tracers into one, in time order.
+ *
+ *      agg [-p] [-u] [-A] [-o out] [-d ms] [-n lines] [-s ms] [-b baud]
+ *          source ...
+ *      agg -T sources [-L lines] [-p] [-o out] [-d ms] [-n lines]
+ *
+ *  A source is "[name=]host:port" for a segger's RTT server (as used by
+ *  tools/tn;  each J-Link needs its own port), "[name=]:port" for one on
+ *  this host, or "[name=]/dev/..." for a serial port at -b baud.  All are
+ *  read at once through epoll (so this is Linux only).
+ *
+ *  Each tracer stamps its packets with its own microsecond clock, which
+ *  starts at reset and wraps every 67 seconds.  The clock is unwrapped,
+ *  and put on the host's clock by the smallest difference seen between
+ *  the two (the packet that arrived with the least delay);  with -u, the
+ *  tracers' clocks are taken as they are.  Lines that aren't packets
+ *  (command output, say) take the time of the source's last packet.
+ *
+ *  That's only good to a few milliseconds, and the tracers' crystals
+ *  drift apart by tens of microseconds a second, so the clocks are then
+ *  aligned on the packets heard by more than one tracer (the same
+ *  channel ID and payload, within -s milliseconds (default 20) of each
+ *  other).  The first source is the reference.  Each packet one source
+ *  shares with a source already on the reference clock is a sync point,
+ *  and a straight line (offset and drift) is fitted to the sync points
+ *  of each source by least squares as they come, with older points
+ *  slowly forgotten;  that's a constant amount of work per packet.  -A
+ *  turns this off.
+ *
+ *  The merge holds the lines from each source in a queue of at most -n
+ *  lines (default 4096), and writes the oldest of the queue heads once
+ *  no source can have anything older to come:  when every source has
+ *  sent something newer, or has been quiet for -d milliseconds (default
+ *  500).  A quiet source is taken to be no further behind than that.
+ *  A full queue forces the oldest line out;  anything older than
+ *  what's been written by the time it arrives is written anyway, and
+ *  counted as late.
+ *
+ *  The output is text, each line prefixed with its time on the host clock
+ *  and the source name, or with -p, pcapng with an interface per source
+ *  and a LINKTYPE_USER0 packet for each ANT packet:  the 13 bytes as sent
+ *  (the 4 address bytes, the flag byte and the 8 bytes of payload) then
+ *  the RSSI in dBm.
+ *
+ *  -T runs a benchmark instead:  that many synthetic sources, each with
+ *  -L lines (default 1000000), are fed through pipes as fast as they'll
+ *  go, merged (to /dev/null unless -o), and the throughput reported.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <signal.h>
+#include <errno.h>
+#include <err.h>
+
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef int s32;
+typedef unsigned int u32;
+typedef long long s64;
+typedef unsigned long long u64;
+
+#define MAX_SOURCES     64
+#define LINE_SIZE       240             //  Longest line kept
+#define READ_SIZE       65536
+#define DEVICE_WRAP     (1ull << 26)    //  Tracer clock wrap (2^32 / 64 MHz)
+#define NEVER           (~0ull)
+
+/**********************************************************************/
+
+typedef struct
+{
+    u64         time;                   //  On the merged clock, us
+    bool        packet;                 //  An ANT packet line
+    u16         len;
+    char        text[LINE_SIZE + 1];    //  ('\0' terminated)
+}
+    Line_t;
+
+/*
+ *  Clock fit:  the reference time of tracer time `x' is
+ *
+ *      x + base + a + d * (x - x0)
+ *
+ *  where `base' is the first sync point's offset.  The sums are weighted,
+ *  older points by FIT_FORGET to the power of their age in points.
+ */
+#define FIT_MIN         3               //  Sync points before it's used
+#define FIT_FORGET      (1.0 - 1.0 / 2000)
+#define FIT_SPREAD      1e6             //  Spread (us) to trust the drift
+#define FIT_NEAR        2000            //  Match window once fitted, us
+#define FIT_REJECT      200             //  Outliers beyond max(this, 5 rms)
+
+typedef struct
+{
+    unsigned    points;                 //  Sync points used
+    unsigned    rejected;               //  Outliers dropped
+    u64         x0;                     //  Tracer time of the first
+    double      base;                   //  Its offset
+    double      s0, sx, sxx, sy, sxy;   //  Weighted sums
+    double      a, d;                   //  The line
+    double      var;                    //  Mean squared residual
+    bool        drift;                  //  `d' is fitted
+}
+    Fit_t;
+
+typedef struct
+{
+    char *      name;
+    int         fd;
+    bool        open;
+
+    char        in[READ_SIZE + LINE_SIZE];
+    int         inLen;                  //  Partial line in `in'
+    u64         heard;                  //  Host time of the last packet
+
+    /*
+     *  Clock.
+     */
+    bool        synced;
+    u32         devLast;                //  Last tracer time (wrapped)
+    u64         dev;                    //  Tracer time, unwrapped
+    s64         offset;                 //  Host less tracer time
+    u64         last;                   //  Time of the last line
+    Fit_t       fit;                    //  To the reference clock
+
+    /*
+     *  Queue of lines waiting to be merged.
+     */
+    Line_t *    q;
+    unsigned    qHead;
+    unsigned    qCount;
+
+    unsigned    lines;
+    unsigned    late;
+}
+    Source_t;
+
+Source_t    Sources[MAX_SOURCES];
+int         NSources;
+int         NOpen;
+
+FILE *      Out;
+bool        Pcap;
+bool        OwnClocks;
+bool        Align = true;
+double      Tolerance = 20000;          //  Sync point match window, us
+u64         Window = 500000;            //  Quiet time before we move on
+unsigned    QueueSize = 4096;
+int         Baud = 115200;
+
+u64         Written;                    //  Time of the last line written
+u64         LinesOut;
+u64         Late;
+
+volatile int Stop;
+
+/**********************************************************************/
+
+static u64
+hostNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/**********************************************************************/
+/*
+ *  Output.
+ */
+
+static void
+put16(u8 * p, u32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+
+static void
+put32(u8 * p, u32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+
+static void
+pcapHeader(void)
+{
+    /*
+     *  Section header, then an interface description for each source,
+     *  named.  (The timestamp resolution defaults to microseconds.)
+     */
+    u8 shb[28];
+    put32(&shb[0], 0x0a0d0d0a);
+    put32(&shb[4], sizeof shb);
+    put32(&shb[8], 0x1a2b3c4d);
+    put16(&shb[12], 1);
+    put16(&shb[14], 0);
+    memset(&shb[16], 0xff, 8);          //  Section length unknown
+    put32(&shb[24], sizeof shb);
+    fwrite(shb, sizeof shb, 1, Out);
+
+    for (int i = 0; i < NSources; i++)
+    {
+        u8 idb[20 + 4 + 64 + 4];
+        int n = strlen(Sources[i].name);
+        if (n > 63)
+            n = 63;
+        int opt = (n + 3) & ~3;
+        int len = 20 + 4 + opt + 4;
+
+        memset(idb, 0, sizeof idb);
+        put32(&idb[0], 1);
+        put32(&idb[4], len);
+        put16(&idb[8], 147);            //  LINKTYPE_USER0
+        put32(&idb[12], 0);             //  No snap length
+        put16(&idb[16], 2);             //  if_name
+        put16(&idb[18], n);
+        memcpy(&idb[20], Sources[i].name, n);
+        put32(&idb[20 + opt], 0);       //  opt_endofopt
+        put32(&idb[len - 4], len);
+        fwrite(idb, len, 1, Out);
+    }
+}
+
+
+static int
+hex(const char ** pp, int digits)
+{
+    const char * p = *pp;
+    int v = 0;
+
+    for (int i = 0; i < digits; i++, p++)
+    {
+        if (*p >= '0' && *p <= '9')
+            v = v * 16 + *p - '0';
+        else if (*p >= 'a' && *p <= 'f')
+            v = v * 16 + *p - 'a' + 10;
+        else
+            return -1;
+    }
+
+    *pp = p;
+    return v;
+}
+
+
+/*
+ *  Pick the packet out of a line from app/tracer.c:
+ *
+ *      <time>(<elapsed>)  {<rssi>dB} tt.dd.nnnn  <esc>...[ff]<esc>...  \
+ *                                      b0 b1 b2 b3  b4 b5 b6 b7  ...
+ */
+static bool
+packetBytes(const char * p, u8 * pkt)
+{
+    if (!(p = strchr(p, '{')))
+        return false;
+    int rssi = strtol(p + 1, 0, 10);
+    if (!(p = strchr(p, '}')))
+        return false;
+    for (p++; *p == ' '; p++)
+        ;
+
+    int tt = hex(&p, 2);
+    int dd = (*p++ == '.') ? hex(&p, 2) : -1;
+    int nn = (*p++ == '.') ? hex(&p, 4) : -1;
+    if (tt < 0 || dd < 0 || nn < 0)
+        return false;
+    put32(&pkt[0], (u32)tt << 24 | dd << 16 | nn);
+
+    /*
+     *  The flag is "[ff]", maybe after a colour escape ("\033[35m").
+     */
+    int ff = -1;
+    while (ff < 0 && (p = strchr(p, '[')) != 0)
+    {
+        p++;
+        ff = hex(&p, 2);
+        if (*p != ']')
+            ff = -1;
+    }
+    if (ff < 0)
+        return false;
+    pkt[4] = ff;
+    p++;
+
+    for (int i = 0; i < 8; i++)
+    {
+        /*
+         *  Step over the spaces, and the colour escape after the flag.
+         */
+        for (;;)
+        {
+            if (*p == ' ')
+                p++;
+            else if (*p == '\033')
+            {
+                while (*p && *p != 'm')
+                    p++;
+                if (*p)
+                    p++;
+            }
+            else
+                break;
+        }
+        int b = hex(&p, 2);
+        if (b < 0)
+            return false;
+        pkt[5 + i] = b;
+    }
+
+    pkt[13] = rssi;
+    return true;
+}
+
+
+static void
+writeLine(Source_t * sp, Line_t * lp)
+{
+    if (lp->time < Written)
+    {
+        sp->late++;
+        Late++;
+    }
+    else
+        Written = lp->time;
+    LinesOut++;
+
+    if (!Pcap)
+    {
+        fprintf(Out, "%6llu.%06llu %-8s %.*s\n",
+                lp->time / 1000000, lp->time % 1000000,
+                sp->name, lp->len, lp->text);
+        return;
+    }
+
+    u8 epb[28 + 16 + 4];
+    if (!lp->packet || !packetBytes(lp->text, &epb[28]))
+        return;
+    put32(&epb[0], 6);
+    put32(&epb[4], sizeof epb);
+    put32(&epb[8], sp - Sources);
+    put32(&epb[12], lp->time >> 32);
+    put32(&epb[16], lp->time);
+    put32(&epb[20], 14);
+    put32(&epb[24], 14);
+    put16(&epb[28 + 14], 0);
+    put32(&epb[sizeof epb - 4], sizeof epb);
+    fwrite(epb, sizeof epb, 1, Out);
+}
+
+/**********************************************************************/
+/*
+ *  The merge.  A heap of the sources with lines queued, by the time of the
+ *  first line in each queue.
+ */
+
+int         Heap[MAX_SOURCES];
+int         HeapLen;
+
+
+static u64
+headTime(int s)
+{
+    Source_t * sp = &Sources[s];
+    return sp->q[sp->qHead].time;
+}
+
+
+static void
+heapDown(int i)
+{
+    for (;;)
+    {
+        int c = 2 * i + 1;
+        if (c >= HeapLen)
+            break;
+        if (c + 1 < HeapLen && headTime(Heap[c + 1]) < headTime(Heap[c]))
+            c++;
+        if (headTime(Heap[i]) <= headTime(Heap[c]))
+            break;
+        int t = Heap[i];
+        Heap[i] = Heap[c];
+        Heap[c] = t;
+        i = c;
+    }
+}
+
+
+static void
+heapUp(int i)
+{
+    while (i > 0)
+    {
+        int p = (i - 1) / 2;
+        if (headTime(Heap[p]) <= headTime(Heap[i]))
+            break;
+        int t = Heap[i];
+        Heap[i] = Heap[p];
+        Heap[p] = t;
+        i = p;
+    }
+}
+
+
+/*
+ *  Write the oldest queued line.
+ */
+static void
+pop(void)
+{
+    Source_t * sp = &Sources[Heap[0]];
+
+    writeLine(sp, &sp->q[sp->qHead]);
+    sp->qHead = (sp->qHead + 1) % QueueSize;
+
+    if (--sp->qCount == 0)
+        Heap[0] = Heap[--HeapLen];
+    heapDown(0);
+}
+
+
+/*
+ *  Write what can't be overtaken:  everything up to the time every open
+ *  source has reached (or would have, if it wasn't quiet).
+ */
+static void
+drain(u64 now, bool all)
+{
+    u64 mark = NEVER;
+
+    if (!all)
+        for (int i = 0; i < NSources; i++)
+        {
+            Source_t * sp = &Sources[i];
+            if (!sp->open)
+                continue;
+
+            u64 t = sp->synced ? sp->last : 0;
+            if (Window != NEVER && now - sp->heard >= Window)
+            {
+                /*
+                 *  Quiet.  On the host clock, what it sends next can't be
+                 *  much older than when it arrives.
+                 */
+                u64 q = OwnClocks ? NEVER : now - Window;
+                if (t < q)
+                    t = q;
+            }
+            if (t < mark)
+                mark = t;
+        }
+
+    while (HeapLen > 0 && headTime(Heap[0]) <= mark)
+        pop();
+}
+
+
+/**********************************************************************/
+/*
+ *  Clock alignment.  The recent packets are kept in a ring, and found by
+ *  a hash of their channel ID and payload.  Each entry links to the
+ *  previous one with the same hash, by sequence number;  a link to an
+ *  entry that has since been overwritten is seen as the end.
+ */
+#define RING_BITS       16
+#define RING_SIZE       (1 << RING_BITS)
+#define CHAIN_LIMIT     8               //  Most entries looked at
+
+typedef struct
+{
+    u32         seq;
+    u32         prev;                   //  Previous with the same hash
+    Source_t *  src;
+    u64         dev;
+    u8          key[12];
+}
+    Recent_t;
+
+Recent_t    Ring[RING_SIZE];
+u32         RingHead[RING_SIZE];
+u32         RingSeq = 1;
+bool        RefPinned;
+
+
+static u32
+hashKey(const u8 * key)
+{
+    u32 h = 2166136261u;
+    for (int i = 0; i < 12; i++)
+        h = (h ^ key[i]) * 16777619u;
+    return (h ^ h >> RING_BITS) & (RING_SIZE - 1);
+}
+
+
+/*
+ *  A source can give sync points to others once its own drift is known
+ *  (until then, its error grows with time).
+ */
+static bool
+fitted(Source_t * sp)
+{
+    return sp == &Sources[0] || sp->fit.drift;
+}
+
+
+/*
+ *  The reference clock stays put once the others are fitted to it.
+ */
+static bool
+pinned(Source_t * sp)
+{
+    return sp == &Sources[0] ? RefPinned : sp->fit.points >= FIT_MIN;
+}
+
+
+/*
+ *  The reference time of tracer time `dev' of a source.
+ */
+static double
+refTime(Source_t * sp, u64 dev)
+{
+    Fit_t * fp = &sp->fit;
+
+    if (sp == &Sources[0] || fp->points < FIT_MIN)
+        return (double)(dev + sp->offset);
+    return dev + fp->base + fp->a + fp->d * (double)(s64)(dev - fp->x0);
+}
+
+
+static void
+fitAdd(Source_t * sp, u64 x, double y)
+{
+    Fit_t * fp = &sp->fit;
+
+    RefPinned = true;
+    if (fp->points == 0)
+    {
+        fp->x0 = x;
+        fp->base = y - x;
+    }
+
+    double xx = (double)(s64)(x - fp->x0);
+    double yy = y - x - fp->base;
+
+    double r = yy - (fp->a + fp->d * xx);
+    if (fp->drift)
+    {
+        if (r * r > 25 * fp->var && fabs(r) > FIT_REJECT)
+        {
+            fp->rejected++;
+            return;
+        }
+    }
+    if (fp->drift)
+        fp->var += (r * r - fp->var) / 64;
+    else
+        fp->var = FIT_REJECT * FIT_REJECT / 25;
+
+    fp->s0 = FIT_FORGET * fp->s0 + 1;
+    fp->sx = FIT_FORGET * fp->sx + xx;
+    fp->sxx = FIT_FORGET * fp->sxx + xx * xx;
+    fp->sy = FIT_FORGET * fp->sy + yy;
+    fp->sxy = FIT_FORGET * fp->sxy + xx * yy;
+    fp->points++;
+
+    /*
+     *  Only fit the drift once the points are spread out enough for it
+     *  to mean something;  until then, just the offset.
+     */
+    double det = fp->s0 * fp->sxx - fp->sx * fp->sx;
+    fp->drift = (det > FIT_SPREAD * FIT_SPREAD * fp->s0 * fp->s0);
+    fp->d = fp->drift ? (fp->s0 * fp->sxy - fp->sx * fp->sy) / det : 0;
+    fp->a = (fp->sy - fp->d * fp->sx) / fp->s0;
+}
+
+
+/*
+ *  Look for the packet `pkt' (from packetBytes()) heard by another tracer
+ *  at about the same time, and make a sync point of it.  Then remember it.
+ */
+static void
+align(Source_t * sp, const u8 * pkt, u64 dev)
+{
+    u8 key[12];
+    memcpy(&key[0], &pkt[0], 4);        //  Channel ID
+    memcpy(&key[4], &pkt[5], 8);        //  Payload
+    u32 h = hashKey(key);
+
+    double t = refTime(sp, dev);
+    double tol = pinned(sp) && sp != &Sources[0] ? FIT_NEAR : Tolerance;
+    Recent_t * best = 0;
+    double bestDiff = tol;
+
+    u32 seq = RingHead[h];
+    for (int n = 0; n < CHAIN_LIMIT && seq != 0; n++)
+    {
+        Recent_t * rp = &Ring[seq & (RING_SIZE - 1)];
+        if (rp->seq != seq)
+            break;                      //  Overwritten
+        if (rp->src != sp && memcmp(rp->key, key, sizeof key) == 0)
+        {
+            double diff = fabs(refTime(rp->src, rp->dev) - t);
+            if (diff < bestDiff)
+            {
+                best = rp;
+                bestDiff = diff;
+            }
+        }
+        seq = rp->prev;
+    }
+
+    if (best)
+    {
+        Source_t * rs = best->src;
+        if (fitted(rs) && sp != &Sources[0])
+            fitAdd(sp, dev, refTime(rs, best->dev));
+        else if (fitted(sp) && rs != &Sources[0])
+            fitAdd(rs, best->dev, refTime(sp, dev));
+    }
+
+    Recent_t * rp = &Ring[RingSeq & (RING_SIZE - 1)];
+    rp->seq = RingSeq;
+    rp->prev = RingHead[h];
+    rp->src = sp;
+    rp->dev = dev;
+    memcpy(rp->key, key, sizeof key);
+    RingHead[h] = RingSeq++;
+    if (RingSeq == 0)
+        RingSeq = 1;                    //  (0 ends a chain)
+}
+
+/**********************************************************************/
+
+static void
+queue(Source_t * sp, const char * text, int len, u64 now)
+{
+    /*
+     *  A packet line starts with the tracer's time stamp (app/tracer.c
+     *  prTime()), then the time since the last one in ().
+     */
+    const char * p = text;
+    const char * e = text + len;
+    while (p < e && *p == ' ')
+        p++;
+
+    u32 dev = 0;
+    bool packet = (p < e && *p >= '0' && *p <= '9');
+    for (; p < e && ((*p >= '0' && *p <= '9') || *p == ','); p++)
+        if (*p != ',')
+            dev = dev * 10 + *p - '0';
+    if (p >= e || *p != '(')
+        packet = false;
+
+    /*
+     *  Make room, if the queue is full.
+     */
+    while (sp->qCount >= QueueSize)
+        pop();
+
+    unsigned i = (sp->qHead + sp->qCount) % QueueSize;
+    Line_t * lp = &sp->q[i];
+    lp->packet = packet;
+    lp->len = (len < LINE_SIZE) ? len : LINE_SIZE;
+    memcpy(lp->text, text, lp->len);
+    lp->text[lp->len] = '\0';
+    sp->lines++;
+
+    u64 t = sp->last;
+    if (packet)
+    {
+        if (!sp->synced)
+        {
+            sp->dev = dev;
+            sp->offset = OwnClocks ? 0 : (s64)(now - dev);
+            sp->synced = true;
+        }
+        else
+            sp->dev += (s32)((dev - sp->devLast) << 6) >> 6;   //  (26 bits)
+        sp->devLast = dev;
+
+        if (!OwnClocks && (s64)(now - sp->dev) < sp->offset && !pinned(sp))
+            sp->offset = now - sp->dev;
+
+        sp->heard = now;
+
+        u8 pkt[14];
+        if (Align && NSources > 1 && packetBytes(lp->text, pkt))
+            align(sp, pkt, sp->dev);
+
+        double rt = refTime(sp, sp->dev);
+        t = (rt > 0) ? (u64)rt : 0;
+        if (t < sp->last)
+            t = sp->last;               //  (The clock was pulled back)
+        sp->last = t;
+    }
+    lp->time = t;
+
+    if (sp->qCount++ == 0)
+    {
+        Heap[HeapLen++] = sp - Sources;
+        heapUp(HeapLen - 1);
+    }
+}
+
+
+static void
+readSource(int ep, Source_t * sp, u64 now)
+{
+    if (!sp->open)
+        return;
+
+    int x = read(sp->fd, &sp->in[sp->inLen], READ_SIZE);
+    if (x < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (x <= 0)
+    {
+        if (x < 0)
+            warn("%s", sp->name);
+        epoll_ctl(ep, EPOLL_CTL_DEL, sp->fd, 0);
+        close(sp->fd);
+        sp->open = false;
+        NOpen--;
+        return;
+    }
+
+    /*
+     *  Queue the complete lines, and keep the rest.
+     */
+    char * s = sp->in;
+    char * e = &sp->in[sp->inLen + x];
+    char * nl;
+    while ((nl = memchr(s, '\n', e - s)) != 0)
+    {
+        int len = nl - s;
+        if (len > 0 && s[len - 1] == '\r')
+            len--;
+        if (len > 0)
+            queue(sp, s, len, now);
+        s = nl + 1;
+    }
+
+    sp->inLen = e - s;
+    if (sp->inLen > LINE_SIZE)
+    {
+        queue(sp, s, sp->inLen, now);   //  Too long;  break it
+        sp->inLen = 0;
+    }
+    memmove(sp->in, s, sp->inLen);
+}
+
+/**********************************************************************/
+/*
+ *  Sources.
+ */
+
+static int
+openSocket(char * spec)
+{
+    char * c = strrchr(spec, ':');
+    *c = '\0';
+    const char * h = (c == spec) ? "localhost" : spec;
+    int port = strtol(c + 1, 0, 0);
+
+    struct hostent * host = gethostbyname(h);
+    if (!host || host->h_addrtype != AF_INET || host->h_length != 4)
+        errx(1, "can't resolve %s", h);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = *(u32 *)host->h_addr;
+    sa.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        err(1, "can't create a socket");
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0)
+        err(1, "can't connect to %s:%d", h, port);
+    *c = ':';
+    return fd;
+}
+
+
+static int
+openSerial(const char * dev)
+{
+    static const struct { int baud; speed_t speed; } speeds[] =
+    {
+        { 9600, B9600 },        { 19200, B19200 },      { 38400, B38400 },
+        { 57600, B57600 },      { 115200, B115200 },    { 230400, B230400 },
+        { 460800, B460800 },    { 921600, B921600 },    { 1000000, B1000000 },
+    };
+
+    int fd = open(dev, O_RDONLY | O_NOCTTY);
+    if (fd < 0)
+        err(1, "%s", dev);
+
+    struct termios ts;
+    if (tcgetattr(fd, &ts) < 0)
+        err(1, "%s", dev);
+    cfmakeraw(&ts);
+    ts.c_cflag |= CLOCAL | CREAD;
+
+    unsigned i;
+    for (i = 0; i < sizeof speeds / sizeof speeds[0]; i++)
+        if (speeds[i].baud == Baud)
+            break;
+    if (i == sizeof speeds / sizeof speeds[0])
+        errx(1, "unsupported baud rate %d", Baud);
+    cfsetispeed(&ts, speeds[i].speed);
+    cfsetospeed(&ts, speeds[i].speed);
+
+    if (tcsetattr(fd, TCSANOW, &ts) < 0)
+        err(1, "%s", dev);
+    return fd;
+}
+
+
+static void
+addSource(char * name, int fd)
+{
+    if (NSources >= MAX_SOURCES)
+        errx(1, "too many sources (%d at most)", MAX_SOURCES);
+
+    Source_t * sp = &Sources[NSources++];
+    sp->name = name;
+    sp->fd = fd;
+    sp->open = true;
+    sp->heard = hostNow();
+    sp->q = malloc(QueueSize * sizeof (Line_t));
+    if (!sp->q)
+        err(1, "no memory for the queues");
+    NOpen++;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+static void
+openSource(char * spec)
+{
+    char * name = spec;
+    char * eq = strchr(spec, '=');
+    if (eq)
+    {
+        *eq = '\0';
+        spec = eq + 1;
+    }
+
+    if (spec[0] == '/')
+        addSource(name, openSerial(spec));
+    else if (strchr(spec, ':'))
+        addSource(name, openSocket(spec));
+    else
+        errx(1, "%s: not host:port or a device", spec);
+}
+
+/**********************************************************************/
+/*
+ *  Benchmark.
+ */
+
+/*
+ *  Make `lines' packet lines the way app/tracer.c prints them, with the
+ *  tracer's clock starting at `t'.
+ */
+static char *
+synthetic(int lines, u32 t, unsigned seed, size_t * size)
+{
+    size_t room = (size_t)lines * 128;
+    char * buf = malloc(room);
+    if (!buf)
+        err(1, "no memory for the synthetic sources");
+
+    char * p = buf;
+    u32 last = t;
+    for (int i = 0; i < lines; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        t = (t + 200 + (seed >> 16) % 2000) & (DEVICE_WRAP - 1);
+        u32 el = (t - last) & (DEVICE_WRAP - 1);
+        last = t;
+
+        p += sprintf(p, "%4u,%03u,%03u(%8u,%03u)  {%3ddB} "
+                        "%02x.%02x.%04x     [%02x]\033[0m  "
+                        "%02x %02x %02x %02x  %02x %02x %02x %02x  \n",
+                     t / 1000000, (t / 1000) % 1000, t % 1000,
+                     el / 1000, el % 1000, -40 - (int)(seed % 50),
+                     1, 0x78, seed >> 16 & 0xffff, 4,
+                     i & 0xff, seed & 0xff, seed >> 8 & 0xff, 0,
+                     i >> 8 & 0xff, 1, 2, 3);
+    }
+
+    *size = p - buf;
+    return buf;
+}
+
+
+static void
+benchmark(int n, int lines)
+{
+    size_t total = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t size;
+        char * buf = synthetic(lines, 1000 + i * 37, i + 1, &size);
+        total += size;
+
+        int fds[2];
+        if (pipe(fds) < 0)
+            err(1, "pipe");
+
+        pid_t pid = fork();
+        if (pid < 0)
+            err(1, "fork");
+        if (pid == 0)
+        {
+            close(fds[0]);
+            for (size_t o = 0; o < size; )
+            {
+                ssize_t x = write(fds[1], buf + o, size - o);
+                if (x < 0)
+                    _exit(1);
+                o += x;
+            }
+            _exit(0);
+        }
+
+        close(fds[1]);
+        free(buf);
+
+        char * name = malloc(16);
+        snprintf(name, 16, "t%d", i);
+        addSource(name, fds[0]);
+    }
+
+    fprintf(stderr, "%d sources, %zu bytes\n", n, total);
+}
+
+static void
+Catch(int sig)
+{
+    Stop = true;
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern int optind;
+    extern char * optarg;
+    char * outFile = 0;
+    int bench = 0;
+    int benchLines = 1000000;
+    int c;
+
+    while ((c = getopt(argc, argv, "Ab:d:n:o:ps:uT:L:")) != -1)
+        switch (c)
+        {
+        case 'A':
+            Align = false;
+            break;
+        case 's':
+            Tolerance = strtod(optarg, 0) * 1000;
+            break;
+        case 'b':
+            Baud = strtol(optarg, 0, 0);
+            break;
+        case 'd':
+            Window = strtoull(optarg, 0, 0) * 1000;
+            break;
+        case 'n':
+            QueueSize = strtoul(optarg, 0, 0);
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        case 'p':
+            Pcap = true;
+            break;
+        case 'u':
+            OwnClocks = true;
+            break;
+        case 'T':
+            bench = strtol(optarg, 0, 0);
+            break;
+        case 'L':
+            benchLines = strtol(optarg, 0, 0);
+            break;
+        default:
+            exit(1);
+        }
+
+    if (QueueSize < 1)
+        errx(1, "the queues need room for a line");
+
+    if (bench > 0)
+    {
+        /*
+         *  The synthetic sources share a clock, and come as fast as the
+         *  pipes go, so the host's clock says nothing about them.
+         */
+        OwnClocks = true;
+        Window = NEVER;
+        if (!outFile)
+            outFile = "/dev/null";
+        benchmark(bench, benchLines);
+    }
+    else if (optind == argc)
+        errx(1, "usage: agg [-p] [-u] [-A] [-o out] [-d ms] [-n lines] "
+                "[-s ms] [-b baud] source ...");
+    for (; optind < argc; optind++)
+        openSource(argv[optind]);
+
+    Out = outFile ? fopen(outFile, "w") : stdout;
+    if (!Out)
+        err(1, "%s", outFile);
+    static char outBuf[1 << 20];
+    setvbuf(Out, outBuf, _IOFBF, sizeof outBuf);
+    if (Pcap)
+        pcapHeader();
+
+    int ep = epoll_create1(0);
+    if (ep < 0)
+        err(1, "epoll");
+    for (int i = 0; i < NSources; i++)
+    {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, Sources[i].fd, &ev) < 0)
+            err(1, "epoll");
+    }
+
+    /*
+     *  Move lines.  Flush the output whenever we catch up, so a person
+     *  watching sees it.
+     */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = Catch;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    u64 t0 = hostNow();
+    while (NOpen > 0 && !Stop)
+    {
+        struct epoll_event ev[MAX_SOURCES];
+        int n = epoll_wait(ep, ev, MAX_SOURCES,
+                           (Window == NEVER) ? -1 : (int)(Window / 2000) + 1);
+        if (n < 0 && errno != EINTR)
+            err(1, "epoll");
+
+        u64 now = hostNow();
+        for (int i = 0; i < n; i++)
+            readSource(ep, &Sources[ev[i].data.u32], now);
+        drain(now, false);
+        if (n <= 0)
+            fflush(Out);
+    }
+    drain(0, true);
+    fflush(Out);
+    u64 t1 = hostNow();
+
+    for (int i = 1; i < NSources; i++)
+    {
+        Fit_t * fp = &Sources[i].fit;
+        if (fp->points > 0)
+            fprintf(stderr, "%s: %+.1f us %+.2f ppm from %s, "
+                            "%u sync points (%u dropped), rms %.1f us\n",
+                    Sources[i].name,
+                    refTime(&Sources[i], Sources[i].dev) - Sources[i].dev,
+                    fp->d * 1e6,
+                    Sources[0].name, fp->points, fp->rejected,
+                    sqrt(fp->var));
+    }
+
+    for (int i = 0; i < NSources; i++)
+        if (Sources[i].late)
+            fprintf(stderr, "%s: %u of %u lines late\n", Sources[i].name,
+                    Sources[i].late, Sources[i].lines);
+
+    if (bench > 0)
+    {
+        while (wait(0) > 0)
+            ;
+        double s = (t1 - t0) * 1e-6;
+        fprintf(stderr, "%llu lines in %.3f s, %.0f lines/s, %llu late\n",
+                LinesOut, s, LinesOut / s, Late);
+    }
+
+    return 0;
+}
@@ -0,0 +1,669 @@
+/*
+ *  Decode the ANT+ sensor values in a capture, to CSV.
+ *
+ *      antdec [-r] [-m MHz] [-d devnum] [-t devtype] [-f secs] [-u secs]
+ *             [-o dir] capture
+ *      antdec -T
+ *
+ *  The capture is a capture store (see cap), or with -r, the tracer's
+ *  packet_t records (20 bytes, as in tracer/host/replay.c), with the time
+ *  in cycles of a -m MHz clock (default 64), as written by antgen or a
+ *  tracer's export.  Only the channels with the -d device number and -t
+ *  device type are decoded, from -f to -u seconds into the capture (or
+ *  for a store with a wall clock time, Unix seconds).
+ *
+ *  The decoders are the tracer's own (tracer/app/antplus.c), so the
+ *  values are those the tracer shows.  As there, only masters' messages
+ *  with a good CRC are decoded, not bursts or the slaves' replies.
+ *
+ *  The output is one row for each value:
+ *
+ *      time,channel,page,field,value
+ *
+ *  With -o, it's instead a file in the directory for each channel
+ *  ("tt.dd.nnnn.csv"), with one row for each message, and a column for
+ *  each field the channel's device type has (empty when the message's
+ *  page doesn't have it):
+ *
+ *      time,page,hr,beats,beat,...
+ *
+ *  -T checks the decoders against known payloads, one for each page.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <err.h>
+
+#include "capstore.h"
+#include "app/antplus.h"
+
+#define BATCH       65536               //  Records read at a time
+#define COLUMNS     24                  //  Most fields of a device type
+#define PAGES       16                  //  Most pages of a device type
+#define OUT_BUF     (64 * 1024)         //  Kept for a channel's file
+
+typedef struct
+{
+    u32         time;                   //  As in tracer/host/replay.c
+    u8          data[13];
+    u8          __res0;
+    s8          rssi;
+    u8          crcOk;
+}
+    packet_t;
+
+/*
+ *  The columns of a device type's file, and where each page's fields go.
+ */
+typedef struct
+{
+    unsigned            columns;
+    const char *        column[COLUMNS];
+    unsigned            pages;
+    const AntPage_t *   page[PAGES];
+    u8                  col[PAGES][ANTPLUS_FIELDS];
+}
+    Type_t;
+
+/*
+ *  A channel's file, written a buffer at a time (there can be more
+ *  channels than open files).
+ */
+typedef struct
+{
+    u32         id;
+    bool        used;
+    bool        started;
+    unsigned    len;
+    char *      buf;
+}
+    Chan_t;
+
+/**********************************************************************/
+
+Type_t *    Types[256];
+
+Chan_t *    Chans;
+unsigned    ChanSize;
+unsigned    ChanCount;
+
+char *      Dir;                        //  -o
+char        Out[OUT_BUF + 256];         //  Stdout
+unsigned    OutLen;
+
+s64         Epoch;                      //  Of a store, if set
+unsigned long long  Packets, Decoded, Values;
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*
+ *  The columns for a device type:  every field of every page, found by
+ *  decoding each page number.
+ */
+static Type_t *
+typeColumns(unsigned type)
+{
+    if (Types[type])
+        return Types[type];
+
+    Type_t * tp = calloc(1, sizeof *tp);
+    if (!tp)
+        err(1, "no memory");
+    Types[type] = tp;
+
+    for (unsigned n = 0; n < 256; n++)
+    {
+        u8 payload[8] = { n };
+        u32 v[ANTPLUS_FIELDS];
+        const AntPage_t * pp = AntDecode(type, payload, v);
+        if (!pp)
+            continue;
+
+        unsigned pi;
+        for (pi = 0; pi < tp->pages; pi++)
+            if (tp->page[pi] == pp)
+                break;
+        if (pi < tp->pages)
+            continue;
+        if (pi >= PAGES)
+            errx(1, "device type %02x has too many pages", type);
+        tp->page[tp->pages++] = pp;
+
+        for (unsigned f = 0; f < pp->fields; f++)
+        {
+            unsigned c;
+            for (c = 0; c < tp->columns; c++)
+                if (strcmp(tp->column[c], pp->field[f].name) == 0)
+                    break;
+            if (c == tp->columns)
+            {
+                if (c >= COLUMNS)
+                    errx(1, "device type %02x has too many fields", type);
+                tp->column[tp->columns++] = pp->field[f].name;
+            }
+            tp->col[pi][f] = c;
+        }
+    }
+
+    return tp;
+}
+
+/**********************************************************************/
+/*
+ *  Formatting, by hand:  printf() is most of the time otherwise.
+ */
+
+static char *
+putU(char * s, u64 v)
+{
+    char b[24];
+    char * p = &b[sizeof b];
+    do
+        *--p = '0' + v % 10;
+    while ((v /= 10) != 0);
+    unsigned n = &b[sizeof b] - p;
+    memcpy(s, p, n);
+    return s + n;
+}
+
+
+/*
+ *  `v' as a fraction of `d' digits, after the point.
+ */
+static char *
+putFraction(char * s, u32 v, unsigned d)
+{
+    *s++ = '.';
+    for (unsigned i = d; i-- > 0; )
+    {
+        s[i] = '0' + v % 10;
+        v /= 10;
+    }
+    return s + d;
+}
+
+
+/*
+ *  A fixed point value, with `d' decimal places.
+ */
+static char *
+putFixed(char * s, u32 v, unsigned d)
+{
+    static const u32 scale[] = { 1, 10, 100, 1000 };
+    s = putU(s, v / scale[d]);
+    return d ? putFraction(s, v % scale[d], d) : s;
+}
+
+
+static char *
+putTime(char * s, u64 us)
+{
+    if (Epoch != 0)
+        us += Epoch;
+    s = putU(s, us / 1000000);
+    return putFraction(s, us % 1000000, 6);
+}
+
+
+static char *
+putHex(char * s, unsigned v, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits; i-- > 0; )
+    {
+        s[i] = hex[v & 15];
+        v >>= 4;
+    }
+    return s + digits;
+}
+
+
+static char *
+putChannel(char * s, u32 id)
+{
+    s = putHex(s, CAP_TXTYPE(id), 2);
+    *s++ = '.';
+    s = putHex(s, CAP_DEVTYPE(id), 2);
+    *s++ = '.';
+    return putHex(s, CAP_DEVNUM(id), 4);
+}
+
+
+static void
+flushOut(void)
+{
+    if (fwrite(Out, 1, OutLen, stdout) != OutLen)
+        err(1, "can't write");
+    OutLen = 0;
+}
+
+/**********************************************************************/
+/*
+ *  Channel files.
+ */
+
+static void
+chanFlush(Chan_t * cp)
+{
+    char path[1024];
+    char * s = path + snprintf(path, sizeof path - 16, "%s/", Dir);
+    s = putChannel(s, cp->id);
+    strcpy(s, ".csv");
+
+    FILE * fp = fopen(path, cp->started ? "a" : "w");
+    if (!fp)
+        err(1, "%s", path);
+    if (!cp->started)
+    {
+        Type_t * tp = typeColumns(CAP_DEVTYPE(cp->id));
+        fputs("time,page", fp);
+        for (unsigned c = 0; c < tp->columns; c++)
+            fprintf(fp, ",%s", tp->column[c]);
+        fputc('\n', fp);
+        cp->started = true;
+    }
+    if (fwrite(cp->buf, 1, cp->len, fp) != cp->len || fclose(fp) != 0)
+        err(1, "can't write %s", path);
+    cp->len = 0;
+}
+
+
+static Chan_t *
+chanFind(u32 id)
+{
+    if (2 * (ChanCount + 1) > ChanSize)
+    {
+        Chan_t * old = Chans;
+        unsigned oldSize = ChanSize;
+        ChanSize = ChanSize ? 2 * ChanSize : 1024;
+        if (!(Chans = calloc(ChanSize, sizeof *Chans)))
+            err(1, "no memory");
+        for (unsigned i = 0; i < oldSize; i++)
+            if (old[i].used)
+            {
+                unsigned h = (old[i].id * 0x9e3779b1u) & (ChanSize - 1);
+                while (Chans[h].used)
+                    h = (h + 1) & (ChanSize - 1);
+                Chans[h] = old[i];
+            }
+        free(old);
+    }
+
+    unsigned h = (id * 0x9e3779b1u) & (ChanSize - 1);
+    while (Chans[h].used && Chans[h].id != id)
+        h = (h + 1) & (ChanSize - 1);
+
+    Chan_t * cp = &Chans[h];
+    if (!cp->used)
+    {
+        cp->used = true;
+        cp->id = id;
+        if (!(cp->buf = malloc(OUT_BUF + 256)))
+            err(1, "no memory");
+        ChanCount++;
+    }
+    return cp;
+}
+
+/**********************************************************************/
+
+static void
+decode(u64 time, u32 id, u8 flag, bool crcOk, const u8 * payload)
+{
+    Packets++;
+    if (!crcOk || (flag & 0x80) || flag == 0x02)
+        return;
+
+    u32 v[ANTPLUS_FIELDS];
+    unsigned type = CAP_DEVTYPE(id);
+    const AntPage_t * pp = AntDecode(type, payload, v);
+    if (!pp)
+        return;
+    Decoded++;
+    Values += pp->fields;
+
+    if (!Dir)
+    {
+        for (unsigned f = 0; f < pp->fields; f++)
+        {
+            char * s = &Out[OutLen];
+            s = putTime(s, time);
+            *s++ = ',';
+            s = putChannel(s, id);
+            *s++ = ',';
+            s = putU(s, payload[0]);
+            *s++ = ',';
+            const char * n = pp->field[f].name;
+            while (*n)
+                *s++ = *n++;
+            *s++ = ',';
+            s = putFixed(s, v[f], pp->field[f].decimals);
+            *s++ = '\n';
+            OutLen = s - Out;
+            if (OutLen >= OUT_BUF)
+                flushOut();
+        }
+        return;
+    }
+
+    /*
+     *  A row of the channel's file.
+     */
+    Type_t * tp = typeColumns(type);
+    unsigned pi;
+    for (pi = 0; pi < tp->pages; pi++)
+        if (tp->page[pi] == pp)
+            break;
+    if (pi == tp->pages)
+        return;                         //  (Not seen when finding columns)
+
+    s8 at[COLUMNS];
+    memset(at, -1, sizeof at);
+    for (unsigned f = 0; f < pp->fields; f++)
+        at[tp->col[pi][f]] = f;
+
+    Chan_t * cp = chanFind(id);
+    char * s = &cp->buf[cp->len];
+    s = putTime(s, time);
+    *s++ = ',';
+    s = putU(s, payload[0]);
+    for (unsigned c = 0; c < tp->columns; c++)
+    {
+        *s++ = ',';
+        if (at[c] >= 0)
+            s = putFixed(s, v[at[c]], pp->field[at[c]].decimals);
+    }
+    *s++ = '\n';
+    cp->len = s - cp->buf;
+    if (cp->len >= OUT_BUF)
+        chanFlush(cp);
+}
+
+/**********************************************************************/
+/*
+ *  Reading.
+ */
+
+static CapQuery_t   Query = { 0, ~0ull, 0, 0 };
+
+
+static bool
+decodePacket(const CapPacket_t * pkt, void * arg)
+{
+    decode(pkt->time, pkt->id, pkt->flag, !(pkt->status & CAP_CRC_BAD),
+           pkt->payload);
+    return true;
+}
+
+
+static void
+readStore(const char * path)
+{
+    CapStore_t * cs = CapOpen(path, false);
+    Epoch = CapEpoch(cs);
+    if (Epoch != 0)
+    {
+        Query.from = (Query.from > (u64)Epoch) ? Query.from - Epoch : 0;
+        if (Query.until != ~0ull)
+            Query.until = (Query.until > (u64)Epoch)
+                          ? Query.until - Epoch : 0;
+    }
+    CapQuery(cs, &Query, decodePacket, 0, 0);
+    CapClose(cs);
+}
+
+
+static void
+readRaw(const char * path, double mhz)
+{
+    FILE * fp = fopen(path, "r");
+    if (!fp)
+        err(1, "%s", path);
+
+    static packet_t pkts[BATCH];
+    u64 cycles = 0;
+    u32 last = 0;
+    bool first = true;
+    size_t n;
+
+    while ((n = fread(pkts, sizeof pkts[0], BATCH, fp)) > 0)
+        for (size_t i = 0; i < n; i++)
+        {
+            packet_t * pp = &pkts[i];
+            if (!first)
+                cycles += (u32)(pp->time - last);
+            first = false;
+            last = pp->time;
+
+            u64 us = cycles / mhz;
+            u32 id = pp->data[0] | pp->data[1] << 8 | pp->data[2] << 16 |
+                     (u32)pp->data[3] << 24;
+            if ((id & Query.mask) != Query.id ||
+                us < Query.from || us >= Query.until)
+                    continue;
+            decode(us, id, pp->data[4], pp->crcOk, &pp->data[5]);
+        }
+
+    if (ferror(fp))
+        err(1, "%s", path);
+    fclose(fp);
+}
+
+/**********************************************************************/
+/*
+ *  Known payloads, and what they decode to.
+ */
+
+typedef struct
+{
+    u8          type;
+    u8          payload[8];
+    const char * page;                  //  0 if not decoded
+    u32         v[ANTPLUS_FIELDS];
+}
+    Vector_t;
+
+static const Vector_t Vectors[] =
+{
+    //  Heart rate:  each page, with the page toggle bit both ways
+    { 0x78, { 0x00, 0xff, 0xff, 0xff, 0x00, 0x04, 0x01, 0x3c }, "hrm",
+      { 60, 1, 1000 } },
+    { 0x78, { 0x81, 0x10, 0x00, 0x00, 0x00, 0x04, 0x05, 0x50 }, "hrm",
+      { 80, 5, 1000, 32 } },
+    { 0x78, { 0x02, 0x01, 0x34, 0x12, 0x00, 0x08, 0x06, 0x51 }, "hrm",
+      { 81, 6, 2000, 1, 0x1234 } },
+    { 0x78, { 0x83, 0x05, 0x02, 0x07, 0x00, 0x0c, 0x07, 0x52 }, "hrm",
+      { 82, 7, 3000, 5, 2, 7 } },
+    { 0x78, { 0x04, 0xff, 0x00, 0x02, 0x00, 0x0c, 0x2a, 0x48 }, "hrm",
+      { 72, 42, 3000, 500 } },
+    { 0x78, { 0x7f, 0xff, 0xff, 0xff, 0x00, 0x02, 0x03, 0x40 }, "hrm",
+      { 64, 3, 500 } },
+
+    //  Bike speed and cadence
+    { 0x7b, { 0x00, 0xff, 0xff, 0xff, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16 } },
+    { 0x7b, { 0x81, 0x00, 0x01, 0x00, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16, 512 } },
+    { 0x7b, { 0x02, 0x0f, 0x01, 0x00, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16, 15, 1 } },
+    { 0x7b, { 0x83, 0x01, 0x02, 0x03, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16, 1, 2, 3 } },
+    { 0x7b, { 0x84, 0xff, 0x80, 0x23, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16, 350, 2 } },
+    { 0x7b, { 0x05, 0x01, 0xff, 0xff, 0x00, 0x04, 0x10, 0x00 }, "speed",
+      { 1000, 16, 1 } },
+    { 0x7a, { 0x00, 0xff, 0xff, 0xff, 0x00, 0x08, 0x20, 0x01 }, "cadence",
+      { 2000, 0x120 } },
+    { 0x79, { 0x00, 0x02, 0x05, 0x00, 0x00, 0x04, 0x10, 0x00 }, "bsc",
+      { 500, 5, 1000, 16 } },
+
+    //  Stride speed and distance
+    { 0x7c, { 0x01, 0x64, 0x05, 0x0a, 0x82, 0x80, 0x20, 0x10 }, "sdm",
+      { 550, 1050, 2500, 32, 500 } },
+    { 0x7c, { 0x02, 0xff, 0xff, 0x5a, 0x82, 0x80, 0xff, 0x11 }, "sdm",
+      { 9050, 2500, 0x11 } },
+    { 0x7c, { 0x03, 0xff, 0xff, 0x5a, 0x82, 0x80, 0x2c, 0xff }, "sdm",
+      { 9050, 2500, 44 } },
+    { 0x7c, { 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 0 },
+
+    //  Bike power
+    { 0x0b, { 0x10, 0x05, 0xff, 0x5a, 0x10, 0x27, 0xc8, 0x00 }, "power",
+      { 5, 255, 90, 10000, 200 } },
+    { 0x0b, { 0x11, 0x06, 0x04, 0x50, 0x00, 0x04, 0x20, 0x00 }, "wheel",
+      { 6, 4, 80, 500, 100 } },
+    { 0x0b, { 0x12, 0x05, 0x03, 0x5a, 0x00, 0x08, 0x40, 0x00 }, "crank",
+      { 5, 3, 90, 1000, 200 } },
+    { 0x0b, { 0x01, 0xac, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, 0 },
+
+    //  Common pages
+    { 0x0b, { 0x50, 0xff, 0xff, 0x02, 0x0f, 0x00, 0x01, 0x00 }, "manufacturer",
+      { 2, 15, 1 } },
+    { 0x7c, { 0x51, 0xff, 0x03, 0x04, 0x78, 0x56, 0x34, 0x12 }, "product",
+      { 4, 3, 0x12345678 } },
+    { 0x0b, { 0x52, 0xff, 0xff, 0xff, 0xff, 0xff, 0x40, 0x32 }, "battery",
+      { 225, 3 } },
+
+    //  Not ANT+
+    { 0x11, { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 }, 0 },
+};
+
+
+static int
+check(void)
+{
+    unsigned bad = 0;
+
+    for (unsigned i = 0; i < sizeof Vectors / sizeof Vectors[0]; i++)
+    {
+        const Vector_t * vp = &Vectors[i];
+        u32 v[ANTPLUS_FIELDS];
+        const AntPage_t * pp = AntDecode(vp->type, vp->payload, v);
+
+        bool ok;
+        if (!vp->page || !pp)
+            ok = (!vp->page && !pp);
+        else
+        {
+            ok = (strcmp(pp->name, vp->page) == 0);
+            for (unsigned f = 0; f < pp->fields; f++)
+                if (v[f] != vp->v[f])
+                    ok = false;
+            for (unsigned f = pp->fields; f < ANTPLUS_FIELDS; f++)
+                if (vp->v[f] != 0)
+                    ok = false;
+        }
+
+        if (!ok)
+        {
+            bad++;
+            printf("device type %02x, page %02x:  expected %s", vp->type,
+                   vp->payload[0], vp->page ? vp->page : "nothing");
+            for (unsigned f = 0; vp->page && f < ANTPLUS_FIELDS; f++)
+                printf(" %u", vp->v[f]);
+            printf(", got %s", pp ? pp->name : "nothing");
+            for (unsigned f = 0; pp && f < pp->fields; f++)
+                printf(" %u", v[f]);
+            printf("\n");
+        }
+    }
+
+    printf("%u of %u decoded as expected\n",
+           (unsigned)(sizeof Vectors / sizeof Vectors[0]) - bad,
+           (unsigned)(sizeof Vectors / sizeof Vectors[0]));
+    return bad ? 1 : 0;
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern int optind;
+    extern char * optarg;
+    bool raw = false;
+    double mhz = 64;
+    int c;
+
+    while ((c = getopt(argc, argv, "rm:d:t:f:u:o:T")) != -1)
+        switch (c)
+        {
+        case 'r':
+            raw = true;
+            break;
+        case 'm':
+            mhz = strtod(optarg, 0);
+            break;
+        case 'd':
+            Query.id |= strtoul(optarg, 0, 0) & 0xffff;
+            Query.mask |= 0xffff;
+            break;
+        case 't':
+            Query.id |= (strtoul(optarg, 0, 0) & 0xff) << 16;
+            Query.mask |= 0xff << 16;
+            break;
+        case 'f':
+            Query.from = strtod(optarg, 0) * 1e6;
+            break;
+        case 'u':
+            Query.until = strtod(optarg, 0) * 1e6;
+            break;
+        case 'o':
+            Dir = optarg;
+            break;
+        case 'T':
+            return check();
+        default:
+            exit(1);
+        }
+    if (optind + 1 != argc || mhz <= 0)
+        errx(1, "usage: antdec [-r] [-m MHz] [-d devnum] [-t devtype] "
+                "[-f secs] [-u secs] [-o dir] capture");
+
+    if (Dir && mkdir(Dir, 0777) < 0)
+    {
+        struct stat st;
+        if (stat(Dir, &st) < 0 || !S_ISDIR(st.st_mode))
+            err(1, "%s", Dir);
+    }
+    if (!Dir)
+        fputs("time,channel,page,field,value\n", stdout);
+
+    double start = now();
+    if (raw)
+        readRaw(argv[optind], mhz);
+    else
+        readStore(argv[optind]);
+
+    if (Dir)
+    {
+        for (unsigned i = 0; i < ChanSize; i++)
+            if (Chans[i].used && Chans[i].len > 0)
+                chanFlush(&Chans[i]);
+    }
+    else
+        flushOut();
+
+    double took = now() - start;
+    fprintf(stderr, "%llu packets, %llu decoded, %llu values", Packets,
+            Decoded, Values);
+    if (Dir)
+        fprintf(stderr, ", %u channels", ChanCount);
+    fprintf(stderr, ";  %.2f s, %.0f packets/s\n", took,
+            took > 0 ? Packets / took : 0.0);
+    return 0;
+}
@@ -0,0 +1,673 @@
+/*
+ *  Make up ANT traffic, as a tracer would hear it, for load testing.
+ *
+ *      antgen [-C channels] [-d secs | -n packets] [-p period] [-j us]
+ *             [-D ppm] [-B prob] [-A prob] [-e prob] [-s seed]
+ *             [-o file | -t | -l port [-x speed]]
+ *
+ *  There are -C channels (default 1000), each a master sending a message
+ *  every period (in 1/32768 s;  by default each channel gets one of the
+ *  usual device profile periods, 4 to 8 Hz), from a random phase, with
+ *  its crystal off by up to -D ppm (default 50), and each message up to
+ *  -j microseconds early or late (default 20).  A message may instead
+ *  start a burst (with probability -B, default 0.002):  2 to 40 burst
+ *  packets, each answered by the slave, with the flag's burst, response,
+ *  sequence, first and last bits as the radio shows them (see the flag
+ *  bits in tracer/app/tracer.c).  Or it may be acknowledged (-A, default
+ *  0.02):  the slave answers just after it.
+ *
+ *  The tracer's radio hears one packet at a time.  A packet that starts
+ *  while another is on the air is lost, and the other corrupted, unless
+ *  it's 6 dB the stronger;  so is one that starts while a lost one is
+ *  still on the air.  As well as those collisions, each packet fails its
+ *  CRC with probability -e (default 0.005), more so when it's weak.
+ *
+ *  The traffic runs for -d seconds (default 60), or -n packets.  With
+ *  -o, it's written as the tracer's packet_t records (as tracer/host/
+ *  replay and cap take them), the bad CRCs included.  With -t, it's
+ *  written as the tracer would print it.  With -l, it's sent as the
+ *  tracer would print it to each client that connects to the port (as
+ *  agg or tn would), at -x times real time (default 1).  It ends with
+ *  the counts of each kind of packet.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <err.h>
+
+
+typedef unsigned char u8;
+typedef signed char s8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef long long s64;
+typedef unsigned long long u64;
+
+#define HZ              64000000        //  The tracer's clock
+#define AIR             (HZ / 1000000 * 150)    //  A packet on the air
+#define TURN            (HZ / 1000000 * 300)    //  Slave's answer, after
+#define BURST_GAP       (HZ / 1000 * 2)         //  Between burst packets
+#define CAPTURE         6               //  dB to survive a collision
+
+/*
+ *  Flag bits (see app/tracer.c).
+ */
+#define F_BURST         0x80
+#define F_RESPONSE      0x40
+#define F_LAST          0x20
+#define F_SEQ           0x10
+#define F_FIRST         0x08
+#define F_ONE           0x02
+
+typedef struct
+{
+    u32         time;                   //  As in tracer/host/replay.c
+    u8          data[13];
+    u8          __res0;
+    s8          rssi;
+    u8          crcOk;
+}
+    packet_t;
+
+typedef struct
+{
+    u32         id;
+    u64         period;                 //  Cycles, with the crystal's error
+    u64         next;                   //  Time of the next message, less jitter
+    s8          rssi;                   //  Master's, at the tracer
+    s8          slaveRssi;
+    u8          count;
+    u16         value;
+}
+    Channel_t;
+
+enum { EV_MESSAGE, EV_BURST, EV_REPLY };
+
+typedef struct
+{
+    u64         time;
+    u32         chan;
+    u8          kind;
+    u8          flag;                   //  For EV_REPLY, EV_BURST
+    u8          left;                   //  Burst packets to come
+}
+    Event_t;
+
+typedef struct
+{
+    u64         start;
+    u32         chan;
+    u8          flag;
+    s8          rssi;
+    bool        crcOk;
+    u8          payload[8];
+}
+    Tx_t;
+
+/**********************************************************************/
+
+Channel_t * Chan;
+unsigned    Channels = 1000;
+
+Event_t *   Heap;
+unsigned    HeapLen, HeapSize;
+
+double      BurstProb = 0.002;
+double      AckProb = 0.02;
+double      CrcProb = 0.005;
+
+unsigned long long  Count[4];           //  By kind of packet, below
+unsigned long long  Lost, Collided, CrcBad, Written;
+
+enum { K_BROADCAST, K_ACK, K_BURST, K_REPLY };
+
+/*
+ *  Output.
+ */
+FILE *      Out;
+bool        Text;
+int         Listen = -1;
+double      Speed = 1;
+
+/**********************************************************************/
+
+static double
+uniform(void)
+{
+    return random() / 2147483648.0;
+}
+
+
+static void
+heapPush(Event_t * ep)
+{
+    if (HeapLen == HeapSize)
+    {
+        HeapSize = HeapSize ? 2 * HeapSize : 1024;
+        if (!(Heap = realloc(Heap, HeapSize * sizeof *Heap)))
+            err(1, "no memory");
+    }
+
+    unsigned i = HeapLen++;
+    while (i > 0)
+    {
+        unsigned p = (i - 1) / 2;
+        if (Heap[p].time <= ep->time)
+            break;
+        Heap[i] = Heap[p];
+        i = p;
+    }
+    Heap[i] = *ep;
+}
+
+
+static void
+heapPop(Event_t * ep)
+{
+    *ep = Heap[0];
+    Event_t last = Heap[--HeapLen];
+    unsigned i = 0;
+    for (;;)
+    {
+        unsigned c = 2 * i + 1;
+        if (c >= HeapLen)
+            break;
+        if (c + 1 < HeapLen && Heap[c + 1].time < Heap[c].time)
+            c++;
+        if (last.time <= Heap[c].time)
+            break;
+        Heap[i] = Heap[c];
+        i = c;
+    }
+    Heap[i] = last;
+}
+
+/**********************************************************************/
+/*
+ *  Writing.
+ */
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*
+ *  As prTime() in the tracer.
+ */
+static int
+prTime(char * s, unsigned t)
+{
+    if (t < 10000)
+        return sprintf(s, "%12d", t);
+    else if (t < 1000000)
+        return sprintf(s, "%8d,%03d", t / 1000, t % 1000);
+    else
+        return sprintf(s, "%4d,%03d,%03d", t / 1000000, (t / 1000) % 1000,
+                       t % 1000);
+}
+
+
+static void
+writeText(const Tx_t * tp, u32 addr, u32 t)
+{
+    static unsigned lastTime;
+    unsigned us = t / (HZ / 1000000);
+    char line[160];
+    char * s = line;
+
+    s += prTime(s, us);
+    *s++ = '(';
+    s += prTime(s, us - lastTime);
+    lastTime = us;
+
+    const char * c0 = "";
+    const char * c2 = "   ";
+    if (tp->flag & F_BURST)
+    {
+        c0 = "\033[35m";
+        c2 = (tp->flag & F_RESPONSE) ? "<==" : "==>";
+    }
+    else if (tp->flag == 0x0a)
+        c2 = "-->";
+    else if (tp->flag == 0x02)
+        c2 = "<--";
+
+    const u8 * p = tp->payload;
+    s += sprintf(s, ")  {%3ddB} %02x.%02x.%04x  %s%s[%02x]\033[0m  "
+                 "%02x %02x %02x %02x  %02x %02x %02x %02x  \r\n",
+                 tp->rssi, addr >> 24, (addr >> 16) & 0xff, addr & 0xffff,
+                 c0, c2, tp->flag,
+                 p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+
+    if (Listen < 0)
+    {
+        fputs(line, Out);
+        return;
+    }
+
+    /*
+     *  Playing to a client:  wait for the packet's time.
+     */
+    static double start;
+    static u64 first;
+    static u64 full;
+    static u32 last;
+    full += (u32)(t - last);
+    last = t;
+    if (start == 0)
+    {
+        start = now();
+        first = full;
+    }
+    double due = start + (full - first) / (HZ * Speed);
+    double wait = due - now();
+    if (wait > 0)
+        usleep(wait * 1e6);
+
+    if (fputs(line, Out) == EOF)
+        errx(1, "the client went away");
+}
+
+
+static void
+emit(const Tx_t * tp)
+{
+    Channel_t * cp = &Chan[tp->chan];
+    u64 end = tp->start + AIR;          //  (Time stamped at the END event)
+
+    if (!tp->crcOk)
+        CrcBad++;
+
+    if (Text)
+    {
+        if (tp->crcOk)                  //  (The tracer only shows good ones)
+            writeText(tp, cp->id, end);
+        Written += tp->crcOk;
+        return;
+    }
+
+    packet_t pkt;
+    memset(&pkt, 0, sizeof pkt);
+    pkt.time = end;
+    pkt.data[0] = cp->id;
+    pkt.data[1] = cp->id >> 8;
+    pkt.data[2] = cp->id >> 16;
+    pkt.data[3] = cp->id >> 24;
+    pkt.data[4] = tp->flag;
+    memcpy(&pkt.data[5], tp->payload, 8);
+    pkt.rssi = tp->rssi;
+    pkt.crcOk = tp->crcOk;
+    if (fwrite(&pkt, sizeof pkt, 1, Out) != 1)
+        err(1, "can't write");
+    Written++;
+}
+
+
+/*
+ *  What the tracer's radio makes of the packets on the air.  A packet is
+ *  held until it's known whether another starts on top of it.
+ */
+static void
+air(const Tx_t * tp)
+{
+    static Tx_t held;
+    static bool holding;
+    static u64 busyUntil;               //  Of a packet not received
+    static s8 busyRssi;
+
+    if (!tp)
+    {
+        if (holding)
+            emit(&held);
+        holding = false;
+        return;
+    }
+
+    Tx_t t = *tp;
+    if (holding && t.start < held.start + AIR)
+    {
+        /*
+         *  Collision:  the radio is busy with `held'.
+         */
+        if (held.rssi < t.rssi + CAPTURE && held.crcOk)
+        {
+            held.crcOk = false;
+            Collided++;
+        }
+        Lost++;
+        if (t.start + AIR > busyUntil)
+        {
+            busyUntil = t.start + AIR;
+            busyRssi = t.rssi;
+        }
+        return;
+    }
+
+    if (holding)
+        emit(&held);
+
+    if (t.start < busyUntil && t.rssi < busyRssi + CAPTURE && t.crcOk)
+    {
+        t.crcOk = false;
+        Collided++;
+    }
+    held = t;
+    holding = true;
+}
+
+
+/*
+ *  A packet from channel `c'.
+ */
+static void
+transmit(u64 start, unsigned c, u8 flag, bool slave, int kind)
+{
+    Channel_t * cp = &Chan[c];
+    Tx_t t;
+    t.start = start;
+    t.chan = c;
+    t.flag = flag;
+    t.rssi = slave ? cp->slaveRssi : cp->rssi;
+    t.rssi += random() % 5 - 2;
+
+    /*
+     *  Weak packets fail more often.
+     */
+    double p = CrcProb;
+    if (t.rssi < -85)
+        p += (-85 - t.rssi) * 0.02;
+    t.crcOk = uniform() >= p;
+
+    /*
+     *  A data page, much like a sensor's:  the page number turns over
+     *  every few messages, then an event count and a slowly changing
+     *  value.  The slave's answers and bursts are just counted.
+     */
+    if (!slave)
+    {
+        cp->count++;
+        if (random() % 8 == 0)
+            cp->value += random() % 16 - 8;
+    }
+    u8 * pl = t.payload;
+    pl[0] = slave ? 0x50 : ((cp->count >> 2) & 1) ? 0x84 : 0x04;
+    pl[1] = 0xff;
+    pl[2] = (flag & F_BURST) ? Count[K_BURST] : 0xff;
+    pl[3] = 0xff;
+    pl[4] = cp->value;
+    pl[5] = cp->value >> 8;
+    pl[6] = cp->count;
+    pl[7] = cp->value / 4;
+
+    Count[kind]++;
+    air(&t);
+}
+
+/**********************************************************************/
+
+/*
+ *  The usual device profile periods (in 1/32768 s).
+ */
+static const unsigned Periods[] = { 8070, 8086, 8182, 8192, 4096, 8118 };
+
+
+static void
+setup(unsigned period, double ppm)
+{
+    Chan = calloc(Channels, sizeof *Chan);
+    u8 * used = calloc(65536, 1);
+    if (!Chan || !used)
+        err(1, "no memory");
+    if (Channels > 65536)
+        errx(1, "too many channels");
+
+    static const u8 types[] = { 0x78, 0x79, 0x7a, 0x7b, 0x0b, 0x11, 0x19 };
+    for (unsigned c = 0; c < Channels; c++)
+    {
+        Channel_t * cp = &Chan[c];
+        unsigned n;
+        do
+            n = random() & 0xffff;
+        while (used[n]);
+        used[n] = 1;
+
+        cp->id = (u32)((random() & 1) ? 0x05 : 0x01) << 24 |
+                 types[random() % sizeof types] << 16 | n;
+        unsigned p = period ? period
+                            : Periods[random() % (sizeof Periods /
+                                                  sizeof Periods[0])];
+        double error = (uniform() * 2 - 1) * ppm / 1e6;
+        cp->period = (u64)p * HZ / 32768 * (1 + error);
+        cp->next = cp->period * uniform() + HZ / 100;
+        cp->rssi = -40 - random() % 55;
+        cp->slaveRssi = -40 - random() % 55;
+        cp->value = random();
+
+        Event_t e = { cp->next, c, EV_MESSAGE, 0, 0 };
+        heapPush(&e);
+    }
+    free(used);
+}
+
+
+static void
+run(u64 until, unsigned long long packets, double jitterUs)
+{
+    u64 jitter = jitterUs * (HZ / 1000000);
+
+    while (HeapLen > 0)
+    {
+        Event_t e;
+        heapPop(&e);
+        if (e.time >= until || Written >= packets)
+            break;
+        Channel_t * cp = &Chan[e.chan];
+
+        switch (e.kind)
+        {
+        case EV_MESSAGE:
+        {
+            double r = uniform();
+            if (r < BurstProb)
+            {
+                /*
+                 *  A burst:  the first packet now, and the rest to come.
+                 */
+                u8 flag = F_BURST | F_FIRST | F_ONE;
+                transmit(e.time, e.chan, flag, false, K_BURST);
+                Event_t b = { e.time + TURN, e.chan, EV_REPLY,
+                              F_BURST | F_RESPONSE | F_ONE, 0 };
+                heapPush(&b);
+                Event_t n = { e.time + BURST_GAP, e.chan, EV_BURST,
+                              F_BURST | F_ONE | F_SEQ, 1 + random() % 39 };
+                heapPush(&n);
+            }
+            else
+            {
+                bool ack = (r < BurstProb + AckProb);
+                transmit(e.time, e.chan, 0x0a, false,
+                         ack ? K_ACK : K_BROADCAST);
+                if (ack)
+                {
+                    Event_t a = { e.time + TURN, e.chan, EV_REPLY, 0x02, 0 };
+                    heapPush(&a);
+                }
+            }
+
+            /*
+             *  The next message, on the channel's own schedule.
+             */
+            cp->next += cp->period;
+            u64 j = jitter ? random() % (2 * jitter + 1) : 0;
+            Event_t n = { cp->next + j - jitter, e.chan, EV_MESSAGE, 0, 0 };
+            heapPush(&n);
+            break;
+        }
+
+        case EV_BURST:
+        {
+            u8 flag = e.flag;
+            if (e.left == 1)
+                flag |= F_LAST;
+            transmit(e.time, e.chan, flag, false, K_BURST);
+            Event_t r = { e.time + TURN, e.chan, EV_REPLY,
+                          F_BURST | F_RESPONSE | F_ONE | (flag & F_SEQ), 0 };
+            heapPush(&r);
+            if (e.left > 1)
+            {
+                Event_t n = { e.time + BURST_GAP, e.chan, EV_BURST,
+                              (e.flag & ~F_SEQ) | (~e.flag & F_SEQ),
+                              e.left - 1 };
+                heapPush(&n);
+            }
+            break;
+        }
+
+        case EV_REPLY:
+            transmit(e.time, e.chan, e.flag, true, K_REPLY);
+            break;
+        }
+    }
+
+    air(0);
+}
+
+/**********************************************************************/
+
+/*
+ *  Wait for a client on the port.
+ */
+static void
+serve(int port)
+{
+    Listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (Listen < 0)
+        err(1, "socket");
+    int on = 1;
+    setsockopt(Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    if (bind(Listen, (struct sockaddr *)&sa, sizeof sa) < 0 ||
+        listen(Listen, 1) < 0)
+            err(1, "can't listen on port %d", port);
+
+    fprintf(stderr, "waiting on port %d\n", port);
+    int fd = accept(Listen, 0, 0);
+    if (fd < 0)
+        err(1, "accept");
+    signal(SIGPIPE, SIG_IGN);
+    Out = fdopen(fd, "w");
+    setvbuf(Out, 0, _IOLBF, 0);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    extern int optind;
+    extern char * optarg;
+    char * outFile = 0;
+    double secs = 60;
+    unsigned long long packets = ~0ull;
+    unsigned period = 0;
+    double jitter = 20;
+    double ppm = 50;
+    int port = 0;
+    int c;
+
+    srandom(45);
+    while ((c = getopt(argc, argv, "C:d:n:p:j:D:B:A:e:s:o:tl:x:")) != -1)
+        switch (c)
+        {
+        case 'C':
+            Channels = strtoul(optarg, 0, 0);
+            break;
+        case 'd':
+            secs = strtod(optarg, 0);
+            break;
+        case 'n':
+            packets = strtod(optarg, 0);
+            break;
+        case 'p':
+            period = strtoul(optarg, 0, 0);
+            break;
+        case 'j':
+            jitter = strtod(optarg, 0);
+            break;
+        case 'D':
+            ppm = strtod(optarg, 0);
+            break;
+        case 'B':
+            BurstProb = strtod(optarg, 0);
+            break;
+        case 'A':
+            AckProb = strtod(optarg, 0);
+            break;
+        case 'e':
+            CrcProb = strtod(optarg, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        case 't':
+            Text = true;
+            break;
+        case 'l':
+            port = strtol(optarg, 0, 0);
+            Text = true;
+            break;
+        case 'x':
+            Speed = strtod(optarg, 0);
+            break;
+        default:
+            exit(1);
+        }
+    if (optind != argc || Channels == 0 || Speed <= 0 ||
+        (!outFile && !Text))
+    {
+        fprintf(stderr, "usage: %s [-C channels] [-d secs | -n packets] "
+                        "[-p period] [-j us] [-D ppm]\n"
+                        "\t[-B prob] [-A prob] [-e prob] [-s seed] "
+                        "[-o file | -t | -l port [-x speed]]\n", argv[0]);
+        exit(1);
+    }
+
+    if (port)
+        serve(port);
+    else if (Text)
+        Out = stdout;
+    else if (!(Out = fopen(outFile, "w")))
+        err(1, "%s", outFile);
+
+    setup(period, ppm);
+    run(secs * HZ + HZ / 100, packets, jitter);
+    fflush(Out);
+
+    fprintf(stderr, "%llu broadcast, %llu acknowledged, %llu burst, "
+                    "%llu replies;  %llu lost, %llu collided, "
+                    "%llu bad CRC;  %llu written\n",
+            Count[K_BROADCAST], Count[K_ACK], Count[K_BURST], Count[K_REPLY],
+            Lost, Collided, CrcBad, Written);
+    return 0;
+}
@@ -0,0 +1,849 @@
+/*
+ *  Keep tracer captures in a capture store (see capstore.c), and look
+ *  things up in them.
+ *
+ *      cap ingest [-r] [-m MHz] [-n name] [-e when] store [file ...]
+ *      cap query [-d devnum] [-t devtype] [-x txtype] [-f from] [-u until]
+ *                [-c] store
+ *      cap info [-v] store
+ *      cap gen [-p packets] [-D devices] [-q queries] store
+ *
+ *  ingest adds packets to the store (making it if it's not there).  The
+ *  input (the files, or stdin) is text:  the tracer's console output, or
+ *  agg's (which has the time on the host clock and the tracer's name at
+ *  the start of each line);  anything that isn't a packet is skipped.
+ *  The packets may also come in runs, from the tracer's "capture on"
+ *  (app/tracer.c);  their times are the tracer's own, even in agg's
+ *  output.  The tracer's clock wraps every 67 seconds, and is unwrapped
+ *  assuming no gap that long.  With -r, the input is the tracer's
+ *  packet_t records instead (20 bytes, as in tracer/host/replay.c), with
+ *  the time in cycles of a -m MHz clock (default 64).  -n names the
+ *  tracer (default the file name).  -e gives the wall clock time of the
+ *  first packet, as "YYYY-MM-DD HH:MM[:SS]" or Unix seconds, so that
+ *  queries can use the time of day;  otherwise times are from the start
+ *  of the capture.
+ *
+ *  query prints the packets with the given channel ID fields, from the
+ *  time -f to -u (either may be left out).  Times are "[D+]H:MM[:SS]",
+ *  the time of day (D days after the first packet's day) if the store
+ *  has a wall clock time, or else the time from the start of the
+ *  capture;  or a number of seconds.  -c only counts them.  So, device
+ *  0x1234 from 2am to 3am:
+ *
+ *      cap query -d 0x1234 -f 2:00 -u 3:00 caps.tcap
+ *
+ *  gen makes a benchmark store of -p packets (default 100M) from -D
+ *  devices (default 1000) sending 4 times a second, then times -q
+ *  queries (default 20) for one device over one hour, picked at random.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/time.h>
+#include <err.h>
+
+#include "capstore.h"
+
+#define WRAP_US     (1ull << 26)        //  Tracer's clock, in microseconds
+
+typedef struct
+{
+    u32         time;                   //  As in tracer/host/replay.c
+    u8          data[13];
+    u8          __res0;
+    s8          rssi;
+    u8          crcOk;
+}
+    packet_t;
+
+/*
+ *  The unwrapped clock of each tracer being read.
+ */
+typedef struct
+{
+    u64         last;
+    bool        any;
+}
+    Clock_t;
+
+Clock_t     Clocks[CAP_SOURCES];
+
+u64         First = ~0ull;              //  Time of the first packet ingested
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static int
+hex(const char ** pp, int digits)
+{
+    const char * p = *pp;
+    int v = 0;
+    for (int i = 0; i < digits; i++, p++)
+    {
+        if (!isxdigit((unsigned char)*p))
+            return -1;
+        v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0'
+                                                 : (*p | 0x20) - 'a' + 10);
+    }
+    *pp = p;
+    return v;
+}
+
+
+/*
+ *  Step over spaces and colour escapes.
+ */
+static const char *
+skip(const char * p)
+{
+    for (;;)
+    {
+        if (*p == ' ')
+            p++;
+        else if (*p == '\033')
+        {
+            while (*p && *p != 'm')
+                p++;
+            if (*p)
+                p++;
+        }
+        else
+            return p;
+    }
+}
+
+
+/*
+ *  Take the packet from a tracer's line:
+ *
+ *      time(elapsed)  {rssidB} tt.dd.nnnn  ==>[ff]  p0 .. p7  ...
+ */
+static bool
+parsePacket(const char * p, CapPacket_t * pkt)
+{
+    if (!(p = strchr(p, '{')))
+        return false;
+    pkt->rssi = strtol(p + 1, 0, 10);
+    if (!(p = strchr(p, '}')))
+        return false;
+    p = skip(p + 1);
+
+    int tt = hex(&p, 2);
+    int dd = (*p++ == '.') ? hex(&p, 2) : -1;
+    int nn = (*p++ == '.') ? hex(&p, 4) : -1;
+    if (tt < 0 || dd < 0 || nn < 0)
+        return false;
+    pkt->id = (u32)tt << 24 | dd << 16 | nn;
+
+    int ff = -1;
+    while (ff < 0 && (p = strchr(p, '[')) != 0)
+    {
+        p++;
+        ff = hex(&p, 2);
+        if (*p != ']')
+            ff = -1;
+    }
+    if (ff < 0)
+        return false;
+    pkt->flag = ff;
+    p++;
+
+    for (int i = 0; i < 8; i++)
+    {
+        p = skip(p);
+        int b = hex(&p, 2);
+        if (b < 0)
+            return false;
+        pkt->payload[i] = b;
+    }
+
+    return true;
+}
+
+
+/*
+ *  Unwrap a tracer's clock, given the time and how often it wraps.
+ */
+static u64
+unwrap(Clock_t * cp, u64 t, u64 wrap)
+{
+    if (!cp->any)
+    {
+        cp->any = true;
+        cp->last = t;
+        return t;
+    }
+
+    /*
+     *  Small steps back are taken as they are (the tracer's clock doesn't
+     *  go backwards, but the input may be a little out of order).
+     */
+    s64 d = (s64)((t - cp->last) & (wrap - 1));
+    if (d >= (s64)(wrap / 2))
+        d -= wrap;
+    cp->last += d;
+    return cp->last;
+}
+
+
+static void
+append(CapStore_t * cs, CapPacket_t * pkt)
+{
+    if (pkt->time < First)
+        First = pkt->time;
+    CapAppend(cs, pkt);
+}
+
+
+/*
+ *  Base-85, as in the tracer's misc/b85.c:  each 5 characters make 4
+ *  bytes (big endian).
+ */
+static bool
+fromBase85(u8 * to, const char * from, unsigned size)
+{
+    static const char digits[] =    "!%&'()*,-./0123456789:;<=>?@AC"
+                                    "DEFGHIJKLMNPQSTUVWXYZ[]_`abcde"
+                                    "fghijklmnopqrstuvwxyz{|}~";
+
+    for (unsigned i = 0; i < size; i += 4)
+    {
+        u32 w = 0;
+        for (int j = 0; j < 5; j++)
+        {
+            const char * d = *from ? strchr(digits, *from++) : 0;
+            if (!d)
+                return false;
+            w = w * 85 + (d - digits);
+        }
+        to[i] = w >> 24;
+        to[i+1] = w >> 16;
+        to[i+2] = w >> 8;
+        to[i+3] = w;
+    }
+
+    return true;
+}
+
+
+/*
+ *  Take a run of packets from the tracer's "!cp_" line:  a word with the
+ *  count of slots (and the frequency, not kept), a word with the time (in
+ *  cycles) of the slot before, then the 16 byte slots, their times (16
+ *  bits, in microseconds since the slot before), and their RSSIs, padded
+ *  to a word.  A time slot (status 3) has the time in cycles in its first
+ *  word, and isn't a packet.
+ */
+static u64
+ingestRun(CapStore_t * cs, const char * p, int source)
+{
+    static u8 b[8 + 255 * (16 + 2 + 1) + 3];
+
+    if (!fromBase85(b, p, 4) || b[0] == 0)
+        return 0;
+    unsigned n = b[0];
+    if (!fromBase85(b, p, (8 + n * (16 + 2 + 1) + 3) & ~3))
+        return 0;
+
+    u32 t = b[4] | b[5] << 8 | b[6] << 16 | (u32)b[7] << 24;
+    const u8 * slot = &b[8];
+    const u8 * time = slot + n * 16;
+    const u8 * rssi = time + n * 2;
+    u64 count = 0;
+
+    for (unsigned i = 0; i < n; i++, slot += 16, time += 2)
+    {
+        if (slot[15] == 3)
+        {
+            t = slot[0] | slot[1] << 8 | slot[2] << 16 | (u32)slot[3] << 24;
+            continue;
+        }
+        t += (time[0] | time[1] << 8) * 64;
+
+        CapPacket_t pkt;
+        memset(&pkt, 0, sizeof pkt);
+        pkt.time = unwrap(&Clocks[source], t / 64, WRAP_US);
+        pkt.id = slot[0] | slot[1] << 8 | slot[2] << 16 |
+                 (u32)slot[3] << 24;
+        pkt.flag = slot[4];
+        memcpy(pkt.payload, &slot[5], 8);
+        pkt.rssi = rssi[i];
+        pkt.source = source;
+        pkt.status = slot[15] ? 0 : CAP_CRC_BAD;
+        append(cs, &pkt);
+        count++;
+    }
+
+    return count;
+}
+
+
+static u64
+ingestText(CapStore_t * cs, FILE * fp, const char * name)
+{
+    char line[1024];
+    u64 count = 0;
+    int source = -1;
+
+    while (fgets(line, sizeof line, fp))
+    {
+        CapPacket_t pkt;
+        memset(&pkt, 0, sizeof pkt);
+
+        /*
+         *  agg's lines are "secs.usecs name line".
+         */
+        char * p = line;
+        while (*p == ' ')
+            p++;
+        char * q;
+        u64 secs = strtoull(p, &q, 10);
+        if (q > p && *q == '.' && isdigit((unsigned char)q[1]) &&
+            q[7] == ' ')
+        {
+            pkt.time = secs * 1000000 + strtoul(q + 1, 0, 10);
+            for (p = q + 8; *p == ' '; p++)
+                ;
+            char tracer[CAP_NAME];
+            int n = 0;
+            while (*p && *p != ' ' && n < CAP_NAME - 1)
+                tracer[n++] = *p++;
+            tracer[n] = 0;
+            if ((q = strstr(p, "!cp_")) != 0)
+            {
+                count += ingestRun(cs, q + 4, CapSource(cs, tracer));
+                continue;
+            }
+            if (!parsePacket(p, &pkt))
+                continue;
+            pkt.source = CapSource(cs, tracer);
+        }
+
+        /*
+         *  The tracer's own are "time(elapsed) ...", the times in
+         *  microseconds with commas.
+         */
+        else
+        {
+            if ((q = strstr(p, "!cp_")) != 0)
+            {
+                if (source < 0)
+                    source = CapSource(cs, name);
+                count += ingestRun(cs, q + 4, source);
+                continue;
+            }
+
+            u64 t = 0;
+            bool digits = false;
+            for (; isdigit((unsigned char)*p) || *p == ','; p++)
+                if (*p != ',')
+                {
+                    t = t * 10 + *p - '0';
+                    digits = true;
+                }
+            if (!digits || *p != '(' || !parsePacket(p, &pkt))
+                continue;
+
+            if (source < 0)
+                source = CapSource(cs, name);
+            pkt.source = source;
+            pkt.time = unwrap(&Clocks[source], t, WRAP_US);
+        }
+
+        append(cs, &pkt);
+        count++;
+    }
+
+    return count;
+}
+
+
+static u64
+ingestRaw(CapStore_t * cs, FILE * fp, const char * name, unsigned mhz)
+{
+    packet_t rec;
+    u64 count = 0;
+    int source = CapSource(cs, name);
+
+    while (fread(&rec, sizeof rec, 1, fp) == 1)
+    {
+        CapPacket_t pkt;
+        memset(&pkt, 0, sizeof pkt);
+        pkt.time = unwrap(&Clocks[source], rec.time, 1ull << 32) / mhz;
+        pkt.id = rec.data[0] | rec.data[1] << 8 | rec.data[2] << 16 |
+                 (u32)rec.data[3] << 24;
+        pkt.flag = rec.data[4];
+        memcpy(pkt.payload, &rec.data[5], 8);
+        pkt.rssi = rec.rssi;
+        pkt.source = source;
+        pkt.status = rec.crcOk ? 0 : CAP_CRC_BAD;
+        append(cs, &pkt);
+        count++;
+    }
+
+    return count;
+}
+
+
+/*
+ *  The wall clock time:  "YYYY-MM-DD HH:MM[:SS]", or Unix seconds.
+ */
+static s64
+wallClock(const char * s)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    if (sscanf(s, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) >= 5)
+    {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return (s64)mktime(&tm) * 1000000;
+    }
+
+    char * e;
+    double t = strtod(s, &e);
+    if (*e || e == s)
+        errx(1, "bad time \"%s\"", s);
+    return t * 1e6;
+}
+
+
+static int
+ingest(int argc, char ** argv)
+{
+    bool raw = false;
+    unsigned mhz = 64;
+    char * name = 0;
+    char * when = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "rm:n:e:")) != -1)
+        switch (c)
+        {
+        case 'r':
+            raw = true;
+            break;
+        case 'm':
+            mhz = strtoul(optarg, 0, 0);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'e':
+            when = optarg;
+            break;
+        default:
+            exit(1);
+        }
+    if (optind >= argc || mhz == 0)
+        errx(1, "usage: cap ingest [-r] [-m MHz] [-n name] [-e when] "
+                "store [file ...]");
+
+    CapStore_t * cs = CapOpen(argv[optind++], true);
+    bool empty = (CapPackets(cs) == 0);
+    double start = now();
+    u64 count = 0;
+
+    for (int i = optind; i < argc || i == optind; i++)
+    {
+        FILE * fp = stdin;
+        const char * n = name ? name : "stdin";
+        if (i < argc)
+        {
+            if (!(fp = fopen(argv[i], "r")))
+                err(1, "%s", argv[i]);
+            if (!name)
+            {
+                n = strrchr(argv[i], '/');
+                n = n ? n + 1 : argv[i];
+            }
+        }
+
+        count += raw ? ingestRaw(cs, fp, n, mhz) : ingestText(cs, fp, n);
+
+        if (fp != stdin)
+            fclose(fp);
+    }
+
+    if (when)
+    {
+        if (!empty)
+            warnx("-e ignored;  the store already has packets");
+        else if (count > 0)
+            CapSetEpoch(cs, wallClock(when) - (s64)First);
+    }
+
+    CapClose(cs);
+    fprintf(stderr, "%llu packets in %.1f seconds\n", count, now() - start);
+    return 0;
+}
+
+/**********************************************************************/
+
+/*
+ *  A query time:  "[D+]H:MM[:SS]", or seconds.
+ */
+static u64
+queryTime(CapStore_t * cs, const char * s)
+{
+    if (!strchr(s, ':'))
+        return strtod(s, 0) * 1e6;
+
+    int d = 0, h = 0, m = 0, sec = 0;
+    if (strchr(s, '+'))
+    {
+        d = strtol(s, 0, 10);
+        s = strchr(s, '+') + 1;
+    }
+    if (sscanf(s, "%d:%d:%d", &h, &m, &sec) < 2)
+        errx(1, "bad time \"%s\"", s);
+    s64 t = (((s64)d * 24 + h) * 60 + m) * 60 + sec;
+
+    s64 epoch = CapEpoch(cs);
+    if (epoch == 0)
+        return t * 1000000;
+
+    /*
+     *  The time of day, from midnight of the first packet's day.
+     */
+    time_t first = (epoch + (s64)CapFirst(cs)) / 1000000;
+    struct tm tm = *localtime(&first);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    s64 midnight = (s64)mktime(&tm) * 1000000;
+    s64 r = midnight + t * 1000000 - epoch;
+    return (r < 0) ? 0 : r;
+}
+
+
+static void
+printTime(CapStore_t * cs, u64 t)
+{
+    s64 epoch = CapEpoch(cs);
+    if (epoch != 0)
+    {
+        time_t s = (epoch + (s64)t) / 1000000;
+        char buf[32];
+        strftime(buf, sizeof buf, "%Y-%m-%d %H:%M:%S", localtime(&s));
+        printf("%s.%06llu", buf, (u64)(epoch + (s64)t) % 1000000);
+    }
+    else
+        printf("%llu+%02llu:%02llu:%02llu.%06llu", t / 86400000000ull,
+               t / 3600000000ull % 24, t / 60000000 % 60, t / 1000000 % 60,
+               t % 1000000);
+}
+
+
+static bool
+printPacket(const CapPacket_t * pkt, void * arg)
+{
+    CapStore_t * cs = arg;
+
+    printTime(cs, pkt->time);
+    printf("  %-8s {%3ddB} %02x.%02x.%04x  [%02x]  "
+           "%02x %02x %02x %02x  %02x %02x %02x %02x%s\n",
+           CapSourceName(cs, pkt->source), pkt->rssi,
+           CAP_TXTYPE(pkt->id), CAP_DEVTYPE(pkt->id), CAP_DEVNUM(pkt->id),
+           pkt->flag,
+           pkt->payload[0], pkt->payload[1], pkt->payload[2], pkt->payload[3],
+           pkt->payload[4], pkt->payload[5], pkt->payload[6], pkt->payload[7],
+           (pkt->status & CAP_CRC_BAD) ? "  (bad CRC)" : "");
+    return true;
+}
+
+
+static int
+query(int argc, char ** argv)
+{
+    char * from = 0;
+    char * until = 0;
+    bool count = false;
+    CapQuery_t q = { 0, ~0ull, 0, 0 };
+    int c;
+
+    while ((c = getopt(argc, argv, "d:t:x:f:u:c")) != -1)
+        switch (c)
+        {
+        case 'd':
+            q.id |= strtoul(optarg, 0, 0) & 0xffff;
+            q.mask |= 0xffff;
+            break;
+        case 't':
+            q.id |= (strtoul(optarg, 0, 0) & 0xff) << 16;
+            q.mask |= 0xff << 16;
+            break;
+        case 'x':
+            q.id |= strtoul(optarg, 0, 0) << 24;
+            q.mask |= 0xffu << 24;
+            break;
+        case 'f':
+            from = optarg;
+            break;
+        case 'u':
+            until = optarg;
+            break;
+        case 'c':
+            count = true;
+            break;
+        default:
+            exit(1);
+        }
+    if (optind + 1 != argc)
+        errx(1, "usage: cap query [-d devnum] [-t devtype] [-x txtype] "
+                "[-f from] [-u until] [-c] store");
+
+    CapStore_t * cs = CapOpen(argv[optind], false);
+    if (from)
+        q.from = queryTime(cs, from);
+    if (until)
+        q.until = queryTime(cs, until);
+
+    CapStats_t st;
+    double start = now();
+    u64 n = CapQuery(cs, &q, count ? 0 : printPacket, cs, &st);
+    double took = now() - start;
+
+    if (count)
+        printf("%llu\n", n);
+    fprintf(stderr, "%llu packets;  %u of %u blocks looked at, %u decoded, "
+                    "%.1f ms\n",
+            n, st.looked, st.blocks, st.decoded, took * 1000);
+
+    CapClose(cs);
+    return 0;
+}
+
+/**********************************************************************/
+
+static int
+info(int argc, char ** argv)
+{
+    bool verify = (argc == 3 && strcmp(argv[1], "-v") == 0);
+    if (argc != 2 && !verify)
+        errx(1, "usage: cap info [-v] store");
+
+    CapStore_t * cs = CapOpen(argv[argc - 1], false);
+    u64 packets = CapPackets(cs);
+    printf("%llu packets in %u blocks\n", packets, CapBlocks(cs));
+    if (packets > 0)
+    {
+        printf("from ");
+        printTime(cs, CapFirst(cs));
+        printf(" to ");
+        printTime(cs, CapLast(cs));
+        printf("\n");
+    }
+    printf("tracers:");
+    for (int i = 0; i < CAP_SOURCES; i++)
+    {
+        const char * n = CapSourceName(cs, i);
+        if (strcmp(n, "?") == 0)
+            break;
+        printf(" %s", n);
+    }
+    printf("\n");
+
+    int r = 0;
+    if (verify)
+    {
+        r = CapVerify(cs) ? 0 : 1;
+        printf("%s\n", r ? "bad blocks" : "all blocks good");
+    }
+    CapClose(cs);
+    return r;
+}
+
+/**********************************************************************/
+/*
+ *  The benchmark.  Each device sends every 250 ms or so (ANT's usual
+ *  8070/32768 s), starting at a random phase, with a little jitter.  The
+ *  payload is a page number that turns over every few packets, an event
+ *  count, and a slowly changing value, much like a sensor's.
+ */
+
+typedef struct
+{
+    u32         id;
+    u32         phase;
+    u8          count;
+    u16         value;
+    s8          rssi;
+}
+    Device_t;
+
+#define PERIOD_US   246277              //  8070/32768 s
+
+
+static bool
+countPacket(const CapPacket_t * pkt, void * arg)
+{
+    (*(u64 *)arg)++;
+    return true;
+}
+
+
+static int
+gen(int argc, char ** argv)
+{
+    u64 packets = 100000000;
+    unsigned devices = 1000;
+    unsigned queries = 20;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:D:q:")) != -1)
+        switch (c)
+        {
+        case 'p':
+            packets = strtod(optarg, 0);
+            break;
+        case 'D':
+            devices = strtoul(optarg, 0, 0);
+            break;
+        case 'q':
+            queries = strtoul(optarg, 0, 0);
+            break;
+        default:
+            exit(1);
+        }
+    if (optind + 1 != argc || devices == 0 || devices > 65536)
+        errx(1, "usage: cap gen [-p packets] [-D devices] [-q queries] store");
+    const char * path = argv[optind];
+
+    /*
+     *  The devices, in order of phase.
+     */
+    static const u8 types[] = { 0x78, 0x79, 0x7a, 0x7b, 0x0b, 0x11 };
+    Device_t * dev = calloc(devices, sizeof *dev);
+    u8 * used = calloc(65536, 1);
+    srandom(43);
+    for (unsigned i = 0; i < devices; i++)
+    {
+        unsigned n;
+        do
+            n = random() & 0xffff;
+        while (used[n]);
+        used[n] = 1;
+        dev[i].id = (u32)((random() & 1) ? 0x05 : 0x01) << 24 |
+                    types[random() % sizeof types] << 16 | n;
+        dev[i].phase = (u64)i * PERIOD_US / devices;
+        dev[i].rssi = -40 - random() % 50;
+        dev[i].value = random();
+    }
+
+    unlink(path);
+    CapStore_t * cs = CapOpen(path, true);
+    int source = CapSource(cs, "gen");
+    double start = now();
+
+    u64 n = 0;
+    for (u64 round = 0; n < packets; round++)
+        for (unsigned i = 0; i < devices && n < packets; i++, n++)
+        {
+            Device_t * dp = &dev[i];
+            CapPacket_t pkt;
+            pkt.time = round * PERIOD_US + dp->phase + random() % 64;
+            pkt.id = dp->id;
+            pkt.flag = 0x0a;
+            pkt.rssi = dp->rssi + random() % 3;
+            pkt.source = source;
+            pkt.status = 0;
+
+            dp->count++;
+            if (random() % 8 == 0)
+                dp->value += random() % 16 - 8;
+            pkt.payload[0] = ((dp->count >> 2) & 1) ? 0x84 : 0x04;
+            pkt.payload[1] = 0xff;
+            pkt.payload[2] = 0xff;
+            pkt.payload[3] = 0xff;
+            pkt.payload[4] = dp->value;
+            pkt.payload[5] = dp->value >> 8;
+            pkt.payload[6] = dp->count;
+            pkt.payload[7] = dp->value / 4;
+            CapAppend(cs, &pkt);
+        }
+    CapClose(cs);
+
+    double took = now() - start;
+    fprintf(stderr, "%llu packets in %.1f s (%.2fM/s)\n",
+            n, took, n / took / 1e6);
+
+    /*
+     *  The queries.
+     */
+    cs = CapOpen(path, false);
+    u64 span = CapLast(cs);
+    u64 hour = 3600000000ull;
+    double total = 0, totalFetch = 0;
+    for (unsigned i = 0; i < queries; i++)
+    {
+        CapQuery_t q;
+        q.id = dev[random() % devices].id & 0xffff;
+        q.mask = 0xffff;
+        q.from = (span > hour) ? (u64)random() * 1000000 % (span - hour) : 0;
+        q.until = q.from + hour;
+
+        CapStats_t st;
+        double t0 = now();
+        u64 found = CapQuery(cs, &q, 0, 0, &st);
+        double t = now() - t0;
+        u64 fetched = 0;
+        CapQuery(cs, &q, countPacket, &fetched, 0);
+        double tf = now() - t0 - t;
+        total += t;
+        totalFetch += tf;
+        printf("device %04x  %5.2f-%5.2f h:  %6llu packets, "
+               "%5u of %u blocks, %6.2f ms to count, %6.2f ms to fetch\n",
+               q.id, q.from / (double)hour, q.until / (double)hour,
+               found, st.decoded, st.blocks, t * 1000, tf * 1000);
+        if (fetched != found)
+            errx(1, "fetched %llu, counted %llu", fetched, found);
+    }
+    if (queries > 0)
+        printf("%.2f ms to count, %.2f ms to fetch, a query\n",
+               total * 1000 / queries, totalFetch * 1000 / queries);
+
+    CapClose(cs);
+    free(dev);
+    free(used);
+    return 0;
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s ingest|query|info|gen ...\n", argv[0]);
+        exit(1);
+    }
+
+    argc--;
+    argv++;
+    if (strcmp(argv[0], "ingest") == 0)
+        return ingest(argc, argv);
+    else if (strcmp(argv[0], "query") == 0)
+        return query(argc, argv);
+    else if (strcmp(argv[0], "info") == 0)
+        return info(argc, argv);
+    else if (strcmp(argv[0], "gen") == 0)
+        return gen(argc, argv);
+
+    errx(1, "unknown command \"%s\"", argv[0]);
+}
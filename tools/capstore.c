@@ -0,0 +1,867 @@
+/*
+ *  Capture store.
+ *
+ *  The file is a header, the blocks, then the directory and a trailer:
+ *
+ *      Header_t                        4 KB, rewritten on close
+ *      Block ...                       Appended, never rewritten
+ *      DirEntry_t ...                  One per block
+ *      Trailer_t                       Where the directory is
+ *
+ *  Appending more packets writes the new blocks over the old directory,
+ *  and a new directory after them.  Each block is complete in itself
+ *  (BlockHdr_t has its size and a CRC), so if the directory didn't get
+ *  written, it's rebuilt by walking the blocks.
+ *
+ *  A block holds up to CAP_BLOCK packets, sorted by channel ID (then in
+ *  the order they came), as columns:
+ *
+ *      COL_IDS         An IdEntry_t for each channel ID in the block, in
+ *                      order of device number, then the rest of the ID;
+ *                      where the channel's packets start, and where its
+ *                      part of each variable length column starts
+ *      COL_TIME        The difference from the channel's previous packet
+ *                      (the first from `tfirst'), zig-zag varint
+ *      COL_RSSI        1 byte each
+ *      COL_MISC        Runs of the same flag, source and status:  a varint
+ *                      count, then the three bytes
+ *      COL_PAYLOAD     For each packet, a byte with a bit set for each
+ *                      payload byte that differs from the channel's last
+ *                      packet, then those bytes
+ *
+ *  Each channel's part of a column stands alone, so a query for a device
+ *  finds it in the block's IDs, and decodes only its packets.  (Sorting
+ *  by channel also makes the time and payload differences small.)
+ *
+ *  The header and directory entry of each block have the range of times
+ *  in it, and a bitmap of the device numbers in it (hashed into
+ *  BLOOM_BITS).  A query looks through the directory, and only decodes
+ *  the blocks that can hold what it wants, and only the columns it needs.
+ *  The file is read through mmap().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "capstore.h"
+
+/**********************************************************************/
+
+#define HEADER_MAGIC    0x50414354      //  "TCAP"
+#define BLOCK_MAGIC     0x4b4c4254      //  "TBLK"
+#define TRAILER_MAGIC   0x49444354      //  "TCDI"
+#define VERSION         1
+#define HEADER_SIZE     4096
+
+#define BLOOM_BITS      1024
+#define BLOOM_BYTES     (BLOOM_BITS / 8)
+
+enum
+{
+    COL_IDS,
+    COL_TIME,
+    COL_RSSI,
+    COL_MISC,
+    COL_PAYLOAD,
+    COL_END,
+    COLS
+};
+
+typedef struct
+{
+    u32         magic;
+    u32         version;
+    u32         block;                  //  CAP_BLOCK
+    u32         sources;                //  Names in use
+    s64         epoch;                  //  Unix time (us) of time 0, or 0
+    char        name[CAP_SOURCES][CAP_NAME];
+}
+    Header_t;
+
+typedef struct
+{
+    u32         magic;
+    u32         size;                   //  Bytes, with this header
+    u32         count;                  //  Packets
+    u16         ids;                    //  Entries in COL_IDS
+    u16         flags;                  //  (None yet)
+    u64         tmin, tmax;
+    u64         tfirst;                 //  Time of the first packet
+    u32         col[COLS];              //  Column offsets, from the block
+    u32         crc;                    //  CRC-32C of the block (this 0)
+    u8          bloom[BLOOM_BYTES];
+}
+    BlockHdr_t;
+
+/*
+ *  The offsets are from the start of each column.
+ */
+typedef struct
+{
+    u32         id;
+    u16         first;                  //  Index of the channel's first packet
+    u16         time;
+    u16         payload;
+    u16         misc;
+}
+    IdEntry_t;
+
+typedef struct
+{
+    u64         offset;                 //  Of the block in the file
+    u64         tmin, tmax;
+    u32         count;
+    u32         size;
+    u8          bloom[BLOOM_BYTES];
+}
+    DirEntry_t;
+
+typedef struct
+{
+    u32         magic;
+    u32         blocks;
+    u64         directory;              //  Offset of the directory
+    u32         crc;                    //  Of the directory
+    u32         pad;
+}
+    Trailer_t;
+
+struct CapStore
+{
+    int         fd;
+    bool        write;
+    Header_t    hdr;
+
+    DirEntry_t * dir;
+    unsigned    blocks;
+    unsigned    dirSize;                //  Entries allocated (when writing)
+    u64         end;                    //  End of the last block
+    u64         packets;
+
+    /*
+     *  Reading.
+     */
+    u8 *        map;
+    size_t      mapSize;
+
+    /*
+     *  Writing.
+     */
+    CapPacket_t * pend;
+    unsigned    pendCount;
+    u8 *        buf;
+};
+
+#define BUF_SIZE    (sizeof (BlockHdr_t) + \
+                     CAP_BLOCK * (sizeof (IdEntry_t) + 10 + 1 + 5 + 9 + 1))
+
+/**********************************************************************/
+
+/*
+ *  The tracer's CRC-32C (misc/crc.c), built with its fastest tables.
+ */
+typedef struct
+{
+    u32         crc;
+}
+    CRC_t;
+
+extern void     CRC(CRC_t * crc, u8 * data, unsigned len);
+
+
+static u32
+crc32c(u32 crc, const u8 * p, size_t len)
+{
+    CRC_t c = { crc };
+    CRC(&c, (u8 *)p, len);
+    return c.crc;
+}
+
+
+static unsigned
+bloomBit(u32 id)
+{
+    return (CAP_DEVNUM(id) * 0x9e3779b1u) >> (32 - 10);
+}
+
+
+static u8 *
+putVarint(u8 * p, u64 v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+
+static const u8 *
+getVarint(const u8 * p, u64 * vp)
+{
+    u64 v = 0;
+    int sh = 0;
+    while (*p & 0x80)
+    {
+        v |= (u64)(*p++ & 0x7f) << sh;
+        sh += 7;
+    }
+    *vp = v | (u64)*p++ << sh;
+    return p;
+}
+
+/**********************************************************************/
+/*
+ *  Writing.
+ */
+
+/*
+ *  The order of the channel IDs in a block:  by device number first, so
+ *  that a query for a device finds its IDs together.
+ */
+static u32
+idKey(u32 id)
+{
+    return id << 16 | id >> 16;
+}
+
+
+static int
+idCompare(const void * a, const void * b)
+{
+    u32 x = idKey(*(const u32 *)a);
+    u32 y = idKey(*(const u32 *)b);
+    return (x > y) - (x < y);
+}
+
+
+/*
+ *  Encode the pending packets as a block, and append it.
+ */
+static void
+writeBlock(CapStore_t * cs)
+{
+    const CapPacket_t * pkt = cs->pend;
+    unsigned n = cs->pendCount;
+    if (n == 0)
+        return;
+
+    BlockHdr_t * bh = (BlockHdr_t *)cs->buf;
+    memset(bh, 0, sizeof *bh);
+    bh->magic = BLOCK_MAGIC;
+    bh->count = n;
+    bh->tfirst = pkt[0].time;
+    bh->tmin = bh->tmax = pkt[0].time;
+
+    /*
+     *  The channel IDs, found through a small hash table.
+     */
+    static u32 ids[CAP_BLOCK];
+    static u32 sorted[CAP_BLOCK];
+    static u16 index[CAP_BLOCK];
+    static u16 rank[CAP_BLOCK];
+    static int slot[2 * CAP_BLOCK];
+    static unsigned start[CAP_BLOCK + 1];
+    static unsigned next[CAP_BLOCK];
+    static u16 order[CAP_BLOCK];
+    unsigned nids = 0;
+
+    memset(slot, 0xff, sizeof slot);
+    for (unsigned i = 0; i < n; i++)
+    {
+        u32 id = pkt[i].id;
+        unsigned h = (id * 0x9e3779b1u) >> (32 - 13);
+        while (slot[h] >= 0 && ids[slot[h]] != id)
+            h = (h + 1) & (2 * CAP_BLOCK - 1);
+        if (slot[h] < 0)
+        {
+            slot[h] = nids;
+            ids[nids++] = id;
+            unsigned b = bloomBit(id);
+            bh->bloom[b / 8] |= 1 << (b % 8);
+        }
+        index[i] = slot[h];
+
+        if (pkt[i].time < bh->tmin)
+            bh->tmin = pkt[i].time;
+        if (pkt[i].time > bh->tmax)
+            bh->tmax = pkt[i].time;
+    }
+    bh->ids = nids;
+
+    /*
+     *  Sort the IDs, then the packets by ID (keeping their order).
+     */
+    memcpy(sorted, ids, nids * 4);
+    qsort(sorted, nids, 4, idCompare);
+    for (unsigned r = 0; r < nids; r++)
+    {
+        unsigned h = (sorted[r] * 0x9e3779b1u) >> (32 - 13);
+        while (ids[slot[h]] != sorted[r])
+            h = (h + 1) & (2 * CAP_BLOCK - 1);
+        rank[slot[h]] = r;
+    }
+
+    memset(start, 0, (nids + 1) * sizeof start[0]);
+    for (unsigned i = 0; i < n; i++)
+        start[rank[index[i]] + 1]++;
+    for (unsigned r = 0; r < nids; r++)
+    {
+        start[r + 1] += start[r];
+        next[r] = start[r];
+    }
+    for (unsigned i = 0; i < n; i++)
+        order[next[rank[index[i]]]++] = i;
+
+    u8 * base = cs->buf;
+    u8 * p = base + sizeof *bh;
+
+    bh->col[COL_IDS] = p - base;
+    IdEntry_t * ent = (IdEntry_t *)p;
+    p += nids * sizeof *ent;
+    for (unsigned r = 0; r < nids; r++)
+    {
+        ent[r].id = sorted[r];
+        ent[r].first = start[r];
+    }
+
+    bh->col[COL_TIME] = p - base;
+    for (unsigned r = 0; r < nids; r++)
+    {
+        ent[r].time = p - (base + bh->col[COL_TIME]);
+        u64 prev = bh->tfirst;
+        for (unsigned j = start[r]; j < start[r + 1]; j++)
+        {
+            s64 d = pkt[order[j]].time - prev;
+            p = putVarint(p, (u64)(d << 1) ^ (u64)(d >> 63));
+            prev = pkt[order[j]].time;
+        }
+    }
+
+    bh->col[COL_RSSI] = p - base;
+    for (unsigned j = 0; j < n; j++)
+        *p++ = pkt[order[j]].rssi;
+
+    bh->col[COL_MISC] = p - base;
+    for (unsigned r = 0; r < nids; r++)
+    {
+        ent[r].misc = p - (base + bh->col[COL_MISC]);
+        for (unsigned j = start[r]; j < start[r + 1]; )
+        {
+            const CapPacket_t * pp = &pkt[order[j]];
+            unsigned k = j + 1;
+            while (k < start[r + 1] &&
+                   pkt[order[k]].flag == pp->flag &&
+                   pkt[order[k]].source == pp->source &&
+                   pkt[order[k]].status == pp->status)
+                k++;
+            p = putVarint(p, k - j);
+            *p++ = pp->flag;
+            *p++ = pp->source;
+            *p++ = pp->status;
+            j = k;
+        }
+    }
+
+    bh->col[COL_PAYLOAD] = p - base;
+    for (unsigned r = 0; r < nids; r++)
+    {
+        ent[r].payload = p - (base + bh->col[COL_PAYLOAD]);
+        u8 last[8] = { 0 };
+        for (unsigned j = start[r]; j < start[r + 1]; j++)
+        {
+            const u8 * pl = pkt[order[j]].payload;
+            u8 * mp = p++;
+            *mp = 0;
+            for (int k = 0; k < 8; k++)
+                if (pl[k] != last[k])
+                {
+                    *mp |= 1 << k;
+                    *p++ = pl[k];
+                    last[k] = pl[k];
+                }
+        }
+    }
+
+    bh->col[COL_END] = p - base;
+    while ((p - base) & 7)              //  (Keep the next block aligned)
+        *p++ = 0;
+    bh->size = p - base;
+    bh->crc = crc32c(0, base, bh->size);
+
+    if (pwrite(cs->fd, base, bh->size, cs->end) != (ssize_t)bh->size)
+        err(1, "can't write the capture store");
+
+    if (cs->blocks == cs->dirSize)
+    {
+        cs->dirSize = cs->dirSize ? 2 * cs->dirSize : 1024;
+        cs->dir = realloc(cs->dir, cs->dirSize * sizeof (DirEntry_t));
+        if (!cs->dir)
+            err(1, "no memory for the directory");
+    }
+    DirEntry_t * dp = &cs->dir[cs->blocks++];
+    dp->offset = cs->end;
+    dp->tmin = bh->tmin;
+    dp->tmax = bh->tmax;
+    dp->count = n;
+    dp->size = bh->size;
+    memcpy(dp->bloom, bh->bloom, BLOOM_BYTES);
+
+    cs->end += bh->size;
+    cs->packets += n;
+    cs->pendCount = 0;
+}
+
+
+static void
+writeDirectory(CapStore_t * cs)
+{
+    size_t size = cs->blocks * sizeof (DirEntry_t);
+    Trailer_t tr;
+    memset(&tr, 0, sizeof tr);
+    tr.magic = TRAILER_MAGIC;
+    tr.blocks = cs->blocks;
+    tr.directory = cs->end;
+    tr.crc = crc32c(0, (u8 *)cs->dir, size);
+
+    if (pwrite(cs->fd, cs->dir, size, cs->end) != (ssize_t)size ||
+        pwrite(cs->fd, &tr, sizeof tr, cs->end + size) != sizeof tr ||
+        pwrite(cs->fd, &cs->hdr, sizeof cs->hdr, 0) != sizeof cs->hdr)
+            err(1, "can't write the capture store");
+    if (ftruncate(cs->fd, cs->end + size + sizeof tr) < 0)
+        err(1, "can't write the capture store");
+}
+
+
+void
+CapAppend(CapStore_t * cs, const CapPacket_t * pkt)
+{
+    cs->pend[cs->pendCount++] = *pkt;
+    if (cs->pendCount == CAP_BLOCK)
+        writeBlock(cs);
+}
+
+
+int
+CapSource(CapStore_t * cs, const char * name)
+{
+    for (unsigned i = 0; i < cs->hdr.sources; i++)
+        if (strncmp(cs->hdr.name[i], name, CAP_NAME - 1) == 0)
+            return i;
+
+    if (cs->hdr.sources == CAP_SOURCES)
+        errx(1, "too many tracers in the capture store");
+    snprintf(cs->hdr.name[cs->hdr.sources], CAP_NAME, "%s", name);
+    return cs->hdr.sources++;
+}
+
+/**********************************************************************/
+/*
+ *  Opening.
+ */
+
+/*
+ *  Read the directory from the trailer, or failing that, rebuild it by
+ *  walking the blocks.
+ */
+static void
+readDirectory(CapStore_t * cs, u64 fileSize)
+{
+    Trailer_t tr;
+    if (fileSize >= HEADER_SIZE + sizeof tr &&
+        pread(cs->fd, &tr, sizeof tr, fileSize - sizeof tr) == sizeof tr &&
+        tr.magic == TRAILER_MAGIC &&
+        tr.directory + (u64)tr.blocks * sizeof (DirEntry_t) + sizeof tr ==
+            fileSize)
+    {
+        size_t size = tr.blocks * sizeof (DirEntry_t);
+        cs->dirSize = tr.blocks + 1;
+        cs->dir = malloc(cs->dirSize * sizeof (DirEntry_t));
+        if (!cs->dir)
+            err(1, "no memory for the directory");
+        if (pread(cs->fd, cs->dir, size, tr.directory) == (ssize_t)size &&
+            crc32c(0, (u8 *)cs->dir, size) == tr.crc)
+        {
+            cs->blocks = tr.blocks;
+            cs->end = tr.directory;
+            for (unsigned i = 0; i < cs->blocks; i++)
+                cs->packets += cs->dir[i].count;
+            return;
+        }
+        free(cs->dir);
+        cs->dir = 0;
+        cs->dirSize = 0;
+    }
+
+    warnx("rebuilding the capture store directory");
+    cs->end = HEADER_SIZE;
+    u8 * buf = malloc(BUF_SIZE);
+    BlockHdr_t bh;
+    while (pread(cs->fd, &bh, sizeof bh, cs->end) == sizeof bh &&
+           bh.magic == BLOCK_MAGIC && bh.size <= BUF_SIZE &&
+           bh.size >= sizeof bh && cs->end + bh.size <= fileSize &&
+           pread(cs->fd, buf, bh.size, cs->end) == bh.size)
+    {
+        ((BlockHdr_t *)buf)->crc = 0;
+        if (crc32c(0, buf, bh.size) != bh.crc)
+            break;
+
+        if (cs->blocks == cs->dirSize)
+        {
+            cs->dirSize = cs->dirSize ? 2 * cs->dirSize : 1024;
+            cs->dir = realloc(cs->dir, cs->dirSize * sizeof (DirEntry_t));
+            if (!cs->dir)
+                err(1, "no memory for the directory");
+        }
+        DirEntry_t * dp = &cs->dir[cs->blocks++];
+        dp->offset = cs->end;
+        dp->tmin = bh.tmin;
+        dp->tmax = bh.tmax;
+        dp->count = bh.count;
+        dp->size = bh.size;
+        memcpy(dp->bloom, bh.bloom, BLOOM_BYTES);
+
+        cs->end += bh.size;
+        cs->packets += bh.count;
+    }
+    free(buf);
+}
+
+
+CapStore_t *
+CapOpen(const char * path, bool write)
+{
+    CapStore_t * cs = calloc(1, sizeof *cs);
+    if (!cs)
+        err(1, "no memory");
+    cs->write = write;
+
+    cs->fd = open(path, write ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+    if (cs->fd < 0)
+        err(1, "%s", path);
+
+    struct stat st;
+    if (fstat(cs->fd, &st) < 0)
+        err(1, "%s", path);
+
+    if (st.st_size == 0 && write)
+    {
+        cs->hdr.magic = HEADER_MAGIC;
+        cs->hdr.version = VERSION;
+        cs->hdr.block = CAP_BLOCK;
+        cs->end = HEADER_SIZE;
+    }
+    else
+    {
+        if (pread(cs->fd, &cs->hdr, sizeof cs->hdr, 0) != sizeof cs->hdr ||
+            cs->hdr.magic != HEADER_MAGIC)
+                errx(1, "%s: not a capture store", path);
+        if (cs->hdr.version != VERSION)
+            errx(1, "%s: capture store version %u", path, cs->hdr.version);
+        readDirectory(cs, st.st_size);
+    }
+
+    if (write)
+    {
+        cs->pend = malloc(CAP_BLOCK * sizeof (CapPacket_t));
+        cs->buf = malloc(BUF_SIZE);
+        if (!cs->pend || !cs->buf)
+            err(1, "no memory");
+    }
+    else if (st.st_size > 0)
+    {
+        cs->mapSize = st.st_size;
+        cs->map = mmap(0, cs->mapSize, PROT_READ, MAP_SHARED, cs->fd, 0);
+        if (cs->map == MAP_FAILED)
+            err(1, "%s", path);
+    }
+
+    return cs;
+}
+
+
+void
+CapClose(CapStore_t * cs)
+{
+    if (cs->write)
+    {
+        writeBlock(cs);
+        writeDirectory(cs);
+        free(cs->pend);
+        free(cs->buf);
+    }
+    if (cs->map)
+        munmap(cs->map, cs->mapSize);
+    close(cs->fd);
+    free(cs->dir);
+    free(cs);
+}
+
+/**********************************************************************/
+/*
+ *  Reading.
+ */
+
+static int
+timeCompare(const void * a, const void * b)
+{
+    const CapPacket_t * x = a;
+    const CapPacket_t * y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) ? 1 : -1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+
+/*
+ *  Run a query.  With no `func', the packets are only counted;  the
+ *  times are decoded only for blocks partly in the query's time, and the
+ *  other columns not at all.
+ */
+u64
+CapQuery(CapStore_t * cs, const CapQuery_t * q,
+         CapVisit_f * func, void * arg, CapStats_t * st)
+{
+    CapStats_t stats;
+    memset(&stats, 0, sizeof stats);
+    stats.blocks = cs->blocks;
+
+    /*
+     *  The bitmap, and the order of the IDs, only help if the query names
+     *  a device number.
+     */
+    bool device = (q->mask & 0xffff) == 0xffff;
+    unsigned bit = bloomBit(q->id);
+
+    static u64 times[CAP_BLOCK];
+    static CapPacket_t found[CAP_BLOCK];
+    bool stop = false;
+
+    for (unsigned b = 0; b < cs->blocks && !stop; b++)
+    {
+        const DirEntry_t * dp = &cs->dir[b];
+        if (dp->tmax < q->from || dp->tmin >= q->until)
+            continue;
+        if (device && !(dp->bloom[bit / 8] & (1 << (bit % 8))))
+            continue;
+        stats.looked++;
+
+        const u8 * base = cs->map + dp->offset;
+        const BlockHdr_t * bh = (const BlockHdr_t *)base;
+        if (dp->offset + dp->size > cs->mapSize || bh->magic != BLOCK_MAGIC)
+            errx(1, "capture store block %u is bad", b);
+
+        const IdEntry_t * ent = (const IdEntry_t *)(base + bh->col[COL_IDS]);
+        unsigned lo = 0;
+        if (device)
+        {
+            unsigned hi = bh->ids;
+            while (lo < hi)
+            {
+                unsigned mid = (lo + hi) / 2;
+                if (CAP_DEVNUM(ent[mid].id) < CAP_DEVNUM(q->id))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+        }
+
+        bool inside = (dp->tmin >= q->from && dp->tmax < q->until);
+        bool any = false;
+        unsigned nfound = 0;
+
+        for (unsigned r = lo; r < bh->ids; r++)
+        {
+            u32 id = ent[r].id;
+            if (device && CAP_DEVNUM(id) != CAP_DEVNUM(q->id))
+                break;
+            if ((id & q->mask) != q->id)
+                continue;
+            any = true;
+
+            unsigned first = ent[r].first;
+            unsigned count = ((r + 1 < bh->ids) ? ent[r + 1].first
+                                                : bh->count) - first;
+            if (!func && inside)
+            {
+                stats.matched += count;
+                continue;
+            }
+
+            /*
+             *  The times.
+             */
+            const u8 * tp = base + bh->col[COL_TIME] + ent[r].time;
+            u64 t = bh->tfirst;
+            unsigned hits = 0;
+            for (unsigned i = 0; i < count; i++)
+            {
+                u64 d;
+                tp = getVarint(tp, &d);
+                t += (s64)(d >> 1) ^ -(s64)(d & 1);
+                times[i] = t;
+                hits += (t >= q->from && t < q->until);
+            }
+            stats.scanned += count;
+            stats.matched += hits;
+            if (!func || hits == 0)
+                continue;
+
+            /*
+             *  The rest of the columns, for the visitor.
+             */
+            const u8 * rp = base + bh->col[COL_RSSI] + first;
+            const u8 * mp = base + bh->col[COL_MISC] + ent[r].misc;
+            const u8 * pp = base + bh->col[COL_PAYLOAD] + ent[r].payload;
+            u8 last[8] = { 0 };
+            u64 run = 0;
+            u8 flag = 0, source = 0, status = 0;
+
+            for (unsigned i = 0; i < count; i++)
+            {
+                if (run == 0)
+                {
+                    mp = getVarint(mp, &run);
+                    flag = *mp++;
+                    source = *mp++;
+                    status = *mp++;
+                }
+                run--;
+
+                u8 m = *pp++;
+                for (int j = 0; j < 8; j++)
+                    if (m & (1 << j))
+                        last[j] = *pp++;
+
+                if (times[i] >= q->from && times[i] < q->until)
+                {
+                    CapPacket_t * fp = &found[nfound++];
+                    fp->time = times[i];
+                    fp->id = id;
+                    fp->flag = flag;
+                    fp->rssi = rp[i];
+                    fp->source = source;
+                    fp->status = status;
+                    memcpy(fp->payload, last, 8);
+                }
+            }
+        }
+        stats.decoded += any;
+
+        /*
+         *  The packets of different channels are apart in the block, so
+         *  put them back in time order.
+         */
+        if (nfound > 1)
+            qsort(found, nfound, sizeof found[0], timeCompare);
+        for (unsigned i = 0; i < nfound && !stop; i++)
+            if (!(*func)(&found[i], arg))
+                stop = true;
+    }
+
+    if (st)
+        *st = stats;
+    return stats.matched;
+}
+
+
+/*
+ *  Check the CRC of every block.
+ */
+bool
+CapVerify(CapStore_t * cs)
+{
+    static u8 buf[BUF_SIZE];
+    bool ok = true;
+
+    for (unsigned b = 0; b < cs->blocks; b++)
+    {
+        const DirEntry_t * dp = &cs->dir[b];
+        if (dp->offset + dp->size > cs->mapSize || dp->size > BUF_SIZE)
+        {
+            warnx("block %u: past the end of the file", b);
+            ok = false;
+            continue;
+        }
+        memcpy(buf, cs->map + dp->offset, dp->size);
+        BlockHdr_t * bh = (BlockHdr_t *)buf;
+        u32 crc = bh->crc;
+        bh->crc = 0;
+        if (bh->magic != BLOCK_MAGIC || crc32c(0, buf, dp->size) != crc)
+        {
+            warnx("block %u: bad CRC", b);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/**********************************************************************/
+
+u64
+CapPackets(CapStore_t * cs)
+{
+    return cs->packets + cs->pendCount;
+}
+
+
+unsigned
+CapBlocks(CapStore_t * cs)
+{
+    return cs->blocks;
+}
+
+
+u64
+CapFirst(CapStore_t * cs)
+{
+    u64 t = ~0ull;
+    for (unsigned b = 0; b < cs->blocks; b++)
+        if (cs->dir[b].tmin < t)
+            t = cs->dir[b].tmin;
+    return t;
+}
+
+
+u64
+CapLast(CapStore_t * cs)
+{
+    u64 t = 0;
+    for (unsigned b = 0; b < cs->blocks; b++)
+        if (cs->dir[b].tmax > t)
+            t = cs->dir[b].tmax;
+    return t;
+}
+
+
+s64
+CapEpoch(CapStore_t * cs)
+{
+    return cs->hdr.epoch;
+}
+
+
+void
+CapSetEpoch(CapStore_t * cs, s64 epoch)
+{
+    cs->hdr.epoch = epoch;
+}
+
+
+const char *
+CapSourceName(CapStore_t * cs, int source)
+{
+    return (source < (int)cs->hdr.sources) ? cs->hdr.name[source] : "?";
+}
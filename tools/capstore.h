@@ -0,0 +1,96 @@
+/*
+ *  Capture store:  the packets the tracers hear, kept in an append-only
+ *  file of compressed column blocks, indexed by time and channel ID.
+ *  (The format is described in capstore.c.)
+ */
+
+#ifndef __CAPSTORE_H__
+#define __CAPSTORE_H__
+
+#include <stdbool.h>
+
+typedef unsigned char       u8;
+typedef signed char         s8;
+typedef unsigned short      u16;
+typedef unsigned int        u32;
+typedef long long           s64;
+typedef unsigned long long  u64;
+
+/**********************************************************************/
+
+#define CAP_BLOCK       4096            //  Packets in a full block
+#define CAP_SOURCES     64              //  Tracers named in a store
+#define CAP_NAME        16              //  Longest tracer name, with '\0'
+
+typedef struct
+{
+    u64         time;                   //  Microseconds
+    u32         id;                     //  Channel ID (address, little end.)
+    u8          flag;                   //  ANT flag byte
+    s8          rssi;                   //  dBm
+    u8          source;                 //  Tracer (CapSource())
+    u8          status;                 //  CAP_CRC_BAD
+    u8          payload[8];
+}
+    CapPacket_t;
+
+#define CAP_CRC_BAD     0x01            //  Heard with a bad CRC
+
+/*
+ *  Channel ID fields.
+ */
+#define CAP_DEVNUM(id)  ((id) & 0xffff)
+#define CAP_DEVTYPE(id) (((id) >> 16) & 0xff)
+#define CAP_TXTYPE(id)  ((id) >> 24)
+
+/*
+ *  A query:  packets with from <= time < until, and (id & mask) == id.
+ */
+typedef struct
+{
+    u64         from;
+    u64         until;
+    u32         id;
+    u32         mask;
+}
+    CapQuery_t;
+
+typedef struct
+{
+    unsigned    blocks;                 //  Blocks in the store
+    unsigned    looked;                 //  Blocks the index let through
+    unsigned    decoded;                //  Blocks with a matching ID
+    u64         scanned;                //  Packets looked at
+    u64         matched;                //  Packets found
+}
+    CapStats_t;
+
+typedef struct CapStore CapStore_t;
+
+/*
+ *  Called for each packet a query finds, in store order.  Returns false
+ *  to stop the query.
+ */
+typedef bool    CapVisit_f(const CapPacket_t * pkt, void * arg);
+
+/**********************************************************************/
+
+extern CapStore_t * CapOpen(const char * path, bool write);
+extern void         CapClose(CapStore_t * cs);
+
+extern int          CapSource(CapStore_t * cs, const char * name);
+extern const char * CapSourceName(CapStore_t * cs, int source);
+extern void         CapAppend(CapStore_t * cs, const CapPacket_t * pkt);
+
+extern u64          CapQuery(CapStore_t * cs, const CapQuery_t * q,
+                             CapVisit_f * func, void * arg, CapStats_t * st);
+extern bool         CapVerify(CapStore_t * cs);
+
+extern u64          CapPackets(CapStore_t * cs);
+extern unsigned     CapBlocks(CapStore_t * cs);
+extern u64          CapFirst(CapStore_t * cs);
+extern u64          CapLast(CapStore_t * cs);
+extern s64          CapEpoch(CapStore_t * cs);
+extern void         CapSetEpoch(CapStore_t * cs, s64 epoch);
+
+#endif // __CAPSTORE_H__
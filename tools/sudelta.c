@@ -0,0 +1,626 @@
+/*
+ *  Software update delta generator.
+ *
+ *  Given the image running on a tracer and a new image, make the delta
+ *  stream the boot loader uses to build the new image in place.  The stream
+ *  format is described in loader/delta.c.
+ *
+ *      sudelta [-v version] [-b base] start old.bin new.bin out.sud
+ *
+ *  Both images are flat binaries to be loaded at `start', which must be on
+ *  a flash page, and must stop short of the loader's scratch page (the last
+ *  before the store).  `base' is the version of the old image:  a tracer
+ *  refuses a delta made for any other.  The output is a header of seven
+ *  little endian words:
+ *
+ *      "SUDL", version, base, start, end, CRC, stream length
+ *
+ *  then the stream.  The header gives the fields of the RT_SU_DELTA record,
+ *  and the stream is sent as the chunks.
+ *
+ *  The stream is an LZ style copy/literal list, where copies come either
+ *  from the old image (at a distance from the output that carries over
+ *  from one copy to the next, as bsdiff does) or from earlier in the same
+ *  output page.  The loader writes pages in place, so copies from the old
+ *  image are limited to the pages not yet written.  Both page orders are
+ *  tried and the smaller stream kept.  The result is checked by running it
+ *  the way the loader does, against a model of the flash.
+ */
+
+#include    <stdbool.h>
+#include    <stdio.h>
+#include    <stdlib.h>
+#include    <string.h>
+#include    <err.h>
+
+/**********************************************************************/
+
+typedef unsigned char       uchar;
+typedef unsigned char       u8;
+typedef unsigned int        u32;
+
+#define FLASH_SIZE      0x80000         //  nRF52 flash size
+#define FLASH_PAGE      4096            //  Flash page size
+#define SU_CHUNK        64              //  Software update chunk size
+#define FLASH_SCRATCH   0x3f000         //  The loader's scratch page
+
+enum
+{
+    DL_LITERAL = 0,         //  Literal bytes
+    DL_COPY = 1,            //  Copy from the old image
+    DL_MATCH = 2,           //  Copy from the output page
+
+    DF_DOWN = 0x01,         //  Write the pages from the highest down
+};
+
+#define MIN_MATCH       4               //  Shortest match looked for
+#define HASH_BITS       16
+#define HASH_SIZE       (1 << HASH_BITS)
+#define CHAIN_LIMIT     512             //  Most candidates tried per byte
+
+/**********************************************************************/
+
+u8 *        Old;                //  Old image, at `Start' in a flash model
+u32         OldEnd;
+u8 *        New;                //  New image, likewise
+u32         Start;
+u32         End;
+
+/*
+ *  Hash chains over the old image, by address.  `oldHead' is the highest
+ *  address with a given hash, and `oldPrev' the next lower one.
+ */
+int *       oldHead;
+int *       oldPrev;
+
+/*
+ *  The stream being built.
+ */
+u8 *        Out;
+unsigned    OutLen;
+
+/**********************************************************************/
+
+static u32
+crc32c(u32 crc, const u8 * p, unsigned len)
+{
+    u32 c = ~crc;
+
+    while (len-- > 0)
+    {
+        c ^= *p++;
+        for (int i = 0; i < 8; i++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+
+    return ~c;
+}
+
+
+static unsigned
+hash(const u8 * p)
+{
+    u32 x = p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+    return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+static unsigned
+numberLen(unsigned n)
+{
+    unsigned l = 1;
+    while (n >= 0x80)
+    {
+        n >>= 7;
+        l++;
+    }
+    return l;
+}
+
+
+static unsigned
+zigzag(int n)
+{
+    return (n < 0) ? ((~n) << 1) | 1 : n << 1;
+}
+
+/**********************************************************************/
+
+static void
+put(unsigned b)
+{
+    Out[OutLen++] = b;
+}
+
+
+static void
+putWord(u32 w)
+{
+    put(w);
+    put(w >> 8);
+    put(w >> 16);
+    put(w >> 24);
+}
+
+
+static void
+putNumber(unsigned n)
+{
+    while (n >= 0x80)
+    {
+        put((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    put(n);
+}
+
+
+static void
+putTag(unsigned op, unsigned n)
+{
+    n -= 1;
+    if (n < 0x3f)
+        put(op << 6 | n);
+    else
+    {
+        put(op << 6 | 0x3f);
+        putNumber(n - 0x3f);
+    }
+}
+
+
+static unsigned
+tagLen(unsigned n)
+{
+    return (n - 1 < 0x3f) ? 1 : 1 + numberLen(n - 1 - 0x3f);
+}
+
+/**********************************************************************/
+
+/*
+ *  Return the page of the new image written `n'th, and its length.
+ */
+static u32
+pageAt(unsigned flags, unsigned n, unsigned * len)
+{
+    u32 last = (End - 1) & ~(FLASH_PAGE - 1);
+    u32 pg = (flags & DF_DOWN) ? last - n * FLASH_PAGE
+                               : Start + n * FLASH_PAGE;
+
+    *len = (pg == last) ? End - pg : FLASH_PAGE;
+    return pg;
+}
+
+
+/*
+ *  The length of the page at `pg' in the old image.
+ */
+static unsigned
+oldLen(u32 pg, unsigned len)
+{
+    return (OldEnd <= pg) ? 0 : (OldEnd - pg < len) ? OldEnd - pg : len;
+}
+
+
+static unsigned
+pages(void)
+{
+    return (End - Start + FLASH_PAGE - 1) / FLASH_PAGE;
+}
+
+
+/*
+ *  Length of the match between the new image at `a' and `src', up to `max'.
+ */
+static unsigned
+matchLen(const u8 * src, u32 a, unsigned max)
+{
+    unsigned n = 0;
+    while (n < max && src[n] == New[a + n])
+        n++;
+    return n;
+}
+
+
+/*
+ *  Make the stream for the given page order.
+ */
+static void
+encode(unsigned flags)
+{
+    static int pageHead[HASH_SIZE];
+    static int pagePrev[FLASH_PAGE];
+    int diff = 0;
+
+    OutLen = 0;
+    put(flags);
+    putWord(OldEnd);
+
+    for (unsigned n = 0; n < pages(); n++)
+    {
+        unsigned len;
+        u32 pg = pageAt(flags, n, &len);
+
+        putWord(crc32c(0, &Old[pg], oldLen(pg, len)));
+        putWord(crc32c(0, &New[pg], len));
+
+        /*
+         *  The part of the old image that may still be copied from.
+         */
+        u32 lo = Start;
+        u32 hi = OldEnd;
+        if (flags & DF_DOWN)
+        {
+            if (hi > pg + FLASH_PAGE)
+                hi = pg + FLASH_PAGE;
+        }
+        else if (lo < pg)
+            lo = pg;
+
+        for (int i = 0; i < HASH_SIZE; i++)
+            pageHead[i] = -1;
+
+        unsigned lit = 0;           //  Literal bytes waiting
+        unsigned o = 0;
+
+        while (o < len)
+        {
+            u32 a = pg + o;
+            unsigned room = len - o;
+            int best = 0;           //  Bytes saved by the best choice
+            unsigned bestLen = 0;
+            unsigned bestOp = DL_LITERAL;
+            int bestArg = 0;
+
+            /*
+             *  Copy from the old image at the same distance as last time.
+             */
+            u32 src = a + diff;
+            if (src >= lo && src < hi)
+            {
+                unsigned max = (hi - src < room) ? hi - src : room;
+                unsigned l = matchLen(&Old[src], a, max);
+                int save = l - tagLen(l) - 1;
+                if (l > 0 && save > best)
+                {
+                    best = save;
+                    bestLen = l;
+                    bestOp = DL_COPY;
+                    bestArg = diff;
+                }
+            }
+
+            if (room >= MIN_MATCH)
+            {
+                unsigned h = hash(&New[a]);
+
+                /*
+                 *  Copy from elsewhere in the old image.
+                 */
+                int tries = CHAIN_LIMIT;
+                for (int s = oldHead[h]; s >= 0 && tries-- > 0; s = oldPrev[s])
+                {
+                    if ((u32)s < lo)
+                        break;
+                    if ((u32)s + MIN_MATCH > hi)
+                        continue;
+
+                    unsigned max = (hi - s < room) ? hi - s : room;
+                    unsigned l = matchLen(&Old[s], a, max);
+                    int d = s - (int)a;
+                    int save = l - tagLen(l) - numberLen(zigzag(d - diff));
+                    if (save > best)
+                    {
+                        best = save;
+                        bestLen = l;
+                        bestOp = DL_COPY;
+                        bestArg = d;
+                    }
+                }
+
+                /*
+                 *  Copy from earlier in this page.
+                 */
+                tries = CHAIN_LIMIT;
+                for (int p = pageHead[h]; p >= 0 && tries-- > 0; p = pagePrev[p])
+                {
+                    unsigned l = matchLen(&New[pg + p], a, room);
+                    unsigned d = o - p;
+                    int save = l - tagLen(l) - numberLen(d - 1);
+                    if (save > best)
+                    {
+                        best = save;
+                        bestLen = l;
+                        bestOp = DL_MATCH;
+                        bestArg = d;
+                    }
+                }
+            }
+
+            /*
+             *  A copy that breaks a run of literals costs a tag later on.
+             */
+            if (bestOp == DL_LITERAL || best <= (lit ? 1 : 0))
+            {
+                bestOp = DL_LITERAL;
+                bestLen = 1;
+            }
+            else
+            {
+                if (lit)
+                {
+                    putTag(DL_LITERAL, lit);
+                    for (unsigned i = o - lit; i < o; i++)
+                        put(New[pg + i]);
+                    lit = 0;
+                }
+
+                putTag(bestOp, bestLen);
+                if (bestOp == DL_COPY)
+                {
+                    putNumber(zigzag(bestArg - diff));
+                    diff = bestArg;
+                }
+                else
+                    putNumber(bestArg - 1);
+            }
+
+            /*
+             *  Add the bytes done to the page's hash chains.
+             */
+            for (unsigned i = 0; i < bestLen; i++, o++)
+            {
+                if (bestOp == DL_LITERAL)
+                    lit++;
+                if (o + MIN_MATCH <= len)
+                {
+                    unsigned h = hash(&New[pg + o]);
+                    pagePrev[o] = pageHead[h];
+                    pageHead[h] = o;
+                }
+            }
+        }
+
+        if (lit)
+        {
+            putTag(DL_LITERAL, lit);
+            for (unsigned i = o - lit; i < o; i++)
+                put(New[pg + i]);
+        }
+    }
+}
+
+/**********************************************************************/
+
+static u32
+word(const u8 * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+
+/*
+ *  Run the stream as the loader does, writing pages in place over a copy
+ *  of the old image, and checking each page's CRCs before and after.
+ *  Returns the CRC of the pages, or errors out.
+ */
+static u32
+check(void)
+{
+    u8 * flash = malloc(FLASH_SIZE);
+    u8 page[FLASH_PAGE];
+    unsigned in = 0;
+    u32 crc = 0;
+    int diff = 0;
+
+    memcpy(flash, Old, FLASH_SIZE);
+
+#define GET()   ((in < OutLen) ? Out[in++] : (errx(1, "check: overrun"), 0))
+#define GET32() ((in + 4 <= OutLen) ? (in += 4, word(&Out[in - 4])) : \
+                 (errx(1, "check: overrun"), 0))
+    unsigned flags = GET();
+    if (GET32() != OldEnd)
+        errx(1, "check: wrong old image end");
+
+    for (unsigned n = 0; n < pages(); n++)
+    {
+        unsigned len;
+        u32 pg = pageAt(flags, n, &len);
+        unsigned o = 0;
+
+        u32 oldCRC = GET32();
+        u32 newCRC = GET32();
+        if (crc32c(0, &flash[pg], oldLen(pg, len)) != oldCRC)
+            errx(1, "check: page %x isn't the old image", pg);
+
+        while (o < len)
+        {
+            unsigned tag = GET();
+            unsigned c = tag & 0x3f;
+            if (c == 0x3f)
+            {
+                unsigned x = 0, s = 0, b;
+                do { b = GET(); x |= (b & 0x7f) << s; s += 7; } while (b & 0x80);
+                c += x;
+            }
+            c += 1;
+            if (c > len - o)
+                errx(1, "check: operation crosses a page");
+
+            unsigned x = 0, s = 0, b;
+            if (tag >> 6 != DL_LITERAL)
+                do { b = GET(); x |= (b & 0x7f) << s; s += 7; } while (b & 0x80);
+
+            switch (tag >> 6)
+            {
+            case DL_LITERAL:
+                while (c-- > 0)
+                    page[o++] = GET();
+                break;
+
+            case DL_COPY:
+                diff += (x & 1) ? ~(x >> 1) : (x >> 1);
+                u32 src = pg + o + diff;
+                if ((flags & DF_DOWN) ? src + c > pg + FLASH_PAGE : src < pg)
+                    errx(1, "check: copy from a page already written");
+                while (c-- > 0)
+                    page[o++] = flash[src++];
+                break;
+
+            case DL_MATCH:
+                if (x + 1 > o)
+                    errx(1, "check: match before the page");
+                while (c-- > 0)
+                {
+                    page[o] = page[o - x - 1];
+                    o++;
+                }
+                break;
+
+            default:
+                errx(1, "check: bad operation");
+            }
+        }
+
+        if (crc32c(0, page, len) != newCRC)
+            errx(1, "check: page %x built wrong", pg);
+        crc = crc32c(crc, page, len);
+        memset(&flash[pg], 0xff, FLASH_PAGE);
+        memcpy(&flash[pg], page, len);
+    }
+#undef GET
+#undef GET32
+
+    if (in != OutLen)
+        errx(1, "check: %u bytes left over", OutLen - in);
+    if (memcmp(&flash[Start], &New[Start], End - Start) != 0)
+        errx(1, "check: the image built is wrong");
+
+    free(flash);
+    return crc;
+}
+
+/**********************************************************************/
+
+static u32
+load(const char * name, u8 * mem)
+{
+    FILE * fd = fopen(name, "r");
+    if (!fd)
+        err(1, "can't open %s", name);
+
+    u32 n = fread(&mem[Start], 1, FLASH_SIZE - Start, fd);
+    if (!feof(fd))
+        errx(1, "%s is too big to load at %x", name, Start);
+    fclose(fd);
+
+    return Start + n;
+}
+
+
+static void
+put32(FILE * fd, u32 x)
+{
+    u8 b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b, 1, 4, fd);
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    u32 version = 0;
+    u32 base = 0;
+    int i;
+
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+        switch (argv[i][1])
+        {
+        case 'v':
+            version = strtoul(argv[i + 1], 0, 0);
+            break;
+
+        case 'b':
+            base = strtoul(argv[i + 1], 0, 0);
+            break;
+
+        default:
+            errx(1, "invalid option %s", argv[i]);
+        }
+    }
+
+    if (argc - i != 4)
+    {
+        fprintf(stderr, "usage: %s [-v version] [-b base] "
+                        "start old.bin new.bin out.sud\n", argv[0]);
+        exit(1);
+    }
+
+    Start = strtoul(argv[i], 0, 0);
+    if (Start < FLASH_PAGE || Start >= FLASH_SIZE || (Start & (FLASH_PAGE - 1)))
+        errx(1, "start address %x is not a page in flash", Start);
+
+    /*
+     *  Load the images into models of the flash.  The loader wants at least
+     *  a page, and whole chunks.
+     */
+    Old = malloc(FLASH_SIZE);
+    New = malloc(FLASH_SIZE);
+    memset(Old, 0xff, FLASH_SIZE);
+    memset(New, 0xff, FLASH_SIZE);
+    OldEnd = load(argv[i + 1], Old);
+    End = load(argv[i + 2], New);
+    End = (End + SU_CHUNK - 1) & ~(SU_CHUNK - 1);
+    if (End < Start + FLASH_PAGE)
+        End = Start + FLASH_PAGE;
+    if (End > FLASH_SCRATCH || OldEnd > FLASH_SCRATCH)
+        errx(1, "an image runs into the loader's scratch page (%x)",
+             FLASH_SCRATCH);
+
+    oldHead = malloc(HASH_SIZE * sizeof (int));
+    oldPrev = malloc(FLASH_SIZE * sizeof (int));
+    for (int h = 0; h < HASH_SIZE; h++)
+        oldHead[h] = -1;
+    for (u32 a = Start; a + MIN_MATCH <= OldEnd; a++)
+    {
+        unsigned h = hash(&Old[a]);
+        oldPrev[a] = oldHead[h];
+        oldHead[h] = a;
+    }
+
+    /*
+     *  Try both page orders.
+     */
+    Out = malloc(2 * (End - Start) + FLASH_SIZE);
+    encode(0);
+    unsigned upLen = OutLen;
+    encode(DF_DOWN);
+    if (upLen < OutLen)
+        encode(0);
+
+    u32 crc = check();
+    if (OutLen >= (1 << 18))
+        errx(1, "delta is too big (%u bytes)", OutLen);
+
+    FILE * fd = fopen(argv[i + 3], "w");
+    if (!fd)
+        err(1, "can't create %s", argv[i + 3]);
+
+    put32(fd, 0x4c445553);                  //  "SUDL"
+    put32(fd, version);
+    put32(fd, base);
+    put32(fd, Start);
+    put32(fd, End);
+    put32(fd, crc);
+    put32(fd, OutLen);
+    fwrite(Out, 1, OutLen, fd);
+    fclose(fd);
+
+    printf("%x..%x: %u bytes, delta %u bytes (%u chunks, %s), crc %08x\n",
+           Start, End, End - Start, OutLen,
+           (OutLen + SU_CHUNK - 1) / SU_CHUNK,
+           (Out[0] & DF_DOWN) ? "down" : "up", crc);
+
+    exit(0);
+}
@@ -0,0 +1,541 @@
+/*
+ *  Turn a tracer's tachyon log into a timeline.
+ *
+ *      tachy [-c] [-s dir ...] [-o out.json] [host [port]]
+ *      tachy -f capture [-s dir ...] [-o out.json]
+ *
+ *  The log is fetched with the tracer's "tachyon" command (debug/tachyon.c)
+ *  through the segger's RTT server, as tools/tn does;  with -c it is
+ *  streamed ("tachyon stream") until ^C.  With -f, the "!ty" lines are
+ *  picked out of a saved copy of the debug output instead.
+ *
+ *  The output is Chrome trace event JSON, for chrome://tracing or
+ *  ui.perfetto.dev.  Ids are named from the sources under each -s
+ *  directory:  a TachyonLog call may end with a comment like
+ *
+ *      TachyonLog1(601, addr);         // tachy: flash begin
+ *
+ *  which names the entries with id 601 "flash".  "begin" and "end" make
+ *  the entries the ends of a span, with each name on its own track;
+ *  without them, an entry is an instant.  Unannotated ids are named by
+ *  the file and line of their TachyonLog call, or just by the number.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <signal.h>
+#include <errno.h>
+#include <err.h>
+
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+
+char * Host = "localhost";
+int Port = 19021;
+int Conn = -1;
+int Stream;
+char * CaptureFile;
+FILE * Out;
+
+volatile int Stop;
+
+/**********************************************************************/
+
+/*
+ *  Names, from the sources.
+ */
+#define KIND_INSTANT    0
+#define KIND_BEGIN      1
+#define KIND_END        2
+
+typedef struct Name_t Name_t;
+struct Name_t
+{
+    Name_t *    next;
+    unsigned    id;
+    char *      name;
+    int         kind;
+    int         track;                  //  For spans
+    bool        annotated;
+};
+
+Name_t * Names;
+int Tracks;                             //  Span tracks (tid 1 on)
+
+
+static Name_t *
+lookup(unsigned id)
+{
+    for (Name_t * np = Names; np; np = np->next)
+        if (np->id == id)
+            return np;
+    return 0;
+}
+
+
+/*
+ *  Spans with the same name share a track.
+ */
+static int
+track(const char * name)
+{
+    for (Name_t * np = Names; np; np = np->next)
+        if (np->kind != KIND_INSTANT && np->name &&
+            strcmp(np->name, name) == 0)
+            return np->track;
+    return ++Tracks;
+}
+
+
+static void
+scanLine(const char * file, int line, const char * s)
+{
+    const char * p = strstr(s, "TachyonLog");
+    if (!p)
+        return;
+    p += 10;
+    if (*p == '1' || *p == '2')
+        p++;
+    while (*p == ' ')
+        p++;
+    if (*p++ != '(')
+        return;
+
+    char * e;
+    unsigned id = strtoul(p, &e, 0);
+    if (e == p)
+        return;
+
+    Name_t * np = lookup(id);
+    const char * a = strstr(e, "tachy:");
+    if (np && (np->annotated || !a))
+        return;
+
+    if (!np)
+    {
+        np = calloc(1, sizeof *np);
+        np->id = id;
+        np->next = Names;
+        Names = np;
+    }
+    free(np->name);
+    np->name = 0;
+
+    char buf[256];
+    if (a)
+    {
+        /*
+         *  "tachy: <name> [begin|end]"
+         */
+        for (a += 6; *a == ' '; a++)
+            ;
+        snprintf(buf, sizeof buf, "%s", a);
+        int n = strlen(buf);
+        while (n > 0 && isspace((u8)buf[n - 1]))
+            buf[--n] = '\0';
+
+        np->kind = KIND_INSTANT;
+        if (n > 6 && strcmp(&buf[n - 6], " begin") == 0)
+        {
+            np->kind = KIND_BEGIN;
+            buf[n - 6] = '\0';
+        }
+        else if (n > 4 && strcmp(&buf[n - 4], " end") == 0)
+        {
+            np->kind = KIND_END;
+            buf[n - 4] = '\0';
+        }
+        np->annotated = true;
+        if (np->kind != KIND_INSTANT)
+            np->track = track(buf);
+    }
+    else
+    {
+        const char * f = strrchr(file, '/');
+        snprintf(buf, sizeof buf, "%s:%d", f ? f + 1 : file, line);
+    }
+
+    np->name = strdup(buf);
+}
+
+
+static void
+scan(const char * path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+        err(1, "%s", path);
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR * d = opendir(path);
+        if (!d)
+            err(1, "%s", path);
+        struct dirent * de;
+        while ((de = readdir(d)) != 0)
+        {
+            if (de->d_name[0] == '.')
+                continue;
+            char sub[1024];
+            snprintf(sub, sizeof sub, "%s/%s", path, de->d_name);
+            int n = strlen(de->d_name);
+            if (stat(sub, &st) == 0 && (S_ISDIR(st.st_mode) ||
+                (n > 2 && de->d_name[n - 2] == '.' &&
+                 (de->d_name[n - 1] == 'c' || de->d_name[n - 1] == 'h'))))
+                    scan(sub);
+        }
+        closedir(d);
+        return;
+    }
+
+    FILE * fd = fopen(path, "r");
+    if (!fd)
+        err(1, "%s", path);
+    char buf[1024];
+    for (int line = 1; fgets(buf, sizeof buf, fd); line++)
+        scanLine(path, line, buf);
+    fclose(fd);
+}
+
+/**********************************************************************/
+
+/*
+ *  The events.
+ */
+unsigned Unit = 64000000;               //  Tachyon ticks a second
+bool Started;
+unsigned LastSeq;
+u32 LastTime;
+u64 Time;                               //  Unwrapped time of the last entry
+unsigned Entries;
+unsigned Lost;
+bool First = true;
+
+
+static void
+event(const char * name, const char * ph, int tid, const char * args)
+{
+    fprintf(Out, "%s\n  { \"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, "
+                 "\"pid\": 1, \"tid\": %d%s%s }",
+            First ? "" : ",", name, ph, Time * 1e6 / Unit, tid,
+            (*ph == 'i') ? ", \"s\": \"t\"" : "", args);
+    First = false;
+}
+
+
+static void
+entry(const u32 * w)
+{
+    unsigned seq = w[0];
+    u32 t = w[1];
+    unsigned id = w[2];
+
+    /*
+     *  Skip what we've seen (a second export overlaps the first).
+     */
+    if (Started && (int)(seq - LastSeq) <= 0)
+        return;
+
+    /*
+     *  The cycle counter wraps every minute or so at 64 MHz;  assume the
+     *  entries are closer together than that.
+     */
+    if (Started)
+        Time += (u32)(t - LastTime);
+    char args[128];
+    if (Started && seq != LastSeq + 1)
+    {
+        snprintf(args, sizeof args, ", \"args\": { \"entries\": %u }",
+                 seq - LastSeq - 1);
+        event("lost", "i", 0, args);
+        Lost += seq - LastSeq - 1;
+    }
+    Started = true;
+    LastSeq = seq;
+    LastTime = t;
+    Entries++;
+
+    snprintf(args, sizeof args,
+             ", \"args\": { \"id\": %u, \"x1\": \"0x%x\", \"x2\": \"0x%x\" }",
+             id, w[3], w[4]);
+
+    Name_t * np = lookup(id);
+    if (!np)
+    {
+        np = calloc(1, sizeof *np);
+        np->id = id;
+        char buf[32];
+        snprintf(buf, sizeof buf, "%u", id);
+        np->name = strdup(buf);
+        np->next = Names;
+        Names = np;
+    }
+
+    if (np->kind == KIND_BEGIN)
+        event(np->name, "B", np->track, args);
+    else if (np->kind == KIND_END)
+        event(np->name, "E", np->track, args);
+    else
+        event(np->name, "i", 0, args);
+}
+
+
+/*
+ *  Base-85, as in the tracer's misc/b85.c:  each 5 characters make 4
+ *  bytes (big endian).
+ */
+static bool
+fromBase85(u8 * to, const char * from, unsigned size)
+{
+    static const char digits[] =    "!%&'()*,-./0123456789:;<=>?@AC"
+                                    "DEFGHIJKLMNPQSTUVWXYZ[]_`abcde"
+                                    "fghijklmnopqrstuvwxyz{|}~";
+
+    for (unsigned i = 0; i < size; i += 4)
+    {
+        u32 w = 0;
+        for (int j = 0; j < 5; j++)
+        {
+            const char * d = *from ? strchr(digits, *from++) : 0;
+            if (!d)
+                return false;
+            w = w * 85 + (d - digits);
+        }
+        to[i] = w >> 24;
+        to[i+1] = w >> 16;
+        to[i+2] = w >> 8;
+        to[i+3] = w;
+    }
+
+    return true;
+}
+
+
+/*
+ *  Handle a line of the debug output.  Returns true at the end of the
+ *  export.
+ */
+static bool
+line(const char * s)
+{
+    s = strstr(s, "!ty");
+    if (!s)
+        return false;
+    s += 3;
+
+    if (*s == '_')
+    {
+        u8 b[20];
+        u32 w[5];
+        if (!fromBase85(b, s + 1, sizeof b))
+        {
+            warnx("bad line: %s", s);
+            return false;
+        }
+        for (int i = 0; i < 5; i++)
+            w[i] = b[4*i] | b[4*i+1] << 8 | b[4*i+2] << 16 |
+                   (u32)b[4*i+3] << 24;
+        entry(w);
+    }
+    else if (strncmp(s, " start ", 7) == 0)
+        Unit = strtoul(s + 7, 0, 0);
+    else if (strncmp(s, " end ", 5) == 0)
+        return true;                    //  (Its losses are gaps we've seen)
+
+    return false;
+}
+
+/**********************************************************************/
+
+static void
+Connect(void)
+{
+    struct hostent * host = gethostbyname(Host);
+    if (!host || host->h_addrtype != AF_INET || host->h_length != 4)
+        errx(1, "can't resolve %s", Host);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = *(u32 *)host->h_addr;
+    sa.sin_port = htons(Port);
+
+    Conn = socket(AF_INET, SOCK_STREAM, 0);
+    if (Conn < 0)
+        err(1, "can't create a socket");
+    if (connect(Conn, (struct sockaddr *)&sa, sizeof sa) < 0)
+        err(1, "can't connect to server (%s)", Host);
+}
+
+
+static void
+Send(const char * s)
+{
+    int len = strlen(s);
+    if (write(Conn, s, len) != len)
+        err(1, "can't write to the server");
+}
+
+
+static void
+Catch(int sig)
+{
+    Stop = true;
+}
+
+
+static void
+Fetch(void)
+{
+    Connect();
+    Send("\n");
+    Send(Stream ? "tachyon stream\n" : "tachyon\n");
+
+    if (Stream)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sa_handler = Catch;
+        sigaction(SIGINT, &sa, 0);
+        fprintf(stderr, "streaming;  ^C to stop\n");
+    }
+
+    static char buf[4096];
+    int len = 0;
+    bool stopping = false;
+
+    for (;;)
+    {
+        if (Stop && !stopping)
+        {
+            Send("\n");                 //  Any key ends the stream
+            stopping = true;
+        }
+
+        int x = read(Conn, &buf[len], sizeof buf - 1 - len);
+        if (x < 0 && errno == EINTR)
+            continue;
+        if (x < 0)
+            err(1, "can't read from the socket");
+        if (x == 0)
+            errx(1, "EOF from connection");
+        len += x;
+
+        /*
+         *  Handle the complete lines.
+         */
+        char * s = buf;
+        char * e;
+        while ((e = memchr(s, '\n', &buf[len] - s)) != 0)
+        {
+            *e = '\0';
+            if (line(s))
+                return;
+            s = e + 1;
+        }
+
+        len = &buf[len] - s;
+        memmove(buf, s, len);
+        if (len == sizeof buf - 1)
+            len = 0;
+    }
+}
+
+
+static void
+Read(void)
+{
+    FILE * fd = strcmp(CaptureFile, "-") ? fopen(CaptureFile, "r") : stdin;
+    if (!fd)
+        err(1, "%s", CaptureFile);
+
+    char buf[1024];
+    while (fgets(buf, sizeof buf, fd))
+        line(buf);
+
+    if (fd != stdin)
+        fclose(fd);
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern int optind;
+    extern char * optarg;
+    char * outFile = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "cf:o:s:")) != -1)
+        switch (c)
+        {
+        case 'c':
+            Stream = true;
+            break;
+        case 'f':
+            CaptureFile = optarg;
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        case 's':
+            scan(optarg);
+            break;
+        default:
+            exit(1);
+        }
+
+    if (optind < argc)
+        Host = argv[optind++];
+    if (optind < argc)
+        Port = strtol(argv[optind++], 0, 0);
+
+    Out = outFile ? fopen(outFile, "w") : stdout;
+    if (!Out)
+        err(1, "%s", outFile);
+
+    /*
+     *  Name the tracks, then add the events.
+     */
+    fprintf(Out, "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (int t = 0; t <= Tracks; t++)
+    {
+        const char * name = "events";
+        for (Name_t * np = Names; np; np = np->next)
+            if (t > 0 && np->kind != KIND_INSTANT && np->track == t)
+                name = np->name;
+
+        fprintf(Out, "%s\n  { \"name\": \"thread_name\", \"ph\": \"M\", "
+                     "\"pid\": 1, \"tid\": %d, "
+                     "\"args\": { \"name\": \"%s\" } }",
+                First ? "" : ",", t, name);
+        First = false;
+    }
+
+    if (CaptureFile)
+        Read();
+    else
+        Fetch();
+
+    fprintf(Out, "\n] }\n");
+    if (Out != stdout)
+        fclose(Out);
+
+    fprintf(stderr, "%u entries, %u lost, %.6f s\n",
+            Entries, Lost, (double)Time / Unit);
+    return 0;
+}
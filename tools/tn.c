@@ -1,6 +1,14 @@
 /*
  *  Simple telnet like tool to connect to a puck or relay v.2 via a segger.
  *  (It was easier to write this than get telnet to work the way we want.
+ *
+ *  With -u, send a software update to a tracer instead (see the tracer's
+ *  store/su.c), then exit:
+ *
+ *      tn -u image.bin -a start -v version [host [port]]
+ *      tn -u image.sud [host [port]]       (a delta, from sudelta)
+ *
+ *  -w sets how many chunks may be waiting to be written to flash.
  */
 
 #include <stdbool.h>
@@ -18,8 +26,10 @@
 #include <signal.h>
 #include <errno.h>
 #include <err.h>
+#include <sys/time.h>
 
 
+typedef unsigned char u8;
 typedef unsigned int u32;
 
 char * Host = "localhost";
@@ -257,6 +267,229 @@ CharacterLoop(void)
     }
 }
 
+/**********************************************************************/
+/*
+ *  Software update.
+ */
+
+#define SU_CHUNK    64
+
+char *  UpdateFile;
+u32     UpdateStart;
+u32     UpdateVersion;
+int     UpdateWindow = 16;
+
+
+static u32
+Crc32c(u32 crc, const u8 * p, unsigned len)
+{
+    u32 c = ~crc;
+
+    while (len-- > 0)
+    {
+        c ^= *p++;
+        for (int i = 0; i < 8; i++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+
+    return ~c;
+}
+
+
+/*
+ *  Base-85, as in the tracer's misc/b85.c:  each 4 bytes (big endian) make
+ *  5 characters.
+ */
+static char *
+Base85(char * to, const u8 * from, unsigned size)
+{
+    static const char digits[] =    "!%&'()*,-./0123456789:;<=>?@AC"
+                                    "DEFGHIJKLMNPQSTUVWXYZ[]_`abcde"
+                                    "fghijklmnopqrstuvwxyz{|}~";
+
+    for (unsigned i = 0; i < size; i += 4)
+    {
+        u32 w = from[i] << 24 | from[i+1] << 16 | from[i+2] << 8 | from[i+3];
+        for (int j = 4; j >= 0; j--)
+        {
+            to[j] = digits[w % 85];
+            w /= 85;
+        }
+        to += 5;
+    }
+
+    return to;
+}
+
+
+static void
+Send(const char * buf, int len)
+{
+    int x = write(Conn, buf, len);
+    if (x < 0)
+        err(1, "can't write to the server");
+    if (x < len)
+        errx(1, "can't write all data to the server (%d of %d)", x, len);
+}
+
+
+/*
+ *  Wait for the next "!su" reply, and return the rest of its line.
+ */
+static char *
+Reply(void)
+{
+    static char buf[4096];
+    static int len;
+    static int used;
+    static char line[256];
+
+    for (;;)
+    {
+        /*
+         *  Look for a complete reply in what we have.
+         */
+        for (int i = used; i + 4 <= len; i++)
+        {
+            if (memcmp(&buf[i], "!su ", 4) != 0)
+                continue;
+
+            char * e = memchr(&buf[i], '\n', len - i);
+            if (!e)
+                break;
+
+            int n = e - &buf[i + 4];
+            if (n >= (int)sizeof line)
+                n = sizeof line - 1;
+            memcpy(line, &buf[i + 4], n);
+            line[n] = '\0';
+            used = e + 1 - &buf[0];
+            return line;
+        }
+
+        /*
+         *  Keep only a possible partial reply, then read some more.
+         */
+        int keep = (len - used < 256) ? len - used : 256;
+        memmove(&buf[0], &buf[len - keep], keep);
+        len = keep;
+        used = 0;
+
+        int x = read(Conn, &buf[len], sizeof buf - len);
+        if (x < 0)
+            err(1, "can't read from the socket");
+        if (x == 0)
+            errx(1, "EOF from connection");
+        len += x;
+    }
+}
+
+
+void
+Update(void)
+{
+    /*
+     *  Read the image, or the delta.
+     */
+    FILE * fd = fopen(UpdateFile, "r");
+    if (!fd)
+        err(1, "can't open %s", UpdateFile);
+
+    static u8 file[0x80000 + 64];
+    unsigned size = fread(file, 1, sizeof file - SU_CHUNK, fd);
+    fclose(fd);
+
+    char cmd[128];
+    u8 * data = &file[0];
+    unsigned base = UpdateStart;        //  Address of the first chunk
+
+    if (size >= 28 && memcmp(file, "SUDL", 4) == 0)
+    {
+        u32 h[7];
+        for (int i = 0; i < 7; i++)
+            h[i] = file[4*i] | file[4*i+1] << 8 |
+                   file[4*i+2] << 16 | (u32)file[4*i+3] << 24;
+        if (size != 28 + h[6])
+            errx(1, "%s: bad delta", UpdateFile);
+
+        data += 28;
+        size = h[6];
+        base = 0;
+        snprintf(cmd, sizeof cmd, "su %x %x %x %x %x %x\n",
+                 h[3], h[4], h[1], h[6], h[2], h[5]);
+    }
+    else
+    {
+        if (UpdateStart == 0)
+            errx(1, "an image needs a start address (-a)");
+        size = (size + SU_CHUNK - 1) & ~(SU_CHUNK - 1);
+        if (size < 4096)
+            size = 4096;
+        snprintf(cmd, sizeof cmd, "su %x %x %x\n",
+                 UpdateStart, UpdateStart + size, UpdateVersion);
+    }
+    memset(&data[size], 0xff, &file[sizeof file] - &data[size]);
+
+    /*
+     *  Send the header, and wait for the go ahead.
+     */
+    Send("\n", 1);
+    Send(cmd, strlen(cmd));
+
+    char * r = Reply();
+    unsigned seq, chunks;
+    if (sscanf(r, "ready %u %u", &seq, &chunks) != 2)
+        errx(1, "update refused: %s", r);
+    if (chunks != (size + SU_CHUNK - 1) / SU_CHUNK)
+        errx(1, "tracer expects %u chunks", chunks);
+
+    /*
+     *  Keep the window full of chunks, until all are in flash.
+     */
+    struct timeval t0, t1;
+    gettimeofday(&t0, 0);
+
+    unsigned sent = 0;
+    unsigned acked = 0;
+    while (acked < chunks)
+    {
+        while (sent < chunks && sent - acked < (unsigned)UpdateWindow)
+        {
+            u8 buf[SU_CHUNK + 4];
+            u32 addr = base + sent * SU_CHUNK;
+            u8 a[4] = { addr, addr >> 8, addr >> 16, addr >> 24 };
+
+            memcpy(buf, &data[sent * SU_CHUNK], SU_CHUNK);
+            u32 crc = Crc32c(Crc32c(0, a, 4), buf, SU_CHUNK);
+            buf[SU_CHUNK + 0] = crc;
+            buf[SU_CHUNK + 1] = crc >> 8;
+            buf[SU_CHUNK + 2] = crc >> 16;
+            buf[SU_CHUNK + 3] = crc >> 24;
+
+            char line[128];
+            line[0] = '_';
+            char * e = Base85(&line[1], buf, sizeof buf);
+            *e++ = '\n';
+            Send(line, e - line);
+            sent++;
+        }
+
+        r = Reply();
+        if (sscanf(r, "%u", &acked) != 1)
+            errx(1, "update failed: %s", r);
+        fprintf(stderr, "\r%u/%u", acked, chunks);
+    }
+
+    r = Reply();
+    if (strncmp(r, "done", 4) != 0)
+        errx(1, "update failed: %s", r);
+
+    gettimeofday(&t1, 0);
+    double t = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) * 1e-6;
+    fprintf(stderr, "\rsent %u chunks (sequence %u) in %.1f s, %.0f bytes/s\n",
+            chunks, seq, t, chunks * SU_CHUNK / t);
+}
+
 /**********************************************************************/
 
 int
@@ -269,9 +502,23 @@ main(int argc, char ** argv)
     extern char * optarg;
     int c;
 
-    while ((c = getopt(argc, argv, "")) != -1)
+    while ((c = getopt(argc, argv, "u:a:v:w:")) != -1)
         switch (c)
         {
+        case 'u':
+            UpdateFile = optarg;
+            break;
+        case 'a':
+            UpdateStart = strtoul(optarg, 0, 0);
+            break;
+        case 'v':
+            UpdateVersion = strtoul(optarg, 0, 0);
+            break;
+        case 'w':
+            UpdateWindow = strtol(optarg, 0, 0);
+            break;
+        default:
+            exit(1);
         }
 
     if (optind < argc)
@@ -284,6 +531,12 @@ main(int argc, char ** argv)
      */
     Connect();
 
+    if (UpdateFile)
+    {
+        Update();
+        return 0;
+    }
+
     /*
      *  Set up the local terminal.
      */
@@ -0,0 +1,393 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  ANT+ data page decoders (see antplus.h).
+ */
+
+#include "types.h"
+#include "app/antplus.h"
+
+/**********************************************************************/
+/*
+ *  Unit conversions, to fixed point.
+ */
+
+/*
+ *  1/1024 s (event times) to ms.
+ */
+static inline u32
+ms1024(const u8 * p)
+{
+    return OqGet16(p) * 1000 / 1024;
+}
+
+
+/*
+ *  An integer part and a 1/16 fraction (in the top nibble of `f') to 2
+ *  decimal places.
+ */
+static inline u32
+sixteenths(unsigned i, unsigned f)
+{
+    return i * 100 + (f >> 4) * 100 / 16;
+}
+
+
+/*
+ *  SDM speed:  a 4 bit integer part and a 1/256 fraction, in m/s, to 3
+ *  decimal places.
+ */
+static inline u32
+sdmSpeed(const u8 * p)
+{
+    return (p[4] & 0x0f) * 1000 + p[5] * 1000 / 256;
+}
+
+
+static inline u32
+get24(const u8 * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16;
+}
+
+/**********************************************************************/
+/*
+ *  Common pages, 80 and up, sent now and then by most devices.
+ */
+
+static const AntPage_t commonPages[] =
+{
+    { "manufacturer", 3, {{ "hw", "", 0 }, { "mfr", "", 0 },
+                          { "model", "", 0 }} },
+    { "product", 3, {{ "sw", "", 0 }, { "swx", "", 0 },
+                     { "serial", "", 0 }} },
+    { "battery", 2, {{ "batt", "V", 2 }, { "status", "", 0 }} },
+};
+
+
+static const AntPage_t *
+commonDecode(const u8 * p, u32 * v)
+{
+    switch (p[0])
+    {
+    case 0x50:
+        v[0] = p[3];
+        v[1] = OqGet16(&p[4]);
+        v[2] = OqGet16(&p[6]);
+        return &commonPages[0];
+
+    case 0x51:
+        v[0] = p[3];
+        v[1] = p[2];
+        v[2] = OqGet32(&p[4]);
+        return &commonPages[1];
+
+    case 0x52:
+        v[0] = (p[7] & 0x0f) * 100 + p[6] * 100 / 256;
+        v[1] = (p[7] >> 4) & 7;
+        return &commonPages[2];
+    }
+
+    return 0;
+}
+
+/**********************************************************************/
+/*
+ *  Heart rate monitor.  Every page ends with the beat time, beat count and
+ *  heart rate;  the first three bytes depend on the page (the top bit of
+ *  the page number toggles every 4 messages).
+ */
+
+#define HRM_FIELDS      { "hr", "bpm", 0 }, { "beats", "", 0 },     \
+                        { "beat", "s", 3 }
+
+static const AntPage_t hrmPages[] =
+{
+    { "hrm", 3, { HRM_FIELDS } },
+    { "hrm", 4, { HRM_FIELDS, { "uptime", "s", 0 } } },
+    { "hrm", 5, { HRM_FIELDS, { "mfr", "", 0 }, { "serial", "", 0 } } },
+    { "hrm", 6, { HRM_FIELDS, { "hw", "", 0 }, { "sw", "", 0 },
+                  { "model", "", 0 } } },
+    { "hrm", 4, { HRM_FIELDS, { "prev", "s", 3 } } },
+};
+
+
+static const AntPage_t *
+hrmDecode(const u8 * p, u32 * v)
+{
+    unsigned page = p[0] & 0x7f;
+
+    v[0] = p[7];
+    v[1] = p[6];
+    v[2] = ms1024(&p[4]);
+
+    switch (page)
+    {
+    case 1:
+        v[3] = get24(&p[1]) * 2;
+        break;
+
+    case 2:
+        v[3] = p[1];
+        v[4] = OqGet16(&p[2]);
+        break;
+
+    case 3:
+        v[3] = p[1];
+        v[4] = p[2];
+        v[5] = p[3];
+        break;
+
+    case 4:
+        v[3] = ms1024(&p[2]);
+        break;
+
+    default:
+        page = 0;
+        break;
+    }
+
+    return &hrmPages[page];
+}
+
+/**********************************************************************/
+/*
+ *  Bicycle speed, and cadence, sensors.  Like the heart rate monitor,
+ *  every page ends with the event time and count.
+ */
+
+#define BSC_PAGES(name, revs)                                               \
+    { name, 2, { { "time", "s", 3 }, { revs, "", 0 } } },                   \
+    { name, 3, { { "time", "s", 3 }, { revs, "", 0 },                       \
+                 { "uptime", "s", 0 } } },                                  \
+    { name, 4, { { "time", "s", 3 }, { revs, "", 0 },                       \
+                 { "mfr", "", 0 }, { "serial", "", 0 } } },                 \
+    { name, 5, { { "time", "s", 3 }, { revs, "", 0 },                       \
+                 { "hw", "", 0 }, { "sw", "", 0 }, { "model", "", 0 } } },  \
+    { name, 4, { { "time", "s", 3 }, { revs, "", 0 },                       \
+                 { "batt", "V", 2 }, { "status", "", 0 } } },               \
+    { name, 3, { { "time", "s", 3 }, { revs, "", 0 },                       \
+                 { "stopped", "", 0 } } }
+
+static const AntPage_t bsPages[] = { BSC_PAGES("speed", "wheel") };
+static const AntPage_t bcPages[] = { BSC_PAGES("cadence", "crank") };
+
+
+static const AntPage_t *
+bscPageDecode(const AntPage_t * pages, const u8 * p, u32 * v)
+{
+    unsigned page = p[0] & 0x7f;
+
+    v[0] = ms1024(&p[4]);
+    v[1] = OqGet16(&p[6]);
+
+    switch (page)
+    {
+    case 1:
+        v[2] = get24(&p[1]) * 2;
+        break;
+
+    case 2:
+        v[2] = p[1];
+        v[3] = OqGet16(&p[2]);
+        break;
+
+    case 3:
+        v[2] = p[1];
+        v[3] = p[2];
+        v[4] = p[3];
+        break;
+
+    case 4:
+        v[2] = (p[3] & 0x0f) * 100 + p[2] * 100 / 256;
+        v[3] = (p[3] >> 4) & 7;
+        break;
+
+    case 5:
+        v[2] = p[1] & 1;
+        break;
+
+    default:
+        page = 0;
+        break;
+    }
+
+    return &pages[page];
+}
+
+
+static const AntPage_t *
+bsDecode(const u8 * p, u32 * v)
+{
+    return bscPageDecode(bsPages, p, v);
+}
+
+
+static const AntPage_t *
+bcDecode(const u8 * p, u32 * v)
+{
+    return bscPageDecode(bcPages, p, v);
+}
+
+
+/*
+ *  The combined sensor has just the one page, with no page number.
+ */
+static const AntPage_t bscPage =
+{
+    "bsc", 4, { { "ctime", "s", 3 }, { "crank", "", 0 },
+                { "stime", "s", 3 }, { "wheel", "", 0 } }
+};
+
+
+static const AntPage_t *
+bscDecode(const u8 * p, u32 * v)
+{
+    v[0] = ms1024(&p[0]);
+    v[1] = OqGet16(&p[2]);
+    v[2] = ms1024(&p[4]);
+    v[3] = OqGet16(&p[6]);
+    return &bscPage;
+}
+
+/**********************************************************************/
+/*
+ *  Stride based speed and distance monitor.
+ */
+
+static const AntPage_t sdmPages[] =
+{
+    { "sdm", 5, { { "time", "s", 2 }, { "dist", "m", 2 },
+                  { "speed", "m/s", 3 }, { "strides", "", 0 },
+                  { "latency", "s", 3 } } },
+    { "sdm", 3, { { "cadence", "spm", 2 }, { "speed", "m/s", 3 },
+                  { "status", "", 0 } } },
+    { "sdm", 3, { { "cadence", "spm", 2 }, { "speed", "m/s", 3 },
+                  { "cal", "kcal", 0 } } },
+};
+
+
+static const AntPage_t *
+sdmDecode(const u8 * p, u32 * v)
+{
+    switch (p[0])
+    {
+    case 1:
+        v[0] = p[2] * 100 + p[1] / 2;
+        v[1] = sixteenths(p[3], p[4]);
+        v[2] = sdmSpeed(p);
+        v[3] = p[6];
+        v[4] = p[7] * 1000 / 32;
+        return &sdmPages[0];
+
+    case 2:
+    case 3:
+        v[0] = sixteenths(p[3], p[4]);
+        v[1] = sdmSpeed(p);
+        v[2] = (p[0] == 2) ? p[7] : p[6];
+        return &sdmPages[p[0] - 1];
+    }
+
+    return commonDecode(p, v);
+}
+
+/**********************************************************************/
+/*
+ *  Bicycle power meter.
+ */
+
+#define BPWR_TORQUE(name, ticks)                                            \
+    { name, 5, { { "events", "", 0 }, { ticks, "", 0 },                     \
+                 { "cadence", "rpm", 0 }, { "period", "s", 3 },             \
+                 { "torque", "Nm", 2 } } }
+
+static const AntPage_t bpwrPages[] =
+{
+    { "power", 5, { { "events", "", 0 }, { "balance", "", 0 },
+                    { "cadence", "rpm", 0 }, { "accum", "W", 0 },
+                    { "power", "W", 0 } } },
+    BPWR_TORQUE("wheel", "ticks"),
+    BPWR_TORQUE("crank", "ticks"),
+};
+
+
+static const AntPage_t *
+bpwrDecode(const u8 * p, u32 * v)
+{
+    switch (p[0])
+    {
+    case 0x10:
+        v[0] = p[1];
+        v[1] = p[2];
+        v[2] = p[3];
+        v[3] = OqGet16(&p[4]);
+        v[4] = OqGet16(&p[6]);
+        return &bpwrPages[0];
+
+    case 0x11:
+    case 0x12:
+        v[0] = p[1];
+        v[1] = p[2];
+        v[2] = p[3];
+        v[3] = OqGet16(&p[4]) * 1000 / 2048;
+        v[4] = OqGet16(&p[6]) * 100 / 32;
+        return &bpwrPages[p[0] - 0x10];
+    }
+
+    return commonDecode(p, v);
+}
+
+/**********************************************************************/
+
+AntDecoder_t * const AntDecoders[256] =
+{
+    [ANTPLUS_BPWR] =    bpwrDecode,
+    [ANTPLUS_HRM] =     hrmDecode,
+    [ANTPLUS_BSC] =     bscDecode,
+    [ANTPLUS_BC] =      bcDecode,
+    [ANTPLUS_BS] =      bsDecode,
+    [ANTPLUS_SDM] =     sdmDecode,
+};
+
+/**********************************************************************/
@@ -0,0 +1,117 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  ANT+ data page decoders.
+ *
+ *  A decoder turns the 8 byte payload of a master's broadcast into the
+ *  sensor values it carries.  There's one for each device type known,
+ *  found in a table indexed by the device type, so finding it costs a
+ *  load.  Each decoder is straight line code over the payload (a switch
+ *  on the page number, and a few shifts and multiplies), so its cost is
+ *  bounded, and small enough for the super loop.
+ *
+ *  The values come back as unsigned fixed point numbers, described by the
+ *  page the decoder returns:  the name of each field, its unit, and the
+ *  number of decimal places.  Nothing here depends on the rest of the
+ *  firmware, so the same code can be built on a host.
+ *
+ *  The page layouts are those of nordic/components/ant/ant_profiles.
+ */
+
+#ifndef __ANTPLUS_H__
+#define __ANTPLUS_H__
+
+#include "types.h"
+
+/**********************************************************************/
+
+/*
+ *  Device types.
+ */
+#define ANTPLUS_BPWR            0x0b    //  Bicycle power
+#define ANTPLUS_HRM             0x78    //  Heart rate monitor
+#define ANTPLUS_BSC             0x79    //  Bicycle speed and cadence
+#define ANTPLUS_BC              0x7a    //  Bicycle cadence
+#define ANTPLUS_BS              0x7b    //  Bicycle speed
+#define ANTPLUS_SDM             0x7c    //  Stride based speed and distance
+
+#define ANTPLUS_FIELDS          6       //  Most values on a page
+
+typedef struct
+{
+    const char *    name;
+    const char *    unit;
+    u8              decimals;           //  Value is in 10^-decimals units
+}
+    AntField_t;
+
+typedef struct
+{
+    const char *    name;
+    u8              fields;
+    AntField_t      field[ANTPLUS_FIELDS];
+}
+    AntPage_t;
+
+/*
+ *  Decode `payload' into `value' (ANTPLUS_FIELDS of them), returning the
+ *  page that describes them, or 0 if the page isn't known.
+ */
+typedef const AntPage_t * AntDecoder_t(const u8 * payload, u32 * value);
+
+extern AntDecoder_t * const AntDecoders[256];
+
+
+static inline const AntPage_t *
+AntDecode(unsigned devType, const u8 * payload, u32 * value)
+{
+    AntDecoder_t * dp = AntDecoders[devType & 0xff];
+    return dp ? dp(payload, value) : 0;
+}
+
+/**********************************************************************/
+
+#endif // __ANTPLUS_H__
+
+/**********************************************************************/
@@ -0,0 +1,229 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Fixing packets that fail their CRC (see crcfix.h).
+ */
+
+#include "types.h"
+#include "defs.h"
+#include "app/crcfix.h"
+
+/**********************************************************************/
+
+#define DATA_BITS       (8 * CRCFIX_BYTES)
+#define BITS            (DATA_BITS + 16)        //  And the CRC's own
+
+/*
+ *  The syndrome of each single bit error, sorted, and the bit each is
+ *  for.  Bits 0 to DATA_BITS - 1 are the packet's, in the order they're
+ *  sent (most significant first);  the rest are the CRC's.  (Two arrays
+ *  rather than an array of structs, which would be padded:  they take 360
+ *  bytes of RAM, not 480.)
+ */
+static u16      syndromes[BITS];
+static u8       syndromeBits[BITS];
+
+static u16      addrCrc;                //  CRC state after the address
+static u8       agreed;                 //  Good packets that agree on it
+static u8       tries;                  //  Good packets looked at
+
+#define TRIES           32              //  To give up after
+
+/**********************************************************************/
+
+void
+CrcFixSetup(void)
+{
+    for (int b = 0; b < BITS; b++)
+    {
+        u16 s;
+        if (b < DATA_BITS)
+        {
+            u8 e[CRCFIX_BYTES] = { 0 };
+            e[b / 8] = 0x80 >> (b % 8);
+            s = CRC16CCITT(0, e, sizeof e);
+        }
+        else
+            s = 1 << (b - DATA_BITS);
+
+        /*
+         *  (Insertion sort:  it's done once.)
+         */
+        int i = b;
+        while (i > 0 && syndromes[i - 1] > s)
+        {
+            syndromes[i] = syndromes[i - 1];
+            syndromeBits[i] = syndromeBits[i - 1];
+            i--;
+        }
+        syndromes[i] = s;
+        syndromeBits[i] = b;
+    }
+
+    agreed = 0;
+    tries = 0;
+}
+
+
+/*
+ *  Find a syndrome in the table, returning its index, or -1.
+ */
+static int
+find(unsigned s)
+{
+    int lo = 0;
+    int hi = BITS;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (syndromes[mid] < s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < BITS && syndromes[lo] == s) ? lo : -1;
+}
+
+
+static void
+flip(u8 * data, int i)
+{
+    unsigned b = syndromeBits[i];
+    if (b < DATA_BITS)                  //  (Else the CRC was wrong)
+        data[b / 8] ^= 0x80 >> (b % 8);
+}
+
+/**********************************************************************/
+
+/*
+ *  Learn the CRC's state after the address from a good packet, by running
+ *  the CRC backwards over it.  Returns true once it's known.  (If the
+ *  packets don't agree on it, the radio isn't doing what's expected, and
+ *  it's given up on.)
+ */
+bool
+CrcFixLearn(const u8 * data, unsigned crc)
+{
+    if (agreed >= 2 || tries >= TRIES)
+        return agreed >= 2;
+    tries++;
+
+    u16 c = crc;
+    for (int i = CRCFIX_BYTES; i-- > 0; )
+        for (int b = 0; b < 8; b++)
+        {
+            unsigned in = (data[i] >> b) & 1;
+            unsigned fb = c & 1;
+            if (fb)
+                c ^= 0x1021;
+            c = (c >> 1) | ((fb ^ in) << 15);
+        }
+
+    if (agreed > 0 && c == addrCrc)
+        agreed++;
+    else
+    {
+        addrCrc = c;
+        agreed = 1;
+    }
+    return agreed >= 2;
+}
+
+
+bool
+CrcFixReady(void)
+{
+    return agreed >= 2;
+}
+
+
+/*
+ *  Fix a packet that came with `crc', flipping up to `bits' bits (1 or
+ *  2).  Returns the number of bits flipped (0 if the packet was right),
+ *  or -1 if it can't be fixed.
+ */
+int
+CrcFix(u8 * data, unsigned crc, int bits)
+{
+    if (agreed < 2 || bits < 1)
+        return -1;
+
+    unsigned s = CRC16CCITT(addrCrc, data, CRCFIX_BYTES) ^ (crc & 0xffff);
+    if (s == 0)
+        return 0;
+
+    int i = find(s);
+    if (i >= 0)
+    {
+        flip(data, i);
+        return 1;
+    }
+    if (bits < 2)
+        return -1;
+
+    /*
+     *  Each pair of bits would be found twice;  only count it once.
+     */
+    int fi = -1;
+    int fj = -1;
+    for (i = 0; i < BITS; i++)
+    {
+        int j = find(s ^ syndromes[i]);
+        if (j > i)
+        {
+            if (fi >= 0)
+                return -1;              //  Not the only fit
+            fi = i;
+            fj = j;
+        }
+    }
+    if (fi < 0)
+        return -1;
+
+    flip(data, fi);
+    flip(data, fj);
+    return 2;
+}
+
+/**********************************************************************/
@@ -0,0 +1,81 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Fixing packets that fail their CRC.
+ *
+ *  Many of the packets the radio hears with a bad CRC are only a bit or
+ *  two wrong.  The CRC is linear, so the difference between the CRC of
+ *  what was heard and the CRC that came with it (the syndrome) depends
+ *  only on which bits are wrong;  a table of the syndrome of each single
+ *  bit error gives the bit to flip.  A 2 bit error is found by trying
+ *  each bit with the table, and is only taken if exactly one pair of
+ *  bits fits.  (The CRC has a Hamming distance of 4 over a packet, so 2
+ *  bit errors can't always be told apart;  and a badly broken packet can
+ *  have the syndrome of a 1 or 2 bit error, more often the latter.)
+ *
+ *  The radio's CRC covers the address before the packet's 13 bytes;  the
+ *  CRC's state after the address is worked back from packets that came
+ *  in good, so nothing here depends on how the radio puts the address
+ *  on the air.  Until two good packets agree on it, nothing is fixed.
+ */
+
+#ifndef __CRCFIX_H__
+#define __CRCFIX_H__
+
+#include "types.h"
+
+/**********************************************************************/
+
+#define CRCFIX_BYTES    13              //  Packet bytes (after the address)
+
+extern void     CrcFixSetup(void);
+extern bool     CrcFixLearn(const u8 * data, unsigned crc);
+extern bool     CrcFixReady(void);
+extern int      CrcFix(u8 * data, unsigned crc, int bits);
+
+/**********************************************************************/
+
+#endif // __CRCFIX_H__
+
+/**********************************************************************/
@@ -52,6 +52,9 @@
 #include "cpu/atomic.h"
 #include "debug/debug.h"
 #include "debug/tachyon.h"
+#include "app/antplus.h"
+#include "app/crcfix.h"
+#include "assert.h"
 #include "stdlib.h"
 
 /**********************************************************************/
@@ -69,26 +72,65 @@
 
 /**********************************************************************/
 
+/*
+ *  The packet ring.  The radio DMAs each packet into a 16 byte slot:  the
+ *  13 bytes after the address (the channel ID, the ANT flag and the
+ *  payload).  The interrupt handler adds the CRC the packet came with,
+ *  and whether it was good, in the 3 bytes the DMA leaves.  The time and
+ *  RSSI are in arrays of their own, so the slots stay packed and aligned,
+ *  and a run of packets is exported (CAPture) by copying a block of each.
+ *
+ *  The time is kept as the microseconds since the slot before (so 19 bytes
+ *  a packet, and 1724 packets in 32 KB).  A packet that comes longer after
+ *  the one before than that holds, 65 ms, goes in the slot after a time
+ *  slot, which has the whole tachyon count in its first 4 bytes.  (So
+ *  there is a time slot at most every 65 ms, and only ones that come
+ *  further apart than that, which don't fill the ring, take two slots.)
+ */
 #define PACKET_MEMORY   (32*1024)
-#define PACKETS         (PACKET_MEMORY / sizeof (packet_t))
+#define PACKET_BYTES    (sizeof (packet_t) + sizeof (u16) + sizeof (s8))
+#define PACKETS         (PACKET_MEMORY / PACKET_BYTES)
 
 typedef struct
 {
-    u32     time;               //  Time stamp
     u8      data[13];           //  payload
-    u8      __res0;
-    s8      rssi;               //  RSSI
+    u8      crc[2];             //  RXCRC (little endian)
     u8      crcOk;              //  Good CRC
 }
     packet_t;
 
+STATIC_ASSERT(sizeof (packet_t) == 16, packet_slot_not_16_bytes);
+
+/*
+ *  What's in packet_t's `crcOk'.
+ */
+#define CRC_BAD         0
+#define CRC_OK          1
+#define CRC_RECOVERED   2               //  Fixed (app/crcfix.c)
+#define CRC_TIME        3               //  A time slot, not a packet
+
 static int          packetWr;
 static int          packetRd;
 static Atomic_t     packetCnt;
 static int          packetCrcError;
+static unsigned     packetCrcLost;      //  Bad CRCs that couldn't be fixed
+static unsigned     packetCrcFixed[3];  //  By the number of bits fixed
+
+static unsigned     radioFrequency;     //  Frequency the radio was started on
+
+/*
+ *  The packets still waiting when the radio was last retuned, which were
+ *  taken on the frequency before.
+ */
+static unsigned     packetStale;
+static unsigned     packetStaleFrequency;
+
+static packet_t __attribute__ ((aligned(16)))   packets[PACKETS];
+static u16 __attribute__ ((aligned(16)))        packetDelta[PACKETS];
+static s8 __attribute__ ((aligned(16)))         packetRssi[PACKETS];
 
-// static packet_t __attribute__ ((aligned(16)))    packets[PACKETS];
-static packet_t     packets[PACKETS];
+static u32          packetStamp;        //  Time of the last slot written,
+static u32          packetClock;        //  and of the last one read
 
 /**********************************************************************/
 
@@ -103,8 +145,10 @@ peripheralRegionEnClear(void)
 
     // while (NRF_MWU->REGIONEN != 0)
     //     ;
+#if !defined(OQ_TESTING)
     asm volatile ("dsb; nop; nop; nop");
     asm volatile ("nop; nop; nop; nop");
+#endif // !defined(OQ_TESTING)
 
     return v;
 }
@@ -116,8 +160,10 @@ peripheralRegionEnClear(void)
 static inline void
 peripheralRegionEnSet(u32 v)
 {
+#if !defined(OQ_TESTING)
     asm volatile ("dsb; nop; nop; nop");
     asm volatile ("nop; nop; nop; nop");
+#endif // !defined(OQ_TESTING)
 
     NRF_MWU->REGIONENSET = v;
     // while (NRF_MWU->REGIONEN != v)
@@ -148,8 +194,10 @@ radioInterrupt(void)
 
     bool crcOk = (radio->CRCSTATUS != 0);
     pkt->crcOk = crcOk;
-    pkt->time = TachyonGet();
-    pkt->rssi = -((int)radio->RSSISAMPLE);
+    OqPut16(pkt->crc, radio->RXCRC);
+    u32 stamp = TachyonGet();
+    unsigned us = (stamp - packetStamp) / US2TACHY(1);
+    unsigned slots = (us > 0xffff) ? 2 : 1;
 
     /*
      *  Count CRC errors.
@@ -161,15 +209,35 @@ radioInterrupt(void)
      *  If there is still space in the packet buffer, update the packet
      *  write pointer and set the new DMA address.  (We fill all but the
      *  last slot in the packet buffer, so the radio has somewhere to write
-     *  a new packet when the buffer is full.)
+     *  a new packet when the buffer is full.)  Packets with a bad CRC are
+     *  kept too if they're to be fixed, in the super loop.  After a long
+     *  gap, the packet is moved up a slot, to make room for a time slot.
      */
-    if (crcOk && AtomicGet(&packetCnt) < ARRAY_SIZE(packets) - 1)
+    if ((crcOk || Config.confRecover) &&
+        AtomicGet(&packetCnt) < ARRAY_SIZE(packets) - slots)
     {
+        if (slots > 1)
+        {
+            packet_t * next = (packetWr + 1 < ARRAY_SIZE(packets)) ?
+                              pkt + 1 : &packets[0];
+            *next = *pkt;
+            OqPut32(pkt->data, stamp);
+            pkt->crcOk = CRC_TIME;
+            packetDelta[packetWr] = 0;
+            packetWr = next - &packets[0];
+            packetStamp = stamp;
+            us = 0;
+        }
+        else
+            packetStamp += us * US2TACHY(1);
+        packetDelta[packetWr] = us;
+        packetRssi[packetWr] = -((int)radio->RSSISAMPLE);
+
         packetWr++;
         if (packetWr >= ARRAY_SIZE(packets))
             packetWr = 0;
         radio->PACKETPTR = (u32)&packets[packetWr].data[0];
-        AtomicAddAndReturn(&packetCnt, 1);
+        AtomicAddAndReturn(&packetCnt, slots);
     }
 
     /*
@@ -226,7 +294,8 @@ radioStart(void)
     /*
      *  Frequency is set from the config.
      */
-    radio->FREQUENCY = Config.confFrequency;
+    radioFrequency = Config.confFrequency;
+    radio->FREQUENCY = radioFrequency;
 
     /*
      *  TX power is +4dBm, but we should never transmit.
@@ -268,9 +337,10 @@ radioStart(void)
     radio->CRCPOLY = 0x11021;
 
     /*
-     *  Start the DMA at the first packet slot.
+     *  Start the DMA at the current packet slot.  (The radio may be
+     *  restarted with packets still waiting in the buffer.)
      */
-    radio->PACKETPTR = (u32)&packets[0].data[0];
+    radio->PACKETPTR = (u32)&packets[packetWr].data[0];
 
     /*
      *  Normal ramp up, and TX 1's between packets.
@@ -289,8 +359,10 @@ radioStart(void)
      */
     radio->EVENTS_READY = 0;
     radio->TASKS_RXEN = 1;
+#if !defined(OQ_TESTING)
     while (!radio->EVENTS_READY)
         ;
+#endif // !defined(OQ_TESTING)
 
     /*
      *  Start the receiver.
@@ -304,6 +376,42 @@ radioStart(void)
 }
 
 
+/*
+ *  Start the radio again on the configured frequency.  The radio is
+ *  stopped, and its interrupt held off, while it's reprogrammed;  a packet
+ *  that came in meanwhile is dropped.  The packets still in the ring are
+ *  marked as being from the old frequency.
+ */
+static void
+radioRetune(void)
+{
+    NRF_RADIO_Type * radio = NRF_RADIO;
+
+    NVIC_DisableIRQ(SWI0_EGU0_IRQn);
+
+    u32 prot = peripheralRegionEnClear();
+    radio->SHORTS = 0;
+    radio->EVENTS_DISABLED = 0;
+    radio->TASKS_DISABLE = 1;
+#if !defined(OQ_TESTING)
+    while (!radio->EVENTS_DISABLED)
+        ;
+#endif // !defined(OQ_TESTING)
+    radio->EVENTS_END = 0;
+    NRF_EGU0->EVENTS_TRIGGERED[0] = 0;
+    peripheralRegionEnSet(prot);
+
+    if (packetStale == 0)
+        packetStaleFrequency = radioFrequency;
+    packetStale = AtomicGet(&packetCnt);
+
+    radioStart();
+
+    NVIC_ClearPendingIRQ(SWI0_EGU0_IRQn);
+    NVIC_EnableIRQ(SWI0_EGU0_IRQn);
+}
+
+
 #if 0
 static void
 radioStop(void)
@@ -359,16 +467,64 @@ setupInterrupts(void)
 
 /**********************************************************************/
 
-void
-PacketDecode(unsigned addr, unsigned mod, unsigned net, unsigned node,
-             unsigned aflag,
-             u8 * payload)
+/*
+ *  Packet decode (Config.confDecode).  The sensor values in a master's
+ *  broadcast are shown after the payload:  as text, or for a host, as
+ *  "!dc_" and the base-85 (misc/b85.c) of little endian words:  the device
+ *  type, page number and value count (a byte each, then 0), and then the
+ *  values, as the decoder gave them (see app/antplus.h).
+ */
+enum
 {
+    DECODE_TEXT,                        //  The default
+    DECODE_BINARY,
+    DECODE_OFF,
+};
+
+#define DECODE_LINE     (4 + 5 * (1 + ANTPLUS_FIELDS) + 3)   //  "!dc_", "\r\n\0"
 
+
+static void
+packetDecode(unsigned devType, unsigned aflag, const u8 * payload)
+{
     /*
-     *  Custom packet decode goes here.
+     *  Only a master's broadcasts (or acknowledged messages) carry data
+     *  pages;  not bursts, nor the slave's replies.
      */
+    if (Config.confDecode == DECODE_OFF || (aflag & 0x80) || aflag == 0x02)
+        return;
+
+    u32 v[ANTPLUS_FIELDS];
+    const AntPage_t * pp = AntDecode(devType, payload, v);
+    if (!pp)
+        return;
+
+    if (Config.confDecode == DECODE_BINARY)
+    {
+        u8 b[4 * (1 + ANTPLUS_FIELDS)];
+        OqPut32(&b[0], devType | payload[0] << 8 | pp->fields << 16);
+        for (int i = 0; i < pp->fields; i++)
+            OqPut32(&b[4 * (i + 1)], v[i]);
+
+        char line[DECODE_LINE] = "!dc";
+        unsigned n = BinaryToBase85(&line[3], b, 4 * (pp->fields + 1));
+        DebugPutString(line, 3 + n - 2);
+        return;
+    }
+
+    static const char * const frac[] = { "", ".%01u", ".%02u", ".%03u" };
+    static const u16 scale[] = { 1, 10, 100, 1000 };
 
+    dprintf("%s", pp->name);
+    for (int i = 0; i < pp->fields; i++)
+    {
+        const AntField_t * fp = &pp->field[i];
+        unsigned d = fp->decimals;
+        dprintf(" %s %u", fp->name, v[i] / scale[d]);
+        if (d > 0)
+            dprintf(frac[d], v[i] % scale[d]);
+        dprintf("%s", fp->unit);
+    }
 }
 
 /**********************************************************************/
@@ -388,6 +544,118 @@ prTime(unsigned time)
 }
 
 
+/*
+ *  Check a packet's CRC.  The good packets show how to fix the bad ones;
+ *  a bad one is fixed if Config.confRecover bits of it at most are wrong.
+ *  Returns false if it's still bad.
+ */
+static bool
+packetCheck(packet_t * pkt)
+{
+    unsigned crc = OqGet16(pkt->crc);
+
+    if (pkt->crcOk != CRC_BAD)
+    {
+        if (Config.confRecover)
+            CrcFixLearn(pkt->data, crc);
+        return true;
+    }
+
+    int n = CrcFix(pkt->data, crc, Config.confRecover);
+    if (n < 0)
+    {
+        packetCrcLost++;
+        return false;
+    }
+
+    packetCrcFixed[n]++;
+    pkt->crcOk = CRC_RECOVERED;
+    return true;
+}
+
+/**********************************************************************/
+
+/*
+ *  Packet capture (Config.confCapture).  Instead of a line of text each,
+ *  the packets go to a host a run at a time, as they are in the ring:
+ *  "!cp" and the base-85 (misc/b85.c) of little endian words:  the number
+ *  of slots (and the frequency they were taken on in the next byte), and
+ *  the time (tachyon cycles) of the slot before;  then the slots, their
+ *  times (microseconds since the slot before) and their RSSIs (padded to
+ *  a word).  Time slots are sent as they are.  A run doesn't cross a
+ *  change of frequency.  Those with a bad CRC that can't be fixed are sent
+ *  too, marked so.  A run waits for room in the debug port buffer, rather
+ *  than being lost there.  tools/cap ingests them.
+ */
+#define CAPTURE_RUN     8               //  Slots in a line, at most
+#define CAPTURE_BYTES   ((8 + CAPTURE_RUN * PACKET_BYTES + 3) & ~3)
+#define CAPTURE_LINE    (4 + CAPTURE_BYTES / 4 * 5 + 3) //  "!cp_", "\r\n\0"
+
+
+static int
+packetCapture(void)
+{
+    if (DebugPutAvail() < CAPTURE_LINE)
+        return 0;
+
+    /*
+     *  Take what's waiting, up to the end of the ring.
+     */
+    int r = packetRd;
+    unsigned n = AtomicGet(&packetCnt);
+    unsigned freq = radioFrequency;
+    if (n > CAPTURE_RUN)
+        n = CAPTURE_RUN;
+    if (n > PACKETS - r)
+        n = PACKETS - r;
+    if (packetStale > 0)
+    {
+        if (n > packetStale)
+            n = packetStale;
+        packetStale -= n;
+        freq = packetStaleFrequency;
+    }
+
+    /*
+     *  (The target is little endian, so the times are copied as they are.)
+     */
+    u8 b[CAPTURE_BYTES];
+    u8 * p = &b[8];
+    OqPut32(&b[0], n | freq << 8);
+    OqPut32(&b[4], packetClock);
+    for (unsigned i = 0; i < n; i++)
+    {
+        if (packets[r + i].crcOk == CRC_TIME)
+            packetClock = OqGet32(packets[r + i].data);
+        else
+        {
+            packetClock += US2TACHY(packetDelta[r + i]);
+            packetCheck(&packets[r + i]);
+        }
+    }
+    memcpy(p, &packets[r], n * sizeof (packet_t));
+    p += n * sizeof (packet_t);
+    memcpy(p, &packetDelta[r], n * sizeof (u16));
+    p += n * sizeof (u16);
+    memcpy(p, &packetRssi[r], n);
+    for (p += n; (p - b) % 4 != 0; p++)
+        *p = 0;
+
+    char line[CAPTURE_LINE] = "!cp";
+    unsigned len = BinaryToBase85(&line[3], b, p - b);
+    DebugPutString(line, 3 + len - 2);
+    DebugPutChar('\n');
+
+    /*
+     *  Only now are the slots given back to the radio.
+     */
+    packetRd = r + n < PACKETS ? r + n : 0;
+    AtomicSubAndReturn(&packetCnt, n);
+    return 1;
+}
+
+/**********************************************************************/
+
 /*
  *  Run the tracer super loop, looking for packets and reporting them.
  */
@@ -396,25 +664,72 @@ TraceSuperLoop(void)
 {
     int work = 0;
     static unsigned lastTime;
+    static bool firstPacket = true;
 
-    if (AtomicGet(&packetCnt) > 0)
+    /*
+     *  Follow changes to the configured frequency.  The tracer is started
+     *  before the flash storage has been replayed, so a newer configuration
+     *  can turn up after the radio is running.
+     */
+    if (Config.confFrequency != radioFrequency && Config.confFrequency != 0)
+    {
+        radioRetune();
+        work++;
+    }
+
+    if (AtomicGet(&packetCnt) > 0 && Config.confCapture)
+        work += packetCapture();
+    else if (AtomicGet(&packetCnt) > 0)
     {
         /*
          *  Grab the next packet.
          */
         AtomicSubAndReturn(&packetCnt, 1);
         packet_t * pkt = &packets[packetRd];
+        unsigned us = packetDelta[packetRd];
+        int rssi = packetRssi[packetRd];
         packetRd++;
         if (packetRd >= ARRAY_SIZE(packets))
             packetRd = 0;
+        bool stale = packetStale > 0;
+        if (stale)
+            packetStale--;
+
+        /*
+         *  A time slot only sets the clock.
+         */
+        if (pkt->crcOk == CRC_TIME)
+        {
+            packetClock = OqGet32(pkt->data);
+            return work + 1;
+        }
+        packetClock += US2TACHY(us);
+        u32 stamp = packetClock;
+
+        /*
+         *  Drop those with a bad CRC that can't be fixed.
+         */
+        if (!packetCheck(pkt))
+            return work;
 
         /*
          *  Time Stamp.
          */
-        unsigned time = TACHY2US(pkt->time);
+        unsigned time = TACHY2US(stamp);
         unsigned elapsed = time - lastTime;
         lastTime = time;
 
+        /*
+         *  Note how long after reset the first packet arrived on the
+         *  configured frequency.  (The cycle counter is cleared at reset.)
+         */
+        if (firstPacket && !stale)
+        {
+            firstPacket = false;
+            TachyonLog1(101, stamp);    // tachy: first packet
+            dprintf("First packet %d us after start up\n", time);
+        }
+
         prTime(time);
         dprintf("(");
         prTime(elapsed);
@@ -423,7 +738,7 @@ TraceSuperLoop(void)
         /*
          *  RSSI.
          */
-        dprintf("{%3ddB} ", pkt->rssi);
+        dprintf("{%3ddB} ", rssi);
 
         /*
          *  Extract our addresses.
@@ -492,13 +807,17 @@ TraceSuperLoop(void)
             pkt->data[12]);
 
         /*
-         *  Custom decode.
+         *  Sensor values.
          */
-        PacketDecode(addr, txType, txTypeX, devType, devNumber, &pkt->data[5]);
+        packetDecode(devType, aflag, &pkt->data[5]);
 
         /*
          *  Finish up.
          */
+        if (pkt->crcOk == CRC_RECOVERED)
+            dprintf("  (recovered)");
+        if (stale)
+            dprintf("  (frequency %u)", packetStaleFrequency);
         dprintf("\n");
     }
 
@@ -508,6 +827,16 @@ TraceSuperLoop(void)
     return work;
 }
 
+/*
+ *  Returns true if there are no received packets waiting to be reported.
+ *  (Other sub-systems use this to pick a quiet time for slow operations.)
+ */
+bool
+TraceIsIdle(void)
+{
+    return AtomicGet(&packetCnt) == 0;
+}
+
 /**********************************************************************/
 
 void
@@ -519,25 +848,48 @@ TraceSetup(void)
         ConfigSave(false);
     }
 
+    CrcFixSetup();
     setupInterrupts();
     radioStart();
+
+    TachyonLog(100);                    // tachy: tracer started
 }
 
 /**********************************************************************/
 
+#ifdef OQ_COMMAND
+
 static void
 captureCmd(int argc, char ** argv)
 {
+    if (argc >= 2)
+    {
+        if (StrcmpCmd("ON", argv[1]) <= 1)
+            Config.confCapture = 1;
+        else if (StrcmpCmd("OFF", argv[1]) <= 1)
+            Config.confCapture = 0;
+        else
+        {
+            dprintf("capture on or off\n");
+            return;
+        }
+        ConfigSave(false);
+    }
+
+    dprintf("Packet capture: %s\n", Config.confCapture ? "on" : "off");
 }
 
 COMMAND(180)
 {
     captureCmd, "CAPture", 0,
-    "CAPture ...", "Packet capture",
-    "   capture [options ...]\n"
-    "       Begin a packet capture with the given options.\n"
+    "CAPture [ON|OFF]", "Packet capture",
+    "   capture [on | off]\n"
+    "       Send the packets to a host in runs, as base-85 (\"!cp\"), for\n"
+    "       tools/cap to ingest;  or as text, a line each.\n"
 };
 
+#endif // OQ_COMMAND
+
 /**********************************************************************/
 
 static void
@@ -552,7 +904,7 @@ frequencyChangeCmd(int argc, char ** argv)
         Config.confFrequency = nf;
         ConfigSave(false);
 
-        radioStart();
+        radioRetune();
     }
 
     dprintf("Current trace frequency: %d\n", Config.confFrequency);
@@ -568,6 +920,89 @@ COMMAND(181)
 
 /**********************************************************************/
 
+#ifdef OQ_COMMAND
+
+static void
+decodeCmd(int argc, char ** argv)
+{
+    static const char * const modes[] = { "text", "binary", "off" };
+
+    if (argc >= 2)
+    {
+        if (StrcmpCmd("Text", argv[1]) <= 1)
+            Config.confDecode = DECODE_TEXT;
+        else if (StrcmpCmd("Binary", argv[1]) <= 1)
+            Config.confDecode = DECODE_BINARY;
+        else if (StrcmpCmd("OFF", argv[1]) <= 1)
+            Config.confDecode = DECODE_OFF;
+        else
+        {
+            dprintf("decode text, binary or off\n");
+            return;
+        }
+        ConfigSave(false);
+    }
+
+    dprintf("Packet decode: %s\n", Config.confDecode < ARRAY_SIZE(modes)
+                                    ? modes[Config.confDecode] : "?");
+}
+
+COMMAND(182)
+{
+    decodeCmd, "DECode", 0,
+    "DECode [Text|Binary|OFF]", "Decode sensor values",
+    "   decode [text | binary | off]\n"
+    "       Show the ANT+ sensor values in each packet as text, as base-85\n"
+    "       for a host (\"!dc\"), or not at all.\n"
+};
+
+#endif // OQ_COMMAND
+
+/**********************************************************************/
+
+#ifdef OQ_COMMAND
+
+static void
+recoverCmd(int argc, char ** argv)
+{
+    if (argc >= 2)
+    {
+        int bits = StrcmpCmd("OFF", argv[1]) <= 1 ? 0 : GetDecimal(argv[1]);
+        if (bits < 0 || bits > 2)
+        {
+            dprintf("recover off, 1 or 2\n");
+            return;
+        }
+        Config.confRecover = bits;
+        ConfigSave(false);
+    }
+
+    if (Config.confRecover == 0)
+        dprintf("Packets with a bad CRC are dropped\n");
+    else
+        dprintf("Packets with a bad CRC are fixed, up to %d bits%s\n",
+                Config.confRecover,
+                CrcFixReady() ? "" : " (not yet:  the CRC isn't learned)");
+    dprintf("Bad CRC %d:  %u fixed 1 bit, %u fixed 2, %u right after all, "
+            "%u lost\n",
+            packetCrcError, packetCrcFixed[1], packetCrcFixed[2],
+            packetCrcFixed[0], packetCrcLost);
+}
+
+COMMAND(183)
+{
+    recoverCmd, "RECover", 0,
+    "RECover [OFF|1|2]", "Fix packets with a bad CRC",
+    "   recover [off | 1 | 2]\n"
+    "       Fix packets with a bad CRC, if up to 1 or 2 bits are wrong,\n"
+    "       and show them marked \"(recovered)\";  or drop them.\n"
+    "       Fixing 2 bits can mistake a worse error for one that small.\n"
+};
+
+#endif // OQ_COMMAND
+
+/**********************************************************************/
+
 #if defined(OQ_DEBUG) && defined(OQ_COMMAND)
 
 /**********************************************************************/
@@ -22,6 +22,48 @@ AtomicGet(Atomic_t * ap)                                    //  return ap
 }
 
 
+#if defined(OQ_TESTING)
+
+/*
+ *  The host build (see host/) has the compiler's builtins instead.
+ */
+
+static inline int
+AtomicTestAndSet(Atomic_t * ap, int v)
+{
+    return __atomic_exchange_n(&ap->val, v, __ATOMIC_SEQ_CST);
+}
+
+
+static inline unsigned
+AtomicSetFlags(Atomic_t * ap, unsigned mask)
+{
+    return __atomic_fetch_or(&ap->val, mask, __ATOMIC_SEQ_CST);
+}
+
+
+static inline unsigned
+AtomicTestAndClearFlags(Atomic_t * ap, unsigned mask)
+{
+    return __atomic_fetch_and(&ap->val, ~mask, __ATOMIC_SEQ_CST) & mask;
+}
+
+
+static inline int
+AtomicAddAndReturn(Atomic_t * ap, int v)
+{
+    return __atomic_add_fetch(&ap->val, v, __ATOMIC_SEQ_CST);
+}
+
+
+static inline int
+AtomicSubAndReturn(Atomic_t * ap, int v)
+{
+    return __atomic_sub_fetch(&ap->val, v, __ATOMIC_SEQ_CST);
+}
+
+#else // defined(OQ_TESTING)
+
 static inline int
 AtomicTestAndSet(Atomic_t * ap, int v)                      //  t = ap
 {                                                           //  ap = v
@@ -106,6 +148,8 @@ AtomicSubAndReturn(Atomic_t * ap, int v)                    //  ap -= v
     return result;
 }
 
+#endif // defined(OQ_TESTING)
+
 /**********************************************************************/
 
 #endif // __ATOMIC_H__
@@ -190,7 +190,17 @@ struct Cmd_t
     const char *    help9;          // Multi-line help string
 };
 
-extern void     CommandLoop(void);
+/*
+ *  A command may take the debug port input for a while (to receive a
+ *  stream of data, say) by passing a function to CommandInput().  The
+ *  function is called in place of the command line editor each time
+ *  around the super loop, and reads the input itself.  It returns false
+ *  once it's done, and the prompt is shown again.
+ */
+typedef bool    CMDInput_f(void);
+
+extern int      CommandLoop(void);
+extern void     CommandInput(CMDInput_f * func);
 extern int      StrcmpCmd(const char * cmd, const char * text);
 extern u32      GetDecimal(const char *);
 extern u32      GetHex(char * sp);
@@ -67,6 +67,8 @@ typedef struct
 static pr_t prd = { DEBUGOUT, 0 };
 static pr_t prdb = { DEBUGBLOCKEDOUT, 0 };
 
+#if OQ_COMMAND
+
 /*
  *  dprintf levels are managed using the below `printMask' which can be managed
  *  using the `level' command.  The mask is represented by any printf called
@@ -91,6 +93,8 @@ static const struct
     {'n', "Nordic related"},
 };
 
+#endif // OQ_COMMAND
+
 static u32 printMask = 0;
 static u32 currentLevel = 0;
 
@@ -0,0 +1,237 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Super loop profiling.
+ */
+
+#if defined(OQ_DEBUG) && defined(OQ_TACHYON)
+
+#include "stdlib.h"
+#include "defs.h"
+#include "timer.h"
+#include "debug/debug.h"
+#include "debug/profile.h"
+
+/**********************************************************************/
+
+/*
+ *  Histogram buckets:  bucket `n' counts the runs that took from 2^n to
+ *  2^(n+1)-1 cycles (bucket 0 also has the runs that took none).
+ */
+#define PROF_BUCKETS    32
+
+typedef struct
+{
+    unsigned    count;                  //  Times run
+    u64         total;                  //  Total cycles
+    unsigned    max;                    //  Longest run, in cycles
+    unsigned    hist[PROF_BUCKETS];     //  log2 histogram of run times
+}
+    Profile_t;
+
+static Profile_t profile[PROF_STAGES];
+
+static const char * const profileName[PROF_STAGES] =
+{
+    [PROF_TEMPUS]   = "tempus",
+    [PROF_TICK]     = "tick",
+    [PROF_COMMAND]  = "command",
+    [PROF_SOC]      = "soc",
+    [PROF_STORE]    = "store",
+    [PROF_RAND]     = "rand",
+    [PROF_TRACE]    = "trace",
+    [PROF_SLEEP]    = "sleep",
+};
+
+/**********************************************************************/
+
+static void
+profileAdd(int stage, u64 time)
+{
+    Profile_t * pp = &profile[stage];
+    unsigned cycles = (time >> 32) ? MAXU32 : (unsigned)time;
+
+    pp->count++;
+    pp->total += time;
+    if (cycles > pp->max)
+        pp->max = cycles;
+    pp->hist[cycles ? 31 - __builtin_clz(cycles) : 0]++;
+}
+
+
+/*
+ *  Charge the time since `start' to `stage', and return the time now (the
+ *  start of the next stage).
+ */
+unsigned
+ProfileStage(int stage, unsigned start)
+{
+    unsigned now = TachyonGet();
+    profileAdd(stage, now - start);
+    return now;
+}
+
+
+/*
+ *  Count a sleep of `ticks' RTC ticks.  The cycle counter stops while the
+ *  CPU sleeps, so the RTC times this one;  it's kept in cycles like the
+ *  rest.  (A long sleep only fits in the total.)
+ */
+void
+ProfileSleep(unsigned ticks)
+{
+    profileAdd(PROF_SLEEP, (u64)ticks * TACHY_UNIT / TICK_UNIT);
+}
+
+/**********************************************************************/
+
+#ifdef OQ_COMMAND
+
+/*
+ *  `n' / `d', without a 64-bit divide (there is no library to do one).
+ *  `n' is scaled down until it fits in 32 bits, and `d' with it while it
+ *  keeps 16 bits, else the quotient is scaled up after, so it's good to
+ *  about 1 part in 2^15, which is close enough for printing.
+ */
+static unsigned
+profileDiv(u64 n, unsigned d)
+{
+    int up = 0;
+
+    if (d == 0)
+        return 0;
+    while (n >> 32)
+    {
+        n >>= 1;
+        if (d >= 0x10000)
+            d >>= 1;
+        else
+            up++;
+    }
+
+    unsigned q = (unsigned)n / d;
+    if (up >= 32 || (up && (q >> (32 - up)) != 0))
+        return MAXU32;
+    return q << up;
+}
+
+
+static void
+profileCmd(int argc, char ** argv)
+{
+    bool hist = false;
+
+    if (argc > 1)
+    {
+        if (StrcmpCmd("CLEar", argv[1]) <= 1)
+        {
+            memset(&profile[0], 0, sizeof profile);
+            return;
+        }
+        else if (StrcmpCmd("HIStogram", argv[1]) <= 1)
+            hist = true;
+    }
+
+    /*
+     *  Work out the whole time covered, for the shares.
+     */
+    u64 all = 0;
+    for (int s = 0; s < PROF_STAGES; s++)
+        all += profile[s].total;
+    unsigned per = profileDiv(all, 1000);
+    if (per == 0)
+        per = 1;
+
+    dprintf("stage        count    total ms  share  mean us   max us\n");
+    for (int s = 0; s < PROF_STAGES; s++)
+    {
+        Profile_t * pp = &profile[s];
+        unsigned share = profileDiv(pp->total, per);
+        unsigned mean = profileDiv(pp->total, pp->count);
+
+        dprintf("%-9s %10u %11u %4u.%u %8u %8u\n",
+                profileName[s], pp->count,
+                profileDiv(pp->total, TACHY_UNIT / 1000),
+                share / 10, share % 10,
+                TACHY2US(mean), TACHY2US(pp->max));
+    }
+
+    if (!hist)
+        return;
+
+    /*
+     *  The histograms, one line per stage, as "bucket:count" for the
+     *  buckets that have anything in them.  The bucket is log2 of the
+     *  cycles taken.
+     */
+    dprintf("\nlog2(cycles):count\n");
+    for (int s = 0; s < PROF_STAGES; s++)
+    {
+        dprintf("%-9s", profileName[s]);
+        for (int b = 0; b < PROF_BUCKETS; b++)
+            if (profile[s].hist[b])
+                dprintf(" %u:%u", b, profile[s].hist[b]);
+        dprintf("\n");
+    }
+}
+
+
+COMMAND(800)
+{
+    profileCmd, "PROFile", 0,
+    "profile [clear|histogram]", "super loop profile",
+    "Prints, for each stage of the super loop, how many times it ran, the\n"
+    "total time spent in it and its share of all the time, and the mean\n"
+    "and longest run.  `sleep' is the time spent waiting for events.\n"
+    "`profile histogram' adds a log2 histogram of the run times, in CPU\n"
+    "cycles.  `profile clear' starts again."
+};
+
+#endif // OQ_COMMAND
+
+/**********************************************************************/
+
+#endif // defined(OQ_DEBUG) && defined(OQ_TACHYON)
+
+/**********************************************************************/
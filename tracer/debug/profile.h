@@ -0,0 +1,103 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Super loop profiling.
+ *
+ *  Each stage of the super loop is timed with the tachyon counter, and the
+ *  time spent waiting for events is counted separately.  The "PROFile"
+ *  command prints the results.  Without OQ_TACHYON this all compiles away.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "debug/tachyon.h"
+
+/******************************/
+
+/*
+ *  Super loop stages.
+ */
+enum
+{
+    PROF_TEMPUS,            //  TempusMagnaCirculi()
+    PROF_TICK,              //  TickMagnaCirculi()
+    PROF_COMMAND,           //  CommandLoop()
+    PROF_SOC,               //  handleSocEvents()
+    PROF_STORE,             //  StoreSuperLoop()
+    PROF_RAND,              //  RandStateMachine()
+    PROF_TRACE,             //  TraceSuperLoop()
+    PROF_SLEEP,             //  sd_app_evt_wait()
+
+    PROF_STAGES
+};
+
+/**********************************************************************/
+
+#if defined(OQ_DEBUG) && defined(OQ_TACHYON)
+
+extern unsigned     ProfileStage(int stage, unsigned start);
+extern void         ProfileSleep(unsigned ticks);
+
+/*
+ *  PROFILE_START() marks the start of a pass through the loop, and
+ *  PROFILE_END(stage) charges the time since the last mark to `stage'.
+ */
+#define PROFILE_START()     unsigned profileMark = TachyonGet()
+#define PROFILE_END(stage)  (profileMark = ProfileStage((stage), profileMark))
+
+#else // defined(OQ_DEBUG) && defined(OQ_TACHYON)
+
+static inline void  ProfileSleep(unsigned ticks)    { }
+
+#define PROFILE_START()     do { } while (0)
+#define PROFILE_END(stage)  do { } while (0)
+
+#endif // defined(OQ_DEBUG) && defined(OQ_TACHYON)
+
+/**********************************************************************/
+
+#endif // __PROFILE_H__
+
+/**********************************************************************/
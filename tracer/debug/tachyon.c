@@ -39,12 +39,16 @@
 
 /*
  *  Tachyon logging implementation.
- */
-/*
+ *
+ *  The log can be read with GDB, or exported over the debug port with the
+ *  "tachyon" command and turned into a timeline by tools/tachy.
  */
 
 #if defined(OQ_DEBUG) && defined(OQ_TACHYON)
 
+#include <stdbool.h>
+#include "defs.h"
+#include "debug/debug.h"
 #include "debug/tachyon.h"
 #include "cpu/atomic.h"
 
@@ -141,4 +145,124 @@ TachyonInit(void)
 
 /**********************************************************************/
 
+#ifdef OQ_COMMAND
+
+/*
+ *  Export of the log over the debug port (see tools/tachy).
+ *
+ *  Entries are identified by their sequence number, the value of
+ *  `TachyIndex' they were logged with;  entry `s' is in TachyLog[s %
+ *  TachySize] until it is overwritten by entry `s + TachySize'.  Each one
+ *  goes out as a line of "!ty" and the base-85 (misc/b85.c) of five words,
+ *  little endian:  the sequence number, time, id, x1 and x2.  The export
+ *  starts with "!ty start <unit> <size>", and ends with "!ty end <lost>",
+ *  where <lost> is the number of entries overwritten before they could be
+ *  sent.  Only as many lines as fit in the debug port buffer are sent on
+ *  each pass of the super loop, so none are dropped there.
+ */
+#define TACHY_LINE      (4 + 25 + 3)    //  "!ty_", base-85, "\r\n\0"
+
+static struct
+{
+    unsigned    next;                   //  Sequence number to send next
+    unsigned    last;                   //  Last to send (if not streaming)
+    unsigned    lost;                   //  Entries overwritten before sent
+    bool        stream;                 //  Send new entries as logged
+}
+    tachyExport;
+
+
+static bool
+tachyExportInput(void)
+{
+    if (DebugGetChar() >= 0)
+        tachyExport.stream = false;
+    else
+    {
+        unsigned idx = AtomicGet(&TachyIndex);
+        unsigned end = tachyExport.stream ? idx : tachyExport.last;
+
+        if ((int)(idx - tachyExport.next) >= (int)TachySize)
+        {
+            unsigned skip = idx + 1 - TachySize - tachyExport.next;
+            tachyExport.lost += skip;
+            tachyExport.next += skip;
+        }
+
+        while ((int)(end - tachyExport.next) >= 0)
+        {
+            if (DebugPutAvail() < TACHY_LINE)
+                return true;
+
+            /*
+             *  Copy the entry, then check it wasn't overwritten while we
+             *  did (an interrupt can log at any time).
+             */
+            unsigned s = tachyExport.next++;
+            log_t * lp = &TachyLog[s % TachySize];
+            u32 w[5] = { s, lp->time, lp->id, lp->x1, lp->x2 };
+            __DMB();
+            if ((unsigned)AtomicGet(&TachyIndex) - s >= TachySize)
+            {
+                tachyExport.lost++;
+                continue;
+            }
+
+            u8 b[sizeof w];
+            for (int i = 0; i < 5; i++)
+                OqPut32(&b[4 * i], w[i]);
+
+            char line[TACHY_LINE] = "!ty";
+            unsigned n = BinaryToBase85(&line[3], b, sizeof b);
+            DebugPutString(line, 3 + n - 2);
+            DebugPutChar('\n');
+        }
+
+        if (tachyExport.stream)
+            return true;
+    }
+
+    dprintf("!ty end %u\n", tachyExport.lost);
+    return false;
+}
+
+
+static void
+tachyonCmd(int argc, char ** argv)
+{
+    /*
+     *  Start with the oldest entry still in the log.
+     */
+    unsigned idx = AtomicGet(&TachyIndex);
+    unsigned n;
+    if (TachyWraps > 0)
+        n = TachySize;
+    else if (TachyWraps == 0)
+        n = idx % TachySize + 1;
+    else
+        n = 0;
+
+    tachyExport.next = idx + 1 - n;
+    tachyExport.last = idx;
+    tachyExport.lost = 0;
+    tachyExport.stream = (argc > 1 && StrcmpCmd("STReam", argv[1]) <= 1);
+
+    dprintf("!ty start %u %u\n", TACHY_UNIT, TachySize);
+    CommandInput(tachyExportInput);
+}
+
+COMMAND(801)
+{
+    tachyonCmd, "TACHyon", 0,
+    "tachyon [stream]", "Export the tachyon log",
+    "tachyon     -- Send the entries in the tachyon log, for tools/tachy\n"
+    "tachyon stream\n"
+    "            -- Send the entries in the log, and then new ones as they\n"
+    "               are logged, until a key is pressed\n"
+};
+
+#endif // OQ_COMMAND
+
+/**********************************************************************/
+
 #endif // defined(OQ_DEBUG) && defined(OQ_TACHYON)
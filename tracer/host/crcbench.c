@@ -0,0 +1,195 @@
+/*
+ *  Measure the tracer's fixing of packets with a bad CRC (app/crcfix.c).
+ *
+ *      crcbench [-n packets] [-p rate] [-s seed]
+ *
+ *  Packets are made up (random bytes, with the CRC the radio would give
+ *  them), then broken, and fixed as the tracer would.  First with exactly
+ *  1 to 4 bits wrong, to show what each kind of error comes to;  then as
+ *  noisy traffic, each bit wrong with probability -p (default 0.002, a
+ *  weak signal).  For each, fixing up to 1 bit, and up to 2:  how many
+ *  were fixed right, how many were "fixed" wrong (and so would be shown
+ *  with made up contents), how many were dropped, and the time taken for
+ *  each packet.  -n packets (default 1000000) for each line.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "defs.h"
+#include "app/crcfix.h"
+
+#define BITS        (8 * CRCFIX_BYTES + 16)
+
+static unsigned long    Packets = 1000000;
+
+/*
+ *  The CRC's state after the address (whatever it is, crcfix learns it).
+ */
+static u16      AddrCrc;
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+make(u8 * data, u16 * crc)
+{
+    for (int i = 0; i < CRCFIX_BYTES; i++)
+        data[i] = random();
+    *crc = CRC16CCITT(AddrCrc, data, CRCFIX_BYTES);
+}
+
+
+static void
+flip(u8 * data, u16 * crc, unsigned b)
+{
+    if (b < 8 * CRCFIX_BYTES)
+        data[b / 8] ^= 0x80 >> (b % 8);
+    else
+        *crc ^= 1 << (b - 8 * CRCFIX_BYTES);
+}
+
+
+/*
+ *  Break `packets' packets, `bits' bits each (or with each bit wrong with
+ *  probability `rate', if `bits' is 0), and fix them up to `fix' bits.
+ */
+static void
+run(const char * what, int bits, double rate, int fix)
+{
+    unsigned long bad = 0, right = 0, wrong = 0, lost = 0;
+    double took = 0;
+
+    for (unsigned long n = 0; n < Packets; n++)
+    {
+        u8 good[CRCFIX_BYTES], data[CRCFIX_BYTES];
+        u16 crc;
+        make(good, &crc);
+        memcpy(data, good, sizeof data);
+
+        if (bits > 0)
+        {
+            unsigned used[4];
+            for (int k = 0; k < bits; k++)
+            {
+                unsigned b;
+                int j;
+                do
+                {
+                    b = random() % BITS;
+                    for (j = 0; j < k && used[j] != b; j++)
+                        ;
+                }
+                while (j < k);
+                used[k] = b;
+                flip(data, &crc, b);
+            }
+        }
+        else
+        {
+            bool any = false;
+            for (unsigned b = 0; b < BITS; b++)
+                if (random() < rate * RAND_MAX)
+                {
+                    flip(data, &crc, b);
+                    any = true;
+                }
+            if (!any || CRC16CCITT(AddrCrc, data, CRCFIX_BYTES) == crc)
+                continue;               //  (The radio would take it)
+        }
+
+        bad++;
+        double t0 = now();
+        int r = CrcFix(data, crc, fix);
+        took += now() - t0;
+
+        if (r < 0)
+            lost++;
+        else if (memcmp(data, good, sizeof data) == 0)
+            right++;
+        else
+            wrong++;
+    }
+
+    printf("%-12s fix %d:  %8lu bad, %6.2f%% fixed, %6.2f%% wrong, "
+           "%6.2f%% dropped, %5.0f ns a packet\n",
+           what, fix, bad, bad ? 100.0 * right / bad : 0.0,
+           bad ? 100.0 * wrong / bad : 0.0, bad ? 100.0 * lost / bad : 0.0,
+           bad ? took * 1e9 / bad : 0.0);
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    double rate = 0.002;
+    int c;
+
+    srandom(48);
+    while ((c = getopt(argc, argv, "n:p:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            Packets = strtod(optarg, 0);
+            break;
+        case 'p':
+            rate = strtod(optarg, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: crcbench [-n packets] [-p rate] [-s seed]\n",
+                  stderr);
+            exit(1);
+        }
+
+    /*
+     *  Any address will do;  the tracer learns its CRC from good packets.
+     */
+    static const u8 addr[] = { 0xa4, 0xda };
+    AddrCrc = CRC16CCITT(0xffff, addr, sizeof addr);
+    CrcFixSetup();
+    for (int i = 0; i < 2; i++)
+    {
+        u8 data[CRCFIX_BYTES];
+        u16 crc;
+        make(data, &crc);
+        CrcFixLearn(data, crc);
+    }
+    if (!CrcFixReady())
+    {
+        fputs("crcbench: the CRC wasn't learned\n", stderr);
+        exit(1);
+    }
+
+    for (int bits = 1; bits <= 4; bits++)
+        for (int fix = 1; fix <= 2; fix++)
+        {
+            char what[16];
+            snprintf(what, sizeof what, "%d bit%s", bits,
+                     bits > 1 ? "s" : "");
+            run(what, bits, 0, fix);
+        }
+
+    char what[16];
+    snprintf(what, sizeof what, "rate %g", rate);
+    run(what, 0, rate, 1);
+    run(what, 0, rate, 2);
+    return 0;
+}
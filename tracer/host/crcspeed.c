@@ -0,0 +1,193 @@
+/*
+ *  Check and time the firmware's CRCs (misc/crc.c).
+ *
+ *      crcspeed [-n megabytes] [-s seed]
+ *
+ *  Built once for each of OQ_CRC_SLICES 1, 4 and 8 (crcspeed1 ...).
+ *  First, each CRC is checked against one worked out a bit at a time:
+ *  CRC() over random lengths and alignments, CRC8(), CRC16() and CRC32()
+ *  on random values, and CRC16CCITT() (with its usual check value too).
+ *  Then CRC() and CRC16CCITT() are timed over large buffers, and over the
+ *  sizes the firmware uses (a config block, a software update chunk, an
+ *  ANT packet), -n megabytes (default 256) each.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "defs.h"
+#include "store/config.h"
+
+#define MAX         65536
+
+static u8       Buf[MAX + 8];
+static int      Failed;
+
+/**********************************************************************/
+/*
+ *  The reference CRCs, a bit at a time.
+ */
+
+static u32
+refCrc(u32 crc, const u8 * data, unsigned len)
+{
+    crc = ~crc;
+    while (len-- > 0)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+    }
+    return ~crc;
+}
+
+
+static u16
+refCcitt(u16 crc, const u8 * data, unsigned len)
+{
+    while (len-- > 0)
+    {
+        crc ^= *data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc << 1) ^ (crc & 0x8000 ? 0x1021 : 0);
+    }
+    return crc;
+}
+
+/**********************************************************************/
+
+static void
+fail(const char * what, unsigned a, unsigned b, u32 got, u32 want)
+{
+    if (Failed++ < 10)
+        printf("%s (%u, %u):  %08x, should be %08x\n",
+               what, a, b, got, want);
+}
+
+
+static void
+check(void)
+{
+    CRC_t crc;
+    u8 v[4];
+
+    for (unsigned i = 0; i < sizeof Buf; i++)
+        Buf[i] = random();
+
+    for (int n = 0; n < 20000; n++)
+    {
+        unsigned off = random() % 8;
+        unsigned len = n < 1000 ? n % 100 : random() % 2000;
+        u32 start = n % 3 == 0 ? 0 : random();
+
+        crc.crc = start;
+        CRC(&crc, Buf + off, len);
+        if (crc.crc != refCrc(start, Buf + off, len))
+            fail("CRC", off, len, crc.crc, refCrc(start, Buf + off, len));
+
+        u16 c16 = CRC16CCITT(start, Buf + off, len);
+        if (c16 != refCcitt(start, Buf + off, len))
+            fail("CRC16CCITT", off, len, c16, refCcitt(start, Buf + off, len));
+
+        u32 x = random();
+        OqPut32(v, x);
+        for (int size = 1; size <= 4; size *= 2)
+        {
+            crc.crc = start;
+            if (size == 1)
+                CRC8(&crc, x & 0xff);
+            else if (size == 2)
+                CRC16(&crc, x & 0xffff);
+            else
+                CRC32(&crc, x);
+            if (crc.crc != refCrc(start, v, size))
+                fail("CRC8/16/32", size, x, crc.crc, refCrc(start, v, size));
+        }
+    }
+
+    static const u8 digits[] = "123456789";
+    if (CRC16CCITT(0xffff, digits, 9) != 0x29b1)
+        fail("CRC16CCITT", 0xffff, 9, CRC16CCITT(0xffff, digits, 9), 0x29b1);
+    crc.crc = 0;
+    CRC(&crc, (u8 *)digits, 9);
+    if (crc.crc != 0xe3069283)
+        fail("CRC", 0, 9, crc.crc, 0xe3069283);
+
+    printf("OQ_CRC_SLICES %d:  %s\n", OQ_CRC_SLICES,
+           Failed ? "FAILED" : "all CRCs check");
+}
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+speed(const char * what, unsigned len, double megabytes)
+{
+    unsigned long n = megabytes * 1e6 / len;
+    volatile u32 sink;
+    CRC_t crc = { 0 };
+    u16 c16 = 0xffff;
+
+    double t0 = now();
+    for (unsigned long i = 0; i < n; i++)
+        CRC(&crc, Buf, len);
+    double t1 = now();
+    for (unsigned long i = 0; i < n; i++)
+        c16 = CRC16CCITT(c16, Buf, len);
+    double t2 = now();
+    sink = crc.crc ^ c16;
+    (void)sink;
+
+    printf("%-18s %6u bytes:  CRC %7.0f MB/s %6.1f ns,  "
+           "CRC16CCITT %7.0f MB/s %6.1f ns\n",
+           what, len, n * len / (t1 - t0) / 1e6, (t1 - t0) * 1e9 / n,
+           n * len / (t2 - t1) / 1e6, (t2 - t1) * 1e9 / n);
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    double megabytes = 256;
+    int c;
+
+    srandom(49);
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            megabytes = strtod(optarg, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: crcspeed [-n megabytes] [-s seed]\n", stderr);
+            exit(1);
+        }
+
+    check();
+
+    speed("buffer", MAX, megabytes);
+    speed("buffer", 4096, megabytes);
+    speed("config", sizeof Config.confArray - sizeof Config.confCRC,
+          megabytes);
+    speed("update chunk", OQ_SU_CHUNK, megabytes);
+    speed("ANT packet", 13, megabytes);
+    return Failed != 0;
+}
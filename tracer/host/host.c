@@ -0,0 +1,186 @@
+/*
+ *  Enough of an nRF52 to run the tracer's packet path on a host.
+ *
+ *  The peripherals and the Cortex-M system space are plain memory, mapped
+ *  where the chip has them, so that the firmware's register accesses just
+ *  work;  nothing behind them does anything, other than what the replay
+ *  driver does by hand (see replay.c).  Time is simulated:  HostNow counts
+ *  the CPU's cycles, and is what the DWT cycle counter (the tachyon),
+ *  RTC2 and the time of day show.
+ *
+ *  The RTT up buffer is modelled as BUFFER_SIZE_UP bytes, emptied by the
+ *  debugger at HostRttRate bytes a second of the target's time.  As on
+ *  the target, a write that doesn't fit is skipped, unless the firmware
+ *  asked to block.  What's read out goes to HostOut.
+ *
+ *  (The firmware has its own printf() and snprintf(), which take over the
+ *  C library's, so the host code only uses fprintf() and friends.)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "host.h"
+#include "types.h"
+#include "nrf.h"
+#include "store/config.h"
+#include "lib/rtt/SEGGER_RTT.h"
+#include "lib/rtt/SEGGER_RTT_Conf.h"
+
+/**********************************************************************/
+
+HostTime_t      HostNow;
+FILE *          HostOut;
+unsigned        HostRttRate = 1000000;
+
+unsigned long long  HostRttBytes;
+unsigned long long  HostRttSkipped;
+unsigned long long  HostRttStall;
+
+Config_t        Config;
+
+static double   rttFill;                //  Bytes in the up buffer
+static bool     rttBlock;               //  Blocking writes
+
+/**********************************************************************/
+
+static void
+map(unsigned long addr, size_t size)
+{
+    void * p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                    MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "can't map %lx for the peripherals", addr);
+}
+
+
+void
+HostSetup(void)
+{
+    map(NRF_CLOCK_BASE, 0x40000);           //  The peripherals
+    map(0xe0000000, 0x10000);               //  DWT, NVIC, SCB ...
+
+    Config.confFrequency = 79;
+    HostSetCycles(0);
+}
+
+
+/*
+ *  Set the time, and the timers that show it.
+ */
+void
+HostSetCycles(HostTime_t t)
+{
+    HostNow = t;
+    DWT->CYCCNT = t;
+    *(volatile u32 *)&NRF_RTC2->COUNTER = (t * 32768 / HOST_HZ) & 0xffffff;
+}
+
+
+/*
+ *  Let time go by.  The debugger reads from the RTT buffer meanwhile.
+ */
+void
+HostAdvance(HostTime_t cycles)
+{
+    rttFill -= (double)cycles * HostRttRate / HOST_HZ;
+    if (rttFill < 0)
+        rttFill = 0;
+    HostSetCycles(HostNow + cycles);
+}
+
+/**********************************************************************/
+/*
+ *  Stand-ins for what the tracer's packet path uses from the rest of the
+ *  firmware.
+ */
+
+void
+ConfigSave(bool force)
+{
+}
+
+
+u32
+GetDecimal(const char * s)
+{
+    return strtoul(s, 0, 10);
+}
+
+
+unsigned
+GetTODZero(void)
+{
+    return HostNow / HOST_HZ;
+}
+
+/**********************************************************************/
+/*
+ *  RTT.
+ */
+
+unsigned
+SEGGER_RTT_Write(unsigned BufferIndex, const void * pBuffer, unsigned NumBytes)
+{
+    if (!rttBlock && rttFill + NumBytes > BUFFER_SIZE_UP)
+    {
+        HostRttSkipped += NumBytes;
+        return 0;
+    }
+
+    /*
+     *  Blocked:  wait for the debugger to make room.
+     */
+    if (rttFill + NumBytes > BUFFER_SIZE_UP)
+    {
+        HostTime_t wait = (rttFill + NumBytes - BUFFER_SIZE_UP) *
+                          HOST_HZ / HostRttRate + 1;
+        HostRttStall += wait;
+        HostAdvance(wait);
+    }
+
+    rttFill += NumBytes;
+    HostRttBytes += NumBytes;
+    if (HostOut)
+        fwrite(pBuffer, 1, NumBytes, HostOut);
+    return NumBytes;
+}
+
+
+int
+SEGGER_RTT_ConfigUpBuffer(unsigned BufferIndex, const char * sName,
+                          void * pBuffer, unsigned BufferSize, unsigned Flags)
+{
+    rttBlock = (Flags & SEGGER_RTT_MODE_MASK) ==
+               SEGGER_RTT_MODE_BLOCK_IF_FIFO_FULL;
+    return 0;
+}
+
+
+unsigned
+SEGGER_RTT_WriteAvailSpace(unsigned BufferIndex)
+{
+    return BUFFER_SIZE_UP - (unsigned)(rttFill + 0.999);
+}
+
+
+unsigned
+SEGGER_RTT_Read(unsigned BufferIndex, void * pBuffer, unsigned BufferSize)
+{
+    return 0;
+}
+
+
+int
+SEGGER_RTT_WaitKey(void)
+{
+    return -1;
+}
+
+
+void
+SEGGER_RTT_Shutdown(void)
+{
+}
@@ -0,0 +1,28 @@
+/*
+ *  The tracer, built to run on a host (see host.c).
+ */
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <stdio.h>
+
+typedef unsigned long long  HostTime_t;     //  CPU cycles (TACHY_UNIT)
+
+#define HOST_HZ         64000000            //  As TACHY_UNIT
+
+/**********************************************************************/
+
+extern HostTime_t   HostNow;        //  The target's time
+extern FILE *       HostOut;        //  Where the RTT output goes (or 0)
+extern unsigned     HostRttRate;    //  Bytes a second the debugger reads
+
+extern unsigned long long   HostRttBytes;   //  Written to the RTT buffer
+extern unsigned long long   HostRttSkipped; //  Lost to a full buffer
+extern unsigned long long   HostRttStall;   //  Cycles blocked on it
+
+extern void         HostSetup(void);
+extern void         HostAdvance(HostTime_t cycles);
+extern void         HostSetCycles(HostTime_t t);
+
+#endif // __HOST_H__
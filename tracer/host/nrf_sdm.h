@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+typedef struct { int source, rc_ctiv, rc_temp_ctiv, xtal_accuracy; } nrf_clock_lf_cfg_t;
+#define NRF_CLOCK_LF_SRC_XTAL 1
+#define NRF_CLOCK_LF_XTAL_ACCURACY_20_PPM 7
+#define NRF_SUCCESS 0
+#define NRF_EVT_FLASH_OPERATION_SUCCESS 2
+#define NRF_EVT_FLASH_OPERATION_ERROR 3
+#define NRF_POWER_DCDC_ENABLE 1
+uint32_t sd_softdevice_enable(nrf_clock_lf_cfg_t*, void*, const char*);
+uint32_t sd_nvic_EnableIRQ(int);
+uint32_t sd_power_dcdc_mode_set(int);
+uint32_t sd_clock_hfclk_request(void);
+uint32_t sd_evt_get(uint32_t*);
+uint32_t sd_app_evt_wait(void);
+uint32_t sd_flash_page_erase(uint32_t);
+uint32_t sd_flash_write(uint32_t*, uint32_t const*, uint32_t);
+typedef struct { uint8_t ANT_MESSAGE_ucSize, ANT_MESSAGE_ucMesgID, ANT_MESSAGE_ucChannel; uint8_t ANT_MESSAGE_aucPayload[8]; } ANT_MESSAGE;
+#define MESG_BROADCAST_DATA_ID 0x4e
+#define MESG_ACKNOWLEDGED_DATA_ID 0x4f
+#define MESG_BURST_DATA_ID 0x50
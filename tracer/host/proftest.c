@@ -0,0 +1,324 @@
+/*
+ *  Check the super loop profile (debug/profile.c), and what the "PROFile"
+ *  command prints of it.
+ *
+ *      proftest [-n passes] [-s seed]
+ *
+ *  The profile's source is included here, and the cycle counter (DWT's
+ *  CYCCNT) is memory at the chip's address, moved on by the test.  -n
+ *  passes (default 100000) of the super loop are made up, each stage
+ *  taking a random time of its own, with the odd long store stage, and
+ *  the counter wrapping.  The sleeps are counted in RTC ticks, one of them
+ *  longer than 32 bits of cycles.
+ *
+ *  What "profile" prints must agree with the times put in:  the counts and
+ *  the longest runs exactly, the totals, the means and the shares to their
+ *  last digit or near enough (the shares must add up to 100%), and the
+ *  histograms of "profile histogram" exactly.  "profile clear" must clear
+ *  it all.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <err.h>
+
+/*
+ *  The profile, with its output renamed out of the C library's way.
+ */
+#define dprintf         profDprintf
+#define snprintf        profSnprintf
+#include "debug/profile.c"
+#undef dprintf
+#undef snprintf
+
+static char     Out[8192];              //  What the command printed
+static unsigned OutLen;
+
+static unsigned Count[PROF_STAGES];
+static u64      Total[PROF_STAGES];
+static unsigned Max[PROF_STAGES];
+static unsigned Hist[PROF_STAGES][PROF_BUCKETS];
+
+static int      Failed;
+
+/**********************************************************************/
+/*
+ *  What the profile uses from the rest of the firmware.
+ */
+
+int
+profDprintf(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(Out + OutLen, sizeof Out - OutLen, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        OutLen += n;
+    return n;
+}
+
+
+/*
+ *  As main/cmd.c has it:  0 if they match, 1 if `text' is a short form of
+ *  `cmd' (all of its capitals), and 2 if not.
+ */
+int
+StrcmpCmd(const char * cmd, const char * text)
+{
+    for (; *text; cmd++, text++)
+        if ((*cmd | ('a' - 'A')) != (*text | ('a' - 'A')))
+            return 2;
+    for (const char * cp = cmd; *cp; cp++)
+        if (*cp >= 'A' && *cp <= 'Z')
+            return 2;
+    return *cmd ? 1 : 0;
+}
+
+/**********************************************************************/
+
+static void
+fail(const char * what, const char * stage, double got, double want)
+{
+    if (Failed++ < 10)
+        printf("%s (%s):  %.1f, should be %.1f\n", what, stage, got, want);
+}
+
+
+static void
+run(char * arg)
+{
+    char * argv[] = { "profile", arg, 0 };
+
+    OutLen = 0;
+    Out[0] = '\0';
+    profileCmd(arg ? 2 : 1, argv);
+}
+
+
+/*
+ *  Put `cycles' on the counter, and charge them to `stage' as the super
+ *  loop does.
+ */
+static unsigned
+stage(int s, unsigned cycles, unsigned mark)
+{
+    DWT->CYCCNT += cycles;
+
+    Count[s]++;
+    Total[s] += cycles;
+    if (cycles > Max[s])
+        Max[s] = cycles;
+    int b = 0;
+    while (b < PROF_BUCKETS - 1 && (cycles >> (b + 1)) != 0)
+        b++;
+    Hist[s][b]++;
+
+    return ProfileStage(s, mark);
+}
+
+
+static void
+sleep64(u64 ticks)
+{
+    u64 cycles = ticks * TACHY_UNIT / TICK_UNIT;
+
+    ProfileSleep(ticks);
+    Count[PROF_SLEEP]++;
+    Total[PROF_SLEEP] += cycles;
+    unsigned c = cycles >> 32 ? MAXU32 : cycles;
+    if (c > Max[PROF_SLEEP])
+        Max[PROF_SLEEP] = c;
+    int b = 0;
+    while (b < PROF_BUCKETS - 1 && (c >> (b + 1)) != 0)
+        b++;
+    Hist[PROF_SLEEP][b]++;
+}
+
+/**********************************************************************/
+
+/*
+ *  The start of the next line of what was printed (the firmware's own
+ *  headers are in the C library's way).
+ */
+static char *
+nextLine(char * cp)
+{
+    while (*cp && *cp != '\n')
+        cp++;
+    return *cp ? cp + 1 : 0;
+}
+
+
+/*
+ *  Check a figure printed to its last digit, or to 1 part in 2^15 (as
+ *  good as profileDiv() gets):  `got' is what was printed, and `want' the
+ *  exact value, in the units printed.
+ */
+static void
+near(const char * what, const char * name, double got, double want,
+     double digit)
+{
+    if (digit < want / 32768)
+        digit = want / 32768;
+    if (got > want + digit || got < want - digit)
+        fail(what, name, got, want);
+}
+
+
+static void
+check(void)
+{
+    u64 all = 0;
+    for (int s = 0; s < PROF_STAGES; s++)
+        all += Total[s];
+
+    run(0);
+    char * line = nextLine(Out);
+    if (!line)
+    {
+        fail("no output", "", 0, 0);
+        return;
+    }
+
+    double shares = 0;
+    for (int s = 0; s < PROF_STAGES; s++)
+    {
+        char name[16];
+        unsigned count, ms, share, tenths, mean, max;
+
+        if (!line || sscanf(line, "%15s %u %u %u.%u %u %u", name, &count,
+                            &ms, &share, &tenths, &mean, &max) != 7)
+        {
+            fail("can't read the line", profileName[s], 0, 0);
+            return;
+        }
+        line = nextLine(line);
+
+        if (strcmp(name, profileName[s]) != 0)
+            fail("the wrong stage", name, s, 0);
+        if (count != Count[s])
+            fail("count", name, count, Count[s]);
+        if (max != TACHY2US(Max[s]))
+            fail("max us", name, max, TACHY2US(Max[s]));
+        near("total ms", name, ms, Total[s] * 1000.0 / TACHY_UNIT, 1);
+        near("mean us", name, mean,
+             Count[s] ? Total[s] * 1e6 / TACHY_UNIT / Count[s] : 0, 1);
+        near("share %", name, share + tenths / 10.0,
+             100.0 * Total[s] / all, 0.1);
+        shares += share + tenths / 10.0;
+    }
+    near("shares %", "all", shares, 100, 0.1 * PROF_STAGES);
+
+    run("hist");
+    line = Out;
+    for (int i = 0; i < PROF_STAGES + 3 && line; i++)
+        line = nextLine(line);
+    if (!line)
+    {
+        fail("no histograms", "", 0, 0);
+        return;
+    }
+
+    for (int s = 0; s < PROF_STAGES; s++)
+    {
+        char * end = nextLine(line) - 1;
+        unsigned b, n, at = 0;
+        int len;
+
+        line += strlen(profileName[s]);
+        while (line < end && sscanf(line, " %u:%u%n", &b, &n, &len) == 2)
+        {
+            while (at < b && at < PROF_BUCKETS)
+                if (Hist[s][at++])
+                    fail("histogram bucket missing", profileName[s],
+                         at - 1, Hist[s][at - 1]);
+            if (at >= PROF_BUCKETS || n != Hist[s][at])
+                fail("histogram bucket", profileName[s], n,
+                     at < PROF_BUCKETS ? Hist[s][at] : 0);
+            at++;
+            line += len;
+        }
+        while (at < PROF_BUCKETS)
+            if (Hist[s][at++])
+                fail("histogram bucket missing", profileName[s],
+                     at - 1, Hist[s][at - 1]);
+        line = end + 1;
+    }
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    unsigned passes = 100000;
+    int c;
+
+    srandom(39);
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            passes = strtoul(optarg, 0, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: proftest [-n passes] [-s seed]\n", stderr);
+            exit(1);
+        }
+
+    if (mmap((void *)((unsigned long)DWT & ~0xfffUL), 0x1000,
+             PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0) == MAP_FAILED)
+        err(1, "can't map the DWT");
+    DWT->CYCCNT = -10000;
+
+    /*
+     *  The super loop, with the stages' times made up.
+     */
+    for (unsigned i = 0; i < passes; i++)
+    {
+        unsigned mark = TachyonGet();
+
+        for (int s = 0; s < PROF_SLEEP; s++)
+        {
+            unsigned cycles = random() % (50 << s);
+            if (s == PROF_STORE && random() % 1000 == 0)
+                cycles += 1000000 + random() % 1000000;
+            mark = stage(s, cycles, mark);
+        }
+        if (random() % 3 == 0)
+            sleep64(1 + random() % (TICK_UNIT / 16));
+    }
+    sleep64((u64)TICK_UNIT * 200);
+
+    check();
+
+    /*
+     *  Cleared, and one pass more.
+     */
+    run("clear");
+    memset(Count, 0, sizeof Count);
+    memset(Total, 0, sizeof Total);
+    memset(Max, 0, sizeof Max);
+    memset(Hist, 0, sizeof Hist);
+
+    unsigned mark = TachyonGet();
+    for (int s = 0; s < PROF_SLEEP; s++)
+        mark = stage(s, 1000 << s, mark);
+    sleep64(TICK_UNIT);
+    check();
+
+    printf("%u passes:  %s\n", passes,
+           Failed ? "FAILED" : "the profile prints as it should");
+    return Failed != 0;
+}
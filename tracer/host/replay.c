@@ -0,0 +1,397 @@
+/*
+ *  Replay packets through the tracer's packet path, on a host.
+ *
+ *      replay [-e] [-o out] [-x speed] [-c cycles] [-b cycles] [-r rate]
+ *             [-C channels] [-n packets] [file]
+ *
+ *  The packets are 20 byte records (Record_t, below, with the time in
+ *  cycles of the 64 MHz clock;  the tools call them packet_t), from the
+ *  file, or made up:  -C channels (default 100) each sending 4 times a
+ *  second, -n packets in all (default 100000), a few with bad CRCs.
+ *
+ *  Each packet is put where the radio's DMA would, and the radio
+ *  interrupt handler run, at the packet's time;  in between, the super
+ *  loop runs (TempusMagnaCirculi() and TraceSuperLoop()), and prints the
+ *  packets to the RTT buffer (see host.c);  or with -e, exports them, as
+ *  the tracer's "capture on" does.  -o writes what comes out of the
+ *  buffer to a file ("-" for stdout).
+ *
+ *  The target's time is simulated.  By default, each pass through the
+ *  super loop that takes a packet costs -c cycles (default 3000), plus -b
+ *  cycles (default 120) for each byte printed;  the packets arrive as
+ *  fast as they're replayed, and come in at their own time on the target.
+ *  That's a rough model, and best set from the target's own numbers (the
+ *  "profile" command).  With -x, the packets are replayed in real time,
+ *  sped up that many times, and the target's time is the host's.
+ *
+ *  At the end, it reports the packets dropped (the ring being full when
+ *  they came, or a bad CRC), the RTT output lost (the buffer being full;
+ *  -r sets how fast the debugger empties it, default 1000000 bytes a
+ *  second), how busy the target was, and how fast the host ran the
+ *  packet path:  packets a second, and CPU cycles a packet (from the
+ *  performance counters if the kernel has them, else the time stamp
+ *  counter);  and the bandwidth of the output:  bytes a packet, and how
+ *  fast the host made them.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <err.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "host.h"
+#include "nrf.h"
+#include "types.h"
+#include "store/config.h"
+
+/*
+ *  Set a register the firmware only reads.
+ */
+#define SET(reg, v)     (*(volatile uint32_t *)&(reg) = (v))
+
+/*
+ *  From the tracer.
+ */
+extern int      TraceSuperLoop(void);
+extern void     TraceSetup(void);
+extern bool     TraceIsIdle(void);
+extern void     TempusMagnaCirculi(void);
+extern void     SWI0_EGU0_IRQHandler(void);
+
+typedef struct
+{
+    uint32_t    time;
+    uint8_t     data[13];
+    uint8_t     __res0;
+    int8_t      rssi;
+    uint8_t     crcOk;
+}
+    Record_t;
+
+/**********************************************************************/
+
+static unsigned     LoopCycles = 3000;
+static unsigned     ByteCycles = 120;
+static double       Speed;
+
+static unsigned long long   In, Bad, Dropped, Done; //  (Done:  passes)
+static HostTime_t           Busy;           //  Target cycles in the loop
+
+static int          PerfFd = -1;
+static double       HostSeconds;
+static unsigned long long   HostCycles;
+
+/**********************************************************************/
+/*
+ *  Measuring the host.
+ */
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+perfOpen(void)
+{
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof pe);
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof pe;
+    pe.config = PERF_COUNT_HW_CPU_CYCLES;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    PerfFd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+
+static unsigned long long
+cycles(void)
+{
+    unsigned long long c = 0;
+    if (PerfFd >= 0)
+    {
+        if (read(PerfFd, &c, sizeof c) != sizeof c)
+            c = 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    else
+        c = __rdtsc();
+#endif
+    return c;
+}
+
+/**********************************************************************/
+
+/*
+ *  One pass through the super loop.
+ */
+static void
+loop(void)
+{
+    bool packet = !TraceIsIdle();
+    unsigned long long bytes = HostRttBytes + HostRttSkipped;
+    HostTime_t start = HostNow;
+
+    double t0 = now();
+    unsigned long long c0 = cycles();
+    TempusMagnaCirculi();
+    TraceSuperLoop();
+    unsigned long long c1 = cycles();
+    double t1 = now();
+
+    if (packet)
+    {
+        Done++;
+        HostCycles += c1 - c0;
+        HostSeconds += t1 - t0;
+    }
+    if (Speed == 0)
+    {
+        HostTime_t cost = packet ? LoopCycles : 50;
+        cost += (HostRttBytes + HostRttSkipped - bytes) * ByteCycles;
+        HostAdvance(cost);
+    }
+    else
+        HostAdvance((t1 - t0) * Speed * HOST_HZ);
+    Busy += HostNow - start;
+}
+
+
+/*
+ *  What the radio does when a packet ends:  DMA it in, and interrupt.
+ */
+static void
+receive(const Record_t * rp, HostTime_t when)
+{
+    HostTime_t t = HostNow;
+    DWT->CYCCNT = when;
+
+    uint32_t slot = NRF_RADIO->PACKETPTR;
+    memcpy((void *)(uintptr_t)slot, rp->data, sizeof rp->data);
+    SET(NRF_RADIO->CRCSTATUS, rp->crcOk);
+    SET(NRF_RADIO->RSSISAMPLE, -rp->rssi);
+    NRF_RADIO->EVENTS_END = 1;
+    SWI0_EGU0_IRQHandler();
+
+    In++;
+    if (!rp->crcOk)
+        Bad++;
+    else if (NRF_RADIO->PACKETPTR == slot)
+        Dropped++;
+
+    DWT->CYCCNT = t;
+}
+
+
+/*
+ *  Run the super loop until the target's time `when', then give it the
+ *  packet.
+ */
+static void
+replay(const Record_t * rp, HostTime_t when)
+{
+    if (Speed > 0)
+    {
+        static double start;
+        if (start == 0)
+            start = now() - when / (HOST_HZ * Speed);
+        double due = start + when / (HOST_HZ * Speed);
+        double t;
+        while ((t = now()) < due)
+        {
+            if (!TraceIsIdle())
+                loop();
+            HostTime_t n = (t - start) * HOST_HZ * Speed;
+            if (n > HostNow)
+                HostAdvance(n - HostNow);
+        }
+    }
+    else
+    {
+        while (!TraceIsIdle() && HostNow < when)
+            loop();
+        if (HostNow < when)
+        {
+            loop();                     //  (An idle pass)
+            if (HostNow < when)
+                HostAdvance(when - HostNow);
+        }
+    }
+
+    receive(rp, when);
+}
+
+/**********************************************************************/
+
+static void
+replayFile(FILE * fp)
+{
+    Record_t r;
+    HostTime_t t = 0;
+    uint32_t last = 0;
+    bool first = true;
+
+    while (fread(&r, sizeof r, 1, fp) == 1)
+    {
+        if (first)
+            t = r.time;
+        else
+            t += r.time - last;
+        first = false;
+        last = r.time;
+        replay(&r, t);
+    }
+}
+
+
+#define PERIOD  (8070ull * HOST_HZ / 32768)     //  ANT's usual 4 Hz
+
+
+static void
+replaySynthetic(unsigned channels, unsigned long long count)
+{
+    HostTime_t * phase = malloc(channels * sizeof *phase);
+    if (!phase)
+        err(1, "no memory");
+    srandom(44);
+    for (unsigned c = 0; c < channels; c++)
+        phase[c] = (HostTime_t)c * PERIOD / channels + random() % 1000;
+
+    unsigned long long n = 0;
+    for (HostTime_t base = HOST_HZ / 10; n < count; base += PERIOD)
+        for (unsigned c = 0; c < channels && n < count; c++, n++)
+        {
+            Record_t r;
+            memset(&r, 0, sizeof r);
+            unsigned dev = 0x1000 + c;
+            r.data[0] = dev;
+            r.data[1] = dev >> 8;
+            r.data[2] = 0x78;
+            r.data[3] = 0x01;
+            r.data[4] = 0x0a;
+            for (int i = 0; i < 8; i++)
+                r.data[5 + i] = random();
+            r.rssi = -40 - random() % 50;
+            r.crcOk = (random() % 100) != 0;
+            HostTime_t t = base + phase[c];
+            r.time = t;
+            replay(&r, t);
+        }
+
+    free(phase);
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern int optind;
+    extern char * optarg;
+    char * outFile = 0;
+    unsigned channels = 100;
+    unsigned long long count = 100000;
+    int c;
+
+    while ((c = getopt(argc, argv, "eo:x:c:b:r:C:n:")) != -1)
+        switch (c)
+        {
+        case 'e':
+            Config.confCapture = 1;
+            break;
+        case 'o':
+            outFile = optarg;
+            break;
+        case 'x':
+            Speed = strtod(optarg, 0);
+            break;
+        case 'c':
+            LoopCycles = strtoul(optarg, 0, 0);
+            break;
+        case 'b':
+            ByteCycles = strtoul(optarg, 0, 0);
+            break;
+        case 'r':
+            HostRttRate = strtoul(optarg, 0, 0);
+            break;
+        case 'C':
+            channels = strtoul(optarg, 0, 0);
+            break;
+        case 'n':
+            count = strtod(optarg, 0);
+            break;
+        default:
+            fputs("usage: replay [-e] [-o out] [-x speed] [-c cycles] "
+                  "[-b cycles] [-r rate] [-C channels] [-n packets] "
+                  "[file]\n", stderr);
+            exit(1);
+        }
+    if (channels == 0 || HostRttRate == 0)
+        errx(1, "-C and -r can't be 0");
+
+    if (outFile && strcmp(outFile, "-") == 0)
+        HostOut = stdout;
+    else if (outFile && !(HostOut = fopen(outFile, "w")))
+        err(1, "%s", outFile);
+
+    perfOpen();
+    HostSetup();
+    TraceSetup();
+
+    if (optind < argc)
+    {
+        FILE * fp = fopen(argv[optind], "r");
+        if (!fp)
+            err(1, "%s", argv[optind]);
+        replayFile(fp);
+        fclose(fp);
+    }
+    else
+        replaySynthetic(channels, count);
+
+    while (!TraceIsIdle())
+        loop();
+    if (HostOut)
+        fflush(HostOut);
+
+    double target = (double)HostNow / HOST_HZ;
+    unsigned long long sent = In - Bad - Dropped;
+    fprintf(stderr,
+            "packets:  %llu in, %llu bad CRC, %llu dropped, %llu %s\n",
+            In, Bad, Dropped, sent,
+            Config.confCapture ? "exported" : "printed");
+    fprintf(stderr,
+            "target:   %.3f s, %.1f%% busy, RTT %llu bytes, %llu lost, "
+            "%.3f s blocked\n",
+            target, target > 0 ? 100.0 * Busy / HostNow : 0.0,
+            HostRttBytes, HostRttSkipped, (double)HostRttStall / HOST_HZ);
+    if (sent > 0 && HostSeconds > 0)
+    {
+        fprintf(stderr,
+                "host:     %.0f packets/s, %.0f ns a packet, "
+                "%.0f cycles a packet (%s)\n",
+                sent / HostSeconds, HostSeconds * 1e9 / sent,
+                (double)HostCycles / sent,
+                PerfFd >= 0 ? "perf" : "tsc");
+        fprintf(stderr,
+                "output:   %.1f bytes a packet, %.1f MB/s on the host, "
+                "%llu passes\n",
+                (double)(HostRttBytes + HostRttSkipped) / sent,
+                (HostRttBytes + HostRttSkipped) / HostSeconds / 1e6, Done);
+    }
+    return 0;
+}
@@ -0,0 +1,1029 @@
+/*
+ *  A model of the flash under the circular store (store/store.c), and
+ *  checks of what the store does with it.
+ *
+ *      storetest [-n records] [-f failures] [-c chunks] [-s seed]
+ *
+ *  The store's source is included here, so the checks can see its state.
+ *  The flash is memory at the chip's addresses, shared by a run of boots:
+ *  each boot is a child process, so the store starts from scratch and
+ *  replays what the boots before it left.  The soft device's flash calls
+ *  complete on the next pass of the super loop, and one in -f (default
+ *  50) fails, so the retries are used too.  Writing a word that is not
+ *  erased, or outside the store, is an error.
+ *
+ *  -n records (default 20000) of all sizes are written over 8 boots, which
+ *  goes round the store a few times:  in bursts, or one a pass, with the
+ *  tracer idle or busy.  After each boot, every
+ *  page in use must have one sequence record, just after the record that
+ *  runs into the page;  the sequence numbers must go up by one a page;
+ *  records must straddle pages, except at the end of the store;  and only
+ *  the last page of the store or the newest may have room left.  In each
+ *  boot, after the replay and after the writes, the records must all be
+ *  there and intact, from the oldest to the newest, with nearly a whole
+ *  store of them.  The page index must agree with the flash, and the
+ *  queries on it (StoreIterInit() ...) must find the records they should.
+ *  The last boot only replays, once the store has gone round a few times,
+ *  and the records found then are reported.
+ *
+ *  The flash itself is watched too:  no page may be given a second
+ *  sequence record between erases, and records that come in bursts must
+ *  go to flash at least four to a write.
+ *
+ *  Erasing the next page ahead of time is checked too:  only the page
+ *  after the one being written is ever erased, and ahead of time only
+ *  once that page is 3/4 full, and only while the tracer is idle.  Records
+ *  written one a pass while it is idle never wait for an erase:  the flash
+ *  notes how each page was last erased, and the first write into a page
+ *  must find it erased ahead.
+ *
+ *  Last, the packing of bytes into records:  wrBytes() must give the same
+ *  words as a wr(8, ...) a byte, after any number of bits, and rdBytes()
+ *  must give the bytes back.  Then both ways are timed, packing and
+ *  unpacking -c software update chunks (default 1000000).
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/*
+ *  The store, with its debug output renamed out of the C library's way.
+ */
+#define dprintf         storeDprintf
+#define snprintf        storeSnprintf
+#include "store/store.c"
+#undef dprintf
+#undef snprintf
+
+#define STORE_WORDS     (OQ_FLASH_PAGE / sizeof (u32))
+#define BOOTS           8
+
+/*
+ *  What's kept from boot to boot.
+ */
+static struct
+{
+    unsigned    next;               //  The next record to write
+    unsigned    burstRecords;       //  Records written in bursts,
+    unsigned    burstWrites;        //  and the flash writes they took
+    u8          seqs[STORE_PAGES];  //  Sequence records written to each page
+    u8          erased[STORE_PAGES];//  How each page was last erased
+    unsigned    entered[3];         //  Pages written into, by how erased
+    unsigned    oldest;             //  The oldest record found last,
+    unsigned    found;              //  how many were found,
+    unsigned    chunks;             //  how many of them chunks,
+    unsigned    pages;              //  and the pages written so far
+}
+    * Shared;
+
+/*
+ *  How a page came to be erased.
+ */
+enum { FRESH, AHEAD, STALLED };
+
+static bool         Idle;
+static bool         Trickle;        //  Records come one a pass
+static unsigned     FailEvery = 50;
+static unsigned     Records = 20000;
+static unsigned     Chunks = 1000000;
+static int          Failed;
+
+/**********************************************************************/
+/*
+ *  The soft device's flash calls.  Only one may be in progress;  it is
+ *  done (or fails) by `flashDone()'.
+ */
+
+static enum { NONE, WRITE, ERASE } Op;
+static u32 *        OpDst;
+static const u32 *  OpSrc;
+static unsigned     OpWords;
+
+
+static void
+fail(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (Failed++ < 10)
+    {
+        vprintf(fmt, ap);
+        putchar('\n');
+    }
+    va_end(ap);
+}
+
+
+static bool
+inStore(u32 * p, unsigned words)
+{
+    u32 a = (u32)p;
+    u32 e = a + words * sizeof (u32);
+
+    if (a >= OQ_FLASH_STORE && e <= OQ_FLASH_STORE_END)
+        return true;
+    return a >= OQ_FLASH_CONFIG && e <= OQ_FLASH_CONFIG + OQ_FLASH_PAGE;
+}
+
+
+uint32_t
+sd_flash_write(uint32_t * dst, uint32_t const * src, uint32_t words)
+{
+    if (Op != NONE)
+        fail("flash write at %x while busy", (u32)dst);
+    if (words == 0 || words > 1024 || !inStore(dst, words))
+        fail("flash write at %x of %u words", (u32)dst, words);
+    Op = WRITE;
+    OpDst = dst;
+    OpSrc = src;
+    OpWords = words;
+    return NRF_SUCCESS;
+}
+
+
+uint32_t
+sd_flash_page_erase(uint32_t page)
+{
+    u32 * p = (u32 *)(page * OQ_FLASH_PAGE);
+
+    if (Op != NONE)
+        fail("flash erase of %x while busy", (u32)p);
+    if (!inStore(p, STORE_WORDS))
+        fail("flash erase of %x", (u32)p);
+
+    /*
+     *  Only ever the page after the one being written.
+     */
+    u32 * next = (u32 *)((u32)currentWrite & ~(OQ_FLASH_PAGE - 1));
+    if (next != currentWrite)
+        next += STORE_WORDS;
+    if (next >= (u32 *)OQ_FLASH_STORE_END)
+        next = (u32 *)OQ_FLASH_STORE;
+    if (p != next && p != (u32 *)OQ_FLASH_CONFIG)
+        fail("flash erase of %x, writing at %x", (u32)p, (u32)currentWrite);
+    Op = ERASE;
+    OpDst = p;
+    return NRF_SUCCESS;
+}
+
+
+/*
+ *  Finish the flash operation in progress, if any.  Returns false if
+ *  there wasn't one.
+ */
+static bool
+flashDone(void)
+{
+    if (Op == NONE)
+        return false;
+
+    bool ok = random() % FailEvery != 0;
+    if (ok && Op == WRITE)
+    {
+        for (unsigned i = 0; i < OpWords; i++)
+        {
+            if (OpDst[i] != 0xffffffff)
+                fail("flash write over %x (%08x)", (u32)&OpDst[i], OpDst[i]);
+            OpDst[i] &= OpSrc[i];
+
+            /*
+             *  The first write into a page.  Written one a pass while the
+             *  tracer is idle, records never wait for the page to be
+             *  erased.
+             */
+            u32 * w = &OpDst[i];
+            if (w < (u32 *)OQ_FLASH_STORE_END &&
+                ((u32)w & (OQ_FLASH_PAGE - 1)) == 0)
+            {
+                unsigned how = Shared->erased[pageNumber(w)];
+                Shared->entered[how]++;
+                if (how == STALLED && Idle && Trickle)
+                    fail("write into %x waited for its erase", (u32)w);
+            }
+
+            /*
+             *  A page gets one sequence record between erases.
+             */
+            if (OpDst < (u32 *)OQ_FLASH_STORE_END &&
+                OpSrc[i] >> RT_SHIFT == (0x20 | RT_SEQUENCE) &&
+                Shared->seqs[pageNumber(&OpDst[i])]++ > 0)
+                fail("a second sequence record at %x", (u32)&OpDst[i]);
+        }
+    }
+    else if (ok && Op == ERASE)
+    {
+        memset(OpDst, 0xff, OQ_FLASH_PAGE);
+        if (OpDst != (u32 *)OQ_FLASH_CONFIG)
+            Shared->seqs[pageNumber(OpDst)] = 0;
+    }
+
+    Op = NONE;
+    StoreFlashed(ok);
+    return true;
+}
+
+/**********************************************************************/
+/*
+ *  What the store uses from the rest of the firmware.
+ */
+
+Config_t        Config;
+
+bool
+TraceIsIdle(void)
+{
+    return Idle;
+}
+
+
+u32
+ConfigCRC(Config_t * conf)
+{
+    return 0;
+}
+
+
+void
+StoreCallbackConfiguration(Config_t * conf)
+{
+}
+
+
+unsigned
+Future(unsigned secs)
+{
+    return secs;
+}
+
+
+void
+TempusCalloutVar(TempusCallout_t * tmr, unsigned tod, int * var)
+{
+}
+
+
+void
+TachyonLog1(int id, unsigned x1)
+{
+}
+
+
+void
+TachyonLog2(int id, unsigned x1, unsigned x2)
+{
+}
+
+
+int
+storeDprintf(const char * fmt, ...)
+{
+    return 0;
+}
+
+
+int
+dbprintf(const char * fmt, ...)
+{
+    return 0;
+}
+
+
+int
+StrcmpCmd(const char * cmd, const char * text)
+{
+    return 2;
+}
+
+
+u32
+GetDecimal(const char * s)
+{
+    return 0;
+}
+
+
+u32
+GetHex(char * s)
+{
+    return 0;
+}
+
+/**********************************************************************/
+/*
+ *  The records written.  Record `n' has a type and contents that depend
+ *  only on `n', and carries `n' in its sequence field.
+ */
+
+static unsigned
+kind(unsigned n)
+{
+    static const u8 kinds[8] =
+    {
+        RT_SU_DATA, RT_SU_DATA, RT_SU_EXEC, RT_SU_DATA,
+        RT_SU_HDR, RT_SU_DATA, RT_SU_DELTA, RT_SU_DATA,
+    };
+
+    return kinds[(n * 2654435761u) >> 29];
+}
+
+
+static void
+make(unsigned n, StoreRecord_t * r)
+{
+    u32 h = n * 2246822519u + 374761393u;
+
+    memset(r, 0, sizeof *r);
+    switch (kind(n))
+    {
+    case RT_SU_DATA:
+        r->sud.sequence = n;
+        r->sud.address = (h & 0x1fff) << OQ_SU_CHUNK_SHIFT;
+        for (int i = 0; i < OQ_SU_CHUNK; i++)
+            r->sud.data[i] = (h >> (i % 24)) + i * 13;
+        break;
+
+    case RT_SU_DELTA:
+        r->sui.delta = (h & 0x3ffff) | 1;
+        r->sui.base = h * 3;
+        r->sui.crc = h * 5;
+        /* fall through */
+    case RT_SU_HDR:
+        r->sui.sequence = n;
+        r->sui.version = h;
+        r->sui.start = (h & 0x3fff) << OQ_SU_CHUNK_SHIFT;
+        r->sui.end = ((h >> 14) & 0x3fff) << OQ_SU_CHUNK_SHIFT;
+        break;
+
+    case RT_SU_EXEC:
+        r->sux.sequence = n;
+        r->sux.version = h;
+        break;
+    }
+}
+
+
+/*
+ *  Queue record `n';  false if the queue is full.
+ */
+static bool
+submit(unsigned n)
+{
+    StoreRecord_t r;
+
+    make(n, &r);
+    switch (kind(n))
+    {
+    case RT_SU_DATA:
+        return StoreSoftwareUpdateChunk(&r.sud);
+    case RT_SU_HDR:
+    case RT_SU_DELTA:
+        return StoreSoftwareUpdateInfo(&r.sui);
+    default:
+        return StoreSoftwareUpdateExecute(&r.sux);
+    }
+}
+
+
+static bool
+same(unsigned n, StoreRecord_t * r)
+{
+    StoreRecord_t want;
+
+    make(n, &want);
+    switch (kind(n))
+    {
+    case RT_SU_DATA:
+        return memcmp(&want.sud, &r->sud, sizeof want.sud) == 0;
+    case RT_SU_HDR:
+    case RT_SU_DELTA:
+        return memcmp(&want.sui, &r->sui, sizeof want.sui) == 0;
+    default:
+        return memcmp(&want.sux, &r->sux, sizeof want.sux) == 0;
+    }
+}
+
+
+/*
+ *  The number of words record `n' takes in flash.
+ */
+static unsigned
+words(unsigned n)
+{
+    static const unsigned bits[RT_MASK + 1] =
+    {
+        [RT_SU_DATA] = 20 + 13 + OQ_SU_CHUNK * 8,
+        [RT_SU_HDR] = 20 + 32 + 14 + 14,
+        [RT_SU_DELTA] = 20 + 32 + 14 + 14 + 18 + 32 + 32,
+        [RT_SU_EXEC] = 20 + 32,
+    };
+
+    return 1 + (bits[kind(n)] - RT_SHIFT + 30) / 31;
+}
+
+/**********************************************************************/
+
+/*
+ *  A pass of the super loop, and the end of the flash operation started
+ *  in the last one.  Returns false if there was nothing to do.
+ */
+static bool
+pass(void)
+{
+    unsigned pre = storePreErases;
+    unsigned stalls = storeEraseStalls;
+    bool busy = StoreSuperLoop();
+
+    if (storeEraseStalls != stalls)
+        Shared->erased[pageNumber(OpDst)] = STALLED;
+    if (storePreErases != pre)
+    {
+        Shared->erased[pageNumber(OpDst)] = AHEAD;
+
+        unsigned used = currentWrite - (u32 *)((u32)currentWrite &
+                                               ~(OQ_FLASH_PAGE - 1));
+        if (!Idle)
+            fail("page erased ahead while the tracer is busy");
+        else if (used != 0 && used < PRE_ERASE_WORDS)
+            fail("page erased ahead with %u words written", used);
+    }
+
+    return flashDone() || busy;
+}
+
+
+/*
+ *  Run the store until it has nothing more to do.
+ */
+static void
+run(void)
+{
+    while (pass())
+        ;
+}
+
+
+/*
+ *  Read all the records back, oldest first.  They must be the records up
+ *  to the last one written, with none missing, and fill most of the store.
+ *  What was found is noted in `Shared'.
+ */
+static void
+checkRecords(const char * when)
+{
+    static u8 found[1 << 20];
+    static const u8 types[] =
+    {
+        RT_SU_DATA, RT_SU_HDR, RT_SU_DELTA, RT_SU_EXEC,
+    };
+    unsigned last = Shared->next;
+    unsigned oldest = last;
+
+    memset(found, 0, last);
+    for (int t = 0; t < sizeof types; t++)
+    {
+        StoreIter_t it;
+        StoreRecord_t r;
+        unsigned prev = 0;
+
+        StoreIterInit(&it, types[t], 0, ~0);
+        while (StoreIterNext(&it))
+        {
+            memset(&r, 0, sizeof r);
+            if (!StoreIterRead(&it, &r))
+            {
+                fail("%s:  can't read record at %x", when, (u32)it.record);
+                continue;
+            }
+
+            unsigned n = r.sequence;
+            if (n >= last || kind(n) != types[t] || !same(n, &r))
+                fail("%s:  record %u (type %x) is wrong", when, n, types[t]);
+            else if (n < prev)
+                fail("%s:  record %u is after %u", when, n, prev);
+            else
+            {
+                found[n] = 1;
+                prev = n;
+                if (n < oldest)
+                    oldest = n;
+            }
+        }
+    }
+
+    unsigned used = 0;
+    Shared->found = Shared->chunks = 0;
+    for (unsigned n = oldest; n < last; n++)
+    {
+        if (!found[n])
+            fail("%s:  record %u is missing (%u to %u are there)",
+                 when, n, oldest, last - 1);
+        used += words(n);
+        Shared->found += found[n];
+        Shared->chunks += found[n] && kind(n) == RT_SU_DATA;
+    }
+    Shared->oldest = oldest;
+
+    /*
+     *  Once round the store, all but the page being erased and the one
+     *  being filled should hold records.
+     */
+    if (oldest > 0 && used < (STORE_PAGES - 2) * STORE_WORDS)
+        fail("%s:  only %u words of records (from record %u)",
+             when, used, oldest);
+}
+
+
+/*
+ *  The page index must match the flash:  each page's sequence number, and
+ *  the types of the records that start in it.  The newest record of each
+ *  type must be the last one written, and iterating over a range of pages
+ *  must find just the records in them.
+ */
+static void
+checkIndex(const char * when)
+{
+    static const u8 types[] =
+    {
+        RT_SU_DATA, RT_SU_HDR, RT_SU_DELTA, RT_SU_EXEC,
+    };
+    unsigned oldest = ~0, newest = 0;
+
+    for (int pn = 0; pn < STORE_PAGES; pn++)
+    {
+        u32 * p = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+        u32 seq = 0, mask = 0;
+
+        for (int i = 0; i < STORE_WORDS && p[i] != 0xffffffff; i++)
+        {
+            if (!(p[i] & 0x80000000))
+                continue;
+            mask |= 1 << ((p[i] >> RT_SHIFT) & RT_MASK);
+            if (p[i] >> RT_SHIFT == (0x20 | RT_SEQUENCE))
+                seq = p[i] & RD_MASK;
+        }
+
+        if (pageIndex[pn].seq != seq || pageIndex[pn].types != mask)
+            fail("%s:  page %x indexed as %u %x, is %u %x", when, (u32)p,
+                 pageIndex[pn].seq, pageIndex[pn].types, seq, mask);
+        if (seq && seq < oldest)
+            oldest = seq;
+        if (seq > newest)
+            newest = seq;
+    }
+    Shared->pages = newest;
+    if (newest == 0)
+        return;
+
+    for (int t = 0; t < sizeof types; t++)
+    {
+        StoreIter_t it;
+        StoreRecord_t r;
+        unsigned last = Shared->next;
+
+        while (last > 0 && kind(last - 1) != types[t])
+            last--;
+        if (last == 0 || last - 1 < Shared->oldest)
+            continue;
+        if (!StoreIterNewest(&it, types[t]))
+            fail("%s:  no newest record of type %x", when, types[t]);
+        else if (!StoreIterRead(&it, &r) || r.sequence != last - 1)
+            fail("%s:  newest record of type %x is %u, not %u",
+                 when, types[t], r.sequence, last - 1);
+    }
+
+    /*
+     *  A few ranges of pages, each one of the records in them.
+     */
+    for (int k = 0; k < 20; k++)
+    {
+        unsigned lo = oldest + random() % (newest - oldest + 1);
+        unsigned hi = lo + random() % 4;
+        unsigned ty = types[k % sizeof types];
+        unsigned want = 0, got = 0;
+        StoreIter_t it;
+
+        for (int pn = 0; pn < STORE_PAGES; pn++)
+        {
+            u32 * p = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+
+            if (pageIndex[pn].seq < lo || pageIndex[pn].seq > hi)
+                continue;
+            for (int i = 0; i < STORE_WORDS && p[i] != 0xffffffff; i++)
+                if (p[i] >> RT_SHIFT == (0x20 | ty))
+                    want++;
+        }
+
+        StoreIterInit(&it, ty, lo, hi);
+        while (StoreIterNext(&it))
+        {
+            unsigned pn = pageNumber(it.record);
+            if (pageIndex[pn].seq < lo || pageIndex[pn].seq > hi ||
+                *it.record >> RT_SHIFT != (0x20 | ty))
+                fail("%s:  record at %x isn't in pages %u to %u",
+                     when, (u32)it.record, lo, hi);
+            got++;
+        }
+        if (got != want)
+            fail("%s:  %u records of type %x in pages %u to %u, not %u",
+                 when, got, ty, lo, hi, want);
+    }
+}
+
+
+/*
+ *  Look at how the pages are laid out.
+ */
+static void
+checkLayout(void)
+{
+    unsigned seq[STORE_PAGES];
+    bool starts[STORE_PAGES] = { false };
+    unsigned newest = 0, straddles = 0;
+    int newp = -1;
+
+    for (int pn = 0; pn < STORE_PAGES; pn++)
+    {
+        u32 * p = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+        unsigned i = 0;
+
+        seq[pn] = 0;
+        if (p[0] == 0xffffffff)
+            continue;
+
+        /*
+         *  The sequence record follows the record that runs into the
+         *  page, which may start there (at the start of the store, or when
+         *  the page before was filled exactly).
+         */
+        while (i < STORE_WORDS && !(p[i] & 0x80000000))
+            i++;
+        if (i > 0)
+            straddles++;
+        if (i > 0 && pn == 0)
+            fail("a record straddles the end of the store");
+        if (i == 0 && p[0] >> RT_SHIFT != (0x20 | RT_SEQUENCE))
+        {
+            starts[pn] = true;
+            for (i++; i < STORE_WORDS && !(p[i] & 0x80000000); i++)
+                ;
+        }
+        if (i == STORE_WORDS || p[i] >> RT_SHIFT != (0x20 | RT_SEQUENCE))
+        {
+            fail("page %x doesn't have its sequence record", (u32)p);
+            continue;
+        }
+
+        seq[pn] = p[i] & RD_MASK;
+        if (seq[pn] > newest)
+        {
+            newest = seq[pn];
+            newp = pn;
+        }
+
+        for (i++; i < STORE_WORDS && p[i] != 0xffffffff; i++)
+            if (p[i] >> RT_SHIFT == (0x20 | RT_SEQUENCE))
+                fail("page %x has two sequence records", (u32)p);
+        for (; i < STORE_WORDS; i++)
+            if (p[i] != 0xffffffff)
+                fail("page %x has a gap at %x", (u32)p, (u32)&p[i]);
+    }
+
+    if (newp < 0)
+        return;
+
+    /*
+     *  Going back from the newest, the sequence numbers go down by one a
+     *  page, and only the newest and last pages have room left.
+     */
+    for (int k = 1; k < STORE_PAGES; k++)
+    {
+        int pn = (newp - k + STORE_PAGES) % STORE_PAGES;
+        u32 * p = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+
+        if (seq[pn] == 0)
+            continue;
+        if (seq[pn] != newest - k)
+            fail("page %x has sequence %u", (u32)p, seq[pn]);
+        if (pn != STORE_PAGES - 1 && p[STORE_WORDS - 1] == 0xffffffff)
+            fail("page %x isn't full", (u32)p);
+
+        /*
+         *  A page that starts with a record (not the rest of one) follows
+         *  a page that was filled exactly, if it follows one at all.
+         */
+        int nx = (pn + 1) % STORE_PAGES;
+        if (nx > 0 && starts[nx] && seq[nx] == seq[pn] + 1 &&
+            p[STORE_WORDS - 1] == 0xffffffff)
+            fail("page %x starts a record, but the page before has room",
+                 (u32)p + OQ_FLASH_PAGE);
+    }
+
+    if (newest > STORE_PAGES && straddles < STORE_PAGES / 2)
+        fail("only %u pages have a record straddling into them", straddles);
+}
+
+/**********************************************************************/
+
+/*
+ *  Start the store on what the flash holds, and write `count' records to
+ *  it, up to `burst' a pass, with the tracer `idle' or not.  Check it
+ *  along the way.
+ */
+static void
+boot(unsigned count, unsigned burst, bool idle)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0)
+    {
+        Idle = idle;
+        Trickle = burst == 1;
+        run();
+        if (!StoreReplayIsDone())
+            fail("the replay didn't finish");
+        checkRecords("replay");
+        checkIndex("replay");
+
+        unsigned writes = storeFlashWrites;
+        unsigned end = Shared->next + count;
+        while (Shared->next < end)
+        {
+            unsigned n = 1 + random() % burst;
+            while (n-- > 0 && Shared->next < end && submit(Shared->next))
+                Shared->next++;
+            pass();
+        }
+        run();
+        if (StoreCommitted() != StoreSubmitted())
+            fail("%u of %u records written",
+                 StoreCommitted(), StoreSubmitted());
+        checkRecords("written");
+        checkIndex("written");
+
+        /*
+         *  Records that arrive together go to flash together.
+         */
+        if (burst > 1)
+        {
+            Shared->burstRecords += StoreCommitted();
+            Shared->burstWrites += storeFlashWrites - writes;
+        }
+
+        if (idle && burst == 1 && storeEraseStalls != 0)
+            fail("%u writes waited for an erase", storeEraseStalls);
+        if (idle && storeFlashErases != 0 && storePreErases == 0)
+            fail("no pages erased ahead");
+        exit(Failed != 0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        Failed++;
+    checkLayout();
+}
+
+/**********************************************************************/
+/*
+ *  Packing bytes.
+ */
+
+/*
+ *  Start a chunk record, with `pre' bits of something else first.
+ */
+static void
+wrStart(unsigned pre, unsigned bytes)
+{
+    queueTail = 0;
+    wrNew(RT_SU_DATA, pre + bytes * 8);
+    for (unsigned n; pre > 0; pre -= n)
+    {
+        n = pre < 31 ? pre : 31;
+        wr(n, 0x5a5a5a5a);
+    }
+}
+
+
+/*
+ *  Get ready to read the record in the queue, after the `pre' bits.
+ */
+static void
+rdStart(unsigned pre)
+{
+    memcpy(buffer, queue, queueTail * sizeof *queue);
+    bufferLimit = queueTail;
+    bufferIndex = 0;
+    bufferPointer = RT_SHIFT;
+    for (unsigned n; pre > 0; pre -= n)
+    {
+        n = pre < 31 ? pre : 31;
+        rd(n);
+    }
+}
+
+
+static void
+checkBytes(void)
+{
+    u8 data[OQ_SU_CHUNK], back[OQ_SU_CHUNK];
+    u32 want[ARRAY_SIZE(queue)];
+    int failed = Failed;
+
+    for (int k = 0; k < 100000; k++)
+    {
+        unsigned pre = random() % 64;
+        unsigned n = 1 + random() % OQ_SU_CHUNK;
+
+        for (int i = 0; i < n; i++)
+            data[i] = random();
+
+        wrStart(pre, n);
+        for (int i = 0; i < n; i++)
+            wr(8, data[i]);
+        unsigned words = queueTail;
+        memcpy(want, queue, words * sizeof *queue);
+
+        wrStart(pre, n);
+        wrBytes(data, n);
+        if (queueTail != words || memcmp(want, queue, words * sizeof *queue))
+            fail("wrBytes() of %u bytes after %u bits is wrong", n, pre);
+
+        rdStart(pre);
+        rdBytes(back, n);
+        if (bufferLimit == 0 || memcmp(back, data, n) != 0)
+            fail("rdBytes() of %u bytes after %u bits is wrong", n, pre);
+    }
+
+    printf("wrBytes() and rdBytes():  %s\n",
+           Failed != failed ? "FAILED" : "the same as wr() and rd()");
+}
+
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ *  Pack and unpack a software update chunk, as the store does, a byte at
+ *  a time and with wrBytes() and rdBytes().
+ */
+static void
+speedBytes(void)
+{
+    u8 data[OQ_SU_CHUNK];
+    volatile u8 sink;
+    double t[5];
+
+    for (int i = 0; i < OQ_SU_CHUNK; i++)
+        data[i] = random();
+
+    t[0] = now();
+    for (unsigned k = 0; k < Chunks; k++)
+    {
+        wrStart(20 + 13, OQ_SU_CHUNK);
+        for (int i = 0; i < OQ_SU_CHUNK; i++)
+            wr(8, data[i]);
+    }
+    t[1] = now();
+    for (unsigned k = 0; k < Chunks; k++)
+    {
+        wrStart(20 + 13, OQ_SU_CHUNK);
+        wrBytes(data, OQ_SU_CHUNK);
+    }
+    t[2] = now();
+    for (unsigned k = 0; k < Chunks; k++)
+    {
+        rdStart(20 + 13);
+        for (int i = 0; i < OQ_SU_CHUNK; i++)
+            data[i] = rd(8);
+    }
+    t[3] = now();
+    for (unsigned k = 0; k < Chunks; k++)
+    {
+        rdStart(20 + 13);
+        rdBytes(data, OQ_SU_CHUNK);
+    }
+    t[4] = now();
+    sink = data[0];
+    (void)sink;
+
+    printf("a chunk:  pack %.1f ns a byte at a time, %.1f ns with wrBytes();  "
+           "unpack %.1f ns, %.1f ns with rdBytes()\n",
+           (t[1] - t[0]) * 1e9 / Chunks, (t[2] - t[1]) * 1e9 / Chunks,
+           (t[3] - t[2]) * 1e9 / Chunks, (t[4] - t[3]) * 1e9 / Chunks);
+}
+
+/**********************************************************************/
+
+static void *
+map(unsigned long addr, size_t size, int flags)
+{
+    void * p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                    flags | MAP_ANONYMOUS | (addr ? MAP_FIXED : 0), -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "can't map %lx", addr);
+    return p;
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    int c;
+
+    srandom(27);
+    while ((c = getopt(argc, argv, "n:f:c:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            Records = strtoul(optarg, 0, 0);
+            break;
+        case 'f':
+            FailEvery = strtoul(optarg, 0, 0);
+            break;
+        case 'c':
+            Chunks = strtoul(optarg, 0, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: storetest [-n records] [-f failures] [-c chunks] "
+                  "[-s seed]\n", stderr);
+            exit(1);
+        }
+
+    if (Records >= 1 << 20)
+        errx(1, "too many records");
+
+    /*
+     *  The flash (shared by the boots), the peripherals, and DWT.
+     */
+    map(OQ_FLASH_STORE, OQ_FLASH_SIZE - OQ_FLASH_STORE, MAP_SHARED);
+    memset((void *)OQ_FLASH_STORE, 0xff, OQ_FLASH_SIZE - OQ_FLASH_STORE);
+    map(NRF_CLOCK_BASE, 0x40000, MAP_PRIVATE);
+    map(0xe0000000, 0x10000, MAP_PRIVATE);
+    *(volatile u32 *)&NRF_NVMC->READY = NVMC_READY_READY_Ready;
+    Shared = map(0, sizeof *Shared, MAP_SHARED);
+
+    for (int b = 0; b < BOOTS; b++)
+        boot(Records / BOOTS, b % 3 == 1 ? 1 : 40, b % 3 != 2);
+    boot(0, 1, true);
+
+    printf("%u records, %u boots:  %s\n", Shared->next, BOOTS + 1,
+           Failed ? "FAILED" : "all records there, pages laid out right");
+
+    /*
+     *  In bursts of up to 40, there should be at least a few records to
+     *  each write.
+     */
+    printf("%u records in bursts took %u flash writes\n",
+           Shared->burstRecords, Shared->burstWrites);
+    if (Shared->burstWrites * 4 > Shared->burstRecords)
+    {
+        printf("too few records to a write\n");
+        Failed++;
+    }
+
+    /*
+     *  The last boot only replays, after the store has gone round a few
+     *  times:  all of the records still there must have been found, and
+     *  the newest of each type.
+     */
+    printf("after %u pages, %u times round the store:  found %u records "
+           "(%u to %u), %u of them chunks\n", Shared->pages,
+           Shared->pages / STORE_PAGES, Shared->found, Shared->oldest,
+           Shared->next - 1, Shared->chunks);
+    if (Shared->pages <= STORE_PAGES || Shared->oldest == 0)
+    {
+        printf("the store didn't wrap\n");
+        Failed++;
+    }
+
+    printf("pages written into:  %u erased ahead, %u waited for the erase, "
+           "%u never erased\n", Shared->entered[AHEAD],
+           Shared->entered[STALLED], Shared->entered[FRESH]);
+
+    /*
+     *  (The boots are done, so the store's state can be used freely.)
+     */
+    checkBytes();
+    speedBytes();
+    return Failed != 0;
+}
@@ -0,0 +1,1006 @@
+/*
+ *  A check of software updates over the debug port (store/su.c), on the
+ *  circular store (store/store.c) and a model of the flash under it.
+ *
+ *      sutest [-n chunks] [-f failures] [-s seed]
+ *      sutestq [-n chunks] [-f failures] [-s seed]
+ *
+ *  su.c and the store are included here, so the checks can see their
+ *  state.  The host's side is tn -u's (tools/tn.c):  it keeps up to its
+ *  window of chunk lines sent that aren't acked yet, as far as the 512 byte
+ *  RTT down buffer takes them, polling every 2 ms as a J-Link does.  Time
+ *  is simulated:  a pass of the super loop takes 10 us, and the flash 41 us
+ *  a word written and 85 ms a page erased (the nRF52's worst case).  One
+ *  flash operation in -f (default 50) fails.  As in storetest.c, the flash
+ *  is shared by a run of boots, each a child process.
+ *
+ *  The first boot tries each way an update is refused or given up, and
+ *  must get its "!su abort <why>":  "su" before the store is replayed, and
+ *  with the write queue full (store busy);  with the wrong arguments
+ *  (usage);  an image over the store, or a delta over the loader's scratch
+ *  page (bad header);  a delta for some other app (wrong base);  and, once
+ *  under way, an ESC (cancelled), and a chunk with a bad CRC or too long a
+ *  line (bad chunk).  su must then let go of the input.  A delta and an
+ *  image are then sent, the image with the host's window wider than su's.
+ *  The second boot sends an image of the running version, which wraps the
+ *  store.
+ *
+ *  In every update:  "!su ready" gives the next header sequence number;
+ *  each "!su <n>" is more than the last, and comes only once chunk n-1 is
+ *  in flash;  su never has more than SU_TICKETS chunks queued that aren't
+ *  in flash yet;  and "!su done" comes only once the execute record is in
+ *  flash.  Then the header, each chunk once with the right data, and the
+ *  execute record must be in the store.  The store's write queue holds
+ *  fewer chunks than su's window, so it fills, and su must hold a chunk
+ *  until there's room for it.  sutestq is built with a bigger queue
+ *  (OQ_STORE_QUEUE), so su's window fills instead.
+ *
+ *  At start up, SuSuperLoop() must cancel the image the first boot left
+ *  (the boot loader didn't apply it), once, in the second boot;  and leave
+ *  the image of the running version alone in the third.
+ *
+ *  Last, -n chunks (default 1691, 108 KB) are sent to an empty store with
+ *  windows of 1, 4 and 16 chunks, and the times reported;  each wider
+ *  window must be quicker.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <err.h>
+
+/*
+ *  The store and su.c, with their debug output renamed out of the C
+ *  library's way.
+ */
+#define dprintf         suDprintf
+#define snprintf        suSnprintf
+#include "store/store.c"
+#include "store/su.c"
+#undef dprintf
+#undef snprintf
+
+#define STORE_WORDS     (OQ_FLASH_PAGE / sizeof (u32))
+#define CHUNK_WORDS     (1 + (20 + 13 + OQ_SU_CHUNK * 8 - RT_SHIFT + 30) / 31)
+
+#define PASS_US         10              //  A pass of the super loop
+#define POLL_US         2000            //  The host polls the RTT buffers
+#define WRITE_US        41              //  The flash writes a word,
+#define ERASE_US        85000           //  and erases a page
+#define DOWN_SIZE       512             //  The RTT down buffer
+
+#define IMAGE_START     0x1c000         //  Where the images go
+#define DELTA_BYTES     2500            //  The delta sent
+#define MAX_CHUNKS      4096
+
+/*
+ *  What's kept from boot to boot.
+ */
+static struct
+{
+    unsigned        sequence;           //  The last update sent,
+    u32             version;            //  and its version
+    unsigned        held;               //  Chunks held for the queue
+    unsigned        ahead;              //  Most chunks queued, not in flash
+    unsigned long   time[3];            //  Each window's update took,
+    unsigned long   busy[3];            //  with the flash busy for
+}
+    * Shared;
+
+static const unsigned Windows[3] = { 1, 4, 16 };
+
+static unsigned     FailEvery = 50;
+static unsigned     Chunks = 1691;
+static int          Failed;
+static unsigned long Now;               //  Simulated time (us)
+
+/**********************************************************************/
+
+static void
+fail(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (Failed++ < 10)
+    {
+        vprintf(fmt, ap);
+        putchar('\n');
+    }
+    va_end(ap);
+}
+
+/**********************************************************************/
+/*
+ *  The soft device's flash calls.  Only one may be in progress;  it takes
+ *  the flash's time, and is then done (or fails) by `flashDone()'.
+ */
+
+static enum { NONE, WRITE, ERASE } Op;
+static u32 *        OpDst;
+static const u32 *  OpSrc;
+static unsigned     OpWords;
+static unsigned long OpEnd;
+static unsigned long FlashBusy;
+
+
+static bool
+inStore(u32 * p, unsigned words)
+{
+    u32 a = (u32)p;
+    u32 e = a + words * sizeof (u32);
+
+    return a >= OQ_FLASH_STORE && e <= OQ_FLASH_STORE_END;
+}
+
+
+uint32_t
+sd_flash_write(uint32_t * dst, uint32_t const * src, uint32_t words)
+{
+    if (Op != NONE)
+        fail("flash write at %x while busy", (u32)dst);
+    if (words == 0 || words > 1024 || !inStore(dst, words))
+        fail("flash write at %x of %u words", (u32)dst, words);
+    Op = WRITE;
+    OpDst = dst;
+    OpSrc = src;
+    OpWords = words;
+    OpEnd = Now + words * WRITE_US;
+    FlashBusy += words * WRITE_US;
+    return NRF_SUCCESS;
+}
+
+
+uint32_t
+sd_flash_page_erase(uint32_t page)
+{
+    u32 * p = (u32 *)(page * OQ_FLASH_PAGE);
+
+    if (Op != NONE)
+        fail("flash erase of %x while busy", (u32)p);
+    if (!inStore(p, STORE_WORDS))
+        fail("flash erase of %x", (u32)p);
+    Op = ERASE;
+    OpDst = p;
+    OpEnd = Now + ERASE_US;
+    FlashBusy += ERASE_US;
+    return NRF_SUCCESS;
+}
+
+
+/*
+ *  Finish the flash operation in progress, if its time is up.
+ */
+static void
+flashDone(void)
+{
+    if (Op == NONE || Now < OpEnd)
+        return;
+
+    bool ok = random() % FailEvery != 0;
+    if (ok && Op == WRITE)
+    {
+        for (unsigned i = 0; i < OpWords; i++)
+        {
+            if (OpDst[i] != 0xffffffff)
+                fail("flash write over %x (%08x)", (u32)&OpDst[i], OpDst[i]);
+            OpDst[i] &= OpSrc[i];
+        }
+    }
+    else if (ok && Op == ERASE)
+        memset(OpDst, 0xff, OQ_FLASH_PAGE);
+
+    Op = NONE;
+    StoreFlashed(ok);
+}
+
+/**********************************************************************/
+/*
+ *  The debug port.  What's printed waits in `Out' for the host's next
+ *  poll;  what the host sends waits in `Down'.
+ */
+
+static char         Out[4096];
+static unsigned     OutLen;
+static char         Down[DOWN_SIZE];
+static unsigned     DownHead, DownTail;
+static CMDInput_f * Input;
+
+static bool         inFlash(unsigned seq, unsigned addr);
+static bool         executed(unsigned seq, u32 version);
+
+
+int
+suDprintf(const char * fmt, ...)
+{
+    va_list ap;
+    char * s = Out + OutLen;
+    unsigned n;
+
+    va_start(ap, fmt);
+    int x = vsnprintf(s, sizeof Out - OutLen, fmt, ap);
+    va_end(ap);
+    if (x > 0)
+        OutLen += x < sizeof Out - OutLen ? x : sizeof Out - 1 - OutLen;
+
+    /*
+     *  A chunk is acked only once it's in flash, and the update done once
+     *  its execute record is.
+     */
+    if (sscanf(s, "!su %u", &n) == 1 && n > 0 &&
+        !inFlash(su.info.sequence,
+                 (su.info.delta ? 0 : su.info.start) + (n - 1) * OQ_SU_CHUNK))
+        fail("\"!su %u\" before chunk %u is in flash", n, n - 1);
+    if (sscanf(s, "!su done %u", &n) == 1 && !executed(n, su.info.version))
+        fail("\"!su done %u\" before the execute record is in flash", n);
+    return x;
+}
+
+
+int
+DebugPutAvail(void)
+{
+    unsigned room = sizeof Out - 1 - OutLen;
+
+    return room < 1024 ? room : 1024;
+}
+
+
+int
+DebugGetChar(void)
+{
+    if (DownTail == DownHead)
+        return -1;
+    return Down[DownTail++ % DOWN_SIZE];
+}
+
+
+static unsigned
+downRoom(void)
+{
+    return DOWN_SIZE - 1 - (DownHead - DownTail);
+}
+
+
+static void
+send(const char * s, unsigned len)
+{
+    if (len > downRoom())
+        fail("sending %u characters with room for %u", len, downRoom());
+    while (len-- > 0)
+        Down[DownHead++ % DOWN_SIZE] = *s++;
+}
+
+
+void
+CommandInput(CMDInput_f * func)
+{
+    Input = func;
+}
+
+/**********************************************************************/
+/*
+ *  What the store and su.c use from the rest of the firmware.
+ */
+
+Config_t        Config;
+const u32       Version = 0x00030007;
+
+
+bool
+TraceIsIdle(void)
+{
+    return true;
+}
+
+
+u32
+ConfigCRC(Config_t * conf)
+{
+    return 0;
+}
+
+
+void
+StoreCallbackConfiguration(Config_t * conf)
+{
+}
+
+
+unsigned
+Future(unsigned secs)
+{
+    return secs;
+}
+
+
+void
+TempusCalloutVar(TempusCallout_t * tmr, unsigned tod, int * var)
+{
+}
+
+
+void
+TachyonLog1(int id, unsigned x1)
+{
+}
+
+
+void
+TachyonLog2(int id, unsigned x1, unsigned x2)
+{
+}
+
+
+int
+dbprintf(const char * fmt, ...)
+{
+    return 0;
+}
+
+
+int
+StrcmpCmd(const char * cmd, const char * text)
+{
+    return 2;
+}
+
+
+u32
+GetDecimal(const char * s)
+{
+    return 0;
+}
+
+
+/*
+ *  As debug/debugger.c has it.
+ */
+u32
+GetHex(char * sp)
+{
+    u32 num = 0;
+
+    for (;; sp++)
+    {
+        if (*sp >= '0' && *sp <= '9')
+            num = num * 16 + *sp - '0';
+        else if (*sp >= 'a' && *sp <= 'f')
+            num = num * 16 + *sp - 'a' + 10;
+        else if (*sp >= 'A' && *sp <= 'F')
+            num = num * 16 + *sp - 'A' + 10;
+        else
+            return num;
+    }
+}
+
+/**********************************************************************/
+/*
+ *  The host's side.
+ */
+
+static struct
+{
+    const u8 *  data;                   //  The image or delta,
+    unsigned    base;                   //  the address of its first chunk,
+    unsigned    chunks;                 //  and its chunks
+    unsigned    window;                 //  Chunks sent but not acked
+    unsigned    sent;
+    unsigned    acked;
+    unsigned    sequence;               //  From "!su ready"
+    bool        ready;
+    bool        done;
+    char        abort[32];              //  From "!su abort"
+    unsigned    cancelled;              //  "Software update ... cancelled"
+    unsigned    cancelledSeq;
+}
+    Host;
+
+static unsigned     Held;               //  Chunks held for the queue
+static unsigned     Ahead;              //  Most chunks queued, not in flash
+
+
+/*
+ *  As tools/tn.c has it.
+ */
+static u32
+crc32c(u32 crc, const u8 * p, unsigned len)
+{
+    u32 c = ~crc;
+
+    while (len-- > 0)
+    {
+        c ^= *p++;
+        for (int i = 0; i < 8; i++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+
+    return ~c;
+}
+
+
+/*
+ *  Make the line for chunk `n', with a byte changed after the CRC if
+ *  `bad'.  Returns its length.
+ */
+static unsigned
+chunkLine(char * line, unsigned n, bool bad)
+{
+    u8 buf[OQ_SU_CHUNK + 4];
+    u32 addr = Host.base + n * OQ_SU_CHUNK;
+    u8 a[4] = { addr, addr >> 8, addr >> 16, addr >> 24 };
+
+    memcpy(buf, &Host.data[n * OQ_SU_CHUNK], OQ_SU_CHUNK);
+    u32 crc = crc32c(crc32c(0, a, 4), buf, OQ_SU_CHUNK);
+    buf[OQ_SU_CHUNK + 0] = crc;
+    buf[OQ_SU_CHUNK + 1] = crc >> 8;
+    buf[OQ_SU_CHUNK + 2] = crc >> 16;
+    buf[OQ_SU_CHUNK + 3] = crc >> 24;
+    buf[5] ^= bad;
+
+    unsigned len = BinaryToBase85(line, buf, sizeof buf);
+    line[len - 2] = '\n';               //  tn sends just a newline
+    return len - 1;
+}
+
+
+/*
+ *  The host polls:  it reads the replies, and sends as many chunks as the
+ *  window and the down buffer allow.
+ */
+static void
+hostPoll(void)
+{
+    char * s = Out;
+    char * e;
+
+    Out[OutLen] = '\0';
+    for (; *s; s = e + 1)
+    {
+        unsigned seq, n;
+
+        for (e = s; *e && *e != '\n'; e++)
+            ;
+        if (*e == '\0')
+            break;
+        *e = '\0';
+        if (sscanf(s, "Software update %u not applied, cancelled", &seq) == 1)
+        {
+            Host.cancelled++;
+            Host.cancelledSeq = seq;
+        }
+        if (memcmp(s, "!su ", 4) != 0)
+            continue;
+
+        s += 4;
+        if (sscanf(s, "ready %u %u", &seq, &n) == 2)
+        {
+            Host.ready = true;
+            Host.sequence = seq;
+            if (n != Host.chunks)
+                fail("su expects %u chunks, not %u", n, Host.chunks);
+        }
+        else if (sscanf(s, "done %u", &seq) == 1)
+        {
+            Host.done = true;
+            if (seq != Host.sequence || Host.acked != Host.chunks)
+                fail("\"!su done %u\" after %u of %u chunks (sequence %u)",
+                     seq, Host.acked, Host.chunks, Host.sequence);
+        }
+        else if (memcmp(s, "abort ", 6) == 0)
+            snprintf(Host.abort, sizeof Host.abort, "%s", s + 6);
+        else if (sscanf(s, "%u", &n) == 1)
+        {
+            if (n <= Host.acked || n > Host.chunks)
+                fail("\"!su %u\" after \"!su %u\"", n, Host.acked);
+            Host.acked = n;
+        }
+        else
+            fail("\"!su %s\"", s);
+    }
+    OutLen = 0;
+
+    while (Host.ready && !Host.done && !Host.abort[0] &&
+           Host.sent < Host.chunks && Host.sent - Host.acked < Host.window)
+    {
+        char line[128];
+        unsigned len = chunkLine(line, Host.sent, false);
+
+        if (len > downRoom())
+            break;
+        send(line, len);
+        Host.sent++;
+    }
+}
+
+/**********************************************************************/
+
+/*
+ *  A pass of the super loop, and the host's poll when it's due.
+ */
+static void
+pass(void)
+{
+    static unsigned long poll;
+    static unsigned held = ~0;
+
+    if (Now >= poll)
+    {
+        hostPoll();
+        poll = Now + POLL_US;
+    }
+
+    if (Input)
+    {
+        if (!(*Input)())
+            Input = 0;
+        else if (su.pending && su.received != held)
+        {
+            held = su.received;
+            Held++;
+        }
+    }
+    StoreSuperLoop();
+    SuSuperLoop();
+
+    if (Input && su.received - su.committed > Ahead)
+    {
+        Ahead = su.received - su.committed;
+        if (Ahead > SU_TICKETS)
+            fail("%u chunks queued, %u of them in flash",
+                 su.received, su.committed);
+    }
+
+    flashDone();
+    Now += PASS_US;
+}
+
+
+/*
+ *  Run for `us' of simulated time, or until `done' is true.
+ */
+static void
+run(unsigned long us, bool * done)
+{
+    unsigned long end = Now + us;
+
+    while (Now < end && !(done && *done))
+        pass();
+}
+
+
+/*
+ *  Is chunk `addr' of update `seq' in flash?  Only the last few pages are
+ *  looked at:  it must have been written lately.
+ */
+static bool
+inFlash(unsigned seq, unsigned addr)
+{
+    StoreIter_t it;
+    StoreRecord_t r;
+
+    StoreIterInit(&it, RT_SU_DATA, sequence > 3 ? sequence - 3 : 0, ~0);
+    while (StoreIterNext(&it))
+        if (StoreIterRead(&it, &r) &&
+            r.sud.sequence == seq && r.sud.address == addr)
+            return true;
+    return false;
+}
+
+
+/*
+ *  Is the newest execute record for update `seq' of `version'?
+ */
+static bool
+executed(unsigned seq, u32 version)
+{
+    StoreIter_t it;
+    StoreRecord_t r;
+
+    return StoreIterNewest(&it, RT_SU_EXEC) && StoreIterRead(&it, &r) &&
+           r.sux.sequence == seq && r.sux.version == version;
+}
+
+
+/*
+ *  Give su the command `line', and get the host ready to send `chunks' of
+ *  `data' from `base', `window' at a time.
+ */
+static void
+command(const char * line, const u8 * data, unsigned base, unsigned chunks,
+        unsigned window)
+{
+    char buf[128];
+    char * argv[16];
+    int argc = 0;
+
+    memset(&Host, 0, sizeof Host);
+    Host.data = data;
+    Host.base = base;
+    Host.chunks = chunks;
+    Host.window = window;
+    DownTail = DownHead;
+
+    snprintf(buf, sizeof buf, "%s", line);
+    for (char * s = buf; *s && argc < 15; )
+    {
+        argv[argc++] = s;
+        while (*s && *s != ' ')
+            s++;
+        while (*s == ' ')
+            *s++ = '\0';
+    }
+    argv[argc] = 0;
+    suCommand(argc, argv);
+}
+
+
+/*
+ *  Run until su has let go of the input and the host has read what it
+ *  printed, and check it gave up for `why'.
+ */
+static void
+aborted(const char * what, const char * why)
+{
+    unsigned long end = Now + 1000000;
+
+    while ((Input || OutLen) && Now < end)
+        pass();
+    if (Input)
+        fail("%s:  su still has the input", what);
+    if (strcmp(Host.abort, why) != 0)
+        fail("%s:  \"!su abort %s\", not \"%s\"", what, Host.abort, why);
+}
+
+
+/*
+ *  Send an update:  `chunks' of `data', with its header `si' (but for the
+ *  sequence number) on the command line, `window' chunks at a time.
+ *  Returns how long it took, from the command to "!su done".
+ */
+static unsigned long
+update(const char * what, SuInfo_t * si, const u8 * data, unsigned chunks,
+       unsigned window)
+{
+    char line[128];
+
+    if (si->delta)
+        snprintf(line, sizeof line, "su %x %x %x %x %x %x", si->start,
+                 si->end, si->version, si->delta, si->base, si->crc);
+    else
+        snprintf(line, sizeof line, "su %x %x %x",
+                 si->start, si->end, si->version);
+
+    unsigned newest = suNewest(RT_SU_HDR) > suNewest(RT_SU_DELTA) ?
+                      suNewest(RT_SU_HDR) : suNewest(RT_SU_DELTA);
+    unsigned long t0 = Now;
+    command(line, data, si->delta ? 0 : si->start, chunks, window);
+    run(120000000, &Host.done);
+
+    si->sequence = Host.sequence;
+    if (!Host.done)
+        fail("%s:  %u of %u chunks acked, %s", what, Host.acked, chunks,
+             Host.abort[0] ? Host.abort : "and stuck");
+    else if (Host.sequence != newest + 1)
+        fail("%s:  sequence %u, after %u", what, Host.sequence, newest);
+    if (Input)
+        fail("%s:  su still has the input", what);
+
+    unsigned long t = Now - t0;
+
+    /*
+     *  The header, and each chunk once.
+     */
+    StoreIter_t it;
+    StoreRecord_t r;
+    static u8 seen[MAX_CHUNKS];
+    unsigned base = si->delta ? 0 : si->start;
+
+    memset(&r, 0, sizeof r);
+    if (!StoreIterNewest(&it, si->delta ? RT_SU_DELTA : RT_SU_HDR) ||
+        !StoreIterRead(&it, &r) || memcmp(&r.sui, si, sizeof *si) != 0)
+        fail("%s:  the header isn't in the store", what);
+
+    memset(seen, 0, chunks);
+    StoreIterInit(&it, RT_SU_DATA, 0, ~0);
+    while (StoreIterNext(&it))
+    {
+        if (!StoreIterRead(&it, &r))
+            fail("%s:  can't read the chunk at %x", what, (u32)it.record);
+        else if (r.sud.sequence == si->sequence)
+        {
+            unsigned n = (r.sud.address - base) / OQ_SU_CHUNK;
+            if (r.sud.address < base || n >= chunks)
+                fail("%s:  chunk at %x", what, r.sud.address);
+            else if (seen[n]++)
+                fail("%s:  chunk %u is in the store twice", what, n);
+            else if (memcmp(r.sud.data, &data[n * OQ_SU_CHUNK],
+                            OQ_SU_CHUNK) != 0)
+                fail("%s:  chunk %u is wrong", what, n);
+        }
+    }
+    for (unsigned n = 0; n < chunks; n++)
+        if (!seen[n])
+            fail("%s:  chunk %u isn't in the store", what, n);
+
+    Shared->sequence = si->sequence;
+    Shared->version = si->version;
+    return t;
+}
+
+/**********************************************************************/
+
+static u8       Image[MAX_CHUNKS * OQ_SU_CHUNK];
+
+
+/*
+ *  The first boot:  each way an update is refused or given up, then a
+ *  delta and an image.
+ */
+static void
+boot1(void)
+{
+    SuInfo_t si;
+    char line[300];
+
+    command("su 1c000 1d000 5", Image, IMAGE_START, 64, 16);
+    aborted("before the replay", "store busy");
+    run(100000, 0);
+    if (!StoreReplayIsDone())
+        fail("the replay didn't finish");
+
+    command("su 1c000 1d000", Image, IMAGE_START, 64, 16);
+    aborted("three arguments", "usage");
+    command("su 1c000 41000 5", Image, IMAGE_START, 64, 16);
+    aborted("an image over the store", "bad header");
+    command("su 1c000 1c800 5", Image, IMAGE_START, 64, 16);
+    aborted("an image of half a page", "bad header");
+    snprintf(line, sizeof line, "su 1c000 40000 5 100 %x 0", Version);
+    command(line, Image, 0, 4, 16);
+    aborted("a delta over the scratch page", "bad header");
+    snprintf(line, sizeof line, "su 1c000 30000 5 100 %x 0", Version + 1);
+    command(line, Image, 0, 4, 16);
+    aborted("a delta for another app", "wrong base");
+
+    /*
+     *  Fill the write queue, so the header won't go in.
+     */
+    SuData_t sd = { 0 };
+    SuExec_t sx = { 0 };
+    while (StoreSoftwareUpdateChunk(&sd))
+        ;
+    while (StoreSoftwareUpdateExecute(&sx))
+        ;
+    command("su 1c000 1d000 5", Image, IMAGE_START, 64, 16);
+    aborted("the queue full", "store busy");
+    run(100000, 0);
+
+    /*
+     *  Under way.
+     */
+    command("su 1c000 1d000 5", Image, IMAGE_START, 64, 0);
+    run(10000, &Host.ready);
+    send(line, chunkLine(line, 0, false));
+    send(line, chunkLine(line, 1, false));
+    send("\033", 1);
+    aborted("ESC", "cancelled");
+
+    command("su 1c000 1d000 5", Image, IMAGE_START, 64, 0);
+    run(10000, &Host.ready);
+    send(line, chunkLine(line, 0, false));
+    send(line, chunkLine(line, 1, true));
+    aborted("a bad CRC", "bad chunk");
+
+    command("su 1c000 1d000 5", Image, IMAGE_START, 64, 0);
+    run(10000, &Host.ready);
+    memset(line, 'A', SU_LINE + 1);
+    line[0] = '_';
+    line[SU_LINE + 1] = '\n';
+    send(line, SU_LINE + 2);
+    aborted("too long a line", "bad chunk");
+
+    /*
+     *  A delta, and an image that isn't the running version, with the
+     *  host sending more than su takes ahead of the flash (tn -w 64).
+     */
+    si = (SuInfo_t){ 0, 0x00040001, 0x1c000, 0x30000,
+                     DELTA_BYTES, Version, 0x12345678 };
+    update("a delta", &si, Image, (DELTA_BYTES + OQ_SU_CHUNK - 1) /
+                                  OQ_SU_CHUNK, 4);
+
+    si = (SuInfo_t){ 0, 0x00040002, IMAGE_START,
+                     IMAGE_START + Chunks * OQ_SU_CHUNK };
+    update("an image", &si, Image, Chunks, 64);
+}
+
+
+/*
+ *  The second boot:  the image the loader didn't apply is cancelled, once.
+ *  Then an image of the running version.
+ */
+static void
+boot2(void)
+{
+    unsigned seq = Shared->sequence;
+    u32 version = Shared->version;
+
+    memset(&Host, 0, sizeof Host);
+    run(1000000, 0);
+    if (Host.cancelled != 1 || Host.cancelledSeq != seq)
+        fail("%u cancelled, update %u the last (not %u once)",
+             Host.cancelled, Host.cancelledSeq, seq);
+    if (!executed(seq, ~version))
+        fail("update %u isn't cancelled", seq);
+
+    SuInfo_t si = { 0, Version, IMAGE_START,
+                    IMAGE_START + Chunks * OQ_SU_CHUNK };
+    update("the running version", &si, Image, Chunks, 16);
+}
+
+
+/*
+ *  The third boot:  the image of the running version is left alone.
+ */
+static void
+boot3(void)
+{
+    memset(&Host, 0, sizeof Host);
+    run(1000000, 0);
+    if (Host.cancelled != 0)
+        fail("update %u (the running version) cancelled", Host.cancelledSeq);
+    if (!executed(Shared->sequence, Version))
+        fail("update %u isn't to be executed", Shared->sequence);
+}
+
+
+/*
+ *  An image sent with window `Windows[w]', on an empty store.
+ */
+static void
+timed(int w)
+{
+    memset((void *)OQ_FLASH_STORE, 0xff, OQ_FLASH_STORE_END - OQ_FLASH_STORE);
+    run(100000, 0);
+
+    SuInfo_t si = { 0, 0x00040003, IMAGE_START,
+                    IMAGE_START + Chunks * OQ_SU_CHUNK };
+    unsigned long busy = FlashBusy;
+    Shared->time[w] = update("timed", &si, Image, Chunks, Windows[w]);
+    Shared->busy[w] = FlashBusy - busy;
+}
+
+
+/*
+ *  Run `func' in a boot of its own.
+ */
+static void
+boot(void (* func)(int), int arg)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0)
+    {
+        (*func)(arg);
+        Shared->held += Held;
+        if (Ahead > Shared->ahead)
+            Shared->ahead = Ahead;
+        exit(Failed != 0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        Failed++;
+}
+
+
+static void
+call(int n)
+{
+    static void (* const boots[])(void) = { boot1, boot2, boot3 };
+
+    (*boots[n])();
+}
+
+/**********************************************************************/
+
+static void *
+map(unsigned long addr, size_t size, int flags)
+{
+    void * p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                    flags | MAP_ANONYMOUS | (addr ? MAP_FIXED : 0), -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "can't map %lx", addr);
+    return p;
+}
+
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    int c;
+
+    srandom(34);
+    while ((c = getopt(argc, argv, "n:f:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            Chunks = strtoul(optarg, 0, 0);
+            break;
+        case 'f':
+            FailEvery = strtoul(optarg, 0, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: sutest [-n chunks] [-f failures] [-s seed]\n",
+                  stderr);
+            exit(1);
+        }
+
+    if (Chunks < OQ_FLASH_PAGE / OQ_SU_CHUNK ||
+        IMAGE_START + Chunks * OQ_SU_CHUNK > OQ_FLASH_STORE)
+        errx(1, "-n must be from %u to %u chunks", OQ_FLASH_PAGE / OQ_SU_CHUNK,
+             (OQ_FLASH_STORE - IMAGE_START) / OQ_SU_CHUNK);
+
+    /*
+     *  The flash (shared by the boots), the peripherals, and DWT.
+     */
+    map(OQ_FLASH_STORE, OQ_FLASH_SIZE - OQ_FLASH_STORE, MAP_SHARED);
+    memset((void *)OQ_FLASH_STORE, 0xff, OQ_FLASH_SIZE - OQ_FLASH_STORE);
+    map(NRF_CLOCK_BASE, 0x40000, MAP_PRIVATE);
+    map(0xe0000000, 0x10000, MAP_PRIVATE);
+    *(volatile u32 *)&NRF_NVMC->READY = NVMC_READY_READY_Ready;
+    Shared = map(0, sizeof *Shared, MAP_SHARED);
+
+    for (unsigned i = 0; i < sizeof Image; i++)
+        Image[i] = random();
+
+    for (int b = 0; b < 3; b++)
+        boot(call, b);
+    printf("aborts, a delta and two images of %u chunks, 3 boots:  %s\n",
+           Chunks, Failed ? "FAILED" : "acked as they reached the flash, "
+                            "and stored whole");
+
+    for (int w = 0; w < 3; w++)
+        boot(timed, w);
+    for (int w = 0; w < 3; w++)
+    {
+        printf("window %2u:  %u chunks in %.2f s, the flash busy %.2f s\n",
+               Windows[w], Chunks, Shared->time[w] / 1e6,
+               Shared->busy[w] / 1e6);
+        if (w > 0 && Shared->time[w] >= Shared->time[w - 1])
+        {
+            printf("no quicker than a window of %u\n", Windows[w - 1]);
+            Failed++;
+        }
+    }
+
+    /*
+     *  What keeps su from reading more chunks:  the store's queue, if it
+     *  holds fewer than SU_TICKETS chunks (it must have been full at times,
+     *  and chunks held for it), or else su's own window (which must have
+     *  been reached).
+     */
+    bool small = QUEUE_WORDS < SU_TICKETS * CHUNK_WORDS;
+    printf("queue of %u chunks:  su had up to %u chunks ahead of the flash, "
+           "and held %u for the queue\n", QUEUE_WORDS / CHUNK_WORDS,
+           Shared->ahead, Shared->held);
+    if (small ? Shared->held == 0 : Shared->ahead != SU_TICKETS)
+    {
+        printf(small ? "the queue was never full\n"
+                     : "su's window was never full\n");
+        Failed++;
+    }
+
+    return Failed != 0;
+}
@@ -0,0 +1,211 @@
+/*
+ *  Check and time the Tempus callouts (time/tempus.c).
+ *
+ *      tempusbench [-n reschedules] [-s seed]
+ *
+ *  First the timer wheel is checked against a plain table of when each
+ *  callout is due:  callouts are set, changed and cancelled at random,
+ *  from now (and before it) out to a month away, and time is moved on by
+ *  a second to a few days at a go.  Some of the callbacks set themselves
+ *  again.  Every callout must fire once, on the first pass at or after
+ *  its time, and TempusNext() must always give the earliest one.
+ *
+ *  Then the cost of the usual case:  10, 100 and 1000 callouts running,
+ *  each set again to 20 to 60 seconds out as packets come in (-n times,
+ *  default 2000000), with a pass of the super loop every second.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "timer.h"
+
+#define N           4000
+
+static TempusCallout_t  Callouts[N];
+static unsigned         Due[N];         //  When each should fire (0 is off)
+static unsigned         Fired;
+static unsigned         Now = 100;
+static int              Failed;
+
+/**********************************************************************/
+/*
+ *  What tempus.c uses from the rest of the firmware.
+ */
+
+unsigned
+GetTODZero(void)
+{
+    return Now;
+}
+
+
+void
+TachyonLog1(int id, unsigned x1)
+{
+}
+
+/**********************************************************************/
+
+static unsigned
+rnd(unsigned n)
+{
+    return random() % n;
+}
+
+
+static void
+fail(const char * what, int i, unsigned got, unsigned want)
+{
+    if (Failed++ < 10)
+        printf("%s (callout %d, now %u):  %u, should be %u\n",
+               what, i, Now, got, want);
+}
+
+
+static void
+set(int i, unsigned tod)
+{
+    TempusCallout(&Callouts[i], tod);
+    Due[i] = tod;
+}
+
+
+static void
+fired(TempusCallout_t * t)
+{
+    int i = t - Callouts;
+
+    if (Due[i] == 0 || t->time > Now)
+        fail("fired early", i, t->time, Due[i]);
+    Due[i] = 0;
+    Fired++;
+    if (i % 7 == 0)
+        set(i, Now + 1 + i % 40);
+}
+
+
+static void
+check(void)
+{
+    for (int i = 0; i < N; i++)
+        Callouts[i].func = fired;
+
+    for (int n = 0; n < 300000; n++)
+    {
+        int i = rnd(N);
+        unsigned r = rnd(100);
+
+        if (r < 5)
+            set(i, 0);
+        else if (r < 10)
+            set(i, Now - rnd(5));
+        else if (r < 15)
+            set(i, Now + rnd(3000000));
+        else if (r < 40)
+            set(i, Now + rnd(5000));
+        else
+            set(i, Now + rnd(60));
+
+        if (rnd(20) != 0)
+            continue;
+
+        /*
+         *  TempusNext() before the pass, then the pass.
+         */
+        unsigned want = 0;
+        for (int j = 0; j < N; j++)
+            if (Due[j] && (want == 0 || Due[j] < want))
+                want = Due[j];
+        if (want && want <= Now)
+            want = Now;
+        if (TempusNext() != want)
+            fail("TempusNext", -1, TempusNext(), want);
+
+        Now += rnd(100) < 3 ? rnd(200000) : rnd(4);
+        TempusMagnaCirculi();
+
+        for (int j = 0; j < N; j++)
+            if (Due[j] && Due[j] <= Now)
+                fail("didn't fire", j, Due[j], Now);
+    }
+
+    printf("%u callouts fired:  %s\n", Fired,
+           Failed ? "FAILED" : "all on time");
+
+    for (int i = 0; i < N; i++)
+        set(i, 0);
+}
+
+/**********************************************************************/
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+speed(int n, unsigned long count)
+{
+    for (int i = 0; i < n; i++)
+        set(i, Now + 20 + rnd(40));
+
+    double t0 = now();
+    for (unsigned long k = 0; k < count; k++)
+    {
+        TempusCallout(&Callouts[rnd(n)], Now + 20 + rnd(40));
+        if ((k & 1023) == 0)
+        {
+            Now++;
+            TempusMagnaCirculi();
+        }
+    }
+    double t1 = now();
+
+    printf("%5d callouts:  %6.1f ns to set one again\n",
+           n, (t1 - t0) * 1e9 / count);
+
+    for (int i = 0; i < n; i++)
+        set(i, 0);
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    unsigned long count = 2000000;
+    int c;
+
+    srandom(36);
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            count = strtoul(optarg, 0, 0);
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: tempusbench [-n reschedules] [-s seed]\n", stderr);
+            exit(1);
+        }
+
+    check();
+
+    speed(10, count);
+    speed(100, count);
+    speed(1000, count);
+    return Failed != 0;
+}
@@ -0,0 +1,500 @@
+/*
+ *  Run the tracer's timers (time/rtc.c, tick.c and tempus.c) on a model of
+ *  RTC2 and its interrupt, and check them.
+ *
+ *      ticksim [-t seconds] [-b ticks] [-i interrupts] [-q] [-s seed]
+ *
+ *  Built once with a regular tick (ticksim), and once with OQ_TICKLESS
+ *  (ticklesssim).
+ *
+ *  RTC2's registers, and the NVIC's, are memory at the chip's addresses,
+ *  kept read-only so that each write the firmware makes to them is caught
+ *  (SIGSEGV), let through a single instruction (SIGTRAP), and then acted
+ *  on as the chip would:  INTENSET and INTENCLR set and clear the RTC's
+ *  interrupts (and both read back what is set), and ISER and ICER enable
+ *  and disable its interrupt in the NVIC.  The model itself sets them
+ *  through a second, writable, mapping.  Time is counted in RTC ticks,
+ *  and the counter shows the low 24 bits of it.  A compare channel matches
+ *  as the counter reaches it, and raises its event, and the interrupt if
+ *  that's on;  but as on the chip, not if it was set to within two ticks
+ *  of the counter.
+ *
+ *  The super loop is modelled as main.c has it, for -t seconds (default
+ *  1200, past two wraps of the counter):  run the callouts, then up to -b
+ *  ticks (default 0) of other work, then sleep if nothing was done, until
+ *  an interrupt.  Other interrupts (the radio ...) come -i times a second
+ *  (default 0), at random.
+ *
+ *  Tick callouts run every 25 ms, 333 ticks, 100 ms, 1 s and 4111 ticks,
+ *  each set again from its own tick, and one is set again for a random
+ *  time up to 3 seconds away each time it runs.  None must run early, or later
+ *  than the other work and the RTC's two tick minimum can explain, and
+ *  none must be missed.  (-q leaves them out, to see how often the Tempus
+ *  callouts alone wake the CPU.)
+ *
+ *  Tempus callouts are set again, each time they run, for 1 to 20 seconds
+ *  away, and one for up to 700 seconds away (past the longest the RTC is
+ *  left without an interrupt).  They must run in the super loop pass that
+ *  follows the start of their second, as late as the other work makes it
+ *  and no later.  After every pass, the time-of-day must be the time of
+ *  the last RTC interrupt to the 1/256 second (with a regular tick), or
+ *  the time now (tickless).
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <err.h>
+
+#include "types.h"
+#include "defs.h"
+#include "timer.h"
+
+typedef unsigned long long  Ticks_t;
+
+static Ticks_t      Now;            //  Ticks since the start
+static u32          IntEn;          //  RTC2's interrupts enabled
+static bool         IrqOn;          //  RTC2's interrupt enabled in the NVIC
+static bool         Woken;          //  An interrupt since the last sleep
+static Ticks_t      NextOther;      //  When the next other interrupt comes
+static Ticks_t      Missed[2];      //  A match each compare will miss
+static Ticks_t      Tick0;          //  When CC[0] last interrupted
+static Ticks_t      Awake;          //  Ticks spent on other work
+
+static unsigned     Seconds = 1200;
+static unsigned     Busy;
+static unsigned     Others;
+static bool         Quiet;
+static unsigned     Wakes;
+static int          Failed;
+
+#define RTC_PAGE    ((void *)((unsigned long)NRF_RTC2 & ~0xfffUL))
+#define NVIC_PAGE   ((void *)((unsigned long)NVIC & ~0xfffUL))
+
+extern void RTC2_IRQHandler(void);
+
+/**********************************************************************/
+/*
+ *  What the timers use from the rest of the firmware.
+ */
+
+void
+TachyonLog1(int id, unsigned x1)
+{
+}
+
+
+void
+TachyonLog2(int id, unsigned x1, unsigned x2)
+{
+}
+
+/**********************************************************************/
+
+static void
+fail(const char * what, long a, long b)
+{
+    if (Failed++ < 10)
+    {
+        printf(what, a, b);
+        printf(" (at tick %llu)\n", Now);
+    }
+}
+
+/**********************************************************************/
+/*
+ *  The registers.
+ */
+
+static volatile u32 *   written;    //  The register being written
+
+
+/*
+ *  Set a register, as the chip does, through the writable mapping of
+ *  RTC2's page.
+ */
+static volatile u8 *    rtcPage;
+
+static void
+poke(const volatile u32 * reg, u32 v)
+{
+    *(volatile u32 *)(rtcPage + ((unsigned long)reg & 0xfff)) = v;
+}
+
+
+static void
+segv(int sig, siginfo_t * si, void * ctx)
+{
+    void * page = (void *)((unsigned long)si->si_addr & ~0xfffUL);
+    if (page != RTC_PAGE && page != NVIC_PAGE)
+    {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    written = si->si_addr;
+    mprotect(page, 0x1000, PROT_READ | PROT_WRITE);
+    ((ucontext_t *)ctx)->uc_mcontext.gregs[REG_EFL] |= 0x100;  //  Step
+}
+
+
+static void
+trap(int sig, siginfo_t * si, void * ctx)
+{
+    u32 v = *written;
+    u32 irq = 1 << (RTC2_IRQn & 31);
+
+    ((ucontext_t *)ctx)->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+
+    if (written == &NRF_RTC2->INTENSET)
+        IntEn |= v;
+    else if (written == &NRF_RTC2->INTENCLR)
+        IntEn &= ~v;
+    else if (written == &NRF_RTC2->CC[0] || written == &NRF_RTC2->CC[1])
+    {
+        unsigned d = (v - Now) & TICK_MASK;
+        Missed[written - NRF_RTC2->CC] = d < 2 ? Now + d : ~0ULL;
+    }
+    else if (written == &NVIC->ISER[RTC2_IRQn >> 5] && (v & irq))
+        IrqOn = true;
+    else if (written == &NVIC->ICER[RTC2_IRQn >> 5] && (v & irq))
+        IrqOn = false;
+
+    poke(&NRF_RTC2->INTENSET, IntEn);
+    poke(&NRF_RTC2->INTENCLR, IntEn);
+    mprotect((void *)((unsigned long)written & ~0xfffUL), 0x1000, PROT_READ);
+}
+
+
+
+/**********************************************************************/
+/*
+ *  Time.
+ */
+
+/*
+ *  The next tick at which compare channel `ch' matches.
+ */
+static Ticks_t
+match(int ch)
+{
+    unsigned d = (NRF_RTC2->CC[ch] - Now) & TICK_MASK;
+    Ticks_t m = Now + (d ? d : TICK_MAX);
+    return m == Missed[ch] ? m + TICK_MAX : m;
+}
+
+
+/*
+ *  Let time go by up to `t', taking the interrupts on the way.
+ */
+static void
+advance(Ticks_t t)
+{
+    for (;;)
+    {
+        Ticks_t m0 = match(0);
+        Ticks_t m1 = match(1);
+        Ticks_t m = m0 < m1 ? m0 : m1;
+
+        if (Others && NextOther <= t && NextOther < m)
+        {
+            Now = NextOther;
+            poke(&NRF_RTC2->COUNTER, Now & TICK_MASK);
+            NextOther = Now + 1 + random() % (2 * TICK_UNIT / Others);
+            Woken = true;
+            continue;
+        }
+        if (m > t)
+            break;
+
+        Now = m;
+        poke(&NRF_RTC2->COUNTER, Now & TICK_MASK);
+        for (int ch = 0; ch < 2; ch++)
+        {
+            if (m != (ch ? m1 : m0))
+                continue;
+            poke(&NRF_RTC2->EVENTS_COMPARE[ch], 1);
+            if (!(IntEn & (RTC_INTENSET_COMPARE0_Msk << ch)))
+                continue;
+            if (!IrqOn)
+                fail("RTC2's interrupt is off in the NVIC", 0, 0);
+            else
+            {
+                if (ch == 0)
+                    Tick0 = Now;
+                RTC2_IRQHandler();
+                Woken = true;
+            }
+        }
+    }
+
+    Now = t;
+    poke(&NRF_RTC2->COUNTER, Now & TICK_MASK);
+}
+
+
+/*
+ *  Sleep until an interrupt (sd_app_evt_wait()).  One since the last
+ *  sleep wakes it straight away.
+ */
+static void
+evtWait(void)
+{
+    while (!Woken)
+    {
+        Ticks_t t = ~0ULL;
+
+        for (int ch = 0; ch < 2; ch++)
+            if ((IntEn & (RTC_INTENSET_COMPARE0_Msk << ch)) && match(ch) < t)
+                t = match(ch);
+        if (Others && NextOther < t)
+            t = NextOther;
+        if (t == ~0ULL)
+        {
+            fail("asleep with no interrupt to wake it", 0, 0);
+            exit(1);
+        }
+        advance(t);
+    }
+
+    Woken = false;
+    Wakes++;
+}
+
+/**********************************************************************/
+/*
+ *  The tick callouts.
+ */
+
+#define PERIODIC    5
+
+static TickCallout_t    Ticks[PERIODIC + 1];
+static Ticks_t          TickDue[PERIODIC + 1];
+static unsigned         TickRuns[PERIODIC + 1];
+static unsigned         TickLate;
+
+static const unsigned   Period[PERIODIC] =
+{
+    MS2TICK(25), 333, MS2TICK(100), MS2TICK(1000), 4111,
+};
+
+
+static void
+tickRun(TickCallout_t * t)
+{
+    int i = t - Ticks;
+
+    if (Now < TickDue[i])
+        fail("tick callout %ld ran %ld ticks early", i, TickDue[i] - Now);
+    else if (Now - TickDue[i] > Busy + 2)
+        fail("tick callout %ld ran %ld ticks late", i, Now - TickDue[i]);
+    else if (Now - TickDue[i] > TickLate)
+        TickLate = Now - TickDue[i];
+    TickRuns[i]++;
+
+    if (i < PERIODIC)
+    {
+        TickDue[i] += Period[i];
+        TickCallout(t, t->tick + Period[i]);
+    }
+    else
+    {
+        TickDue[i] = Now + 1 + random() % (3 * TICK_UNIT);
+        TickCallout(t, TickDue[i]);
+    }
+}
+
+
+static void
+tickStart(void)
+{
+    for (int i = 0; i <= PERIODIC; i++)
+    {
+        TickDue[i] = Now + 100 + i;
+        TickCalloutFunc(&Ticks[i], TickDue[i], tickRun, 0, 0);
+    }
+}
+
+
+static void
+tickCheck(void)
+{
+    for (int i = 0; i < PERIODIC; i++)
+    {
+        unsigned want = (Now - 100 - i) / Period[i];
+        if (TickRuns[i] + 1 < want)
+            fail("tick callout %ld ran %ld times", i, TickRuns[i]);
+    }
+}
+
+/**********************************************************************/
+/*
+ *  The Tempus callouts, and the time-of-day.
+ */
+
+#define TEMPUS      8
+
+static TempusCallout_t  Tempus[TEMPUS];
+static unsigned         TempusRuns;
+static unsigned         TempusLate;
+
+
+static void tempusRun(TempusCallout_t * t);
+
+static void
+tempusSet(int i)
+{
+    unsigned secs = i ? 1 + random() % 20 : 1 + random() % 700;
+    TempusCalloutFunc(&Tempus[i], Now / TICK_UNIT + secs, tempusRun, 0, 0);
+}
+
+
+static void
+tempusRun(TempusCallout_t * t)
+{
+    Ticks_t due = (Ticks_t)t->time * TICK_UNIT;
+
+    if (Now < due)
+        fail("Tempus callout %ld ran %ld ticks early", t - Tempus, due - Now);
+    else if (Now - due > Busy + 2)
+        fail("Tempus callout %ld ran %ld ticks late", t - Tempus, Now - due);
+    else if (Now - due > TempusLate)
+        TempusLate = Now - due;
+    TempusRuns++;
+
+    tempusSet(t - Tempus);
+}
+
+
+static void
+tempusCheck(void)
+{
+    for (int i = 0; i < TEMPUS; i++)
+        if ((Ticks_t)Tempus[i].time * TICK_UNIT + Busy + 2 < Now)
+            fail("Tempus callout %ld due at %ld didn't run", i,
+                 Tempus[i].time);
+}
+
+
+static void
+todCheck(void)
+{
+#if defined(OQ_TICKLESS)
+    Ticks_t t = Now;
+#else
+    Ticks_t t = Tick0;
+#endif // defined(OQ_TICKLESS)
+    u64 tod = GetTODZero64();
+
+    if (tod >> 32 != t / TICK_UNIT)
+        fail("TOD is %ld seconds, should be %ld", tod >> 32, t / TICK_UNIT);
+    else if ((u32)tod >> 24 != t % TICK_UNIT / (TICK_UNIT / 256))
+        fail("TOD is %ld/256 into the second, should be %ld",
+             (u32)tod >> 24, t % TICK_UNIT / (TICK_UNIT / 256));
+}
+
+/**********************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+    extern char * optarg;
+    int c;
+
+    srandom(37);
+    while ((c = getopt(argc, argv, "t:b:i:qs:")) != -1)
+        switch (c)
+        {
+        case 't':
+            Seconds = strtoul(optarg, 0, 0);
+            break;
+        case 'b':
+            Busy = strtoul(optarg, 0, 0);
+            break;
+        case 'i':
+            Others = strtoul(optarg, 0, 0);
+            break;
+        case 'q':
+            Quiet = true;
+            break;
+        case 's':
+            srandom(strtoul(optarg, 0, 0));
+            break;
+        default:
+            fputs("usage: ticksim [-t seconds] [-b ticks] [-i interrupts] "
+                  "[-q] [-s seed]\n", stderr);
+            exit(1);
+        }
+
+    int fd = memfd_create("rtc2", 0);
+    if (fd < 0 || ftruncate(fd, 0x1000) < 0 ||
+        mmap(RTC_PAGE, 0x1000, PROT_READ, MAP_FIXED | MAP_SHARED,
+             fd, 0) == MAP_FAILED ||
+        (rtcPage = mmap(0, 0x1000, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0)) == MAP_FAILED ||
+        mmap(NVIC_PAGE, 0x1000, PROT_READ, MAP_FIXED | MAP_PRIVATE |
+             MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+        err(1, "can't map RTC2 and the NVIC");
+
+    struct sigaction sa = { .sa_flags = SA_SIGINFO | SA_NODEFER };
+    sa.sa_sigaction = segv;
+    sigaction(SIGSEGV, &sa, 0);
+    sa.sa_sigaction = trap;
+    sigaction(SIGTRAP, &sa, 0);
+
+    TimerInit();
+    if (!Quiet)
+        tickStart();
+    for (int i = 0; i < TEMPUS; i++)
+        tempusSet(i);
+    if (Others)
+        NextOther = random() % (TICK_UNIT / Others);
+
+    /*
+     *  The super loop.
+     */
+    Ticks_t end = (Ticks_t)Seconds * TICK_UNIT;
+    int work = 1;
+    while (Now < end)
+    {
+        if (!work)
+        {
+            TimerAboutToSleep();
+            evtWait();
+            TimerJustWokeUp();
+        }
+
+        work = 0;
+        TempusMagnaCirculi();
+        work += TickMagnaCirculi();
+        if (Busy)
+        {
+            Ticks_t t = Now;
+            advance(Now + random() % (Busy + 1));
+            Awake += Now - t;
+        }
+        todCheck();
+    }
+    if (!Quiet)
+        tickCheck();
+    tempusCheck();
+
+    printf("%s %u s, up to %u ticks busy, %u interrupts/s:  "
+           "%.1f wake ups/s, %.1f%% awake\n",
+#if defined(OQ_TICKLESS)
+           "tickless",
+#else
+           "ticking",
+#endif // defined(OQ_TICKLESS)
+           Seconds, Busy, Others, (double)Wakes / Seconds,
+           100.0 * Awake / Now);
+    printf("  callouts up to %u ticks late (tick), %u (Tempus, %u runs):  "
+           "%s\n", TickLate, TempusLate, TempusRuns,
+           Failed ? "FAILED" : "all on time");
+    return Failed != 0;
+}
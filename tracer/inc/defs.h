@@ -110,14 +110,14 @@
 #endif // OQ_FLASH_STORE
 
 #ifndef OQ_FLASH_STORE_END
-#  define OQ_FLASH_STORE_END    (126*OQ_FLASH_PAGE)   //  Storage area end
+#  define OQ_FLASH_STORE_END    (125*OQ_FLASH_PAGE)   //  Storage area end
 #endif // OQ_FLASH_STORE_END
 
 #ifndef OQ_FLASH_CONFIG
-#  define OQ_FLASH_CONFIG       (126*OQ_FLASH_PAGE)   //  Configuration page
+#  define OQ_FLASH_CONFIG       (125*OQ_FLASH_PAGE)   //  Configuration page
 #endif // OQ_FLASH_CONFIG
 
-#define OQ_FLASH_BOOT_LOADER    (127*OQ_FLASH_PAGE)   //  Boot loader
+#define OQ_FLASH_BOOT_LOADER    (126*OQ_FLASH_PAGE)   //  Boot loader (2 pages)
 
 /*
  *  Particulars of the app code.
@@ -141,7 +141,6 @@
 /****************/
 // main/board.c
 
-extern void     BoardLoop(void);
 extern u32      BoardGetDeviceID(void);
 extern void     SetupBoard(void);
 extern void     Reboot(unsigned tod0);
@@ -201,6 +200,8 @@ extern void     CRC8(CRC_t * crc, u32 data);
 extern void     CRC16(CRC_t * crc, u32 data);
 extern void     CRC32(CRC_t * crc, u32 data);
 
+extern u16      CRC16CCITT(u16 crc, const u8 * data, unsigned len);
+
 /****************/
 // misc/rand.c
 
@@ -233,6 +234,7 @@ extern void     RandStateMachine(void);
 
 extern int      TraceSuperLoop(void);
 extern void     TraceSetup(void);
+extern bool     TraceIsIdle(void);
 
 /****************/
 // Nordic error codes
@@ -256,6 +256,8 @@ extern void     TimerJustWokeUp(void);
  *
  *  This timer is a non-interrupt driven timer based on the Time-Of-Day
  *  since boot (TOD0), with an unlimited maximum time (many years).
+ *  Nothing wakes the CPU when one expires, so with OQ_TICKLESS it's only
+ *  seen the next time something else does;  use a callout instead.
  */
 
 typedef struct Tempus_t Tempus_t;
@@ -287,6 +289,7 @@ TempusTimeout(Tempus_t * t)
  *
  *  These timers are a callout mechanism implemented entirely in the App
  *  context.  They have a resolution of 1 Hz, and many years of maximum.
+ *  The structure must be zeroed before first use.
  */
 
 typedef struct TempusCallout_t TempusCallout_t;
@@ -295,11 +298,13 @@ struct TempusCallout_t
 {
     unsigned            time;       // Trigger time
     TempusCallout_t *   next;       // Next in callout list
+    TempusCallout_t **  prev;       // Link to this entry (0 if inactive)
     TempusCallout_f *   func;       // Callout function
     void *              data[2];    // Callout data store
 };
 
 extern void     TempusMagnaCirculi(void);
+extern unsigned TempusNext(void);
 
 extern void	TempusCallout(TempusCallout_t * t, unsigned tod);
 extern void	TempusCalloutVar(TempusCallout_t * t, unsigned tod,
@@ -307,6 +312,35 @@ extern void	TempusCalloutVar(TempusCallout_t * t, unsigned tod,
 extern void	TempusCalloutFunc(TempusCallout_t * t, unsigned tod,
                                   TempusCallout_f * func, void * d0, void * d1);
 
+/**********************************************************************/
+/*
+ *  Tick callouts.
+ *
+ *  Like the Tempus callouts, these run in the App context from the super
+ *  loop, but are timed to the tick of RTC2 (1/32768 second).  A compare
+ *  channel on RTC2 is set for the earliest one, so the super loop wakes up
+ *  just when it's due.  Times are RTC2 tick values (see `TimerGetTick()'),
+ *  and must be less than 256 seconds away.
+ */
+
+typedef struct TickCallout_t TickCallout_t;
+typedef void TickCallout_f(TickCallout_t * t);
+struct TickCallout_t
+{
+    unsigned            tick;       // Trigger tick
+    TickCallout_t *     next;       // Next in callout list
+    TickCallout_f *     func;       // Callout function
+    void *              data[2];    // Callout data store
+    bool                active;     // On the callout list
+};
+
+extern int      TickMagnaCirculi(void);
+
+extern void     TickCallout(TickCallout_t * t, unsigned tick);
+extern void     TickCalloutCancel(TickCallout_t * t);
+extern void     TickCalloutFunc(TickCallout_t * t, unsigned tick,
+                                TickCallout_f * func, void * d0, void * d1);
+
 /**********************************************************************/
 
 #endif // __TIMER_H__
@@ -316,6 +316,17 @@ static unsigned ledCnt[4];
 static int button[4];
 static int buttonCnt[4];
 
+/*
+ *  40 times per second, we blink an LED and check for button presses.
+ *  With no LED lit and no button down, the buttons are looked at only 4
+ *  times per second, so as not to keep waking the CPU for nothing.
+ */
+#define BOARD_TICK      MS2TICK(25)
+#define BOARD_IDLE_TICK MS2TICK(250)
+
+static TickCallout_t boardTimer;
+static bool boardIdle;
+
 /*
  *  Turn on the `n'th LED for `cnt' ticks.
  */
@@ -328,6 +339,12 @@ TouchLED(unsigned n, unsigned cnt)
     if (cnt > 40)
         cnt = 40;
     ledCnt[n] = cnt;
+
+    if (boardIdle)
+    {
+        boardIdle = false;
+        TickCallout(&boardTimer, TimerGetTick());
+    }
 }
 
 
@@ -350,58 +367,55 @@ ButtonEvent(void)
 
 #ifdef OQ_DEBUG
 
-void
-BoardLoop(void)
+static void
+boardTick(TickCallout_t * tmr)
 {
-    static Timer_t tmr;
+    NRF_GPIO_Type * p0 = NRF_P0;
+    bool idle = true;
 
-    if (TimerTimeout(&tmr))
+    for (int i = 0; i < maxLED; i++)
     {
-        /*
-         *  40 times per second, we blink an LED and check for button presses.
-         */
-        TimerSetMs(&tmr, 25);
-
-        NRF_GPIO_Type * p0 = NRF_P0;
-
-        for (int i = 0; i < maxLED; i++)
+        unsigned x = 1 << PinAssign[PIN_LED0 + i];
+        if (ledCnt[i] > 0)
         {
-            unsigned x = 1 << PinAssign[PIN_LED0 + i];
-            if (ledCnt[i] > 0)
-            {
-                p0->OUTCLR = x;
-                ledCnt[i]--;
-            }
-            else
-                p0->OUTSET = x;
-            x <<= 1;
+            p0->OUTCLR = x;
+            ledCnt[i]--;
+            idle = false;
         }
+        else
+            p0->OUTSET = x;
+        x <<= 1;
+    }
 
-        for (int i = 0; i < maxButton; i++)
+    for (int i = 0; i < maxButton; i++)
+    {
+        unsigned x = 1 << PinAssign[PIN_BUTTON0 + i];
+        int b = !(p0->IN & x);
+        if (b || button[i])
+            idle = false;
+        if (b && !button[i])
+        {
+            if (buttonCnt[i] < 0)
+                buttonCnt[i] = 0;
+            buttonCnt[i]++;
+            if (buttonCnt[i] >= 2)
+                button[i] = 1;
+        }
+        else if (!b && button[i])
         {
-            unsigned x = 1 << PinAssign[PIN_BUTTON0 + i];
-            int b = !(p0->IN & x);
-            if (b && !button[i])
-            {
-                if (buttonCnt[i] < 0)
-                    buttonCnt[i] = 0;
-                buttonCnt[i]++;
-                if (buttonCnt[i] >= 2)
-                    button[i] = 1;
-            }
-            else if (!b && button[i])
-            {
-                if (buttonCnt[i] > 0)
-                    buttonCnt[i] = 0;
-                buttonCnt[i]--;
-                if (buttonCnt[i] <= 2)
-                    button[i] = 0;
-            }
-
-            x <<= 1;
+            if (buttonCnt[i] > 0)
+                buttonCnt[i] = 0;
+            buttonCnt[i]--;
+            if (buttonCnt[i] <= 2)
+                button[i] = 0;
         }
+
+        x <<= 1;
     }
 
+    boardIdle = idle;
+    TickCallout(tmr, tmr->tick + (idle ? BOARD_IDLE_TICK : BOARD_TICK));
+
 
 #if 0
 
@@ -427,6 +441,13 @@ dprintf("tick (%d, %d)\n", pus.time, GetTODZero());
 
 }
 
+
+INITFUNC(100)
+{
+    TickCalloutFunc(&boardTimer, TimerGetTick() + BOARD_TICK,
+                    &boardTick, 0, 0);
+}
+
 #endif // OQ_DEBUG
 
 /**********************************************************************/
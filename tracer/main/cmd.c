@@ -241,15 +241,27 @@ COMMAND(001)
 static char     line[256];
 static char *   linep = &line[0];
 static char *   args[16];
+static CMDInput_f * input;
+
+
+/*
+ *  Hand the debug port input to `func' (see debug.h).
+ */
+void
+CommandInput(CMDInput_f * func)
+{
+    input = func;
+}
 
 
 /*
  *  Command handler.  Checks for new characters from the debug port,
  *  collects them into a group of words and executes them as commands.
  *  Each time it's called, it checks for a new character.  If one is
- *  found, it tosses it at a state machine.
+ *  found, it tosses it at a state machine.  Returns non-zero if a
+ *  command has taken the input and is still busy with it.
  */
-void
+int
 CommandLoop(void)
 {
     /*
@@ -259,7 +271,7 @@ CommandLoop(void)
     if (!beenHere)
     {
         if (DebugPutAvail() < 80)
-            return;
+            return 0;
 
         dprintf("\nTracer debugger        "
                 "(type \"help\" for more information)\n\n");
@@ -268,20 +280,31 @@ CommandLoop(void)
         goto prompt;
     }
 
+    /*
+     *  If a command has taken the input, let it have it until it's done.
+     */
+    if (input)
+    {
+        if ((*input)())
+            return 1;
+        input = 0;
+        goto prompt;
+    }
+
     /*
      *  Wait for enough characters to become available in the
      *  transmit queue for the longest message we will print
      *  here.
      */
     if (DebugPutAvail() < 32)
-        return;
+        return 0;
 
     /*
      *  Check for a new character, and return if none was found.
      */
     int c = DebugGetChar();
     if (c < 0)
-        return;
+        return 0;
 
     /*
      *  Fold CR & LF -- a CR or LF, or CRLF all amount to a single
@@ -299,7 +322,7 @@ CommandLoop(void)
             int CR1 = CR;
             CR = false;
             if (CR1 && c == '\n')
-                return;
+                return 0;
         }
     }
 
@@ -320,7 +343,7 @@ CommandLoop(void)
             linep--;
             dprintf("\b \b");
         }
-        return;
+        return 0;
 
     default:
         if (c >= ' ' && c <= '~' && linep < &line[sizeof line] - 1)
@@ -328,7 +351,7 @@ CommandLoop(void)
             *linep++ = c;
             dprintf("%c", c);
         }
-        return;
+        return 0;
     }
 
     /*
@@ -373,9 +396,12 @@ CommandLoop(void)
         (*cmd->func)(ap - &args[0], &args[0]);
     else
         dprintf("Unknown command: %s\n", args[0]);
+    if (input)
+        return 1;
 
 prompt:
     dprintf("Tracer> ");
+    return 0;
 }
 
 #endif // OQ_COMMAND
@@ -65,10 +65,14 @@
  *                          The total of all of the above should a little
  *                          less than 256 KB.
  *
- *      40000 - 7f000       Circular flash storage (configuration, sensor
- *                          samples, software updates, etc).
+ *      3f000 - 40000       Boot loader scratch page, for delta updates.
  *
- *      7f000 - 80000       Boot loader (for software update)
+ *      40000 - 7d000       Circular flash storage (sensor samples,
+ *                          software updates, etc).
+ *
+ *      7d000 - 7e000       Configuration page.
+ *
+ *      7e000 - 80000       Boot loader (for software update)
  *
  *  RAM memory:  (20000000 - 2000ffff)
  *      0000 - ssss         Soft device storage;  4 KB - 8 KB depending on
@@ -130,6 +134,7 @@
 #include "cpu/atomic.h"
 #include "debug/debug.h"
 #include "debug/tachyon.h"
+#include "debug/profile.h"
 #include "version.h"
 // #include "ant/oqant.h"
 // #include "ant_parameters.h"
@@ -321,24 +326,18 @@ Main(void)
     ConfigInitialize();
 
     /*
-     *  Now run a mini super loop for the flash only, to allow it to read
-     *  and possibly initialize the flash.  This will retrieve any
-     *  configuration in the storage flash, if it exists, and is more recent
-     *  than one from the config page.  (Note that items located in circular
-     *  flash must not be processed yet, but can be remembered for later.)
+     *  Update the device id in the config based on the board.
      */
-    while (StoreSuperLoop())
-    {
-        TempusMagnaCirculi();
-        handleSocEvents();
-    }
+    Config.confDeviceID = devID;
 
     /*
-     *  Update the device id in the config based on the board.  This has to be
-     *  done after the store loop is run once since we could have config entries
-     *  in the circular flash.
+     *  Start the tracer.  The radio configuration is known from the config
+     *  page, so there is no need to wait for the circular flash to be
+     *  read;  that happens a page at a time from the super loop.  Should
+     *  a more recent configuration turn up there, the tracer will pick up
+     *  the change.
      */
-    Config.confDeviceID = devID;
+    TraceSetup();
 
     /**********************************************************************/
     //
@@ -365,11 +364,6 @@ Main(void)
     //
     /******  Part 2  --  higher level initialization  ******/
 
-    /*
-     *  Start the tracer.
-     */
-    TraceSetup();
-
     /*
      *  Set up the ANT and/or BLE protocols.
      */
@@ -391,54 +385,63 @@ Main(void)
          */
         if (!work)
         {
+            unsigned slept = TimerGetTick();
+
             /*
              *  Wait for something to happen.  This returns if any
              *  interrupts have occurred since the last call.  If no
              *  interrupts have happened, it will cause the CPU to sleep.
              */
+            TimerAboutToSleep();
             sd_app_evt_wait();
+            TimerJustWokeUp();
+
+            ProfileSleep((TimerGetTick() - slept) & TICK_MASK);
         }
 
         work = 0;
+        PROFILE_START();
 
         /*
-         *  Run the Tempus thingy.
+         *  Run the Tempus thingy, and the tick callouts.
          */
         TempusMagnaCirculi();
+        PROFILE_END(PROF_TEMPUS);
+        work += TickMagnaCirculi();
+        PROFILE_END(PROF_TICK);
 
 #ifdef OQ_COMMAND
         /*
          *  Debugger command processor.
          */
-        CommandLoop();
+        work += CommandLoop();
+        PROFILE_END(PROF_COMMAND);
 #endif // OQ_COMMAND
 
-#ifdef OQ_DEBUG
-        /*
-         *  Flash LEDs, and check buttons.
-         */
-        BoardLoop();
-#endif // OQ_DEBUG
-
         /*
          *  Handle SOC events, such as flash operations.
          */
         work += handleSocEvents();
+        PROFILE_END(PROF_SOC);
 
         /*
          *  Run the flash storage state machine.
          */
         work += StoreSuperLoop();
+        work += SuSuperLoop();
+        PROFILE_END(PROF_STORE);
 
         /*
          *  Ensure that our larger random buffer is filled.
          */
         RandStateMachine();
+        PROFILE_END(PROF_RAND);
 
         /*
          *  Run the tracer (main) state machine.
          */
         work += TraceSuperLoop();
+        PROFILE_END(PROF_TRACE);
     }
 }
 
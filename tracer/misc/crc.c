@@ -1,5 +1,10 @@
 /*
  *  CRC functions and table.
+ *
+ *  OQ_CRC_SLICES picks how fast CRC() is, for the flash it takes:  1 (the
+ *  default) folds in a byte at a time, with a 1 KB table;  4 or 8 fold in
+ *  that many bytes at a time, with 4 or 8 KB of tables (see crctab.h).
+ *  The faster builds also have tables for CRC16CCITT().
  */
 
 #include <stdbool.h>
@@ -7,7 +12,15 @@
 
 #define POLY 0x82f63b78
 
-static unsigned table[256] =
+#ifndef OQ_CRC_SLICES
+#define OQ_CRC_SLICES   1
+#endif
+
+#if OQ_CRC_SLICES != 1 && OQ_CRC_SLICES != 4 && OQ_CRC_SLICES != 8
+#error "OQ_CRC_SLICES must be 1, 4 or 8"
+#endif
+
+static const u32 table[256] =
 {
     0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
     0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
@@ -75,6 +88,10 @@ static unsigned table[256] =
     0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
 };
 
+#if OQ_CRC_SLICES > 1
+#include "crctab.h"
+#endif
+
 
 void
 CRCInit(CRC_t * crc)
@@ -83,11 +100,39 @@ CRCInit(CRC_t * crc)
 }
 
 
+/*
+ *  Fold four bytes (the first in the low 8 bits) into the CRC `c'.
+ */
+#if OQ_CRC_SLICES > 1
+#define CRC_WORD(c) (crcSlice[2][(c) & 0xff] ^                          \
+                     crcSlice[1][((c) >> 8) & 0xff] ^                   \
+                     crcSlice[0][((c) >> 16) & 0xff] ^                  \
+                     table[(c) >> 24])
+#endif
+
+
 void
 CRC(CRC_t * crc, u8 * data, unsigned len)
 {
     u32 c = ~crc->crc;
 
+#if OQ_CRC_SLICES == 8
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        u32 a = OqGet32(data) ^ c;
+        u32 b = OqGet32(data + 4);
+        c = crcSlice[6][a & 0xff] ^ crcSlice[5][(a >> 8) & 0xff] ^
+            crcSlice[4][(a >> 16) & 0xff] ^ crcSlice[3][a >> 24] ^
+            CRC_WORD(b);
+    }
+#elif OQ_CRC_SLICES == 4
+    for (; len >= 4; data += 4, len -= 4)
+    {
+        c ^= OqGet32(data);
+        c = CRC_WORD(c);
+    }
+#endif
+
     while (len-- > 0)
         c = (c >> 8) ^ table[(c ^ *data++) & 0xFF];
 
@@ -107,22 +152,53 @@ CRC8(CRC_t * crc, u32 data)
 void
 CRC16(CRC_t * crc, u32 data)
 {
-    CRC8(crc, data & 0xff);
-    data >>= 8;
-    CRC8(crc, data & 0xff);
+    u32 c = ~crc->crc;
+    c = (c >> 8) ^ table[(c ^ data) & 0xFF];
+    c = (c >> 8) ^ table[(c ^ (data >> 8)) & 0xFF];
+    crc->crc = ~c;
 }
 
 
 void
 CRC32(CRC_t * crc, u32 data)
 {
-    CRC8(crc, data & 0xff);
-    data >>= 8;
-    CRC8(crc, data & 0xff);
-    data >>= 8;
-    CRC8(crc, data & 0xff);
-    data >>= 8;
-    CRC8(crc, data & 0xff);
+    u32 c = ~crc->crc ^ data;
+#if OQ_CRC_SLICES > 1
+    c = CRC_WORD(c);
+#else
+    c = (c >> 8) ^ table[c & 0xFF];
+    c = (c >> 8) ^ table[c & 0xFF];
+    c = (c >> 8) ^ table[c & 0xFF];
+    c = (c >> 8) ^ table[c & 0xFF];
+#endif
+    crc->crc = ~c;
+}
+
+/**********************************************************************/
+/*
+ *  CRC-16-CCITT (polynomial 0x1021, most significant bit first), as the
+ *  radio checks ANT packets.  Each byte is folded in with a few shifts,
+ *  without a table;  the faster builds take four bytes at a time from
+ *  crcCcitt[][] (2 KB).
+ */
+u16
+CRC16CCITT(u16 crc, const u8 * data, unsigned len)
+{
+#if OQ_CRC_SLICES > 1
+    for (; len >= 4; data += 4, len -= 4)
+        crc = crcCcitt[3][data[0] ^ (crc >> 8)] ^
+              crcCcitt[2][data[1] ^ (crc & 0xff)] ^
+              crcCcitt[1][data[2]] ^ crcCcitt[0][data[3]];
+#endif
+
+    while (len-- > 0)
+    {
+        unsigned x = ((crc >> 8) ^ *data++) & 0xff;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
+    }
+
+    return crc;
 }
 
 /**********************************************************************/
@@ -193,11 +193,15 @@ StoreCallbackConfiguration(Config_t * cf)
     {
         /*
          *  Update the RAM copy of the config, and schedule it to be
-         *  written back to the config flash page.
+         *  written back to the config flash page.  The device ID comes
+         *  from the board, not from the flash;  the replay happens after
+         *  it is set, so keep it.
          */
+        u32 devID = Config.confDeviceID;
         memcpy(&Config.confArray[0],
                &cf->confArray[0],
                sizeof Config.confArray);
+        Config.confDeviceID = devID;
 
         StoreConfiguration(true);
     }
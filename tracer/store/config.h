@@ -79,7 +79,9 @@ typedef union
         u32     __res1[3];
 
         u8      confFrequency;      //  Tracer frequency [1, 80]
-        u8      __res4[3];
+        u8      confDecode;         //  Packet decode (see app/tracer.c)
+        u8      confRecover;        //  Bad CRC bits to fix (0 - 2)
+        u8      confCapture;        //  Packet capture (see app/tracer.c)
 
         u32     __res5[22];
 
@@ -59,7 +59,10 @@
  *  On system start up, the entire region is read to determine the most
  *  recent information.  Record handlers take care of determining the most
  *  recent of a particular record type.  The storage manager will
- *  determine the most recent page, and continue writing from there.
+ *  determine the most recent page, and continue writing from there.  The
+ *  read is done a page at a time from the super loop, so the rest of the
+ *  system is running before it finishes;  new records are not written
+ *  until it has.
  *
  *  The region is organized as follows:
  *
@@ -72,17 +75,14 @@
  *      |  | | | | | |  |
  *      |               |
  *      +---------------+
- *      |    page 58    |
- *      +---------------+ 0x7b000   (last page)
  *      |    page 59    |
- *      +---------------+ 0x7c000   (end of region + 1)
- *      |     ....      |
- *      +---------------+ 0x7d000
- *      |   BLE conf    |
+ *      +---------------+ 0x7c000   (last page)
+ *      |    page 60    |
+ *      +---------------+ 0x7d000   (end of region + 1)
+ *      | configuration |
  *      +---------------+ 0x7e000
- *      |   BLE conf    |
- *      +---------------+ 0x7f000
  *      |  boot loader  |
+ *      |   (2 pages)   |
  *      +---------------+ 0x80000   (end of flash)
  *
  *  Records are a collection of words.  The first word has its MSB set
@@ -173,22 +173,15 @@
 #include "store/store.h"
 #include "store/config.h"
 #include "debug/debug.h"
+#include "debug/tachyon.h"
 
 #include "nrf52.h"
 
 /*
- *  Record types, and related.
+ *  Record layout.  (The record types are in store.h.)
  */
 enum
 {
-    RT_ZERO = 0,            //  Zero record -- no operation
-    RT_CONFIG = 0x01,       //  OttoQ configuration structure
-    // RT_SLOG = 0x08,         //  Sensor log record
-    RT_SU_HDR = 0x0c,       //  Software update header
-    RT_SU_DATA = 0x0d,      //  Software update chunk
-    RT_SU_EXEC = 0x0e,      //  Software update "execute"
-    RT_SEQUENCE = 0x1f,     //  Storage manager sequence record
-
     RT_MASK = 0x1f,         //  Mask of the record type data
     RT_SHIFT = 26,          //  Record type bit position
 
@@ -196,7 +189,9 @@ enum
 };
 
 /*
- *  Operation flags.
+ *  Operation flags.  These select the records delivered by a read of the
+ *  flash;  OF_CONFIG is also used in `opFlag' for a pending configuration
+ *  save.  (Other records go straight to the write queue.)
  */
 enum
 {
@@ -209,27 +204,22 @@ enum
 static unsigned     opFlag;
 
 /*
- *  Configuration save timer.
+ *  Configuration save timer.  (A callout rather than a polled Tempus_t, so
+ *  that it wakes the CPU when the time comes.)
  */
-Tempus_t configSaveTimer;
+TempusCallout_t configSaveTimer;
+int configSaveDue;
 int configSaving;
 
 /*
  *  Staging area.  Note that this staging area is used for both reading
- *  and writing of flash.  Callers must ensure that both are not attempted
- *  at the same time.
+ *  records, and writing of the configuration.  Callers must ensure that
+ *  both are not attempted at the same time.
  */
 struct
 {
-    unsigned        sequence;
-    Config_t        config;
-
-    union
-    {
-        SuInfo_t    sui;
-        SuData_t    sud;
-        SuExec_t    sux;
-    };
+    Config_t        config;         //  Configuration being written
+    StoreRecord_t   rec;            //  Record being read
 }
     staging;
 
@@ -401,6 +391,7 @@ flashErase(u32 * addr)
     flashTries = 4;
     flashAddress = addr;
 
+    TachyonLog1(601, (u32)addr);                // tachy: flash begin
     sd_flash_page_erase((u32)addr / OQ_FLASH_PAGE);
 }
 
@@ -419,6 +410,7 @@ flashWrite(u32 * dst, u32 * src, unsigned cnt)
     flashSource = src;
     flashCount = cnt;
 
+    TachyonLog2(602, (u32)dst, cnt);            // tachy: flash begin
     sd_flash_write((uint32_t *)dst, (uint32_t *)src, cnt);
 }
 
@@ -430,6 +422,8 @@ flashWrite(u32 * dst, u32 * src, unsigned cnt)
 void
 StoreFlashed(int ok)
 {
+    TachyonLog1(603, ok);                       // tachy: flash end
+
     if (ok)
     {
         /*
@@ -501,7 +495,71 @@ static u32 *    newCurrentWrite;    //  Current write pointer candidate
 static unsigned newSequence;        //  Sequence number candidate
 
 /*
- *  Flash access staging area, and content details.  (It must contain
+ *  Flash write queue.  Records are packed into storage format as they are
+ *  submitted, and appended to the queue.  The queue is written to flash
+ *  a page at a time (or what remains of one), so a burst of records costs
+ *  a single soft device flash operation rather than one each.
+ *
+ *  `queueTail' is the number of words in the queue.  `queuePointer' is
+ *  the number of bits remaining in the last word (LSB bits) of the record
+ *  being built.  `queueWrite' is the number of words at the front of the
+ *  queue handed to the soft device in the flash write now in progress;
+ *  the queue must not be moved until that write completes.  (One word is
+ *  always held back so a sequence record can be added.)  OQ_STORE_QUEUE
+ *  sets its size in words;  a host check builds it bigger (see
+ *  host/sutest.c).
+ */
+#ifndef OQ_STORE_QUEUE
+#define OQ_STORE_QUEUE  256
+#endif
+
+#define QUEUE_WORDS     OQ_STORE_QUEUE
+
+static u32      queue[QUEUE_WORDS];
+static unsigned queueTail;
+static unsigned queuePointer;
+static unsigned queueWrite;
+
+/*
+ *  Write statistics.
+ */
+static unsigned storeFlashWrites;   //  Soft device write operations
+static unsigned storeFlashErases;   //  Soft device erase operations
+static unsigned storeRecords;       //  Records committed to flash
+static unsigned storeSubmitted;     //  Records added to the queue
+static unsigned storePreErases;     //  Pages erased ahead of time
+static unsigned storeEraseStalls;   //  Writes that had to wait for an erase
+
+/*
+ *  Page index.  For each page of the circular flash, the sequence number
+ *  of the page (0 if not in use), and a bit mask of the types of records
+ *  that start in it.  Built as the flash is replayed, and kept up to date
+ *  as records are written and pages erased.
+ */
+#define STORE_PAGES     ((OQ_FLASH_STORE_END - OQ_FLASH_STORE) / OQ_FLASH_PAGE)
+
+static struct
+{
+    u32         seq;                //  Page sequence number
+    u32         types;              //  Bit mask of record types in the page
+}
+    pageIndex[STORE_PAGES];
+
+
+static inline unsigned
+pageNumber(u32 * p)
+{
+    return ((u32)p - OQ_FLASH_STORE) / OQ_FLASH_PAGE;
+}
+
+/*
+ *  Once the current page is this full (in words), the next page is
+ *  erased in the background.
+ */
+#define PRE_ERASE_WORDS     ((OQ_FLASH_PAGE / sizeof (u32)) * 3 / 4)
+
+/*
+ *  Flash read staging area, and content details.  (It must contain
  *  enough space for the largest record that we could have.)
  *
  *  The number of used words in this buffer is `bufferIndex + 1'.  An
@@ -521,33 +579,43 @@ static u32 storeDebugOldq = 0xffffffff;
 static u32 * storeDebugNewp = 0;
 static u32 storeDebugNewq = 0;
 static int storeDebugFlag = false;
-static void printStoreRecord(int ty);
+static void printStoreRecord(int ty, StoreRecord_t * r);
 #endif // OQ_DEBUG
 
 /******************************/
 
 /*
- *  Start a new storage record in the staging buffer.  Add the type.
+ *  Start a new storage record at the end of the write queue.  Add the
+ *  type.  `bits' is the size of the record's payload;  if there is not
+ *  room in the queue for it, nothing is added and false is returned.
  */
-static void
-wrNew(unsigned ty)
+static bool
+wrNew(unsigned ty, unsigned bits)
 {
+    unsigned words = 1;
+    if (bits > RT_SHIFT)
+        words += (bits - RT_SHIFT + 30) / 31;
+
+    if (queueTail + words >= ARRAY_SIZE(queue))
+        return false;
+
     ty &= RT_MASK;
-    buffer[0] = 0x80000000 | (ty << RT_SHIFT);
-    bufferIndex = 0;
-    bufferPointer = RT_SHIFT;
+    queue[queueTail++] = 0x80000000 | (ty << RT_SHIFT);
+    queuePointer = RT_SHIFT;
+    storeSubmitted++;
+    return true;
 }
 
 
 /*
- *  Write `bits' of new `data' into the staging area, ready to be written
- *  to flash.
+ *  Write `bits' of new `data' into the record at the end of the queue,
+ *  ready to be written to flash.
  */
 static void
 wr(unsigned bits, u32 data)
 {
-    unsigned idx = bufferIndex;
-    unsigned ptr = bufferPointer;
+    unsigned idx = queueTail - 1;
+    unsigned ptr = queuePointer;
 
     while (bits > ptr)
     {
@@ -555,17 +623,15 @@ wr(unsigned bits, u32 data)
         {
             u32 msk = (1 << ptr) - 1;
 
-            buffer[idx] = (buffer[idx] & ~msk) |
-                          (data & msk);
+            queue[idx] = (queue[idx] & ~msk) |
+                         (data & msk);
 
             data >>= ptr;
             bits -= ptr;
         }
 
-        if (idx < ARRAY_SIZE(buffer) - 1)
-            idx++;
-        bufferIndex = idx;
-        buffer[idx] = 0;
+        idx++;
+        queue[idx] = 0;
         ptr = 31;
     }
 
@@ -573,56 +639,145 @@ wr(unsigned bits, u32 data)
     ptr -= bits;
     data <<= ptr;
 
-    buffer[idx] = (buffer[idx] & ~msk) |
-                  (data & msk);
+    queue[idx] = (queue[idx] & ~msk) |
+                 (data & msk);
 
-    bufferPointer = ptr;
+    queueTail = idx + 1;
+    queuePointer = ptr;
 }
 
 
 /*
- *  Append a sequence number record to the buffer.
+ *  Write `cnt' bytes from `src' into the record at the end of the queue.
+ *  The same as `wr(8, ...)' for each byte, but with the word being filled
+ *  kept in a register.  (A byte split over two words has its low bits in
+ *  the first word, so the bytes cannot simply be shifted in as a stream.)
  */
 static void
-wrSeq(void)
+wrBytes(const u8 * src, unsigned cnt)
 {
-    unsigned idx = bufferIndex;
-    if (++idx < ARRAY_SIZE(buffer))
+    unsigned idx = queueTail - 1;
+    unsigned ptr = queuePointer;
+    u32 w = queue[idx] & ~((1 << ptr) - 1);
+
+    while (cnt-- > 0)
     {
-        u32 s = 0x80000000 |
-                (RT_SEQUENCE << RT_SHIFT) |
-                (++sequence & RD_MASK);
-        buffer[idx] = s;
-        bufferIndex = idx;
+        u32 b = *src++;
+        if (ptr >= 8)
+        {
+            ptr -= 8;
+            w |= b << ptr;
+        }
+        else
+        {
+            /*
+             *  Low bits finish this word, the high bits start the next.
+             */
+            w |= b & ((1 << ptr) - 1);
+            queue[idx++] = w;
+            b >>= ptr;
+            ptr += 31 - 8;
+            w = b << ptr;
+        }
     }
+
+    queue[idx] = w;
+    queueTail = idx + 1;
+    queuePointer = ptr;
+}
+
+
+/*
+ *  Insert a sequence number record into the queue at word `idx'.  (There
+ *  is always room for one.)
+ */
+static void
+wrSeq(unsigned idx)
+{
+    for (unsigned i = queueTail; i > idx; i--)
+        queue[i] = queue[i - 1];
+    queue[idx] = 0x80000000 |
+                 (RT_SEQUENCE << RT_SHIFT) |
+                 (++sequence & RD_MASK);
+    queueTail++;
+}
+
+
+/*
+ *  Return the number of words in the queued record starting at word `idx'.
+ */
+static unsigned
+wrLength(unsigned idx)
+{
+    unsigned i = idx + 1;
+    while (i < queueTail && !(queue[i] & 0x80000000))
+        i++;
+    return i - idx;
 }
 
 /******************************/
 
 /*
- *  Start a flash write, with the data we've just collected.  It manages
+ *  If a write has just completed, take its words off the queue, and note
+ *  its records in the page index.
+ */
+static void
+wrDone(void)
+{
+    if (!queueWrite)
+        return;
+
+    /*
+     *  The assumption is that if the first word is no longer erased, then
+     *  the write succeeded.  (The retries in `StoreFlashed()' make sure the
+     *  write is done, one way or another, so there is nothing more we
+     *  could do if not.)
+     */
+    for (unsigned i = 0; i < queueWrite; i++)
+    {
+        u32 rec = queue[i];
+        if (!(rec & 0x80000000))
+            continue;
+
+        unsigned ty = (rec >> RT_SHIFT) & RT_MASK;
+        unsigned pn = pageNumber(currentWrite + i);
+        pageIndex[pn].types |= 1 << ty;
+        if (ty == RT_SEQUENCE)
+            pageIndex[pn].seq = rec & RD_MASK;
+        else
+            storeRecords++;
+    }
+
+    currentWrite += queueWrite;
+    queueTail -= queueWrite;
+    for (unsigned i = 0; i < queueTail; i++)
+        queue[i] = queue[i + queueWrite];
+    queueWrite = 0;
+}
+
+
+/*
+ *  Start a flash operation to move the write queue to flash.  It manages
  *  paging correctly.  Returns true if there was a flash operation.  If it
  *  returns true, the flash state machine should arrange to call it again
- *  once the flash operation is complete to possibly start the next step
- *  of a write, and should not move on to the next until it returns false.
- *  (Worst case, `wrGo()' could need three flash operations -- an erase,
- *   and two writes.)
+ *  once the flash operation is complete, and should not move on to the
+ *  next until it returns false (the queue is empty).
+ *
+ *  Each write covers as many whole records as fit in the rest of the
+ *  current page.  If the next page is already erased, the first record
+ *  that does not fit is added too (straddling the page boundary),
+ *  followed by the sequence record for the new page.
  */
 static int
 wrGo(void)
 {
+    wrDone();
+
     /*
-     *  The flash write state machine.
+     *  If there is nothing to write, we are done.
      */
-    static enum
-    {
-        IDLE = 0,
-        ERASE1, ERASE2, ERASE3,     //  Erase state, including retries
-        WRITE1, WRITE2, WRITE3,     //  Write state, including retries
-                    //  XXX   These retry states can probably be removed now
-    }
-        state = IDLE;
-    static bool needSeq = false;
+    if (queueTail == 0)
+        return 0;
 
     /*
      *  Set up our collection of values.  We collect:
@@ -630,13 +785,11 @@ wrGo(void)
      *  -   the start of the current page
      *  -   the end of this page + 1
      *  -   the word count remaining in this page
-     *  -   the number of words we need to write for this record
      */
     u32 * ptr = currentWrite;
     u32 * page = (u32 *)((unsigned)ptr & ~(OQ_FLASH_PAGE - 1));
     u32 * pe = (u32 *)((unsigned)page + OQ_FLASH_PAGE);
     unsigned remain = pe - ptr;
-    unsigned cnt = bufferIndex + 1;
 
     /*
      *  If the write pointer is at the very beginning of the page, then we
@@ -647,166 +800,126 @@ wrGo(void)
     if (ptr == page)
     {
         pe = page;
-        page = (u32 *)((unsigned)page - OQ_FLASH_PAGE);
-        if (page < (u32 *)OQ_FLASH_STORE)
-            page = (u32 *)(OQ_FLASH_STORE_END - OQ_FLASH_PAGE);
         remain = 0;
     }
 
     /*
-     *  Run the state machine.
+     *  Collect the whole records that fit in this page.
      */
-    switch (state)
+    unsigned cnt = 0;
+    while (cnt < queueTail)
+    {
+        unsigned len = wrLength(cnt);
+        if (cnt + len > remain)
+            break;
+        cnt += len;
+    }
+
+    if (cnt < queueTail)
     {
-    case IDLE:
         /*
-         *  If there is nothing to write, we are done.  (An excessive
-         *  count is the indication of an invalid record.)
+         *  Figure the address of the next page to erase/write.
          */
-        if (cnt > ARRAY_SIZE(buffer))
-            return 0;
+        u32 * next = pe;        //  The next page to write, wrapping as needed
+        if (next >= (u32 *)OQ_FLASH_STORE_END)
+            next = (u32 *)OQ_FLASH_STORE;
 
         /*
-         *  Start with the page erase state.  (Most of the time, it'll
-         *  go right through that state to write.)
+         *  We have more to write than there are words remaining in this
+         *  page.  We need another page.  If the next page is not erased,
+         *  we first need to erase it.  (Since we always write from start
+         *  to finish, if the first word is erased, we can assume the whole
+         *  page is erased.)  Whatever fits in this page can go first.
          */
-        state = ERASE1;
-        goto erase;
-
-    case ERASE1:
-        state = ERASE2;
-        goto erase;
-
-    case ERASE2:
-        state = ERASE3;
-        goto erase;
-
-    erase:
-        if (cnt > remain)
+        if (*next != 0xffffffff)
         {
-            /*
-             *  Figure the address of the next page to erase/write.
-             */
-            u32 * next = pe;    //  The next page to write, wrapping as needed
-            if (next >= (u32 *)OQ_FLASH_STORE_END)
-                next = (u32 *)OQ_FLASH_STORE;
-
-            /*
-             *  We have more to write than there are words remaining in
-             *  this page.  We need another page.  If the next page is not
-             *  erased, we first need to erase it.  (Since we always write
-             *  from start to finish, if the first word is erased, we can
-             *  assume the whole page is erased.)
-             */
-            if (*next != 0xffffffff)
+            if (cnt == 0)
             {
                 /*
                  *  Trigger a page erase.  The soft device will let us
                  *  know later when it is done.
                  */
                 flashErase(next);
-
-                /*
-                 *  Have the flash state machine come back to us until
-                 *  we're done.
-                 */
+                pageIndex[pageNumber(next)].seq = 0;
+                pageIndex[pageNumber(next)].types = 0;
+                storeFlashErases++;
+                storeEraseStalls++;
                 return 1;
             }
-
-            /*
-             *  We needed a new page, and we have one.  In the normal
-             *  case, we can just write from the current pointer in the
-             *  current page over the page boundary into the new page.
-             *  But, if the next page is actually the first page
-             *  (wrapped), that ain't gunna work.  We take the easy way
-             *  out, and just discard the remaining words in the current
-             *  page, and write from the start of the new page.
-             */
-            if (ptr > next)         //  Skip the remaining words, and start
-            {
-                ptr = next;         //  ... at the bottom of the new page
-                currentWrite = ptr;
-            }
-
+        }
+        else if (ptr <= next)
+        {
             /*
-             *  Note that we need to write a new sequence record for the
-             *  new page into the write stream.
+             *  We have a new page.  Write the next record over the page
+             *  boundary into the new page, followed by the new page's
+             *  sequence record.
              */
-            needSeq = true;
+            cnt += wrLength(cnt);
+            wrSeq(cnt++);
         }
-        state = WRITE1;
-        goto write;
-
-    case WRITE1:
-        state = WRITE2;
-        goto write;
-
-    case WRITE2:
-        state = WRITE3;
-        goto write;
-
-    write:
-        /*
-         *  Write the record to flash, if it's not already there.  (The
-         *  assumption here is that if the first word is no longer erased,
-         *  then the write succeeded.  So long as the soft device writes
-         *  the whole record, or nothing, that'll work.  If not, there is
-         *  nothing we can do.)
-         */
-        if (*ptr != 0xffffffff)
+        else if (cnt == 0)
         {
             /*
-             *  The write completed;  update the pointer and go home.
+             *  The next page is actually the first page (wrapped), so we
+             *  cannot write over the boundary.  We take the easy way out,
+             *  and just discard the remaining words in the current page,
+             *  and write from the start of the new page.
              */
-            ptr += cnt;
+            ptr = next;
             currentWrite = ptr;
-            goto done;
+            cnt = wrLength(0);
+            wrSeq(cnt++);
         }
+    }
 
-        /*
-         *  If we are about to write a new page, we need to make sure that
-         *  a sequence record appears in that page.
-         */
-        if (needSeq)
-        {
-            needSeq = false;
-            wrSeq();
-            cnt = bufferIndex + 1;
-        }
+    /*
+     *  Write the collected records to flash in one operation.
+     */
+    queueWrite = cnt;
+    flashWrite(ptr, &queue[0], cnt);
+    storeFlashWrites++;
 
-#if 0
-if (0)
-{
- dprintf("flash write: %x =", (uint32_t *)ptr);
- for (int i = 0; i < cnt; i++)
-  dprintf(" %08x", buffer[i]);
- dprintf("\n");
+    /*
+     *  Have the flash state machine come back to us until we're done.
+     */
+    return 1;
 }
-#endif // 0
 
-        /*
-         *  Write the entire record to flash in one operation.  This may
-         *  straddle a page in some cases.
-         */
-        flashWrite(ptr, &buffer[0], cnt);
 
-        /*
-         *  Have the flash state machine come back to us until we're done.
-         */
-        return 1;
+/*
+ *  Erase the page following the current page ahead of time, if the
+ *  current page is getting full and the tracer is not busy.  Returns true
+ *  if an erase was started.  (The oldest page in the store is lost a little
+ *  early, but it would be erased when the writes get there anyway.)
+ */
+static bool
+wrPreErase(void)
+{
+    u32 * ptr = currentWrite;
+    u32 * page = (u32 *)((unsigned)ptr & ~(OQ_FLASH_PAGE - 1));
+    u32 * next = page + (OQ_FLASH_PAGE / sizeof *page);
 
-    case ERASE3:
-    case WRITE3:
-    done:
-    default:
-        /*
-         *  Either we tried three times to write/erase and failed, or we
-         *  finished successfully.  Wrap it up.
-         */
-        bufferIndex = ARRAY_SIZE(buffer);       //  Mark as empty
-        state = IDLE;                           //  Back to the start
-        return 0;
-    }
+    /*
+     *  A pointer at the very start of a page means the last page was
+     *  filled exactly, and this page is the next.
+     */
+    if (ptr == page)
+        next = page;
+    else if (ptr - page < PRE_ERASE_WORDS)
+        return false;
+
+    if (next >= (u32 *)OQ_FLASH_STORE_END)
+        next = (u32 *)OQ_FLASH_STORE;
+
+    if (*next == 0xffffffff || !TraceIsIdle())
+        return false;
+
+    flashErase(next);
+    pageIndex[pageNumber(next)].seq = 0;
+    pageIndex[pageNumber(next)].types = 0;
+    storeFlashErases++;
+    storePreErases++;
+    return true;
 }
 
 /**********************************************************************/
@@ -852,8 +965,58 @@ rd(unsigned bits)
 }
 
 
+/*
+ *  Read `cnt' bytes into `dst';  the reverse of `wrBytes()'.
+ */
 static void
-importRecord(unsigned ops)
+rdBytes(u8 * dst, unsigned cnt)
+{
+    unsigned idx = bufferIndex;
+    unsigned ptr = bufferPointer;
+    unsigned lim = bufferLimit;
+    u32 w = buffer[idx];
+
+    while (cnt-- > 0)
+    {
+        if (ptr >= 8)
+        {
+            ptr -= 8;
+            *dst++ = w >> ptr;
+        }
+        else
+        {
+            /*
+             *  Low bits are at the end of this word, the high bits are at
+             *  the start of the next.
+             */
+            u32 x = w & ((1 << ptr) - 1);
+            unsigned lo = ptr;
+
+            idx++;
+            if (idx >= lim)
+            {
+                idx = 0;
+                lim = 0;
+            }
+            w = buffer[idx];
+            ptr += 31 - 8;
+
+            *dst++ = x | (w >> ptr) << lo;
+        }
+    }
+
+    bufferIndex = idx;
+    bufferPointer = ptr;
+    bufferLimit = lim;
+}
+
+
+/*
+ *  Decode the record in the read buffer into `r'.  Returns the record
+ *  type;  `bufferLimit' is left zero if the stored record was too small.
+ */
+static unsigned
+decodeRecord(StoreRecord_t * r)
 {
     /*
      *  Extract the record type from the first word, then set up for
@@ -876,45 +1039,67 @@ importRecord(unsigned ops)
         break;
 
     case RT_SEQUENCE:           //  Storage manager sequence record
-        staging.sequence = rd(RT_SHIFT);
+        r->sequence = rd(RT_SHIFT);
         break;
 
     case RT_CONFIG:             //  OttoQ configuration structure
         for (int i = 0; i < CONFIG_WORDS; i++)
-            staging.config.confArray[i] = rd(32);
+            r->config.confArray[i] = rd(32);
         break;
 
     case RT_SU_HDR:             //  Software update header
         {
-            SuInfo_t * si = &staging.sui;
+            SuInfo_t * si = &r->sui;
+            si->sequence = rd(20);                     //  Sequence #
+            si->version = rd(32);                      //  Version
+            si->start = rd(14) << OQ_SU_CHUNK_SHIFT;   //  Start address
+            si->end = rd(14) << OQ_SU_CHUNK_SHIFT;     //  End address
+            si->delta = 0;
+        }
+        break;
+
+    case RT_SU_DELTA:           //  Software update header, delta image
+        {
+            SuInfo_t * si = &r->sui;
             si->sequence = rd(20);                     //  Sequence #
             si->version = rd(32);                      //  Version
             si->start = rd(14) << OQ_SU_CHUNK_SHIFT;   //  Start address
             si->end = rd(14) << OQ_SU_CHUNK_SHIFT;     //  End address
+            si->delta = rd(18);                        //  Stream length
+            si->base = rd(32);                         //  Base version
+            si->crc = rd(32);                          //  New image CRC
         }
         break;
 
     case RT_SU_DATA:            //  Software update chunk
         {
-            SuData_t * sd = &staging.sud;
+            SuData_t * sd = &r->sud;
             sd->sequence = rd(20);
             sd->address = rd(13) << OQ_SU_CHUNK_SHIFT;
-            for (int i = 0; i < OQ_SU_CHUNK; i++)
-                sd->data[i] = rd(8);
+            rdBytes(&sd->data[0], OQ_SU_CHUNK);
         }
         break;
 
     case RT_SU_EXEC:            //  Software update "execute"
         {
-            SuExec_t * si = &staging.sux;
+            SuExec_t * si = &r->sux;
             si->sequence = rd(20);                     //  Sequence #
             si->version = rd(32);                      //  Version
         }
         break;
     }
 
+    return ty;
+}
+
+
+static void
+importRecord(unsigned ops)
+{
+    unsigned ty = decodeRecord(&staging.rec);
+
 #if OQ_DEBUG
-    printStoreRecord(ty);
+    printStoreRecord(ty, &staging.rec);
 #endif // OQ_DEBUG
 
     /*
@@ -939,29 +1124,30 @@ importRecord(unsigned ops)
          */
         if (ops & OF_CONFIG)
         {
-            if (staging.config.confCRC == ConfigCRC(&staging.config))
+            if (staging.rec.config.confCRC == ConfigCRC(&staging.rec.config))
             {
                 /*
                  *  The stored CRC was correct.  Pass this up.
                  */
-                StoreCallbackConfiguration(&staging.config);
+                StoreCallbackConfiguration(&staging.rec.config);
             }
         }
         break;
 
     case RT_SU_HDR:             //  Software update header
+    case RT_SU_DELTA:           //  Software update header, delta image
         if (ops & OF_SW_UPDATE)
-            ; // StoreCallbackSoftwareUpdateInfo(&staging.sui);
+            ; // StoreCallbackSoftwareUpdateInfo(&staging.rec.sui);
         break;
 
     case RT_SU_DATA:            //  Software update chunk
         if (ops & OF_SW_CHUNK)
-            ; // StoreCallbackSoftwareUpdateChunk(&staging.sud);
+            ; // StoreCallbackSoftwareUpdateChunk(&staging.rec.sud);
         break;
 
     case RT_SU_EXEC:            //  Software update "execute"
         if (ops & OF_SW_EXEC)
-            ; // StoreCallbackSoftwareUpdateExecute(&staging.sux);
+            ; // StoreCallbackSoftwareUpdateExecute(&staging.rec.sux);
         break;
     }
 }
@@ -1015,22 +1201,30 @@ importReset(unsigned ops)
 /**********************************************************************/
 
 /*
- *  Read the entire flash storage, parse records, and deliver them to
- *  interested parties.  As a side effect, record the flash bounds, and
- *  any other things of interest.
+ *  Flash replay state.  The oldest and newest used pages found by the
+ *  scan, and the next page to be replayed.  The replay can be done all at
+ *  once (`readFlash()'), or a page at a time from the super loop.
+ */
+static u32 *    replayOldp;         //  Oldest used page (0 if none)
+static u32 *    replayNewp;         //  Newest used page (0 if none)
+static unsigned replayNewq;         //  Sequence number of the newest page
+static u32 *    replayPage;         //  Next page to replay
+
+
+/*
+ *  Scan the entire flash storage region to find the oldest and newest
+ *  used pages, and get ready to replay from the oldest.
  */
 static void
-readFlash(unsigned ops)
+readFlashScan(unsigned ops)
 {
-    /*
-     *  Scan the entire flash storage region to find the oldest and newest
-     *  used pages.
-     */
     u32 * oldp = 0;
     u32 oldq = 0xffffffff;
     u32 * newp = 0;
     u32 newq = 0;
 
+    memset(&pageIndex[0], 0, sizeof pageIndex);
+
     u32 * page;
     for (page = (u32 *)OQ_FLASH_STORE;
          page < (u32 *)OQ_FLASH_STORE_END;
@@ -1057,6 +1251,7 @@ readFlash(unsigned ops)
                  *  Got the sequence record.  Grab it's info.
                  */
                 unsigned seq = rec & RD_MASK;
+                pageIndex[pageNumber(page)].seq = seq;
                 if (seq < oldq)
                 {
                     oldq = seq;
@@ -1082,110 +1277,145 @@ readFlash(unsigned ops)
     storeDebugNewq = newq;
 #endif // OQ_DEBUG
 
+    replayOldp = oldp;
+    replayNewp = newp;
+    replayNewq = newq;
+    replayPage = oldp;
+
     /*
-     *  If we found at least one used page, process ...
+     *  Reset the up stream handlers.
      */
-    if (newp)
-    {
-        /*
-         *  Reset the up stream handlers.
-         */
-        importReset(ops);
-
-        /*
-         *  Scan records in all pages from oldest to newest, applying
-         *  their data.
-         */
-        page = oldp;
-        for (;;)
-        {
-            if (page >= (u32 *)OQ_FLASH_STORE_END)
-                page = (u32 *)OQ_FLASH_STORE;
+    importReset(ops);
+}
 
-            /*
-             *  Scan records in this page.
-             */
-            u32 * erp = page + (OQ_FLASH_PAGE / sizeof *page);
-            u32 * rp = page;
-            while (rp < erp)
-            {
-                u32 rec = *rp++;
-                importWord(ops, rec);   //  Add to accumulated data
 
-                if (rec == 0xffffffff)
-                    break;              //  End of records in page
-            }
+/*
+ *  Replay the records in the next page, delivering them to interested
+ *  parties.  Returns true once the newest page has been replayed (or if
+ *  there was nothing to replay).
+ */
+static bool
+readFlashPage(unsigned ops)
+{
+    u32 * page = replayPage;
+    if (!page)
+        return true;
 
-            /*
-             *  If we just finished processing the newest page, we are done.
-             *  We need to inject a single "erased" word into the stream to
-             *  help the handlers finish what they are doing.
-             */
-            if (page == newp)
-            {
-                importWord(ops, 0xffffffff);
-                break;
-            }
+    if (page >= (u32 *)OQ_FLASH_STORE_END)
+        page = (u32 *)OQ_FLASH_STORE;
 
-            /*
-             *  Next...
-             */
-            page += (OQ_FLASH_PAGE / sizeof *page);
-        }
+    /*
+     *  Scan records in this page, noting the record types in the index.
+     */
+    u32 * erp = page + (OQ_FLASH_PAGE / sizeof *page);
+    u32 * rp = page;
+    u32 types = 0;
+    while (rp < erp)
+    {
+        u32 rec = *rp++;
+        importWord(ops, rec);   //  Add to accumulated data
 
-        /*
-         *  We have read everything we are interested in.  Now set up
-         *  to continue to write from where we left off.
-         */
-        u32 * xp = newp + (OQ_FLASH_PAGE / sizeof *page);
-        while (xp > newp)
-        {
-            u32 * xp1 = xp - 1;
-            if (*xp1 != 0xffffffff)
-                break;
-            xp = xp1;
-        }
+        if (rec == 0xffffffff)
+            break;              //  End of records in page
+        if (rec & 0x80000000)
+            types |= 1 << ((rec >> RT_SHIFT) & RT_MASK);
+    }
+    pageIndex[pageNumber(page)].types = types;
 
-        /*
-         *  We have what we want -- the current page is the page with the
-         *  highest sequence number, and the current write pointer is the
-         *  next word to be written to storage.  The current pointer
-         *  should never be less than the 2nd word in a page, but may be
-         *  the word beyond the last word of the page.  Beyond the last is
-         *  ok, in which case we will create a new page on the next write.
-         */
-        newCurrentWrite = xp;
-        newSequence = newq;
+    /*
+     *  If we just finished processing the newest page, we are done.
+     *  We need to inject a single "erased" word into the stream to
+     *  help the handlers finish what they are doing.
+     */
+    if (page == replayNewp)
+    {
+        importWord(ops, 0xffffffff);
+        replayPage = 0;
+        return true;
     }
-    else
+
+    /*
+     *  Next...
+     */
+    replayPage = page + (OQ_FLASH_PAGE / sizeof *page);
+    return false;
+}
+
+
+/*
+ *  Once everything has been replayed, set up to continue to write from
+ *  where we left off.
+ */
+static void
+readFlashFinish(void)
+{
+    u32 * newp = replayNewp;
+
+    /*
+     *  If we found no used page, set up for an empty flash.
+     */
+    if (!newp)
     {
-        /*
-         *  We found nothing -- set up for an empty flash.
-         */
         newCurrentWrite = 0;
         newSequence = 0;
+        return;
+    }
+
+    u32 * xp = newp + (OQ_FLASH_PAGE / sizeof *newp);
+    while (xp > newp)
+    {
+        u32 * xp1 = xp - 1;
+        if (*xp1 != 0xffffffff)
+            break;
+        xp = xp1;
     }
+
+    /*
+     *  We have what we want -- the current page is the page with the
+     *  highest sequence number, and the current write pointer is the
+     *  next word to be written to storage.  The current pointer
+     *  should never be less than the 2nd word in a page, but may be
+     *  the word beyond the last word of the page.  Beyond the last is
+     *  ok, in which case we will create a new page on the next write.
+     */
+    newCurrentWrite = xp;
+    newSequence = replayNewq;
+}
+
+
+/*
+ *  Read the entire flash storage, parse records, and deliver them to
+ *  interested parties.  As a side effect, record the flash bounds, and
+ *  any other things of interest.
+ */
+static void
+readFlash(unsigned ops)
+{
+    readFlashScan(ops);
+    while (!readFlashPage(ops))
+        ;
+    readFlashFinish();
 }
 
 /**********************************************************************/
 
 static enum
 {
-    INIT0 = 0,          //  System start up -- sift through circular flash
+    INIT0 = 0,          //  System start up -- find the circular flash extent
+    INIT1,              //  Replaying the circular flash, a page per pass
     IDLE,               //  Waiting for an operation
     WRITING,            //  Flash write started, waiting for result
+    ERASING,            //  Erasing the next page ahead of time
 
     CONFIG0,            //  Saving configuration
     CONFIG1,
     CONFIG2,
     CONFIG3,
-
-    SU_HDR_0,           //  Storing a software update header
-    SU_DATA_0,          //  Storing a software update data chunk
-    SU_EXEC_0,          //  Storing a software update execute record
 }
     state = INIT0, savedState;
 
+static u32          replayStart;    //  Tachyon time the replay started
+
 
 int
 StoreSuperLoop(void)
@@ -1198,13 +1428,26 @@ StoreSuperLoop(void)
     {
     case INIT0:
         /*
-         *  Read the flash storage, extracting the configuration, if it exists.
+         *  Find the extent of the flash storage.  The replay itself is
+         *  spread over the following passes of the super loop, a page at
+         *  a time, so that the tracer can run while it happens.
+         */
+        replayStart = TachyonGet();
+        readFlashScan(OF_CONFIG | OF_SW_UPDATE | OF_SW_CHUNK | OF_SW_EXEC);
+        state = INIT1;
+        return 1;
+
+    case INIT1:
+        /*
+         *  Replay the next page, extracting the configuration, if it exists.
          */
-        readFlash(OF_CONFIG | OF_SW_UPDATE | OF_SW_CHUNK | OF_SW_EXEC);
+        if (!readFlashPage(OF_CONFIG | OF_SW_UPDATE | OF_SW_CHUNK | OF_SW_EXEC))
+            return 1;
 
         /*
          *  Get ready to write to flash.
          */
+        readFlashFinish();
         if (newCurrentWrite == 0)
         {
             /*
@@ -1222,54 +1465,58 @@ StoreSuperLoop(void)
         currentWrite = newCurrentWrite;
         sequence = newSequence;
         state = IDLE;
-        return 0;
 
-    case IDLE:
-        /*
-         *  While we are idling, and there is nothing to do, return that
-         *  we did no work.
-         */
-        if (!opFlag)
-            return 0;
+        TachyonLog1(600, TachyonGet() - replayStart);   // tachy: replay done
+        dprintf("Store replay done (%d us)\n",
+                                TACHY2US(TachyonGet() - replayStart));
+        return 1;
 
-        if ((opFlag & OF_CONFIG) && TempusTimeout(&configSaveTimer))
+    case IDLE:
+        if ((opFlag & OF_CONFIG) && configSaveDue)
         {
             opFlag &= ~OF_CONFIG;
             state = CONFIG0;
             goto CONFIG0;
         }
-        else if (opFlag & OF_SW_UPDATE)
-        {
-            opFlag &= ~OF_SW_UPDATE;
-            state = SU_HDR_0;
-            goto SU_HDR_0;
-        }
-        else if (opFlag & OF_SW_CHUNK)
-        {
-            opFlag &= ~OF_SW_CHUNK;
-            state = SU_DATA_0;
-            goto SU_DATA_0;
-        }
-        else if (opFlag & OF_SW_EXEC)
+
+        /*
+         *  Keep the next page erased, so that writes never have to wait
+         *  for an erase.
+         */
+        if (wrPreErase())
         {
-            opFlag &= ~OF_SW_EXEC;
-            state = SU_EXEC_0;
-            goto SU_EXEC_0;
+            state = ERASING;
+            return 1;
         }
-#if 0
-        else
+
+        /*
+         *  Write out any queued records.
+         */
+        if (queueTail > 0)
         {
-            /*
-             *  Bogus flags.  Just clear everything.  (Should never happen.)
-             */
-            opFlag = 0;
-            return 0;
+            savedState = IDLE;
+            goto doWrite;
         }
-#endif // 0
+
+        /*
+         *  While we are idling, and there is nothing to do, return that
+         *  we did no work.
+         */
         return 0;
 
     case CONFIG0:
     CONFIG0:
+        /*
+         *  The configuration may need to go to the circular flash (see
+         *  below).  If there is no room in the write queue for it, empty
+         *  the queue first.
+         */
+        if (queueTail + CONFIG_WORDS + 3 >= ARRAY_SIZE(queue))
+        {
+            savedState = CONFIG0;
+            goto doWrite;
+        }
+
         /*
          *  Update the sequence number and copy the configuration to the
          *  local staging area.
@@ -1313,7 +1560,7 @@ StoreSuperLoop(void)
          *  that page, save a copy of the configuration in the circular
          *  flash area, just in case.
          */
-        wrNew(RT_CONFIG);
+        wrNew(RT_CONFIG, CONFIG_WORDS * 32);
         for (int i = 0; i < CONFIG_WORDS; i++)
             wr(32, staging.config.confArray[i]);
 
@@ -1365,74 +1612,18 @@ StoreSuperLoop(void)
         state = IDLE;
         return 1;
 
-    case SU_HDR_0:
-    SU_HDR_0:
-        {
-            SuInfo_t * si = &staging.sui;
-
-            /*
-             *  Pack the data into storage record format.
-             */
-            wrNew(RT_SU_HDR);
-            wr(20, si->sequence);                       //  Sequence #
-            wr(32, si->version);                        //  Version
-            wr(14, si->start >> OQ_SU_CHUNK_SHIFT);     //  Start address
-            wr(14, si->end >> OQ_SU_CHUNK_SHIFT);       //  End address
-
-            /*
-             *  Write it.
-             */
-            savedState = IDLE;
-            goto doWrite;
-        }
-
-    case SU_DATA_0:
-    SU_DATA_0:
-        {
-            SuData_t * sd = &staging.sud;
-
-            /*
-             *  Pack the data into storage record format.
-             */
-            wrNew(RT_SU_DATA);
-            wr(20, sd->sequence);
-            wr(13, sd->address >> OQ_SU_CHUNK_SHIFT);
-            for (int i = 0; i < OQ_SU_CHUNK; i++)
-            {
-                wr(8, sd->data[i]);
-            }
-
-            /*
-             *  Write it.
-             */
-            savedState = IDLE;
-            goto doWrite;
-        }
-
-    case SU_EXEC_0:
-    SU_EXEC_0:
-        {
-            SuExec_t * sx = &staging.sux;
-
-            /*
-             *  Pack the data into storage record format.
-             */
-            wrNew(RT_SU_EXEC);
-            wr(20, sx->sequence);                       //  Sequence #
-            wr(32, sx->version);                        //  Version
+    case ERASING:
+        if (!flashComplete)
+            return 0;
 
-            /*
-             *  Write it.
-             */
-            savedState = IDLE;
-            goto doWrite;
-        }
+        state = IDLE;
+        goto again;
 
     doWrite:
         if (wrGo() == 0)
         {
             /*
-             *  The write completed immediately, or failed.  We are done.
+             *  There was nothing left to write.  We are done.
              */
             state = savedState;
             goto again;
@@ -1445,6 +1636,17 @@ StoreSuperLoop(void)
         if (!flashComplete)
             return 0;
 
+        /*
+         *  Records coming in steadily keep us writing, so look to erase
+         *  the next page ahead between the writes too.
+         */
+        wrDone();
+        if (savedState == IDLE && wrPreErase())
+        {
+            state = ERASING;
+            return 1;
+        }
+
         if (wrGo() == 0)
         {
             state = savedState;
@@ -1466,10 +1668,18 @@ StoreRead(unsigned ops)
 }
 
 
+bool
+StoreReplayIsDone(void)
+{
+    return state != INIT0 && state != INIT1;
+}
+
+
 void
 StoreConfiguration(bool force)
 {
-    TempusSet(&configSaveTimer, Future(force ? 0 : 5));
+    configSaveDue = 0;
+    TempusCalloutVar(&configSaveTimer, Future(force ? 0 : 5), &configSaveDue);
     opFlag |= OF_CONFIG;
     configSaving = true;
 }
@@ -1482,27 +1692,236 @@ StoreConfigurationIsDone(void)
 }
 
 
-void
-StoreSoftwareUpdateInfo(SuInfo_t * sui)
+bool
+StoreSoftwareUpdateInfo(SuInfo_t * si)
 {
-    staging.sui = *sui;
-    opFlag |= OF_SW_UPDATE;
+    /*
+     *  Pack the data into storage record format.
+     */
+    unsigned ty = si->delta ? RT_SU_DELTA : RT_SU_HDR;
+    if (!wrNew(ty, 20 + 32 + 14 + 14 + (si->delta ? 18 + 32 + 32 : 0)))
+        return false;
+    wr(20, si->sequence);                       //  Sequence #
+    wr(32, si->version);                        //  Version
+    wr(14, si->start >> OQ_SU_CHUNK_SHIFT);     //  Start address
+    wr(14, si->end >> OQ_SU_CHUNK_SHIFT);       //  End address
+    if (si->delta)
+    {
+        wr(18, si->delta);                      //  Stream length
+        wr(32, si->base);                       //  Base version
+        wr(32, si->crc);                        //  New image CRC
+    }
+    return true;
 }
 
 
-void
-StoreSoftwareUpdateChunk(SuData_t * sud)
+bool
+StoreSoftwareUpdateChunk(SuData_t * sd)
+{
+    /*
+     *  Pack the data into storage record format.
+     */
+    if (!wrNew(RT_SU_DATA, 20 + 13 + OQ_SU_CHUNK * 8))
+        return false;
+    wr(20, sd->sequence);
+    wr(13, sd->address >> OQ_SU_CHUNK_SHIFT);
+    wrBytes(&sd->data[0], OQ_SU_CHUNK);
+    return true;
+}
+
+
+bool
+StoreSoftwareUpdateExecute(SuExec_t * sx)
+{
+    /*
+     *  Pack the data into storage record format.
+     */
+    if (!wrNew(RT_SU_EXEC, 20 + 32))
+        return false;
+    wr(20, sx->sequence);                       //  Sequence #
+    wr(32, sx->version);                        //  Version
+    return true;
+}
+
+
+unsigned
+StoreCommitted(void)
+{
+    return storeRecords;
+}
+
+
+unsigned
+StoreSubmitted(void)
+{
+    return storeSubmitted;
+}
+
+/**********************************************************************/
+/*
+ *  Record queries.
+ */
+
+/*
+ *  Return the index of the page with the sequence number `seq', or -1 if
+ *  there is no such page.
+ */
+static int
+pageFind(unsigned seq)
 {
-    staging.sud = *sud;
-    opFlag |= OF_SW_CHUNK;
+    for (int i = 0; i < STORE_PAGES; i++)
+        if (pageIndex[i].seq == seq)
+            return i;
+    return -1;
 }
 
 
+/*
+ *  Set up to iterate over the records of `type' in pages with sequence
+ *  numbers from `seqLo' to `seqHi' inclusive.
+ */
 void
-StoreSoftwareUpdateExecute(SuExec_t * sux)
+StoreIterInit(StoreIter_t * it, unsigned type, unsigned seqLo, unsigned seqHi)
+{
+    /*
+     *  Limit the range to the pages that are actually in flash.
+     */
+    unsigned oldest = 0xffffffff;
+    for (int i = 0; i < STORE_PAGES; i++)
+        if (pageIndex[i].seq != 0 && pageIndex[i].seq < oldest)
+            oldest = pageIndex[i].seq;
+
+    if (seqLo < oldest)
+        seqLo = oldest;
+    if (seqHi > sequence)
+        seqHi = sequence;
+
+    it->type = type & RT_MASK;
+    it->seq = seqLo;
+    it->seqHi = seqHi;
+    it->ptr = 0;
+    it->end = 0;
+    it->record = 0;
+}
+
+
+/*
+ *  Find the next record, oldest first.  Returns false when there are no
+ *  more.
+ */
+bool
+StoreIterNext(StoreIter_t * it)
+{
+    if (!StoreReplayIsDone())
+        return false;
+
+    for (;;)
+    {
+        /*
+         *  Look through the rest of the current page.
+         */
+        while (it->ptr < it->end)
+        {
+            u32 * rp = it->ptr++;
+            u32 rec = *rp;
+            if (rec == 0xffffffff)
+                break;              //  End of records in page
+
+            if ((rec & 0x80000000) &&
+                ((rec >> RT_SHIFT) & RT_MASK) == it->type)
+            {
+                it->record = rp;
+                return true;
+            }
+        }
+
+        /*
+         *  Move on to the next page that holds the type.
+         */
+        int pn;
+        do
+        {
+            if (it->seq > it->seqHi)
+                return false;
+            pn = pageFind(it->seq++);
+        }
+        while (pn < 0 || !(pageIndex[pn].types & (1 << it->type)));
+
+        it->ptr = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+        it->end = it->ptr + (OQ_FLASH_PAGE / sizeof (u32));
+    }
+}
+
+
+/*
+ *  Find the most recent record of `type'.  Returns false if there is none.
+ */
+bool
+StoreIterNewest(StoreIter_t * it, unsigned type)
+{
+    StoreIterInit(it, type, 0, 0xffffffff);
+    if (!StoreReplayIsDone())
+        return false;
+
+    for (unsigned seq = it->seqHi; seq >= it->seq && seq > 0; seq--)
+    {
+        int pn = pageFind(seq);
+        if (pn < 0 || !(pageIndex[pn].types & (1 << it->type)))
+            continue;
+
+        /*
+         *  The last one in the page is the newest.
+         */
+        u32 * rp = (u32 *)(OQ_FLASH_STORE + pn * OQ_FLASH_PAGE);
+        u32 * erp = rp + (OQ_FLASH_PAGE / sizeof *rp);
+        for (; rp < erp && *rp != 0xffffffff; rp++)
+            if ((*rp & 0x80000000) &&
+                ((*rp >> RT_SHIFT) & RT_MASK) == it->type)
+                it->record = rp;
+
+        if (it->record)
+        {
+            it->seq = it->seqHi + 1;        //  Nothing more to find
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ *  Decode the record found by the iterator into `rec'.  Returns false if
+ *  the record is damaged.
+ */
+bool
+StoreIterRead(StoreIter_t * it, StoreRecord_t * rec)
 {
-    staging.sux = *sux;
-    opFlag |= OF_SW_EXEC;
+    u32 * rp = it->record;
+
+    /*
+     *  The read buffer is shared with the start up replay.
+     */
+    if (!rp || !StoreReplayIsDone())
+        return false;
+
+    /*
+     *  Collect the record's words.  (A record may run into the next page,
+     *  but never past the end of the region.)
+     */
+    unsigned n = 0;
+    buffer[n] = *rp++;
+    while (n < ARRAY_SIZE(buffer) - 1 &&
+           rp < (u32 *)OQ_FLASH_STORE_END &&
+           !(*rp & 0x80000000))
+        buffer[++n] = *rp++;
+    bufferIndex = n;
+
+    decodeRecord(rec);
+    bool ok = (bufferLimit != 0);
+
+    bufferIndex = ARRAY_SIZE(buffer);       //  Mark as empty
+    return ok;
 }
 
 /**********************************************************************/
@@ -1510,7 +1929,7 @@ StoreSoftwareUpdateExecute(SuExec_t * sux)
 #if OQ_DEBUG
 
 static void
-printStoreRecord(int ty)
+printStoreRecord(int ty, StoreRecord_t * r)
 {
     if (!storeDebugFlag)
         return;
@@ -1523,30 +1942,41 @@ printStoreRecord(int ty)
         break;
 
     case RT_SEQUENCE:           //  Storage manager sequence record
-        dbprintf("   seq:  %d\n", staging.sequence);
+        dbprintf("   seq:  %d\n", r->sequence);
         break;
 
     case RT_CONFIG:             //  OttoQ configuration structure
-        dbprintf("config:  CRC %x (%x)\n", staging.config.confCRC,
-                                           ConfigCRC(&staging.config));
+        dbprintf("config:  CRC %x (%x)\n", r->config.confCRC,
+                                           ConfigCRC(&r->config));
         break;
 
     case RT_SU_HDR:             //  Software update header
         dbprintf("su-hdr:  seq=%x, ver=%x, start=%x, end=%x\n",
-                                                    staging.sui.sequence,
-                                                    staging.sui.version,
-                                                    staging.sui.start,
-                                                    staging.sui.end);
+                                                    r->sui.sequence,
+                                                    r->sui.version,
+                                                    r->sui.start,
+                                                    r->sui.end);
+        break;
+
+    case RT_SU_DELTA:           //  Software update header, delta image
+        dbprintf("su-dlt:  seq=%x, ver=%x, start=%x, end=%x, "
+                 "len=%x, base=%x, crc=%x\n", r->sui.sequence,
+                                              r->sui.version,
+                                              r->sui.start,
+                                              r->sui.end,
+                                              r->sui.delta,
+                                              r->sui.base,
+                                              r->sui.crc);
         break;
 
     case RT_SU_DATA:            //  Software update chunk
-        dbprintf("su-dat:  seq=%x, addr=%x\n", staging.sud.sequence,
-                                               staging.sud.address);
+        dbprintf("su-dat:  seq=%x, addr=%x\n", r->sud.sequence,
+                                               r->sud.address);
         break;
 
     case RT_SU_EXEC:            //  Software update "execute"
-        dbprintf("su-exc:  seq=%x, version=%x\n", staging.sux.sequence,
-                                                  staging.sux.version);
+        dbprintf("su-exc:  seq=%x, version=%x\n", r->sux.sequence,
+                                                  r->sux.version);
         break;
     }
 }
@@ -1567,9 +1997,60 @@ storeCommand(int argc, char ** argv)
             dprintf("    Newest page: %x (seq = %d)\n",
                                     storeDebugNewp, storeDebugNewq);
             dprintf("    Current write pointer: %x\n", currentWrite);
+            dprintf("    Queued: %d words\n", queueTail);
+            dprintf("    Flash writes: %d (%d records), erases: %d\n",
+                            storeFlashWrites, storeRecords, storeFlashErases);
+            dprintf("    Pre-erases: %d, erase stalls: %d\n",
+                            storePreErases, storeEraseStalls);
+            if (!StoreReplayIsDone())
+                dprintf("    Replay in progress, at page %x\n", replayPage);
+        }
+        else if (StrcmpCmd("Find", arg) <= 1 ||
+                 StrcmpCmd("NEWest", arg) <= 1)
+        {
+            if (argc < 3)
+            {
+                dprintf("Record type needed\n");
+                return;
+            }
+
+            StoreIter_t it;
+            StoreRecord_t rec;
+            unsigned ty = GetHex(argv[2]);
+
+            storeDebugFlag = true;
+            if (StrcmpCmd("Find", arg) <= 1)
+            {
+                unsigned lo = (argc >= 4) ? GetDecimal(argv[3]) : 0;
+                unsigned hi = (argc >= 5) ? GetDecimal(argv[4]) : 0xffffffff;
+
+                StoreIterInit(&it, ty, lo, hi);
+                while (StoreIterNext(&it))
+                {
+                    dprintf("%x: ", it.record);
+                    StoreIterRead(&it, &rec);
+                    printStoreRecord(ty, &rec);
+                }
+            }
+            else if (StoreIterNewest(&it, ty))
+            {
+                dprintf("%x: ", it.record);
+                StoreIterRead(&it, &rec);
+                printStoreRecord(ty, &rec);
+            }
+            storeDebugFlag = false;
         }
         else if (StrcmpCmd("List", arg) <= 1)
         {
+            /*
+             *  The list shares the import buffer with the start up replay.
+             */
+            if (!StoreReplayIsDone())
+            {
+                dprintf("Storage replay still in progress\n");
+                return;
+            }
+
             storeDebugFlag = true;
             readFlash(0);
             storeDebugFlag = false;
@@ -1583,6 +2064,10 @@ COMMAND(672)
     "STORE [command]", "Examine and manipulate flash storage",
     "store info  -- Print information about the storage\n"
     "store list  -- Print a diatribe of the entire circular flash store\n"
+    "store find <type> [first-seq [last-seq]]\n"
+    "            -- Print records of a type (hex), from pages in the range\n"
+    "store newest <type>\n"
+    "            -- Print the most recent record of a type\n"
 };
 
 #endif // OQ_DEBUG
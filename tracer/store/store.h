@@ -70,6 +70,13 @@ extern void     StoreFlashed(int ok);
  */
 extern void     StoreRead(unsigned ops);
 
+/*
+ *  Returns true once the start up replay of the flash storage has
+ *  completed.  Until then, records may still be delivered to the
+ *  callbacks, and nothing is written to the storage.
+ */
+extern bool     StoreReplayIsDone(void);
+
 /******************************/
 
 /*
@@ -87,6 +94,9 @@ typedef struct
     u32         version;            //  Software update version
     unsigned    start;              //  Software update start address
     unsigned    end;                //  Software update end address (+1)
+    unsigned    delta;              //  Delta stream length (0 if full image)
+    u32         base;               //  Version the delta applies to
+    u32         crc;                //  CRC of the new image (delta only)
 }
     SuInfo_t;
 
@@ -110,11 +120,97 @@ typedef struct
 
 /*
  *  Schedule the storage of a software update header, or update chunk.
- *  The data is copied from the caller supplied data to an internal buffer.
+ *  The data is packed from the caller supplied data into the write queue.
+ *  A header with `delta' set is stored as an RT_SU_DELTA record;  its
+ *  chunks then hold the delta stream (at addresses 0 to `delta') rather
+ *  than the image itself.  See tools/sudelta.c for the stream format.
+ *  Returns false if the queue is full;  try again once some of it has been
+ *  written out.
+ */
+extern bool     StoreSoftwareUpdateInfo(SuInfo_t * info);
+extern bool     StoreSoftwareUpdateChunk(SuData_t * data);
+extern bool     StoreSoftwareUpdateExecute(SuExec_t * exec);
+
+/*
+ *  Returns a count of the records written to flash since start up, and of
+ *  the records added to the write queue.  Records are written in the order
+ *  they were added, so a record is in flash once StoreCommitted() reaches
+ *  the value StoreSubmitted() had just after it was added.
+ */
+extern unsigned StoreCommitted(void);
+extern unsigned StoreSubmitted(void);
+
+/*
+ *  Cancel, once the store has been replayed at start up, a software update
+ *  the boot loader was told to run but didn't (see store/su.c).  Run from
+ *  the super loop;  returns true if there was work done.
+ */
+extern int      SuSuperLoop(void);
+
+/*
+ *  Record types.
+ */
+enum
+{
+    RT_ZERO = 0,            //  Zero record -- no operation
+    RT_CONFIG = 0x01,       //  OttoQ configuration structure
+    // RT_SLOG = 0x08,         //  Sensor log record
+    RT_SU_HDR = 0x0c,       //  Software update header
+    RT_SU_DATA = 0x0d,      //  Software update chunk
+    RT_SU_EXEC = 0x0e,      //  Software update "execute"
+    RT_SU_DELTA = 0x0f,     //  Software update header, delta image
+    RT_SEQUENCE = 0x1f,     //  Storage manager sequence record
+};
+
+
+/*
+ *  A decoded record, of any type.
+ */
+typedef union
+{
+    unsigned    sequence;           //  RT_SEQUENCE
+    Config_t    config;             //  RT_CONFIG
+    SuInfo_t    sui;                //  RT_SU_HDR, RT_SU_DELTA
+    SuData_t    sud;                //  RT_SU_DATA
+    SuExec_t    sux;                //  RT_SU_EXEC
+}
+    StoreRecord_t;
+
+/******************************/
+
+/*
+ *  Random access to the records in flash.  An index of the record types
+ *  found in each page is kept in RAM, so only pages holding the wanted
+ *  type are read.  Records carry no time stamp;  the sequence number of
+ *  the page a record was written to serves instead, with higher numbers
+ *  being more recent.  For example:
+ *
+ *      StoreIter_t it;
+ *      StoreRecord_t rec;
+ *
+ *      StoreIterInit(&it, RT_SU_DATA, 0, ~0);
+ *      while (StoreIterNext(&it))
+ *          StoreIterRead(&it, &rec);
+ *
+ *  No records are found until the start up replay is done.  Records still
+ *  in the write queue are not found.
  */
-extern void     StoreSoftwareUpdateInfo(SuInfo_t * info);
-extern void     StoreSoftwareUpdateChunk(SuData_t * data);
-extern void     StoreSoftwareUpdateExecute(SuExec_t * exec);
+typedef struct
+{
+    unsigned    type;               //  Record type wanted
+    unsigned    seq;                //  Sequence number of the current page
+    unsigned    seqHi;              //  Last sequence number wanted
+    u32 *       ptr;                //  Next word to look at
+    u32 *       end;                //  End of the current page
+    u32 *       record;             //  The record found (first word)
+}
+    StoreIter_t;
+
+extern void     StoreIterInit(StoreIter_t * it, unsigned type,
+                              unsigned seqLo, unsigned seqHi);
+extern bool     StoreIterNext(StoreIter_t * it);
+extern bool     StoreIterNewest(StoreIter_t * it, unsigned type);
+extern bool     StoreIterRead(StoreIter_t * it, StoreRecord_t * rec);
 
 /**********************************************************************/
 
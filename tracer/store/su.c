@@ -0,0 +1,372 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Software update over the debug port.
+ *
+ *  The host (tools/tn -u) sends an "su" command with the update header,
+ *  then the chunks, one per line.  Each line is a '_' and the base-85 of
+ *  the 64 bytes of the chunk followed by a CRC-32C (little endian) of the
+ *  chunk address and data.  The chunks are passed straight to the flash
+ *  store;  the host keeps several of them in flight, and is told how many
+ *  are in flash as the store writes them.  Once all are in flash, the
+ *  execute record is stored, and the boot loader applies the update at
+ *  the next reset.
+ *
+ *  The replies all start with "!su", so the host can pick them out of any
+ *  other output:
+ *
+ *      !su ready <seq> <chunks>    Header queued;  send the chunks
+ *      !su <n>                     The first <n> chunks are in flash
+ *      !su done <seq>              The execute record is in flash
+ *      !su abort <why>             Gave up;  nothing more is read
+ *
+ *  An update the boot loader didn't apply is cancelled at the next start
+ *  up (see `SuSuperLoop()').
+ */
+
+
+#include <stdbool.h>
+#include "defs.h"
+#include "stdlib.h"
+#include "store/store.h"
+#include "debug/debug.h"
+
+/**********************************************************************/
+
+/*
+ *  Return the sequence number of the newest update header of type `ty'
+ *  in the store, or 0 if none.
+ */
+static unsigned
+suNewest(unsigned ty)
+{
+    StoreIter_t it;
+    StoreRecord_t rec;
+
+    if (StoreIterNewest(&it, ty) && StoreIterRead(&it, &rec))
+        return rec.sui.sequence;
+    return 0;
+}
+
+
+/*
+ *  Once the store has been replayed at start up, cancel an update that the
+ *  boot loader was told to run but didn't:  a delta it refused, or gave up
+ *  on with this app still whole, or an update with chunks missing.  It
+ *  would otherwise be tried at every reset.  The boot loader takes the
+ *  newest execute record for the newest header, so one naming some other
+ *  version cancels it.  Returns true if there was work done.
+ */
+int
+SuSuperLoop(void)
+{
+    static bool checked;
+    StoreIter_t it;
+    StoreRecord_t rec;
+
+    if (checked || !StoreReplayIsDone())
+        return 0;
+
+    unsigned ty = suNewest(RT_SU_DELTA) > suNewest(RT_SU_HDR) ? RT_SU_DELTA
+                                                              : RT_SU_HDR;
+    if (!StoreIterNewest(&it, ty) || !StoreIterRead(&it, &rec))
+    {
+        checked = true;
+        return 0;
+    }
+
+    SuInfo_t si = rec.sui;
+    if (si.version == Version ||
+        !StoreIterNewest(&it, RT_SU_EXEC) || !StoreIterRead(&it, &rec) ||
+        rec.sux.sequence != si.sequence || rec.sux.version != si.version)
+    {
+        checked = true;
+        return 0;
+    }
+
+    SuExec_t sx = { si.sequence, ~si.version };
+    if (!StoreSoftwareUpdateExecute(&sx))
+        return 1;
+
+    dprintf("Software update %d not applied, cancelled\n", si.sequence);
+    checked = true;
+    return 1;
+}
+
+/**********************************************************************/
+
+#if defined(OQ_COMMAND) && defined(OQ_DEBUG)
+
+/**********************************************************************/
+
+/*
+ *  The write queue holds about a dozen chunks;  allow for a few more in
+ *  flight than that, so the store never waits for us.
+ */
+#define SU_TICKETS      16              //  (Power of 2)
+#define SU_LINE         (1 + (OQ_SU_CHUNK + 4) * 5 / 4)
+
+static struct
+{
+    SuInfo_t    info;
+    unsigned    chunks;                 //  Chunks in the update
+    unsigned    received;               //  Chunks received and queued
+    unsigned    committed;              //  Chunks in flash
+    unsigned    ticket[SU_TICKETS];     //  StoreSubmitted() for each chunk
+    unsigned    exec;                   //  Ticket for the execute record
+    bool        pending;                //  `data' is waiting for the queue
+    unsigned    len;                    //  Characters in `line'
+    char        line[SU_LINE];
+    SuData_t    data;
+}
+    su;
+
+/**********************************************************************/
+
+static bool
+suAbort(const char * why)
+{
+    dprintf("!su abort %s\n", why);
+    return false;
+}
+
+
+/*
+ *  Decode a chunk line into `su.data'.
+ */
+static bool
+suDecode(void)
+{
+    u8 buf[OQ_SU_CHUNK + 4];
+
+    if (su.len != SU_LINE || su.line[0] != '_' ||
+        Base85ToBinary(buf, &su.line[1], su.len - 1) != sizeof buf)
+            return false;
+
+    SuData_t * sd = &su.data;
+    sd->sequence = su.info.sequence;
+    sd->address = (su.info.delta ? 0 : su.info.start) +
+                  su.received * OQ_SU_CHUNK;
+    memcpy(&sd->data[0], buf, OQ_SU_CHUNK);
+
+    CRC_t crc;
+    CRCInit(&crc);
+    CRC32(&crc, sd->address);
+    CRC(&crc, &sd->data[0], OQ_SU_CHUNK);
+    return crc.crc == OqGet32(&buf[OQ_SU_CHUNK]);
+}
+
+
+/*
+ *  Input handler, called from the command loop while the update is being
+ *  received.
+ */
+static bool
+suInput(void)
+{
+    /*
+     *  Report the chunks that have reached the flash.
+     */
+    if (DebugPutAvail() < 32)
+        return true;
+
+    unsigned n = su.committed;
+    while (n < su.received &&
+           (int)(StoreCommitted() - su.ticket[n & (SU_TICKETS - 1)]) >= 0)
+        n++;
+    if (n != su.committed)
+    {
+        su.committed = n;
+        dprintf("!su %d\n", n);
+    }
+
+    /*
+     *  All chunks are in:  store the execute record, and wait for that.
+     */
+    if (su.committed == su.chunks)
+    {
+        if (su.exec == 0)
+        {
+            SuExec_t sx = { su.info.sequence, su.info.version };
+            if (StoreSoftwareUpdateExecute(&sx))
+                su.exec = StoreSubmitted();
+        }
+        else if ((int)(StoreCommitted() - su.exec) >= 0)
+        {
+            dprintf("!su done %d\n", su.info.sequence);
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     *  Queue the chunks received, as long as the store has room.
+     */
+    for (;;)
+    {
+        if (su.pending)
+        {
+            if (!StoreSoftwareUpdateChunk(&su.data))
+                return true;
+            su.ticket[su.received++ & (SU_TICKETS - 1)] = StoreSubmitted();
+            su.pending = false;
+        }
+
+        if (su.received == su.chunks ||
+            su.received - su.committed >= SU_TICKETS)
+                return true;
+
+        int c = DebugGetChar();
+        if (c < 0)
+            return true;
+
+        if (c == '\033')
+            return suAbort("cancelled");
+        else if (c == '\r' || c == '\n')
+        {
+            if (su.len == 0)
+                continue;
+            if (!suDecode())
+                return suAbort("bad chunk");
+            su.pending = true;
+            su.len = 0;
+        }
+        else if (su.len < SU_LINE)
+            su.line[su.len++] = c;
+        else
+            return suAbort("bad chunk");
+    }
+}
+
+/**********************************************************************/
+
+static void
+suCommand(int argc, char ** argv)
+{
+    SuInfo_t * si = &su.info;
+
+    if (argc != 4 && argc != 7)
+    {
+        suAbort("usage");
+        return;
+    }
+
+    si->start = GetHex(argv[1]);
+    si->end = GetHex(argv[2]);
+    si->version = GetHex(argv[3]);
+    si->delta = (argc == 7) ? GetHex(argv[4]) : 0;
+    si->base = (argc == 7) ? GetHex(argv[5]) : 0;
+    si->crc = (argc == 7) ? GetHex(argv[6]) : 0;
+
+    /*
+     *  Check it's something the boot loader would take.  A delta must stop
+     *  short of the loader's scratch page.
+     */
+    if (si->start < OQ_FLASH_PAGE || si->end > OQ_FLASH_STORE ||
+        si->end < si->start + OQ_FLASH_PAGE ||
+        ((si->start | si->end) & (OQ_SU_CHUNK - 1)) ||
+        (si->delta && ((si->start & (OQ_FLASH_PAGE - 1)) ||
+                       si->end > OQ_FLASH_STORE - OQ_FLASH_PAGE ||
+                       si->delta >= (1 << 18))))
+    {
+        suAbort("bad header");
+        return;
+    }
+
+    /*
+     *  A delta made for some other app would be refused by the loader, but
+     *  one for an app partly like this one could look to it like an apply
+     *  cut short, and keep it from running either.
+     */
+    if (si->delta && si->base != Version)
+    {
+        suAbort("wrong base");
+        return;
+    }
+
+    if (!StoreReplayIsDone())
+    {
+        suAbort("store busy");
+        return;
+    }
+
+    /*
+     *  The boot loader takes the header with the highest sequence number.
+     */
+    unsigned a = suNewest(RT_SU_HDR);
+    unsigned b = suNewest(RT_SU_DELTA);
+    si->sequence = (((a > b) ? a : b) + 1) & 0xfffff;
+    if (si->sequence == 0)
+        si->sequence = 1;
+
+    if (!StoreSoftwareUpdateInfo(si))
+    {
+        suAbort("store busy");
+        return;
+    }
+
+    su.chunks = si->delta ? (si->delta + OQ_SU_CHUNK - 1) / OQ_SU_CHUNK
+                          : (si->end - si->start) / OQ_SU_CHUNK;
+    su.received = 0;
+    su.committed = 0;
+    su.exec = 0;
+    su.pending = false;
+    su.len = 0;
+
+    dprintf("!su ready %d %d\n", si->sequence, su.chunks);
+    CommandInput(suInput);
+}
+
+COMMAND(675)
+{
+    suCommand, "SU", 0,
+    "SU start end version ...", "Receive a software update (see tools/tn)",
+    "su <start> <end> <version> [<length> <base> <crc>]\n"
+    "            -- Receive the chunks of a software update (or of a delta\n"
+    "               update, if the last three are given), and store them\n"
+};
+
+#endif // defined(OQ_COMMAND) && defined(OQ_DEBUG)
+
+/**********************************************************************/
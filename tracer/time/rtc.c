@@ -53,6 +53,12 @@
  *  services, such as sensor probing, time-of-day, and the Tempus callout
  *  timer mechanism.  It is design to use the minimal amount of CPU to save
  *  power.
+ *
+ *  With OQ_TICKLESS there is no regular tick.  Just before the super loop
+ *  sleeps, the compare is set for the next thing that needs the CPU (the
+ *  next Tempus callout), or for half the range of the RTC at most, so that
+ *  counter wraps are still seen.  The time-of-day is brought up to date
+ *  from the counter whenever it is asked for.
  */
 
 
@@ -78,17 +84,48 @@ static u32 todSecs;         //  # seconds since RTC counter was zero
 
 static u32 hibernate;       //  The TOD0 time we should hibernate to
 
+static u32 idleFrom;        //  Counter when the super loop last went to sleep
+static u32 idleWoke;        //  Counter when it last woke up
+static u32 idleWakes;       //  # wake ups since the stats were cleared
+static u32 idleSleep;       //  Ticks spent asleep
+static u32 idleActive;      //  Ticks spent awake
+
+#if defined(OQ_TICKLESS)
+  /*
+   *  Longest we go without an RTC interrupt:  half the range of the counter.
+   */
+# define TICKLESS_MAX   (TICK_MAX / 2)
+#endif // defined(OQ_TICKLESS)
+
 #if 0
   static u32 ltod0;         //  Debug for time sync
 #endif // 0
 
 
+static void updateTOD(unsigned cntr);
+
+/*
+ *  Bring the time-of-day up to date from the counter.  Without a regular
+ *  tick, the last interrupt may have been a long time ago.
+ */
+static inline void
+todRefresh(void)
+{
+#if defined(OQ_TICKLESS)
+    NVIC_DisableIRQ(RTC2_IRQn);
+    updateTOD(NRF_RTC2->COUNTER);
+    NVIC_EnableIRQ(RTC2_IRQn);
+#endif // defined(OQ_TICKLESS)
+}
+
+
 /*
  *  Return the Time-of-Day, as seconds since boot.
  */
 unsigned
 GetTODZero(void)
 {
+    todRefresh();
     return tod0;
 }
 
@@ -105,6 +142,7 @@ GetTODZero64(void)
     volatile u32 * ptodFrac = &tod0Frac;
     u32 s0, f0, s1;
 
+    todRefresh();
     do
     {
         s0 = *ptod;
@@ -158,6 +196,7 @@ SetTOD64(u64 t, u8 hopcount)
 unsigned
 Future(unsigned secs)
 {
+    todRefresh();
     return tod0 + secs;
 }
 
@@ -267,12 +306,26 @@ callRTCFunctions(unsigned cntr)
 /**********************************************************************/
 
 /*
- *  Callout interrupt.  Called in response to a match event on RTC 2.
- *  Look to running callout events.
+ *  Callout interrupt.  Called in response to a match event on RTC 2:
+ *  CC[0] for the regular tick, CC[1] for a tick callout.
  */
 void
 RTC2_IRQHandler(void)
 {
+    /*
+     *  A tick callout is due (see tick.c).  Waking up is all it needs;
+     *  the super loop will run it.
+     */
+    if (NRF_RTC2->EVENTS_COMPARE[1])
+    {
+        NRF_RTC2->EVENTS_COMPARE[1] = 0;
+        if (!NRF_RTC2->EVENTS_COMPARE[0])
+        {
+            NVIC_ClearPendingIRQ(RTC2_IRQn);
+            return;
+        }
+    }
+
     NRF_RTC2->EVENTS_COMPARE[0] = 0;
     NVIC_ClearPendingIRQ(RTC2_IRQn);
 
@@ -294,6 +347,14 @@ RTC2_IRQHandler(void)
     unsigned incr = OQ_LFCLK / HZ;
     unsigned match;
 
+#if defined(OQ_TICKLESS)
+    /*
+     *  The super loop sets the compare for what it needs before it sleeps;
+     *  this is just the long stop.
+     */
+    (void)incr;
+    match = cntr + TICKLESS_MAX;
+#else
     if (hibernate <= tod0)
     {
         match = cntr + incr;
@@ -308,9 +369,10 @@ RTC2_IRQHandler(void)
 
         match = cntr + dly;
     }
+#endif // defined(OQ_TICKLESS)
 
     NRF_RTC2->CC[0] = match;
-TachyonLog2(900, cntr, match);
+TachyonLog2(900, cntr, match);          // tachy: rtc interrupt
 
     callRTCFunctions(cntr);
 }
@@ -375,18 +437,50 @@ TimerInit(void)
 /**********************************************************************/
 /*
  *  Called just before and after calling the soft device to sleep for the
- *  next event.  We use this to implement the long "hibernate" sleep.
+ *  next event.  We keep count of the wake ups and the time spent asleep,
+ *  and without a regular tick, set the RTC to wake us for the next Tempus
+ *  callout.  (Tick callouts have their own compare channel.)
  */
 void
 TimerAboutToSleep(void)
 {
-    NRF_RTC2->EVENTS_COMPARE[0] = 1;        //  Cause a RTC2 interrupt
+    unsigned cntr = NRF_RTC2->COUNTER;
+    idleActive += (cntr - idleWoke) & TICK_MASK;
+    idleFrom = cntr;
+
+#if defined(OQ_TICKLESS)
+    NVIC_DisableIRQ(RTC2_IRQn);
+
+    updateTOD(cntr);
+
+    unsigned dly = TICKLESS_MAX;
+    unsigned next = TempusNext();
+    if (next)
+    {
+        if (next <= tod0)
+            dly = 0;
+        else if (next - tod0 < TICKLESS_MAX / TICK_UNIT)
+            dly = (next - tod0) * TICK_UNIT - (cntr % TICK_UNIT);
+    }
+
+    /*
+     *  The RTC won't match a compare value within two ticks of the counter.
+     */
+    if (dly < 2)
+        dly = 2;
+    NRF_RTC2->CC[0] = (cntr + dly) & TICK_MASK;
+
+    NVIC_EnableIRQ(RTC2_IRQn);
+#endif // defined(OQ_TICKLESS)
 }
 
 void
 TimerJustWokeUp(void)
 {
-    NRF_RTC2->EVENTS_COMPARE[0] = 1;        //  Cause a RTC2 interrupt
+    unsigned cntr = NRF_RTC2->COUNTER;
+    idleSleep += (cntr - idleFrom) & TICK_MASK;
+    idleWoke = cntr;
+    idleWakes++;
 }
 
 /******************************/
@@ -420,6 +514,7 @@ TimerHibernate(unsigned hit)
 void
 TimerDelaySpin(unsigned us)
 {
+#if !defined(OQ_TESTING)
     us *= 2;
     asm volatile (  "1: cbz %0, 2f\n"
                     "   nop; nop; nop; nop\n"
@@ -433,6 +528,7 @@ TimerDelaySpin(unsigned us)
                     "   b   1b\n"
                     "2:"
                 : "+r" (us));
+#endif // !defined(OQ_TESTING)
 }
 
 /**********************************************************************/
@@ -471,6 +567,36 @@ COMMAND(789)
     "time <tod> <frac> [<hopct=0>]  -   sets the time\n"
 };
 
+
+static void
+idleCmd(int argc, char ** argv)
+{
+    unsigned total = idleSleep + idleActive;
+    unsigned per = total / 1000;
+    if (per == 0)
+        per = 1;
+    unsigned awake = idleActive / per;
+
+    unsigned secs = TICK2S(total);
+    dprintf("Idle:  %u wake ups in %u.%03u s (%u/s), CPU awake %u.%u%%\n",
+            idleWakes, secs, TICK2MS(total % TICK_UNIT),
+            secs ? idleWakes / secs : idleWakes,
+            awake / 10, awake % 10);
+
+    if (argc > 1 && StrcmpCmd("CLEar", argv[1]) <= 1)
+        idleWakes = idleSleep = idleActive = 0;
+}
+
+
+COMMAND(790)
+{
+    idleCmd, "IDLE", 0,
+    "idle [clear]", "print super loop wake up and sleep statistics",
+    "Prints the number of times the super loop has woken up, and the share\n"
+    "of the time the CPU was awake, since the statistics were last cleared.\n"
+    "With `clear', clears them after printing."
+};
+
 #endif // OQ_COMMAND
 
 /**********************************************************************/
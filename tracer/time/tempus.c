@@ -43,6 +43,20 @@
 
 /*
  *  Tempus callout implementation.
+ *
+ *  Callouts are kept on a hierarchical timer wheel, so that adding,
+ *  changing and cancelling a callout costs the same however many there
+ *  are.  There are `WHEEL_LEVELS' wheels of `WHEEL_SIZE' slots each.  A
+ *  slot on level 0 is one second;  a slot on level `l' covers
+ *  WHEEL_SIZE^l seconds.  A callout goes on the lowest level at which its
+ *  time agrees with the wheel time in all the higher bits, so the whole
+ *  level 0 slot fires together.  As the wheel time crosses the boundary
+ *  of a higher level slot, that slot is emptied and its callouts are put
+ *  back down, closer to the bottom.
+ *
+ *  Callouts further out than the top wheel reaches (about 12 days) go on
+ *  the top wheel anyway, and are simply put back there each time their
+ *  slot comes around, until they are close enough.
  */
 
 #include "timer.h"
@@ -50,10 +64,174 @@
 
 /**********************************************************************/
 
+#define WHEEL_BITS      5
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+
+/*
+ *  The wheels.
+ */
+static TempusCallout_t * tempusWheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/*
+ *  Callouts whose time had already come when they were set.  They run on
+ *  the next pass of the super loop.
+ */
+static TempusCallout_t * tempusDue = 0;
+
 /*
- *  Callout list.
+ *  The last second the wheels have been run up to, and the number of
+ *  callouts on them.
  */
-static TempusCallout_t * tempusList = 0;
+static unsigned tempusNow = 0;
+static unsigned tempusCount = 0;
+
+/*
+ *  The list being run by tempusRun().
+ */
+static TempusCallout_t * tempusRunning = 0;
+
+/**********************************************************************/
+
+/*
+ *  Put a callout on a list.
+ */
+static inline void
+tempusLink(TempusCallout_t ** head, TempusCallout_t * tmr)
+{
+    tmr->next = *head;
+    if (tmr->next)
+        tmr->next->prev = &tmr->next;
+    tmr->prev = head;
+    *head = tmr;
+}
+
+
+/*
+ *  Take a callout off whatever list it's on.
+ */
+static inline void
+tempusUnlink(TempusCallout_t * tmr)
+{
+    *tmr->prev = tmr->next;
+    if (tmr->next)
+        tmr->next->prev = tmr->prev;
+    tmr->prev = 0;
+    tempusCount--;
+}
+
+
+/*
+ *  Put a callout on the wheel (or on the due list).  Placement is against
+ *  the next second to be run.
+ */
+static void
+tempusPlace(TempusCallout_t * tmr)
+{
+    unsigned tod = tmr->time;
+    unsigned next = tempusNow + 1;
+
+    tempusCount++;
+    if (tod < next)
+    {
+        tempusLink(&tempusDue, tmr);
+        return;
+    }
+
+    /*
+     *  Find the highest group of bits that differs from the wheel time.
+     */
+    unsigned diff = tod ^ next;
+    unsigned l = 0;
+    while (l < WHEEL_LEVELS - 1 && (diff >> (WHEEL_BITS * (l + 1))) != 0)
+        l++;
+
+    tempusLink(&tempusWheel[l][(tod >> (WHEEL_BITS * l)) & WHEEL_MASK], tmr);
+}
+
+
+/*
+ *  Empty a slot on one of the upper wheels, and place its callouts again.
+ */
+static void
+tempusCascade(unsigned l, unsigned slot)
+{
+    TempusCallout_t * tp = tempusWheel[l][slot];
+    tempusWheel[l][slot] = 0;
+
+    while (tp)
+    {
+        TempusCallout_t * next = tp->next;
+        tempusCount--;
+        tempusPlace(tp);
+        tp = next;
+    }
+}
+
+
+/*
+ *  Run one callout.
+ */
+static void
+tempusFire(TempusCallout_t * tp)
+{
+    /*
+     *  Take the entry off its list now, so there won't be any confusion if
+     *  the callback adds the entry again.
+     */
+    tempusUnlink(tp);
+
+    /*
+     *  Tiggered!!
+     */
+    if (tp->func)
+    {
+        /*
+         *  !!!!!!!!!!!!   CALLBACK   !!!!!!!!!!!!
+         *
+         *  Call the callout callback function, passing it's entry
+         *  to it.  The callback function is responsible for
+         *  scheduling itself again if needed, and can also
+         *  schedule DSRs to be called.
+         */
+        (*tp->func)(tp);                        //   <---------  Callback
+    }
+    else
+    {
+        /*
+         *  !!!!!!!!!!!!   TRIGGERED   !!!!!!!!!!!!
+         *
+         *  Set the given flag, typically used to trigger events in
+         *  other parts of the super loop.
+         */
+        int * var = tp->data[0];
+        *var = 1;
+    }
+}
+
+
+/*
+ *  Run all the callouts on a list.  The list is taken over first, so a
+ *  callout set again for now, from its own callback, waits for the next
+ *  pass of the super loop.
+ */
+static void
+tempusRun(TempusCallout_t ** list)
+{
+    if (!*list)
+        return;
+
+    /*
+     *  Move the list to `tempusRunning', so unlinking each callout in turn
+     *  moves the head along.
+     */
+    tempusRunning = *list;
+    tempusRunning->prev = &tempusRunning;
+    *list = 0;
+    while (tempusRunning)
+        tempusFire(tempusRunning);
+}
 
 /**********************************************************************/
 
@@ -63,62 +241,33 @@ static TempusCallout_t * tempusList = 0;
  *  A callout can be changed by calling the API again with the updated
  *  time, or can be deleted before it fires by setting the time to zero.
  *
- *  NOTE:   The `time' field is used as a flag to indicate if the
- *          callout is already active.  Typically the caller will have
- *          initialized the whole TempusCallout_t structure to zero
- *          before the first call, but if not, having a falsely set
- *          `time' flag will only mean a wasted search to delete it
- *          from the list.
+ *  NOTE:   The `prev' field is used as a flag to indicate if the
+ *          callout is already active, so the caller must initialize the
+ *          whole TempusCallout_t structure to zero before the first
+ *          call.  (Static and zeroed structures are fine.)
  */
 void
 TempusCallout(TempusCallout_t * tmr, unsigned tod)
 {
-TachyonLog1(950, tod);
+TachyonLog1(950, tod);                  // tachy: tempus callout set
 
     /*
-     *  If the callout is already active, remove it from the callout list
-     *  before inserting it again.
+     *  If the callout is already active, remove it from its list before
+     *  placing it again.
      */
-    TempusCallout_t ** cpp = &tempusList;
-    TempusCallout_t * cp = *cpp;
-    if (tmr->time)
-    {
-        while (cp)
-        {
-            if (cp == tmr)
-            {
-                *cpp = cp->next;
-                break;
-            }
-
-            cpp = &cp->next;
-            cp = *cpp;
-        }
-    }
+    if (tmr->prev)
+        tempusUnlink(tmr);
 
     /*
      *  Set the new time to expire.  And now that we know the new callout
      *  is not active, check if it is supposed to be deleted, and return
-     *  if so.  Otherwise mark it as active.
+     *  if so.
      */
     tmr->time = tod;
     if (tod == 0)
         return;
 
-    /*
-     *  Insert the new callout onto the list.
-     */
-    cpp = &tempusList;
-    cp = *cpp;
-    while (cp)
-    {
-        if (tod < cp->time)
-            break;
-        cpp = &cp->next;
-        cp = *cpp;
-    }
-    tmr->next = *cpp;
-    *cpp = tmr;
+    tempusPlace(tmr);
 }
 
 
@@ -142,6 +291,83 @@ TempusCalloutFunc(TempusCallout_t * tmr, unsigned tod,
     TempusCallout(tmr, tod);
 }
 
+/*
+ *  The earlier of `tod' and the earliest callout on a list (zero is none).
+ */
+static unsigned
+tempusEarliest(TempusCallout_t * tp, unsigned tod)
+{
+    for (; tp; tp = tp->next)
+        if (tod == 0 || tp->time < tod)
+            tod = tp->time;
+    return tod;
+}
+
+
+/*
+ *  Return the time of the next callout to run, or zero if there are none.
+ *  This is how long the CPU may sleep for, as far as Tempus cares.
+ */
+unsigned
+TempusNext(void)
+{
+    if (tempusDue)
+        return tempusNow;
+    if (tempusCount == 0)
+        return 0;
+
+    /*
+     *  Level 0 holds the callouts in the current run of WHEEL_SIZE seconds,
+     *  a second to a slot.  If the next second starts a new run, the upper
+     *  wheel slots that are about to be emptied into it count too.
+     */
+    unsigned next = tempusNow + 1;
+    unsigned tod = 0;
+    unsigned l, i;
+
+    for (l = 1; l < WHEEL_LEVELS &&
+                (next & ((1u << (WHEEL_BITS * l)) - 1)) == 0; l++)
+        tod = tempusEarliest(
+                tempusWheel[l][(next >> (WHEEL_BITS * l)) & WHEEL_MASK], tod);
+
+    for (i = next & WHEEL_MASK; i < WHEEL_SIZE; i++)
+        if (tempusWheel[0][i])
+        {
+            unsigned t = (next & ~WHEEL_MASK) | i;
+            if (tod == 0 || t < tod)
+                tod = t;
+            break;
+        }
+
+    if (tod)
+        return tod;
+
+    /*
+     *  On the other wheels but the top one, the callouts still to come are
+     *  in the slots after the current one, and the first slot with anything
+     *  in it holds the earliest.
+     */
+    for (l = 1; l < WHEEL_LEVELS - 1; l++)
+    {
+        for (i = ((next >> (WHEEL_BITS * l)) & WHEEL_MASK) + 1;
+             i < WHEEL_SIZE;
+             i++)
+        {
+            if (tempusWheel[l][i])
+                return tempusEarliest(tempusWheel[l][i], 0);
+        }
+    }
+
+    /*
+     *  The top wheel also holds the callouts that are beyond its reach,
+     *  in any slot, so look at all of it.
+     */
+    for (i = 0; i < WHEEL_SIZE; i++)
+        tod = tempusEarliest(tempusWheel[WHEEL_LEVELS - 1][i], tod);
+
+    return tod;
+}
+
 /******************************/
 
 /*
@@ -153,54 +379,38 @@ TempusMagnaCirculi(void)
     unsigned tod = GetTODZero();
 
     /*
-     *  Run all entries on the top of the callout list that have
-     *  expired time values.
+     *  Run the callouts that were already due when they were set.
+     */
+    tempusRun(&tempusDue);
+
+    /*
+     *  If there is nothing on the wheels, they can just be moved on.
      */
-    for (;;)
+    if (tempusCount == 0)
     {
-        TempusCallout_t * tp = tempusList;
-        if (!tp)
-            break;
+        if (tod > tempusNow)
+            tempusNow = tod;
+        return;
+    }
 
-        /*
-         *  If the top entry has not expired, we are done.
-         *  (The list is sorted.)
-         */
-        if (tod < tp->time)
-            break;
+    /*
+     *  Turn the wheels a second at a time up to now.  At the boundary of
+     *  an upper wheel's slot, empty that slot first (the highest wheel
+     *  first, since it may drop callouts into the next one down).
+     */
+    while (tempusNow < tod)
+    {
+        unsigned next = tempusNow + 1;
 
-        /*
-         *  Remove the entry from the list now, so there won't be
-         *  any confusion if the callback adds the entry again.
-         */
-        tempusList = tp->next;
+        unsigned l = 0;
+        while (l < WHEEL_LEVELS - 1 &&
+               (next & ((1u << (WHEEL_BITS * (l + 1))) - 1)) == 0)
+            l++;
+        for (; l > 0; l--)
+            tempusCascade(l, (next >> (WHEEL_BITS * l)) & WHEEL_MASK);
 
-        /*
-         *  Tiggered!!
-         */
-        if (tp->func)
-        {
-            /*
-             *  !!!!!!!!!!!!   CALLBACK   !!!!!!!!!!!!
-             *
-             *  Call the callout callback function, passing it's entry
-             *  to it.  The callback function is responsible for
-             *  scheduling itself again if needed, and can also
-             *  schedule DSRs to be called.
-             */
-            (*tp->func)(tp);                    //   <---------  Callback
-        }
-        else
-        {
-            /*
-             *  !!!!!!!!!!!!   TRIGGERED   !!!!!!!!!!!!
-             *
-             *  Set the given flag, typically used to trigger events in
-             *  other parts of the super loop.
-             */
-            int * var = tp->data[0];
-            *var = 1;
-        }
+        tempusNow = next;
+        tempusRun(&tempusWheel[0][next & WHEEL_MASK]);
     }
 }
 
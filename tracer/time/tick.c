@@ -0,0 +1,226 @@
+/*****************************************************************************\
+*                  ____  __  __        ____      ____                         *
+*                 / __ \/ /_/ /_____  / __ \    /  _/___  _____               *
+*                / / / / __/ __/ __ \/ / / /    / // __ \/ ___/               *
+*               / /_/ / /_/ /_/ /_/ / /_/ /   _/ // / / / /___                *
+*               \____/\__/\__/\____/\___\_\  /___/_/ /_/\___(_)               *
+*                                                                             *
+*   Copyright (c) 2015-2017 OttoQ Inc.                                        *
+*   All rights reserved.                                                      *
+*                                                                             *
+*   Redistribution  and use in  source and  binary forms,  with  or without   *
+*   modification, are  permitted provided that the following conditions are   *
+*   met:                                                                      *
+*                                                                             *
+*   1.  Redistributions  of  source  code  must retain the above  copyright   *
+*       notice, this list of conditions and the following disclaimer.         *
+*   2.  Redistributions in binary  form must reproduce  the above copyright   *
+*       notice, this list  of conditions and the  following  disclaimer  in   *
+*       the   documentation   and/or  other  materials  provided  with  the   *
+*       distribution.                                                         *
+*   3.  All  advertising  materials  mentioning  features  or  use of  this   *
+*       software  must display the following acknowledgment:  "This product   *
+*       includes software developed by OttoQ Inc."                            *
+*   4.  The  name OttoQ Inc may not be used to endorse or  promote products   *
+*       derived   from   this   software  without  specific  prior  written   *
+*       permission.                                                           *
+*                                                                             *
+*   THIS  SOFTWARE  IS PROVIDED BY OTTOQ INC AND CONTRIBUTORS ``AS IS'' AND   *
+*   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED  TO,  THE   *
+*   IMPLIED  WARRANTIES  OF  MERCHANTABILITY  AND  FITNESS FOR A PARTICULAR   *
+*   PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL OTTOQ INC OR CONTRIBUTORS BE   *
+*   LIABLE  FOR  ANY  DIRECT,  INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   *
+*   CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED  TO,  PROCUREMENT  OF   *
+*   SUBSTITUTE  GOODS  OR  SERVICES;   LOSS  OF  USE, DATA, OR PROFITS;  OR   *
+*   BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY  OF  LIABILITY,   *
+*   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR   *
+*   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN  IF   *
+*   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                *
+*                                                                             *
+*   (This license is derived from the Berkeley Public License.)               *
+*                                                                             *
+\*****************************************************************************/
+
+/*
+ *  Tick callout implementation.
+ *
+ *  There are only ever a few of these (LEDs, buttons, and the like), so
+ *  they are kept on a list sorted by time to go.  RTC2's CC[1] is set for
+ *  the first one on the list;  its interrupt does nothing but wake the
+ *  super loop, which then runs it from `TickMagnaCirculi()'.
+ */
+
+#include "timer.h"
+#include "debug/tachyon.h"
+
+/**********************************************************************/
+
+/*
+ *  Callout list.
+ */
+static TickCallout_t * tickList = 0;
+
+/*
+ *  The RTC won't match a compare value within two ticks of the counter.
+ */
+#define TICK_MIN_DELAY  2
+
+/**********************************************************************/
+
+/*
+ *  Number of ticks from `now' until `tick' (negative if it has passed).
+ */
+static inline int
+tickUntil(unsigned tick, unsigned now)
+{
+    return (int)((tick - now) << 8) >> 8;
+}
+
+
+/*
+ *  Set RTC2's compare channel for the first callout on the list, or turn
+ *  it off if there is none.
+ */
+static void
+tickArm(void)
+{
+    TickCallout_t * tp = tickList;
+    if (!tp)
+    {
+        NRF_RTC2->INTENCLR = RTC_INTENCLR_COMPARE1_Msk;
+        return;
+    }
+
+    unsigned now = TimerGetTick();
+    int dly = tickUntil(tp->tick, now);
+    if (dly < TICK_MIN_DELAY)
+        dly = TICK_MIN_DELAY;
+
+    NRF_RTC2->CC[1] = (now + dly) & TICK_MASK;
+    NRF_RTC2->EVTENSET = RTC_EVTEN_COMPARE1_Msk;
+    NRF_RTC2->INTENSET = RTC_INTENSET_COMPARE1_Msk;
+}
+
+
+/*
+ *  Take a callout off the list.
+ */
+static void
+tickUnlink(TickCallout_t * tmr)
+{
+    TickCallout_t ** cpp = &tickList;
+    while (*cpp)
+    {
+        if (*cpp == tmr)
+        {
+            *cpp = tmr->next;
+            break;
+        }
+        cpp = &(*cpp)->next;
+    }
+    tmr->active = false;
+}
+
+/**********************************************************************/
+
+/*
+ *  Schedule a callout event to run at RTC2 tick `tick'.  A callout can be
+ *  changed by calling this again with the new time.  A periodic callout
+ *  should set itself again relative to its own `tick', so as not to drift.
+ */
+void
+TickCallout(TickCallout_t * tmr, unsigned tick)
+{
+TachyonLog1(955, tick);                 // tachy: tick callout set
+
+    if (tmr->active)
+        tickUnlink(tmr);
+
+    /*
+     *  Insert the callout on the list, after any that are due at the same
+     *  time.
+     */
+    unsigned now = TimerGetTick();
+    tick &= TICK_MASK;
+    int dly = tickUntil(tick, now);
+
+    TickCallout_t ** cpp = &tickList;
+    while (*cpp && tickUntil((*cpp)->tick, now) <= dly)
+        cpp = &(*cpp)->next;
+
+    tmr->tick = tick;
+    tmr->next = *cpp;
+    tmr->active = true;
+    *cpp = tmr;
+
+    if (tickList == tmr)
+        tickArm();
+}
+
+
+/*
+ *  Cancel a callout, if it hasn't already run.
+ */
+void
+TickCalloutCancel(TickCallout_t * tmr)
+{
+    if (!tmr->active)
+        return;
+
+    bool first = (tickList == tmr);
+    tickUnlink(tmr);
+    if (first)
+        tickArm();
+}
+
+
+void
+TickCalloutFunc(TickCallout_t * tmr, unsigned tick,
+                TickCallout_f * func, void * d0, void * d1)
+{
+    tmr->func = func;
+    tmr->data[0] = d0;
+    tmr->data[1] = d1;
+    TickCallout(tmr, tick);
+}
+
+/******************************/
+
+/*
+ *  The Super Loop tick worker -- run the callouts that are due.  Returns
+ *  non-zero if any ran.
+ */
+int
+TickMagnaCirculi(void)
+{
+    unsigned now = TimerGetTick();
+    int ran = 0;
+
+    /*
+     *  Run all entries on the top of the callout list that are due.
+     *  (The list is sorted.)
+     */
+    for (;;)
+    {
+        TickCallout_t * tp = tickList;
+        if (!tp || tickUntil(tp->tick, now) > 0)
+            break;
+
+        /*
+         *  Remove the entry from the list now, so there won't be
+         *  any confusion if the callback adds the entry again.
+         */
+        tickList = tp->next;
+        tp->active = false;
+
+TachyonLog2(956, tp->tick, now);        // tachy: tick callout run
+        (*tp->func)(tp);                        //   <---------  Callback
+        ran = 1;
+    }
+
+    if (ran)
+        tickArm();
+    return ran;
+}
+
+/**********************************************************************/